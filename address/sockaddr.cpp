@@ -1,8 +1,10 @@
 #include "sockaddr.h"
 
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <memory>
+#include <stdexcept>
 
 namespace LNETNS {
 namespace address {
@@ -30,6 +32,20 @@ bool ParsePort(const std::string& s, int* port) {
   return true;
 }
 
+constexpr char kUnixPrefix[] = "unix:";
+constexpr size_t kUnixPrefixLen = sizeof(kUnixPrefix) - 1;
+
+// Significant bytes of sun_path, including the leading NUL of an abstract name.
+size_t UnixPathLen(const sockaddr_un& sun) {
+  constexpr size_t kMax = sizeof(sun.sun_path);
+  if (sun.sun_path[0] != '\0') {
+    return strnlen(sun.sun_path, kMax);
+  }
+  // Abstract, or unnamed when all zero (an abstract name can't start with a NUL here).
+  auto len = strnlen(sun.sun_path + 1, kMax - 1);
+  return len > 0 ? 1 + len : 0;
+}
+
 }  // unnamed namespace
 
 // https://github.com/grpc/grpc/blob/v1.59.1/src/core/lib/gprpp/host_port.cc
@@ -184,6 +200,39 @@ std::shared_ptr<SockAddr> ParseIPPort(const std::string& addr) {
   return sa;
 }
 
+bool IsUnix(const std::string& addr) {
+  return addr.compare(0, kUnixPrefixLen, kUnixPrefix) == 0;
+}
+
+std::shared_ptr<SockAddr> ParseUnix(const std::string& addr) {
+  if (!IsUnix(addr)) {
+    return nullptr;
+  }
+  auto path = addr.substr(kUnixPrefixLen);
+  bool abstract = !path.empty() && path[0] == '@';
+  // A path needs its terminating NUL, an abstract name its leading one.
+  if (path.empty() || (abstract && path.size() == 1) ||
+      path.size() >= sizeof(sockaddr_un::sun_path) || path.find('\0') != std::string::npos) {
+    return nullptr;
+  }
+
+  auto sa = std::make_shared<SockAddr>();
+  std::memset(sa.get(), 0, sizeof(SockAddr));
+  sa->sockaddr_un.sun_family = AF_UNIX;
+  std::memcpy(sa->sockaddr_un.sun_path, path.data(), path.size());
+  if (abstract) {
+    sa->sockaddr_un.sun_path[0] = '\0';
+  }
+  return sa;
+}
+
+std::shared_ptr<SockAddr> ParseAddress(const std::string& addr) {
+  if (IsUnix(addr)) {
+    return ParseUnix(addr);
+  }
+  return ParseIPPort(addr);
+}
+
 std::string ToString(const in_addr& sa) {
   char buf[INET_ADDRSTRLEN];
   return inet_ntop(AF_INET, &sa, buf, INET_ADDRSTRLEN);
@@ -214,11 +263,93 @@ std::string ToString(const SockAddr& sa, bool iponly) {
     }
     return JoinHostPort(ip, ntohs(sa6->sin6_port));
   }
+  case AF_UNIX: {
+    auto& sun = sa.sockaddr_un;
+    auto len = UnixPathLen(sun);
+    if (len == 0) {
+      return kUnixPrefix;  // unnamed
+    }
+    if (sun.sun_path[0] == '\0') {
+      return std::string(kUnixPrefix) + "@" + std::string(sun.sun_path + 1, len - 1);
+    }
+    return std::string(kUnixPrefix) + std::string(sun.sun_path, len);
+  }
   default: {
     return "";
   }
   }
 }
 
+socklen_t GetSockLen(const SockAddr& sa) {
+  switch (sa.sockaddr.sa_family) {
+  case AF_INET:
+    return sizeof(sockaddr_in);
+  case AF_INET6:
+    return sizeof(sockaddr_in6);
+  case AF_UNIX: {
+    auto len = UnixPathLen(sa.sockaddr_un);
+    // The terminating NUL of a path is counted, an abstract name has none.
+    if (len > 0 && sa.sockaddr_un.sun_path[0] != '\0' && len < sizeof(sa.sockaddr_un.sun_path)) {
+      ++len;
+    }
+    return offsetof(sockaddr_un, sun_path) + len;
+  }
+  default:
+    return 0;
+  }
+}
+
+size_t SockAddrHash::operator()(const SockAddr& sa) const {
+  // FNV-1a over the significant bytes.
+  size_t h = 14695981039346656037ULL;
+  auto mix = [&h](const void* data, size_t len) {
+    auto p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+      h = (h ^ p[i]) * 1099511628211ULL;
+    }
+  };
+
+  mix(&sa.sockaddr.sa_family, sizeof(sa.sockaddr.sa_family));
+  switch (sa.sockaddr.sa_family) {
+  case AF_INET:
+    mix(&sa.sockaddr_in.sin_addr, sizeof(sa.sockaddr_in.sin_addr));
+    mix(&sa.sockaddr_in.sin_port, sizeof(sa.sockaddr_in.sin_port));
+    break;
+  case AF_INET6:
+    mix(&sa.sockaddr_in6.sin6_addr, sizeof(sa.sockaddr_in6.sin6_addr));
+    mix(&sa.sockaddr_in6.sin6_port, sizeof(sa.sockaddr_in6.sin6_port));
+    mix(&sa.sockaddr_in6.sin6_scope_id, sizeof(sa.sockaddr_in6.sin6_scope_id));
+    break;
+  case AF_UNIX:
+    mix(sa.sockaddr_un.sun_path, UnixPathLen(sa.sockaddr_un));
+    break;
+  default:
+    break;
+  }
+  return h;
+}
+
+bool SockAddrEqual::operator()(const SockAddr& a, const SockAddr& b) const {
+  if (a.sockaddr.sa_family != b.sockaddr.sa_family) {
+    return false;
+  }
+  switch (a.sockaddr.sa_family) {
+  case AF_INET:
+    return a.sockaddr_in.sin_addr.s_addr == b.sockaddr_in.sin_addr.s_addr &&
+           a.sockaddr_in.sin_port == b.sockaddr_in.sin_port;
+  case AF_INET6:
+    return memcmp(&a.sockaddr_in6.sin6_addr, &b.sockaddr_in6.sin6_addr, sizeof(in6_addr)) == 0 &&
+           a.sockaddr_in6.sin6_port == b.sockaddr_in6.sin6_port &&
+           a.sockaddr_in6.sin6_scope_id == b.sockaddr_in6.sin6_scope_id;
+  case AF_UNIX: {
+    auto len = UnixPathLen(a.sockaddr_un);
+    return len == UnixPathLen(b.sockaddr_un) &&
+           memcmp(a.sockaddr_un.sun_path, b.sockaddr_un.sun_path, len) == 0;
+  }
+  default:
+    return true;
+  }
+}
+
 }  // namespace address
 }  // namespace LNETNS
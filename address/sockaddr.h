@@ -38,10 +38,33 @@ bool IsValidIP(const char* ip);
 // "ipv4:port" or "[ipv6]:port"
 std::shared_ptr<SockAddr> ParseIPPort(const std::string& addr);
 
-// sockaddr to human-readable ip (and port) string, e.g. "ipv6", "[ipv6]:port"
+// Unix domain socket addresses: "unix:/path/to/socket" (or a relative path), and
+// "unix:@name" for the Linux abstract namespace. An abstract name ends at the first
+// NUL, names embedding NULs are not supported.
+std::shared_ptr<SockAddr> ParseUnix(const std::string& addr);
+bool IsUnix(const std::string& addr);
+
+// Any of the above: "ipv4:port", "[ipv6]:port" or "unix:...".
+std::shared_ptr<SockAddr> ParseAddress(const std::string& addr);
+
+// sockaddr to human-readable ip (and port) string, e.g. "ipv6", "[ipv6]:port",
+// "unix:/path", "unix:@name" or "unix:" for an unnamed socket
 std::string ToString(const in_addr& sa);
 std::string ToString(const in6_addr& sa);
 std::string ToString(const SockAddr& sa, bool iponly = false);
 
+// Length of the address to pass to bind/connect/sendto, 0 if the family is unknown.
+socklen_t GetSockLen(const SockAddr& sa);
+
+// Hash and equality of family, address and port (scope id for IPv6, path for
+// AF_UNIX), e.g. std::unordered_map<SockAddr, T, SockAddrHash, SockAddrEqual>.
+struct SockAddrHash {
+  size_t operator()(const SockAddr& sa) const;
+};
+
+struct SockAddrEqual {
+  bool operator()(const SockAddr& a, const SockAddr& b) const;
+};
+
 }  // namespace address
 }  // namespace LNETNS
@@ -1,6 +1,7 @@
 #include "sockaddr.h"
 #include "gtest/gtest.h"
 
+#include <cstddef>
 #include <cstring>
 
 GTEST_TEST(AddrTest, JoinHostPortTest) {
@@ -196,3 +197,59 @@ GTEST_TEST(AddrTest, ParseIPPortTest) {
   EXPECT_EQ(reinterpret_cast<sockaddr_in*>(sa.get())->sin_addr.s_addr, htonl(INADDR_ANY));
   EXPECT_EQ(LNETNS::address::ToString(*sa), "0.0.0.0:80");
 }
+
+GTEST_TEST(AddrTest, SockAddrHashTest) {
+  LNETNS::address::SockAddrHash hash;
+  LNETNS::address::SockAddrEqual equal;
+
+  auto a = LNETNS::address::ParseIPPort("127.0.0.1:80");
+  auto b = LNETNS::address::ParseIPPort("127.0.0.1:80");
+  // Padding bytes are ignored.
+  std::memset(b->sockaddr_in.sin_zero, 0xff, sizeof(b->sockaddr_in.sin_zero));
+  EXPECT_TRUE(equal(*a, *b));
+  EXPECT_EQ(hash(*a), hash(*b));
+
+  auto c = LNETNS::address::ParseIPPort("127.0.0.1:81");
+  EXPECT_FALSE(equal(*a, *c));
+  auto d = LNETNS::address::ParseIPPort("[::1]:80");
+  auto e = LNETNS::address::ParseIPPort("[::1]:80");
+  EXPECT_FALSE(equal(*a, *d));
+  EXPECT_TRUE(equal(*d, *e));
+  EXPECT_EQ(hash(*d), hash(*e));
+}
+
+GTEST_TEST(AddrTest, ParseUnixTest) {
+  auto sa = LNETNS::address::ParseUnix("unix:/tmp/lightnet.sock");
+  ASSERT_NE(sa, nullptr);
+  EXPECT_EQ(sa->sockaddr.sa_family, AF_UNIX);
+  EXPECT_STREQ(sa->sockaddr_un.sun_path, "/tmp/lightnet.sock");
+  EXPECT_EQ(LNETNS::address::GetSockLen(*sa), offsetof(sockaddr_un, sun_path) + 19);
+  EXPECT_EQ(LNETNS::address::ToString(*sa), "unix:/tmp/lightnet.sock");
+
+  // Abstract namespace, no terminating NUL.
+  auto abstract = LNETNS::address::ParseAddress("unix:@lightnet");
+  ASSERT_NE(abstract, nullptr);
+  EXPECT_EQ(abstract->sockaddr_un.sun_path[0], '\0');
+  EXPECT_EQ(LNETNS::address::GetSockLen(*abstract), offsetof(sockaddr_un, sun_path) + 9);
+  EXPECT_EQ(LNETNS::address::ToString(*abstract), "unix:@lightnet");
+
+  LNETNS::address::SockAddrHash hash;
+  LNETNS::address::SockAddrEqual equal;
+  auto other = LNETNS::address::ParseUnix("unix:@lightnet2");
+  EXPECT_FALSE(equal(*abstract, *other));
+  EXPECT_FALSE(equal(*abstract, *sa));
+  EXPECT_TRUE(equal(*abstract, *LNETNS::address::ParseUnix("unix:@lightnet")));
+  EXPECT_NE(hash(*abstract), hash(*other));
+
+  EXPECT_EQ(LNETNS::address::ParseUnix("unix:"), nullptr);
+  EXPECT_EQ(LNETNS::address::ParseUnix("unix:@"), nullptr);
+  EXPECT_EQ(LNETNS::address::ParseUnix("/tmp/x"), nullptr);
+  EXPECT_EQ(LNETNS::address::ParseUnix("unix:/" + std::string(200, 'x')), nullptr);
+  EXPECT_FALSE(LNETNS::address::IsUnix("127.0.0.1:80"));
+  EXPECT_EQ(LNETNS::address::ToString(*LNETNS::address::ParseAddress("127.0.0.1:80")), "127.0.0.1:80");
+
+  LNETNS::address::SockAddr unnamed;
+  std::memset(&unnamed, 0, sizeof(unnamed));
+  unnamed.sockaddr.sa_family = AF_UNIX;
+  EXPECT_EQ(LNETNS::address::ToString(unnamed), "unix:");
+}
@@ -1,9 +1,10 @@
 #! /bin/sh
 
-LONG_OPTIONS=poller:,ns:,with_debug,with_test,job:,verbose
-OPTIONS=p:n:dtj:v
+LONG_OPTIONS=poller:,ns:,with_debug,with_test,with_coro,job:,verbose
+OPTIONS=p:n:dtcj:v
 WITH_DEBUG=0
 WITH_TEST=0
+WITH_CORO=0
 JOB=8
 VERBOSE=0
 
@@ -15,6 +16,7 @@ while true; do
         -n | --ns) CPPNS=$2; shift 2;;
         -d | --with_debug) ((WITH_DEBUG++)); shift;;
         -t | --with_test) ((WITH_TEST++)); shift;;
+        -c | --with_coro) ((WITH_CORO++)); shift;;
         -j | --job) JOB=$2; shift 2;;
         -v | --verbose) ((VERBOSE++)); shift;;
         --) shift; break;;
@@ -35,6 +37,9 @@ fi
 if [ $WITH_TEST -ne 0 ]; then
     CMAKE_OPT="$CMAKE_OPT -DLNET_BUILD_TESTS=ON"
 fi
+if [ $WITH_CORO -ne 0 ]; then
+    CMAKE_OPT="$CMAKE_OPT -DLNET_BUILD_CORO=ON"
+fi
 
 if [ ! -e cmake-build ]; then
     mkdir -v cmake-build
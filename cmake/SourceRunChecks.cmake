@@ -152,6 +152,27 @@ int main(int argc, char *argv [])
 endmacro()
 
 
+macro(check_so_reuseport)
+  message(STATUS "Checking whether SO_REUSEPORT is supported")
+  check_c_source_runs(
+    "
+#include <sys/types.h>
+#include <sys/socket.h>
+
+int main (int argc, char *argv [])
+{
+    int s, rc, opt = 1;
+    return (
+        ((s = socket (PF_INET, SOCK_STREAM, 0)) == -1) ||
+        ((rc = setsockopt (s, SOL_SOCKET, SO_REUSEPORT, (char*) &opt, sizeof (int))) == -1)
+    );
+}
+"
+    HAVE_SO_REUSEPORT
+  )
+endmacro()
+
+
 macro(check_so_priority)
   message(STATUS "Checking whether SO_PRIORITY is supported")
   check_c_source_runs(
@@ -0,0 +1,42 @@
+// From "libzmq/builds/cmake/platform.hpp.in"
+#pragma once
+
+#define LNETNS lightnet
+
+/* #undef LNET_DEBUG */
+
+#define POLLER_USE_EPOLL
+#define POLLER_USE_EPOLL_CLOEXEC
+#define HAVE_EPOLLEXCLUSIVE
+/* #undef POLLER_USE_POLL */
+/* #undef POLLER_USE_SELECT */
+#define HAVE_ACCEPT4
+#define HAVE_SENDFILE
+#define HAVE_SPLICE
+#define HAVE_EVENTFD
+#define HAVE_MEMFD_CREATE
+#define HAVE_MSG_ZEROCOPY
+#define HAVE_RECVMMSG
+#define HAVE_SENDMMSG
+#define HAVE_MSG_CMSG_CLOEXEC
+#define HAVE_UDP_SEGMENT
+#define HAVE_UDP_GRO
+
+#define HAVE_SOCK_CLOEXEC
+#define HAVE_O_CLOEXEC
+#define HAVE_SO_KEEPALIVE
+#define HAVE_TCP_KEEPCNT
+#define HAVE_TCP_KEEPIDLE
+#define HAVE_TCP_KEEPINTVL
+/* #undef HAVE_TCP_KEEPALIVE */
+
+#define HAVE_SO_PRIORITY
+#define HAVE_SO_REUSEPORT
+
+/* #undef HAVE_PTHREAD_SETNAME_1 */
+#define HAVE_PTHREAD_SETNAME_2
+/* #undef HAVE_PTHREAD_SETNAME_3 */
+/* #undef HAVE_PTHREAD_SET_NAME */
+#define HAVE_PTHREAD_SET_AFFINITY
+
+#define HAVE_NOEXCEPT
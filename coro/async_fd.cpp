@@ -0,0 +1,131 @@
+#include "async_fd.h"
+
+namespace LNETNS {
+namespace coro {
+
+FdAwaiter::~FdAwaiter() {
+  // The frame is being destroyed while suspended.
+  if (pending_) {
+    afd_->Unwatch(this);
+  }
+}
+
+bool FdAwaiter::await_suspend(std::coroutine_handle<> h) {
+  handle_ = h;
+  if (!afd_->Watch(this)) {
+    fired_ = event::kEventError;
+    return false;  // resume immediately
+  }
+  pending_ = true;
+  return true;
+}
+
+AsyncFd::AsyncFd(event::Poller* poller, int fd) : poller_(poller), fd_(fd) {
+}
+
+AsyncFd::~AsyncFd() {
+  if (destroyed_) {
+    *destroyed_ = true;
+  }
+  if (registered_) {
+    poller_->RemoveFd(fd_);
+  }
+}
+
+bool AsyncFd::Watch(FdAwaiter* awaiter) {
+  auto& slot = awaiter->event_ == event::kEventIn ? reader_ : writer_;
+  if (slot) {
+    return false;
+  }
+  slot = awaiter;
+  mask_ |= awaiter->event_;
+
+  bool ok = false;
+  if (!registered_) {
+    ok = registered_ = poller_->UpsertFd(fd_, this, mask_);
+  } else {
+    ok = poller_->UpdateFdEvents(fd_, mask_);
+  }
+  if (!ok) {
+    slot = nullptr;
+    mask_ &= ~awaiter->event_;
+  }
+  return ok;
+}
+
+void AsyncFd::Unwatch(FdAwaiter* awaiter) {
+  if (reader_ == awaiter) {
+    reader_ = nullptr;
+    mask_ &= ~event::kEventIn;
+  } else if (writer_ == awaiter) {
+    writer_ = nullptr;
+    mask_ &= ~event::kEventOut;
+  } else {
+    return;
+  }
+  awaiter->pending_ = false;
+  UpdateInterest();
+}
+
+void AsyncFd::UpdateInterest() {
+  if (registered_) {
+    poller_->UpdateFdEvents(fd_, mask_);
+  }
+}
+
+void AsyncFd::Wake(FdAwaiter*& slot, int fired) {
+  auto awaiter = slot;
+  slot = nullptr;
+  awaiter->pending_ = false;
+  awaiter->fired_ = fired;
+  awaiter->handle_.resume();
+}
+
+void AsyncFd::OnReadable(int fd) {
+  if (!reader_) {
+    return;
+  }
+  mask_ &= ~event::kEventIn;
+  UpdateInterest();
+  Wake(reader_, event::kEventIn);
+}
+
+void AsyncFd::OnWritable(int fd) {
+  if (!writer_) {
+    return;
+  }
+  mask_ &= ~event::kEventOut;
+  UpdateInterest();
+  Wake(writer_, event::kEventOut);
+}
+
+void AsyncFd::OnError(int fd) {
+  if (!reader_ && !writer_) {
+    // Error/hang-up is reported even with an empty interest set (epoll), stop
+    // watching until somebody awaits again.
+    poller_->RemoveFd(fd_);
+    registered_ = false;
+    return;
+  }
+
+  // Both waiters are notified, but the first resumed coroutine may release
+  // this object (and even the other waiter's frame).
+  auto writer = writer_;
+  bool destroyed = false;
+  destroyed_ = &destroyed;
+  mask_ = 0;
+  UpdateInterest();
+  if (reader_) {
+    Wake(reader_, event::kEventError);
+  }
+  if (destroyed) {
+    return;
+  }
+  destroyed_ = nullptr;
+  if (writer_ && writer_ == writer) {
+    Wake(writer_, event::kEventError);
+  }
+}
+
+}  // namespace coro
+}  // namespace LNETNS
@@ -0,0 +1,83 @@
+#pragma once
+#include <coroutine>
+#include "event/poller.h"
+
+namespace LNETNS {
+namespace coro {
+
+class AsyncFd;
+
+// Awaitable returned by AsyncFd::Readable()/Writable().
+//
+// Resumes with the fired event: kEventIn/kEventOut on readiness, kEventError on
+// error/hang-up or if the fd could not be watched.
+class FdAwaiter {
+public:
+  FdAwaiter(AsyncFd* afd, int event) : afd_(afd), event_(event) {}
+  FdAwaiter(const FdAwaiter&) = delete;
+  FdAwaiter& operator=(const FdAwaiter&) = delete;
+  ~FdAwaiter();
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h);
+  int await_resume() const noexcept { return fired_; }
+
+private:
+  friend class AsyncFd;
+
+  AsyncFd* afd_{nullptr};
+  int event_{0};
+  int fired_{0};
+  bool pending_{false};
+  std::coroutine_handle<> handle_;
+};
+
+// Wraps a non-blocking fd for use from coroutines. It registers the fd with the
+// poller on the first await and removes it on destruction, event interest is only
+// enabled while a coroutine is waiting for it.
+//
+// At most one reader and one writer may wait at the same time.
+//
+//   AsyncFd afd(poller, fd);
+//   while (co_await afd.Readable() == event::kEventIn) {
+//     ssize_t n = read(fd, buf, sizeof(buf));
+//     ...
+//   }
+class AsyncFd final : public event::EventHandler {
+public:
+  AsyncFd(event::Poller* poller, int fd);
+  AsyncFd() = delete;
+  ~AsyncFd() override;
+
+  inline FdAwaiter Readable() { return FdAwaiter(this, event::kEventIn); }
+  inline FdAwaiter Writable() { return FdAwaiter(this, event::kEventOut); }
+  inline int Fd() const { return fd_; }
+
+private:
+  friend class FdAwaiter;
+
+  bool Watch(FdAwaiter* awaiter);
+  void Unwatch(FdAwaiter* awaiter);
+  void UpdateInterest();
+  void Wake(FdAwaiter*& slot, int fired);
+
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override;
+  void OnError(int fd) override;
+
+private:
+  event::Poller* poller_{nullptr};
+  int fd_{BAD_FD};
+  bool registered_{false};
+  int mask_{0};
+  FdAwaiter* reader_{nullptr};
+  FdAwaiter* writer_{nullptr};
+  // Points to a local of the running callback, lets it know that a resumed
+  // coroutine has destroyed this object.
+  bool* destroyed_{nullptr};
+
+  NON_COPYABLE_NOR_MOVABLE(AsyncFd)
+};
+
+}  // namespace coro
+}  // namespace LNETNS
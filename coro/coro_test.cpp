@@ -0,0 +1,125 @@
+#include "task.h"
+#include "sleep.h"
+#include "async_fd.h"
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <memory>
+
+namespace LNETNS {
+namespace coro {
+namespace test {
+
+Task<int> Add(event::Poller* poller, int a, int b) {
+  co_await Sleep(poller, 5);
+  co_return a + b;
+}
+
+Task<> Sum(event::Poller* poller, int n, int* result, bool* done) {
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    sum = co_await Add(poller, sum, i);
+  }
+  *result = sum;
+  *done = true;
+}
+
+Task<> Reader(AsyncFd* afd, std::string* received, bool* done) {
+  char buf[16];
+  while (co_await afd->Readable() == event::kEventIn) {
+    auto n = read(afd->Fd(), buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    received->append(buf, n);
+  }
+  *done = true;
+}
+
+Task<> Writer(event::Poller* poller, int fd, std::string data) {
+  for (auto c : data) {
+    co_await Sleep(poller, 1);
+    write(fd, &c, 1);
+  }
+  close(fd);
+}
+
+}  // namespace test
+}  // namespace coro
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::coro::test
+
+GTEST_TEST(CoroTest, FramePoolTest) {
+  auto p1 = LNETNS::coro::FramePool::Allocate(100);
+  auto cached = LNETNS::coro::FramePool::CachedCount();
+  LNETNS::coro::FramePool::Deallocate(p1, 100);
+  EXPECT_EQ(LNETNS::coro::FramePool::CachedCount(), cached + 1);
+
+  // Same size class.
+  auto p2 = LNETNS::coro::FramePool::Allocate(120);
+  EXPECT_EQ(p1, p2);
+  EXPECT_EQ(LNETNS::coro::FramePool::CachedCount(), cached);
+  LNETNS::coro::FramePool::Deallocate(p2, 120);
+
+  // Not pooled.
+  auto big = LNETNS::coro::FramePool::Allocate(LNETNS::coro::FramePool::kMaxPooledSize + 1);
+  LNETNS::coro::FramePool::Deallocate(big, LNETNS::coro::FramePool::kMaxPooledSize + 1);
+  EXPECT_EQ(LNETNS::coro::FramePool::CachedCount(), cached + 1);
+}
+
+GTEST_TEST(CoroTest, SleepTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+
+  int result = 0;
+  bool done = false;
+  auto task = TESTNS::Sum(poller.get(), 5, &result, &done);
+  task.Start();
+  EXPECT_FALSE(task.Done());
+  while (!done) {
+    poller->DoPoll();
+  }
+  EXPECT_TRUE(task.Done());
+  EXPECT_EQ(result, 10);
+  EXPECT_EQ(poller->TimerCount(), 0);
+}
+
+GTEST_TEST(CoroTest, CancelTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+
+  int result = 0;
+  bool done = false;
+  {
+    auto task = TESTNS::Sum(poller.get(), 5, &result, &done);
+    task.Start();
+    EXPECT_EQ(poller->TimerCount(), 1);
+  }
+  // Destroying the suspended task cancels its timer.
+  EXPECT_EQ(poller->TimerCount(), 0);
+  EXPECT_FALSE(done);
+}
+
+GTEST_TEST(CoroTest, AsyncFdTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  std::string received;
+  bool done = false;
+  auto afd = std::make_unique<LNETNS::coro::AsyncFd>(poller.get(), fds[0]);
+  LNETNS::coro::Spawn(TESTNS::Reader(afd.get(), &received, &done));
+  LNETNS::coro::Spawn(TESTNS::Writer(poller.get(), fds[1], "lightnet"));
+  while (!done) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(received, "lightnet");
+
+  afd.reset();
+  EXPECT_EQ(poller->FdCount(), 0);
+  close(fds[0]);
+}
+
+#undef TESTNS
@@ -0,0 +1,84 @@
+#include "frame_pool.h"
+#include <new>
+
+namespace LNETNS {
+namespace coro {
+
+namespace {
+
+constexpr std::size_t kNumClasses = FramePool::kMaxPooledSize / FramePool::kGranularity;
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+struct FrameCache {
+  ~FrameCache() {
+    for (std::size_t i = 0; i < kNumClasses; ++i) {
+      while (heads[i]) {
+        auto block = heads[i];
+        heads[i] = block->next;
+        ::operator delete(block);
+      }
+    }
+  }
+
+  FreeBlock* heads[kNumClasses] = {};
+  std::size_t counts[kNumClasses] = {};
+};
+
+thread_local FrameCache cache;
+
+inline std::size_t SizeClass(std::size_t size) {
+  return (size + FramePool::kGranularity - 1) / FramePool::kGranularity - 1;
+}
+
+}  // unnamed namespace
+
+void* FramePool::Allocate(std::size_t size) {
+  if (size == 0 || size > kMaxPooledSize) {
+    return ::operator new(size);
+  }
+
+  auto cls = SizeClass(size);
+  auto block = cache.heads[cls];
+  if (block) {
+    cache.heads[cls] = block->next;
+    --cache.counts[cls];
+    return block;
+  }
+  // Always allocate the full class size so that the block can be reused by
+  // any frame of the same class.
+  return ::operator new((cls + 1) * kGranularity);
+}
+
+void FramePool::Deallocate(void* ptr, std::size_t size) {
+  if (!ptr) {
+    return;
+  }
+  if (size == 0 || size > kMaxPooledSize) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  auto cls = SizeClass(size);
+  if (cache.counts[cls] >= kMaxCachedPerClass) {
+    ::operator delete(ptr);
+    return;
+  }
+  auto block = static_cast<FreeBlock*>(ptr);
+  block->next = cache.heads[cls];
+  cache.heads[cls] = block;
+  ++cache.counts[cls];
+}
+
+std::size_t FramePool::CachedCount() {
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < kNumClasses; ++i) {
+    n += cache.counts[i];
+  }
+  return n;
+}
+
+}  // namespace coro
+}  // namespace LNETNS
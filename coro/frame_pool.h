@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include "macros.h"
+
+namespace LNETNS {
+namespace coro {
+
+// Size-classed free lists for coroutine frames.
+//
+// Every coroutine created through Task<T> gets its frame from here instead of the
+// global operator new. Frames are recycled per thread, which matches the
+// one-poller-per-thread model: a frame is almost always released on the thread
+// that allocated it. Releasing on another thread is safe, the block just migrates
+// to that thread's cache.
+class FramePool {
+public:
+  // Frames larger than kMaxPooledSize bypass the pool.
+  static constexpr std::size_t kGranularity = 64;
+  static constexpr std::size_t kMaxPooledSize = 2048;
+  // Upper bound of cached blocks per size class.
+  static constexpr std::size_t kMaxCachedPerClass = 1024;
+
+  static void* Allocate(std::size_t size);
+  static void Deallocate(void* ptr, std::size_t size);
+
+  // Number of blocks cached by the calling thread.
+  static std::size_t CachedCount();
+};
+
+}  // namespace coro
+}  // namespace LNETNS
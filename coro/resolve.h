@@ -0,0 +1,69 @@
+#pragma once
+#include <coroutine>
+#include <string>
+#include "dns/dns.h"
+
+namespace LNETNS {
+namespace coro {
+
+struct ResolveResult {
+  dns::ResolveStatus status{dns::kResolveFailure};
+  dns::AddrList addrs;
+};
+
+// Awaitable wrapper of AresResolver::Resolve(). Completes without suspension if
+// the resolver answers synchronously (e.g. localhost or an IP literal). The pending
+// query is cancelled if the awaiting coroutine is destroyed.
+class ResolveAwaiter {
+public:
+  ResolveAwaiter(dns::AresResolver* resolver, std::string name, dns::AddrFamily af)
+    : resolver_(resolver), name_(std::move(name)), af_(af) {}
+  ResolveAwaiter(const ResolveAwaiter&) = delete;
+  ResolveAwaiter& operator=(const ResolveAwaiter&) = delete;
+  ~ResolveAwaiter() {
+    if (query_) {
+      query_->Cancel();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> h) {
+    handle_ = h;
+    auto cb = [this](dns::ResolveStatus status, dns::AddrList&& addrs) {
+      result_.status = status;
+      result_.addrs = std::move(addrs);
+      completed_ = true;
+      query_ = nullptr;  // the query releases itself after the callback
+      if (suspended_) {
+        handle_.resume();
+      }
+    };
+    query_ = resolver_->Resolve(name_, af_, cb);
+    if (completed_ || !query_) {
+      return false;
+    }
+    suspended_ = true;
+    return true;
+  }
+
+  ResolveResult await_resume() noexcept { return std::move(result_); }
+
+private:
+  dns::AresResolver* resolver_{nullptr};
+  std::string name_;
+  dns::AddrFamily af_{dns::AddrFamily::kUnSpec};
+  dns::DnsQuery* query_{nullptr};
+  ResolveResult result_;
+  bool completed_{false};
+  bool suspended_{false};
+  std::coroutine_handle<> handle_;
+};
+
+// auto result = co_await Resolve(&resolver, "www.example.com", dns::AddrFamily::kInet4);
+inline ResolveAwaiter Resolve(dns::AresResolver* resolver, std::string name, dns::AddrFamily af) {
+  return ResolveAwaiter(resolver, std::move(name), af);
+}
+
+}  // namespace coro
+}  // namespace LNETNS
@@ -0,0 +1,28 @@
+#include "sleep.h"
+
+namespace LNETNS {
+namespace coro {
+
+SleepAwaiter::~SleepAwaiter() {
+  if (timer_key_ != event::kBadTimerKey) {
+    poller_->CancelTimer(timer_key_, this);
+    timer_key_ = event::kBadTimerKey;
+  }
+}
+
+bool SleepAwaiter::await_suspend(std::coroutine_handle<> h) {
+  timer_key_ = poller_->AddTimer(timeout_, this);
+  if (timer_key_ == event::kBadTimerKey) {
+    return false;
+  }
+  handle_ = h;
+  return true;
+}
+
+void SleepAwaiter::OnTimeout(int id) {
+  timer_key_ = event::kBadTimerKey;
+  handle_.resume();
+}
+
+}  // namespace coro
+}  // namespace LNETNS
@@ -0,0 +1,46 @@
+#pragma once
+#include <coroutine>
+#include "event/poller.h"
+
+namespace LNETNS {
+namespace coro {
+
+// Awaitable one-time timer on the poller. The timer is cancelled if the awaiting
+// coroutine is destroyed before it fires.
+class SleepAwaiter final : public event::EventHandler {
+public:
+  SleepAwaiter(event::Poller* poller, uint32_t timeout)
+    : poller_(poller), timeout_(timeout) {}
+  SleepAwaiter(const SleepAwaiter&) = delete;
+  SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+  ~SleepAwaiter() override;
+
+  bool await_ready() const noexcept { return timeout_ == 0; }
+  bool await_suspend(std::coroutine_handle<> h);
+  void await_resume() const noexcept {}
+
+private:
+  void OnReadable(int fd) override {}
+  void OnWritable(int fd) override {}
+  void OnTimeout(int id) override;
+
+private:
+  event::Poller* poller_{nullptr};
+  uint32_t timeout_{0};
+  event::TimerKey timer_key_{event::kBadTimerKey};
+  std::coroutine_handle<> handle_;
+};
+
+// co_await Sleep(poller, 100);
+inline SleepAwaiter Sleep(event::Poller* poller, uint32_t timeout) {
+  return SleepAwaiter(poller, timeout);
+}
+
+// Sleep until the monotonic time "deadline" (see BasePoller::GetNowMs()).
+inline SleepAwaiter SleepUntil(event::Poller* poller, uint64_t deadline) {
+  auto now = event::BasePoller::GetNowMs();
+  return SleepAwaiter(poller, deadline > now ? deadline - now : 0);
+}
+
+}  // namespace coro
+}  // namespace LNETNS
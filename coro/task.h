@@ -0,0 +1,194 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "frame_pool.h"
+
+namespace LNETNS {
+namespace coro {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+  // Coroutine frames come from the pool, see frame_pool.h.
+  static void* operator new(std::size_t size) {
+    return FramePool::Allocate(size);
+  }
+  static void operator delete(void* ptr, std::size_t size) {
+    FramePool::Deallocate(ptr, size);
+  }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    // Symmetric transfer to the awaiting coroutine, so that a chain of nested
+    // tasks resumes without growing the stack.
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+      auto& promise = h.promise();
+      if (promise.continuation_) {
+        return promise.continuation_;
+      }
+      if (promise.detached_) {
+        if (promise.exception_) {
+          // Nobody can observe the exception of a detached task.
+          std::terminate();
+        }
+        h.destroy();
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  // Tasks are lazy, they start running when awaited, started or spawned.
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { exception_ = std::current_exception(); }
+
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+  bool detached_{false};
+};
+
+template <typename T>
+struct Promise : public PromiseBase {
+  Task<T> get_return_object() noexcept;
+
+  template <typename U>
+  void return_value(U&& value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T Result() {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+    return std::move(*value_);
+  }
+
+  std::optional<T> value_;
+};
+
+template <>
+struct Promise<void> : public PromiseBase {
+  Task<void> get_return_object() noexcept;
+
+  void return_void() noexcept {}
+
+  void Result() {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+};
+
+}  // namespace detail
+
+// Lazily started coroutine that resumes its awaiter on completion.
+//
+// There is no scheduler: a suspended task is resumed directly from the poller
+// callback (OnReadable/OnWritable/OnTimeout/ResolveCb) that completed the
+// awaited operation, i.e. always on the thread that calls Poller::DoPoll().
+//
+// A task owns its frame, destroying a suspended task destroys the frame and
+// every awaiter living in it (which in turn unregisters itself from the poller).
+template <typename T>
+class Task {
+public:
+  using promise_type = detail::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  Task() = default;
+  explicit Task(Handle h) : handle_(h) {}
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() { Reset(); }
+
+  inline bool Valid() const { return static_cast<bool>(handle_); }
+  inline bool Done() const { return !handle_ || handle_.done(); }
+
+  // Run the task until its first suspension point.
+  void Start() {
+    if (handle_ && !handle_.done()) {
+      handle_.resume();
+    }
+  }
+
+  // Only valid after Done() returns true.
+  T Result() { return handle_.promise().Result(); }
+
+  // Give up the ownership of the frame, which will be released on completion.
+  void Detach() {
+    if (!handle_) {
+      return;
+    }
+    auto h = std::exchange(handle_, nullptr);
+    if (h.done()) {
+      h.destroy();
+      return;
+    }
+    h.promise().detached_ = true;
+  }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return !handle || handle.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation_ = awaiting;
+        return handle;
+      }
+      T await_resume() { return handle.promise().Result(); }
+
+      Handle handle;
+    };
+    return Awaiter{handle_};
+  }
+
+private:
+  void Reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+  Handle handle_;
+};
+
+namespace detail {
+
+template <typename T>
+inline Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+
+}  // namespace detail
+
+// Fire-and-forget: run the task on the calling thread until it suspends, the frame
+// is released when the task completes.
+template <typename T>
+inline void Spawn(Task<T> task) {
+  task.Start();
+  task.Detach();
+}
+
+}  // namespace coro
+}  // namespace LNETNS
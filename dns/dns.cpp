@@ -1,4 +1,13 @@
 #include "dns.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include "debug.h"
@@ -6,6 +15,333 @@
 namespace LNETNS {
 namespace dns {
 
+namespace {
+
+// Snapshot file: a header, then the records from the most recently used entry on.
+// Native byte order, a file of another one fails on the magic.
+constexpr uint32_t kSnapshotMagic = 0x43444e4c;  // "LNDC"
+constexpr uint32_t kSnapshotVersion = 1;
+
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+  uint64_t checksum;  // of the records
+};
+
+// Followed by the name and the addresses.
+struct SnapshotRecord {
+  int64_t expire_ms;  // wall clock
+  uint32_t ttl;
+  uint16_t name_len;
+  uint16_t addr_count;
+  uint8_t af;
+  uint8_t failure;
+};
+
+// Family, then the IPv4 or IPv6 address.
+constexpr size_t kSnapshotAddrSize = 1 + sizeof(in6_addr);
+
+uint64_t Fnv1a(const char* data, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+int64_t WallNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // unnamed namespace
+
+std::string DnsCache::MakeKey(const std::string& name, AddrFamily af) {
+  std::string key(name.size() + 2, '/');
+  std::transform(name.begin(), name.end(), key.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  key.back() = '0' + static_cast<int>(af);
+  return key;
+}
+
+const std::string& DnsCache::ScratchKey(const std::string& name, AddrFamily af) {
+  key_.resize(name.size() + 2);
+  std::transform(name.begin(), name.end(), key_.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  key_[name.size()] = '/';
+  key_.back() = '0' + static_cast<int>(af);
+  return key_;
+}
+
+const DnsCache::Entry* DnsCache::Lookup(const std::string& name, AddrFamily af, uint64_t now_ms) {
+  auto it = index_.find(ScratchKey(name, af));
+  if (it == index_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  auto entry = it->second;
+  if (entry->expire_ms <= now_ms) {
+    if (entry->status != kResolveSuccess ||
+        entry->expire_ms + options_.max_stale * 1000ULL <= now_ms) {
+      lru_.erase(entry);
+      index_.erase(it);
+    }
+    ++misses_;
+    return nullptr;
+  }
+
+  if (options_.refresh_ahead > 0 && !entry->refresh && entry->status == kResolveSuccess &&
+      entry->expire_ms - now_ms <= entry->ttl * 10ULL * options_.refresh_ahead) {
+    entry->refresh = true;
+    refreshes_.emplace_back(entry->key.substr(0, entry->key.size() - 2), af);
+  }
+  lru_.splice(lru_.begin(), lru_, entry);
+  ++hits_;
+  return &*entry;
+}
+
+const DnsCache::Entry* DnsCache::LookupStale(const std::string& name, AddrFamily af,
+                                             uint64_t now_ms) {
+  auto it = index_.find(ScratchKey(name, af));
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  auto entry = it->second;
+  if (entry->status != kResolveSuccess ||
+      entry->expire_ms + options_.max_stale * 1000ULL <= now_ms) {
+    return nullptr;
+  }
+  entry->refresh = false;
+  return &*entry;
+}
+
+void DnsCache::Insert(const std::string& name, AddrFamily af, ResolveStatus status,
+                      const AddrList& addrs, uint32_t ttl, uint64_t now_ms) {
+  if (options_.capacity == 0) {
+    return;
+  }
+  if (status == kResolveSuccess) {
+    ttl = std::min(std::max(ttl, options_.min_ttl), options_.max_ttl);
+  } else {
+    ttl = options_.negative_ttl;
+  }
+
+  auto key = MakeKey(name, af);
+  auto it = index_.find(key);
+  if (ttl == 0) {
+    // Not to be cached, and a previous result is outdated.
+    if (it != index_.end()) {
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+    return;
+  }
+
+  auto& entry = Emplace(std::move(key));
+  entry.af = af;
+  entry.status = status;
+  entry.addrs = addrs;
+  entry.expire_ms = now_ms + ttl * 1000ULL;
+  entry.ttl = ttl;
+  entry.refresh = false;
+}
+
+DnsCache::Entry& DnsCache::Emplace(std::string key) {
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return lru_.front();
+  }
+  if (index_.size() >= options_.capacity) {
+    index_.erase(lru_.back().key);
+    lru_.pop_back();
+  }
+  lru_.emplace_front();
+  lru_.front().key = std::move(key);
+  index_.emplace(lru_.front().key, lru_.begin());
+  return lru_.front();
+}
+
+bool DnsCache::Save(const std::string& path, uint64_t now_ms) const {
+  auto wall_now = WallNowMs();
+  std::string records;
+  uint64_t count = 0;
+  for (auto& entry : lru_) {
+    if (entry.expire_ms + options_.max_stale * 1000ULL <= now_ms) {
+      continue;
+    }
+    auto name_len = entry.key.size() - 2;
+    if (name_len > UINT16_MAX || entry.addrs.size() > UINT16_MAX) {
+      continue;
+    }
+    SnapshotRecord rec;
+    std::memset(&rec, 0, sizeof(rec));  // no garbage padding in the file
+    rec.expire_ms = wall_now + (static_cast<int64_t>(entry.expire_ms) - static_cast<int64_t>(now_ms));
+    rec.ttl = entry.ttl;
+    rec.name_len = name_len;
+    rec.addr_count = entry.addrs.size();
+    rec.af = static_cast<uint8_t>(entry.af);
+    rec.failure = entry.status != kResolveSuccess;
+    records.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+    records.append(entry.key, 0, name_len);
+    for (auto& addr : entry.addrs) {
+      char buf[kSnapshotAddrSize] = {};
+      if (addr.sockaddr_in.sin_family == AF_INET6) {
+        buf[0] = 6;
+        std::memcpy(buf + 1, &addr.sockaddr_in6.sin6_addr, sizeof(in6_addr));
+      } else {
+        buf[0] = 4;
+        std::memcpy(buf + 1, &addr.sockaddr_in.sin_addr, sizeof(in_addr));
+      }
+      records.append(buf, sizeof(buf));
+    }
+    ++count;
+  }
+
+  SnapshotHeader header = {kSnapshotMagic, kSnapshotVersion, count,
+                           Fnv1a(records.data(), records.size())};
+  // Written aside then renamed, a reader never sees a partial file.
+  auto tmp = path + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  data += records;
+  size_t off = 0;
+  while (off < data.size()) {
+    auto n = write(fd, data.data() + off, data.size() - off);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      close(fd);
+      unlink(tmp.c_str());
+      errno = err;
+      return false;
+    }
+    off += n;
+  }
+  if (close(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+    int err = errno;
+    unlink(tmp.c_str());
+    errno = err;
+    return false;
+  }
+  return true;
+}
+
+bool DnsCache::Load(const std::string& path, uint64_t now_ms) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(SnapshotHeader)) {
+    close(fd);
+    errno = EPROTO;
+    return false;
+  }
+  auto mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno;
+  close(fd);
+  if (mem == MAP_FAILED) {
+    errno = err;
+    return false;
+  }
+
+  // Validated as a whole before anything is cached.
+  auto data = static_cast<const char*>(mem);
+  SnapshotHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  bool ok = header.magic == kSnapshotMagic && header.version == kSnapshotVersion &&
+            header.checksum == Fnv1a(data + sizeof(header), size - sizeof(header));
+  auto wall_now = WallNowMs();
+  std::vector<Entry> entries;
+  size_t off = sizeof(header);
+  for (uint64_t i = 0; ok && i < header.count; ++i) {
+    SnapshotRecord rec;
+    if (size - off < sizeof(rec)) {
+      ok = false;
+      break;
+    }
+    std::memcpy(&rec, data + off, sizeof(rec));
+    off += sizeof(rec);
+    if (size - off < rec.name_len + size_t(rec.addr_count) * kSnapshotAddrSize ||
+        rec.name_len == 0 || rec.af > static_cast<uint8_t>(AddrFamily::kInet6)) {
+      ok = false;
+      break;
+    }
+    std::string name(data + off, rec.name_len);
+    off += rec.name_len;
+    AddrList addrs;
+    for (uint16_t j = 0; j < rec.addr_count; ++j, off += kSnapshotAddrSize) {
+      address::SockAddr addr;
+      if (data[off] == 4) {
+        addr.sockaddr_in.sin_family = AF_INET;
+        addr.sockaddr_in.sin_port = 0;
+        std::memcpy(&addr.sockaddr_in.sin_addr, data + off + 1, sizeof(in_addr));
+      } else if (data[off] == 6) {
+        addr.sockaddr_in6.sin6_family = AF_INET6;
+        addr.sockaddr_in6.sin6_port = 0;
+        std::memcpy(&addr.sockaddr_in6.sin6_addr, data + off + 1, sizeof(in6_addr));
+      } else {
+        ok = false;
+        break;
+      }
+      addrs.push_back(addr);
+    }
+    auto remaining = rec.expire_ms - wall_now;
+    if (!ok || remaining + options_.max_stale * 1000LL <= 0) {
+      continue;
+    }
+    entries.emplace_back();
+    auto& entry = entries.back();
+    entry.af = static_cast<AddrFamily>(rec.af);
+    entry.key = MakeKey(name, entry.af);
+    entry.status = rec.failure ? kResolveFailure : kResolveSuccess;
+    entry.addrs = std::move(addrs);
+    entry.expire_ms = std::max<int64_t>(static_cast<int64_t>(now_ms) + remaining, 0);
+    entry.ttl = rec.ttl;
+  }
+  munmap(mem, size);
+  if (!ok || off != size) {
+    errno = EPROTO;
+    return false;
+  }
+
+  // The least recently used first, what is cached already is newer.
+  for (auto it = entries.rbegin(); it != entries.rend() && options_.capacity > 0; ++it) {
+    if (index_.count(it->key)) {
+      continue;
+    }
+    auto key = it->key;
+    Emplace(std::move(key)) = std::move(*it);
+  }
+  return true;
+}
+
+void DnsCache::Clear() {
+  index_.clear();
+  lru_.clear();
+  refreshes_.clear();
+}
+
+std::vector<std::pair<std::string, AddrFamily> > DnsCache::TakeRefreshes() {
+  std::vector<std::pair<std::string, AddrFamily> > refreshes;
+  refreshes.swap(refreshes_);
+  return refreshes;
+}
+
 const AresResolver::Options AresResolver::kDefaultOptions;
 
 AresResolver::AresResolver(event::Poller* poller)
@@ -13,7 +349,7 @@ AresResolver::AresResolver(event::Poller* poller)
 }
 
 AresResolver::AresResolver(event::Poller* poller, const Options& opt)
-  : poller_(poller) {
+  : poller_(poller), cache_(opt.cache) {
   if (&opt != &kDefaultOptions) {
     options_ = new Options(opt);
   } else {
@@ -22,11 +358,18 @@ AresResolver::AresResolver(event::Poller* poller, const Options& opt)
 }
 
 AresResolver::~AresResolver() {
+  if (refresh_timer_ != event::kBadTimerKey) {
+    poller_->CancelTimer(refresh_timer_, this, kRefreshTimerId);
+  }
   // All fds and timers will be removed in OnAresSocketStateChange when calling ares_destroy.
   if (channel_) {
     ares_destroy(channel_);
     channel_ = nullptr;
   }
+  for (auto query : free_queries_) {
+    delete query;
+  }
+  free_queries_.clear();
 
   if (options_ != &kDefaultOptions) {
     delete options_;
@@ -68,22 +411,49 @@ bool AresResolver::SetServers(std::string servers) {
 }
 
 DnsQuery* AresResolver::Resolve(const std::string& name, AddrFamily af, ResolveCb callback) {
+  if (auto entry = cache_.Lookup(name, af, event::BasePoller::GetNowMs())) {
+    LOG_DEBUG("Cache hit: {}", name);
+    if (cache_.RefreshCount() > 0 && refresh_timer_ == event::kBadTimerKey) {
+      // Refreshes of this loop iteration go together.
+      refresh_timer_ = poller_->AddTimer(0, this, kRefreshTimerId);
+    }
+    callback(entry->status, AddrList(entry->addrs));
+    return nullptr;
+  }
+
+  auto key = DnsCache::MakeKey(name, af);
+  auto it = flights_.find(key);
+  if (it != flights_.end()) {
+    LOG_DEBUG("Joined pending query: {}", name);
+    return Join(it->second, std::move(callback));
+  }
+
+  auto flight = std::make_unique<Flight>(this, std::move(key), name, af);
+  auto query = Join(flight.get(), std::move(callback));
+  if (!Send(std::move(flight))) {
+    // The query has been released with the result.
+    return nullptr;
+  }
+  return query;
+}
+
+bool AresResolver::Send(std::unique_ptr<Flight> flight) {
   // TODO: reinit channel periodically.
   if (!channel_) {
     if (!InitAresChannel()) {
-      callback(kResolveFailure, {});
-      return nullptr;
+      flight->Complete(kResolveFailure, {});
+      return false;
     }
   } else if (dirty_channel_) {
     LOG_INFO("channel is dirty.");
     if (!ReinitAresChannel()) {
-      callback(kResolveFailure, {});
-      return nullptr;
+      flight->Complete(kResolveFailure, {});
+      return false;
     }
   }
 
   ares_addrinfo_hints hints = {};
-  switch (af) {
+  switch (flight->af) {
   case LNETNS::dns::AddrFamily::kInet4:
     hints.ai_family = AF_INET;
     break;
@@ -95,22 +465,125 @@ DnsQuery* AresResolver::Resolve(const std::string& name, AddrFamily af, ResolveC
     break;
   }
   hints.ai_flags = ARES_AI_NOSORT;
-  auto query = std::make_unique<Query>(this, callback);
+  flights_.emplace(flight->key, flight.get());
   auto cb = [](void* arg, int status, int timeouts, ares_addrinfo* addrinfo) {
-    auto dnsq = static_cast<Query*>(arg);
-    dnsq->OnGetAddrInfoCallback(status, timeouts, addrinfo);
+    auto flight = static_cast<Flight*>(arg);
+    flight->OnGetAddrInfoCallback(status, timeouts, addrinfo);
   };
-  ares_getaddrinfo(channel_, name.c_str(), nullptr, &hints, cb, query.get());
-  if (query->completed_) {
+  ares_getaddrinfo(channel_, flight->name.c_str(), nullptr, &hints, cb, flight.get());
+  if (flight->completed_) {
     // Resolution does not need asynchronous behavior. For example, localhost lookup.
     LOG_DEBUG("ares_getaddrinfo() completes immediately.");
-    return nullptr;
+    return false;
   }
 
   // Asynchronous pending request.
   UpdateTimer();
-  query->owned_ = true;  // Make AresDnsQuery being released in OnGetAddrInfoCallback.
-  return query.release();
+  flight->owned_ = true;  // Make Flight being released in OnGetAddrInfoCallback.
+  flight.release();
+  return true;
+}
+
+void AresResolver::Refresh() {
+  for (auto& refresh : cache_.TakeRefreshes()) {
+    auto key = DnsCache::MakeKey(refresh.first, refresh.second);
+    if (flights_.count(key)) {
+      continue;
+    }
+    LOG_DEBUG("Refreshing {}", refresh.first);
+    // Nobody waits, the result goes to the cache.
+    Send(std::make_unique<Flight>(this, std::move(key), refresh.first, refresh.second));
+  }
+}
+
+DnsQuery* AresResolver::ResolveMany(const std::vector<std::string>& names, AddrFamily af,
+                                    uint32_t timeout, ResolveManyCb callback,
+                                    ResolveEachCb each) {
+  auto batch = new Batch(this, names.size(), std::move(callback), std::move(each));
+  batch->issuing = true;
+  for (size_t i = 0; i < names.size(); ++i) {
+    batch->queries[i] = Resolve(names[i], af, [batch, i](ResolveStatus status, AddrList&& addrs) {
+      batch->OnResolved(i, status, std::move(addrs));
+    });
+  }
+  batch->issuing = false;
+  if (batch->pending == 0) {
+    // Cached or local names only.
+    batch->Finish();
+    return nullptr;
+  }
+  if (timeout > 0) {
+    batch->timer = poller_->AddTimer(timeout, batch);
+  }
+  return batch;
+}
+
+std::vector<ResolveResult> AresResolver::ResolveManyBlocking(const std::vector<std::string>& names,
+                                                             AddrFamily af, uint32_t timeout) {
+  return ResolveManyBlocking(names, af, timeout, kDefaultOptions, std::string());
+}
+
+std::vector<ResolveResult> AresResolver::ResolveManyBlocking(const std::vector<std::string>& names,
+                                                             AddrFamily af, uint32_t timeout,
+                                                             const Options& opt,
+                                                             const std::string& servers) {
+  std::vector<ResolveResult> results(names.size());
+  event::Poller poller;
+  AresResolver resolver(&poller, opt);
+  if (!servers.empty() && !resolver.SetServers(servers)) {
+    return results;
+  }
+  bool done = false;
+  resolver.ResolveMany(names, af, timeout, [&](std::vector<ResolveResult>&& all) {
+    results = std::move(all);
+    done = true;
+  });
+  while (!done) {
+    poller.DoPoll();
+  }
+  return results;
+}
+
+bool AresResolver::SaveCache(const std::string& path) {
+  if (!cache_.Save(path, event::BasePoller::GetNowMs())) {
+    err_ = "Saving DNS cache to " + path + " failed: " + std::strerror(errno);
+    LOG_ERROR("{}", err_);
+    return false;
+  }
+  return true;
+}
+
+bool AresResolver::LoadCache(const std::string& path) {
+  if (!cache_.Load(path, event::BasePoller::GetNowMs())) {
+    err_ = "Loading DNS cache from " + path + " failed: " + std::strerror(errno);
+    LOG_ERROR("{}", err_);
+    return false;
+  }
+  LOG_INFO("Loaded DNS cache from {}, {} entries", path, cache_.Size());
+  return true;
+}
+
+AresResolver::Query* AresResolver::Join(Flight* flight, ResolveCb&& callback) {
+  Query* query;
+  if (!free_queries_.empty()) {
+    query = free_queries_.back();
+    free_queries_.pop_back();
+  } else {
+    query = new Query();
+  }
+  query->callback = std::move(callback);
+  flight->Append(query);
+  return query;
+}
+
+void AresResolver::ReleaseQuery(Query* query) {
+  query->flight = nullptr;
+  query->callback = nullptr;  // release what it captured now
+  if (free_queries_.size() < kMaxFreeQueries) {
+    free_queries_.push_back(query);
+  } else {
+    delete query;
+  }
 }
 
 bool AresResolver::InitAresChannel() {
@@ -134,6 +607,12 @@ bool AresResolver::InitAresChannel() {
     optmask |= ARES_OPT_TIMEOUTMS;
     options.timeout = options_->timeout;
   }
+#ifdef ARES_OPT_QUERY_CACHE
+  // Options::cache is the only cache: c-ares' one would answer repeated queries
+  // synchronously even with ours disabled.
+  optmask |= ARES_OPT_QUERY_CACHE;
+  options.qcache_max_ttl = 0;
+#endif  // ARES_OPT_QUERY_CACHE
 
   int rc = ares_init_options(&channel_, &options, optmask);
   if (rc != ARES_SUCCESS) {
@@ -223,12 +702,81 @@ void AresResolver::OnWritable(int fd) {
 }
 
 void AresResolver::OnTimeout(int id) {
+  if (id == kRefreshTimerId) {
+    refresh_timer_ = event::kBadTimerKey;
+    Refresh();
+    return;
+  }
   LOG_WARN("Query timed out.");
   ares_process_fd(channel_, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
   UpdateTimer();
 }
 
-void AresResolver::Query::OnGetAddrInfoCallback(int status, int timeouts, ares_addrinfo* addrinfo) {
+void AresResolver::Batch::Cancel() {
+  if (timer != event::kBadTimerKey) {
+    resolver->poller_->CancelTimer(timer, this);
+  }
+  for (auto query : queries) {
+    if (query) {
+      query->Cancel();
+    }
+  }
+  delete this;
+}
+
+void AresResolver::Batch::OnResolved(size_t index, ResolveStatus status, AddrList&& addrs) {
+  queries[index] = nullptr;
+  --pending;
+  if (each) {
+    if (callback) {
+      each(index, status, AddrList(addrs));
+    } else {
+      each(index, status, std::move(addrs));
+    }
+  }
+  results[index].status = status;
+  results[index].addrs = std::move(addrs);
+  if (pending == 0 && !issuing) {
+    Finish();
+  }
+}
+
+void AresResolver::Batch::OnTimeout(int id) {
+  timer = event::kBadTimerKey;
+  LOG_WARN("ResolveMany() timed out, {} names left", pending);
+  for (size_t i = 0; i < queries.size(); ++i) {
+    if (queries[i]) {
+      queries[i]->Cancel();
+      queries[i] = nullptr;
+      if (each) {
+        each(i, kResolveFailure, {});
+      }
+    }
+  }
+  pending = 0;
+  Finish();
+}
+
+void AresResolver::Batch::Finish() {
+  if (timer != event::kBadTimerKey) {
+    resolver->poller_->CancelTimer(timer, this);
+  }
+  if (callback) {
+    callback(std::move(results));
+  }
+  delete this;
+}
+
+void AresResolver::Query::Cancel() {
+  if (!flight) {
+    return;
+  }
+  auto resolver = flight->resolver;
+  flight->Remove(this);
+  resolver->ReleaseQuery(this);
+}
+
+void AresResolver::Flight::OnGetAddrInfoCallback(int status, int timeouts, ares_addrinfo* addrinfo) {
   completed_ = true;
 #ifdef LNET_DEBUG
   // host_query.timeouts: number of timeouts we saw for this request
@@ -237,8 +785,10 @@ void AresResolver::Query::OnGetAddrInfoCallback(int status, int timeouts, ares_a
   }
 #endif  // LNET_DEBUG
 
-  std::list<address::SockAddr> addrs;
+  AddrList addrs;
   ResolveStatus resolve_status;
+  // Seconds the result may be cached for, the smallest of the records.
+  uint32_t ttl = UINT32_MAX;
   if (status == ARES_SUCCESS) {
     if (addrinfo != nullptr && addrinfo->nodes != nullptr) {
       for (const ares_addrinfo_node* ai = addrinfo->nodes; ai != nullptr; ai = ai->ai_next) {
@@ -256,6 +806,10 @@ void AresResolver::Query::OnGetAddrInfoCallback(int status, int timeouts, ares_a
           addr.sockaddr_in6.sin6_addr = reinterpret_cast<sockaddr_in6*>(ai->ai_addr)->sin6_addr;
         }
         addrs.emplace_back(addr);
+        ttl = std::min<uint32_t>(ttl, std::max(ai->ai_ttl, 0));
+      }
+      for (auto cname = addrinfo->cnames; cname != nullptr; cname = cname->next) {
+        ttl = std::min<uint32_t>(ttl, std::max(cname->ttl, 0));
       }
     }
     if (!addrs.empty()) {
@@ -283,12 +837,72 @@ void AresResolver::Query::OnGetAddrInfoCallback(int status, int timeouts, ares_a
     }
   }
 
-  if (!cancelled_) {
-    callback(resolve_status, std::move(addrs));
+  auto& cache = resolver->cache_;
+  auto now = event::BasePoller::GetNowMs();
+  if (status == ARES_ETIMEOUT || status == ARES_ECONNREFUSED || status == ARES_ESERVFAIL ||
+      status == ARES_EREFUSED) {
+    // Upstream unavailable, keep the last known result if not too old.
+    if (auto stale = cache.LookupStale(name, af, now)) {
+      LOG_WARN("Serving stale result of {}", name);
+      Complete(kResolveSuccess, AddrList(stale->addrs));
+      return;
+    }
+  }
+  // Failures but the resolver's own ones are cached as negative results.
+  if (status != ARES_ECANCELLED && status != ARES_EDESTRUCTION && status != ARES_ENOMEM) {
+    cache.Insert(name, af, resolve_status, addrs, ttl, now);
+  }
+  Complete(resolve_status, std::move(addrs));
+}
+
+void AresResolver::Flight::Append(Query* query) {
+  query->flight = this;
+  query->prev = last;
+  query->next = nullptr;
+  if (last) {
+    last->next = query;
+  } else {
+    first = query;
+  }
+  last = query;
+}
+
+void AresResolver::Flight::Remove(Query* query) {
+  if (query->prev) {
+    query->prev->next = query->next;
+  } else {
+    first = query->next;
+  }
+  if (query->next) {
+    query->next->prev = query->prev;
+  } else {
+    last = query->prev;
+  }
+  query->prev = query->next = nullptr;
+  query->flight = nullptr;
+}
+
+void AresResolver::Flight::Complete(ResolveStatus status, AddrList&& addrs) {
+  completed_ = true;
+  auto it = resolver->flights_.find(key);
+  if (it != resolver->flights_.end() && it->second == this) {
+    resolver->flights_.erase(it);
+  }
+
+  // Fan out. A callback may cancel the waiters left, or resolve the name again.
+  while (first) {
+    auto query = first;
+    Remove(query);
+    if (!first) {
+      query->callback(status, std::move(addrs));
+    } else {
+      query->callback(status, AddrList(addrs));
+    }
+    resolver->ReleaseQuery(query);
   }
   if (owned_) {
     delete this;
-    LOG_DEBUG("Self-deleted AresResolver::DnsQuery.");
+    LOG_DEBUG("Self-deleted AresResolver::Flight.");
   }
 }
 
@@ -3,9 +3,13 @@
 #include <memory>
 #include <functional>
 #include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "event/poller.h"
 #include "address/sockaddr.h"
+#include "small_vector.h"
 #include "ares.h"
 
 namespace LNETNS {
@@ -22,10 +26,25 @@ enum ResolveStatus {
   kResolveFailure = -1,
 };
 
+// Most names have a few addresses, they are kept inline.
+constexpr size_t kInlineAddrs = 4;
+
 // status can be kResolveSuccess or kResolveFailure (kResolvePending is for AresResolver::Resolve)
-using AddrList = std::list<address::SockAddr>;
+using AddrList = SmallVector<address::SockAddr, kInlineAddrs>;
+// Pass it moved, a callable small enough (e.g. capturing one pointer) isn't copied
+// to the heap.
 using ResolveCb = std::function<void(ResolveStatus status, AddrList&& addrs)>;
 
+// Result of one name of AresResolver::ResolveMany().
+struct ResolveResult {
+  ResolveStatus status{kResolveFailure};
+  AddrList addrs;
+};
+// All the results, in the order of the names.
+using ResolveManyCb = std::function<void(std::vector<ResolveResult>&& results)>;
+// The result of names[index], as soon as it is known.
+using ResolveEachCb = std::function<void(size_t index, ResolveStatus status, AddrList&& addrs)>;
+
 class DnsQuery {
 public:
   virtual ~DnsQuery() = default;
@@ -36,12 +55,89 @@ public:
   virtual void Cancel() = 0;
 };
 
+// LRU cache of resolution results keyed by (name, family). A result lives as long
+// as the smallest TTL of its records, clamped to [min_ttl, max_ttl]; a failure
+// (NXDOMAIN, no data, server failure, timeout) lives negative_ttl.
+//
+// A result looked up within the last refresh_ahead percent of its TTL is marked
+// for refreshing, see TakeRefreshes(). An expired result is kept max_stale more
+// seconds, to be served by LookupStale() when resolving it again fails.
+class DnsCache {
+public:
+  struct Options {
+    size_t capacity{1024};  // max entries, 0 disables the cache
+    uint32_t min_ttl{0};  // seconds
+    uint32_t max_ttl{3600};  // seconds
+    uint32_t negative_ttl{5};  // seconds, 0 disables caching failures
+    uint32_t refresh_ahead{10};  // percent of the TTL, 0 disables refreshing
+    uint32_t max_stale{0};  // seconds, 0 disables serving expired results
+  };
+
+  struct Entry {
+    std::string key;
+    AddrFamily af{AddrFamily::kUnSpec};
+    ResolveStatus status{kResolveFailure};
+    AddrList addrs;
+    uint64_t expire_ms{0};  // monotonic, see event::BasePoller::GetNowMs()
+    uint32_t ttl{0};  // seconds, clamped
+    bool refresh{false};  // marked for refreshing
+  };
+
+public:
+  explicit DnsCache(const Options& opt) : options_(opt) {}
+
+  // Names are case-insensitive.
+  static std::string MakeKey(const std::string& name, AddrFamily af);
+
+  // Returns the unexpired entry and makes it the most recently used one, or null.
+  const Entry* Lookup(const std::string& name, AddrFamily af, uint64_t now_ms);
+  // Returns the successful result, unexpired or not older than max_stale, or null.
+  // It may be marked for refreshing again.
+  const Entry* LookupStale(const std::string& name, AddrFamily af, uint64_t now_ms);
+  // "ttl" is the records' one in seconds, unused for failures. The least recently
+  // used entry is evicted when full.
+  void Insert(const std::string& name, AddrFamily af, ResolveStatus status,
+              const AddrList& addrs, uint32_t ttl, uint64_t now_ms);
+  void Clear();
+
+  // Write the entries (but the too old ones) to a snapshot file, or add the ones of
+  // a snapshot file not expired yet. Expiry is saved as wall clock time, "now_ms" is
+  // the current monotonic time. Return false with errno set on failure, EPROTO for
+  // an invalid file.
+  bool Save(const std::string& path, uint64_t now_ms) const;
+  bool Load(const std::string& path, uint64_t now_ms);
+
+  // Names and families marked since the last call.
+  std::vector<std::pair<std::string, AddrFamily> > TakeRefreshes();
+  inline size_t RefreshCount() const { return refreshes_.size(); }
+
+  inline size_t Size() const { return index_.size(); }
+  inline uint64_t Hits() const { return hits_; }
+  inline uint64_t Misses() const { return misses_; }
+
+private:
+  // The entry of "key", existing or added, made the most recently used one.
+  Entry& Emplace(std::string key);
+  // MakeKey() into key_, not allocating once grown.
+  const std::string& ScratchKey(const std::string& name, AddrFamily af);
+
+private:
+  Options options_;
+  std::list<Entry> lru_;  // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  std::vector<std::pair<std::string, AddrFamily> > refreshes_;
+  std::string key_;
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+};
+
 class AresResolver : event::EventHandler {
 public:
   struct Options {
     bool use_tcp{false};  // ARES_FLAG_USEVC, always use TCP queries instead of UDP queries
     bool no_search{false};  // ARES_FLAG_NOSEARCH, do not use the default search domains
     int timeout{-1};  // milliseconds, negative means use the c-ares default value
+    DnsCache::Options cache;
   };
 
 public:
@@ -56,35 +152,126 @@ public:
   bool SetServers(std::string servers);
 
   // Returns the pending query object if this is a asynchronous resolution, or null
-  // if it's a synchronous resolution (e.g. localhost) or failure (callback won't
-  // be invoked in this circumstance).
+  // if it's a synchronous resolution (e.g. localhost or a cache hit) or failure
+  // (callback won't be invoked in this circumstance). The query object is reused once
+  // its callback returned, don't keep it past that.
+  //
+  // A query identical to a pending one (same name and family) doesn't go to c-ares
+  // again, it waits for the same result.
+  //
+  // Cached results looked up shortly before expiring are refreshed in the background
+  // (DnsCache::Options::refresh_ahead). If resolving fails for a timeout or a server
+  // failure, a result expired less than max_stale ago is served instead.
   //
   // Beware of set "af" to AddrFamily::kUnSpec (AF_UNSPEC). If part of query completes
   // (i.e. either record A or record AAAA received), ares_addrinfo_callback won't be
   // invoked when you call ares_cancel/ares_destroy, which will cause memory leak.
   DnsQuery* Resolve(const std::string& name, AddrFamily af, ResolveCb callback);
+
+  // Resolve all the names concurrently. "each" (optional) gets every result as it
+  // comes, "callback" (optional) all of them once the last one is known. Names not
+  // resolved within "timeout" milliseconds (0 for none) fail. Returns the pending
+  // batch, whose Cancel() cancels all the names left, or null if all completed
+  // synchronously.
+  DnsQuery* ResolveMany(const std::vector<std::string>& names, AddrFamily af, uint32_t timeout,
+                        ResolveManyCb callback, ResolveEachCb each = nullptr);
+  // Blocking ResolveMany() for initialization, on a private poller and resolver.
+  static std::vector<ResolveResult> ResolveManyBlocking(const std::vector<std::string>& names,
+                                                        AddrFamily af, uint32_t timeout);
+  // "servers" as for SetServers().
+  static std::vector<ResolveResult> ResolveManyBlocking(const std::vector<std::string>& names,
+                                                        AddrFamily af, uint32_t timeout,
+                                                        const Options& opt,
+                                                        const std::string& servers);
   const std::string& GetLastError() const;
+  inline const DnsCache& GetCache() const { return cache_; }
+
+  // Save the cache to a snapshot file, e.g. before exiting, and fill it from one at
+  // startup so that the first queries are served without waiting for the network.
+  // The loaded results are refreshed as usual when looked up close to expiring.
+  bool SaveCache(const std::string& path);
+  bool LoadCache(const std::string& path);
+  // Requests sent to c-ares and not completed yet.
+  inline size_t PendingCount() const { return flights_.size(); }
 
 private:
+  struct Flight;
+
+  // One caller waiting for a flight.
+  // Pooled by the resolver.
   struct Query : public DnsQuery {
-    Query(AresResolver* rsv, ResolveCb cb) : resolver(rsv), callback(cb) {}
+    Query() = default;
     ~Query() override = default;
 
-    // c-ares only supports channel-wide cancellation, so we just allow the
-    // network events to continue but don't invoke the callback on completion.
-    void Cancel() override { cancelled_ = true; }
+    // Detach this caller only, the flight goes on for the others and the cache.
+    // Nothing to do once the callback is being invoked.
+    void Cancel() override;
+
+    Flight* flight{nullptr};  // null once completed
+    Query* prev{nullptr};  // in flight's waiters
+    Query* next{nullptr};
+    ResolveCb callback;
+  };
+
+  // One ares_getaddrinfo() request, shared by the identical queries issued while it
+  // is pending.
+  struct Flight {
+    Flight(AresResolver* rsv, std::string key, const std::string& name, AddrFamily af)
+      : resolver(rsv), key(std::move(key)), name(name), af(af) {}
 
     // ares_getaddrinfo callback.
     void OnGetAddrInfoCallback(int status, int timeouts, ares_addrinfo* addrinfo);
+    // Invoke the waiters' callbacks and release the flight if owned.
+    void Complete(ResolveStatus status, AddrList&& addrs);
+
+    void Append(Query* query);
+    void Remove(Query* query);
 
     AresResolver* resolver{nullptr};
-    ResolveCb callback;
+    std::string key;  // in resolver->flights_
+    std::string name;
+    AddrFamily af{AddrFamily::kUnSpec};
+    Query* first{nullptr};  // waiters, in arrival order
+    Query* last{nullptr};
     bool completed_{false};
-    bool cancelled_{false};
     bool owned_{false};  // self-delete when the request completes if owned by itself
   };
 
+  // A ResolveMany() call.
+  struct Batch : public DnsQuery, public event::EventHandler {
+    Batch(AresResolver* rsv, size_t count, ResolveManyCb cb, ResolveEachCb each)
+      : resolver(rsv), results(count), queries(count, nullptr), pending(count),
+        callback(std::move(cb)), each(std::move(each)) {}
+    ~Batch() override = default;
+
+    // Cancel the names left, nothing is invoked anymore.
+    void Cancel() override;
+
+    void OnResolved(size_t index, ResolveStatus status, AddrList&& addrs);
+    // Invoke the callback and self-delete.
+    void Finish();
+
+    void OnReadable(int fd) override {}
+    void OnWritable(int fd) override {}
+    // Deadline.
+    void OnTimeout(int id) override;
+
+    AresResolver* resolver{nullptr};
+    std::vector<ResolveResult> results;
+    std::vector<DnsQuery*> queries;  // of the pending names
+    size_t pending{0};
+    ResolveManyCb callback;
+    ResolveEachCb each;
+    event::TimerKey timer{event::kBadTimerKey};
+    bool issuing{false};  // in ResolveMany()
+  };
+
 private:
+  Query* Join(Flight* flight, ResolveCb&& callback);
+  void ReleaseQuery(Query* query);
+  // Returns false if the flight completed synchronously.
+  bool Send(std::unique_ptr<Flight> flight);
+  void Refresh();
   bool InitAresChannel();
   bool ReinitAresChannel();
   void UpdateTimer();
@@ -106,8 +293,15 @@ private:
   bool dirty_channel_{false};  // reinit the channel if error happens
 
   event::TimerKey timer_key_{event::kBadTimerKey};
+  event::TimerKey refresh_timer_{event::kBadTimerKey};
   std::string err_;
+  DnsCache cache_;
+  // Pending requests by cache key, identical queries join them.
+  std::unordered_map<std::string, Flight*> flights_;
+  std::vector<Query*> free_queries_;
 
+  static constexpr int kRefreshTimerId = 1;
+  static constexpr size_t kMaxFreeQueries = 256;
   static const Options kDefaultOptions;
 };
 
@@ -1,6 +1,15 @@
 #include "dns.h"
 #include "gtest/gtest.h"
 #include "fmt/format.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <memory>
@@ -9,6 +18,36 @@ namespace LNETNS {
 namespace dns {
 namespace test {
 
+// Allocations made by this thread while counting.
+thread_local bool counting = false;
+std::atomic<size_t> allocations{0};
+
+}  // namespace test
+}  // namespace dns
+}  // namespace LNETNS
+
+void* operator new(size_t size) {
+  if (LNETNS::dns::test::counting) {
+    ++LNETNS::dns::test::allocations;
+  }
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+namespace LNETNS {
+namespace dns {
+namespace test {
+
 std::string Int2NameFamily(int family) {
   switch (family) {
   case AF_INET:
@@ -100,12 +139,250 @@ struct FakeProxy : public event::EventHandler {
   bool timedout_{false};
 };
 
+// Name server on 127.0.0.1 answering A queries from "records", NXDOMAIN otherwise.
+struct FakeDnsServer : public event::EventHandler {
+  struct Record {
+    std::vector<std::string> addrs;
+    uint32_t ttl{60};
+    uint8_t rcode{0};
+    bool drop{false};  // no answer
+  };
+
+  explicit FakeDnsServer(event::Poller* poller) : poller_(poller) {}
+  ~FakeDnsServer() override {
+    if (fd_ != BAD_FD) {
+      poller_->RemoveFd(fd_);
+      close(fd_);
+    }
+  }
+
+  bool Start() {
+    fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd_ < 0 || bind(fd_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+        getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    return poller_->UpsertFd(fd_, this, event::kEventIn);
+  }
+
+  std::string Address() const { return "127.0.0.1:" + std::to_string(port_); }
+
+  void OnReadable(int fd) override {
+    uint8_t req[512];
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n;
+    while ((n = recvfrom(fd_, req, sizeof(req), 0, reinterpret_cast<sockaddr*>(&from),
+                         &from_len)) > 0) {
+      // Header, then the question: labels, type, class.
+      size_t off = 12;
+      std::string name;
+      while (off < static_cast<size_t>(n) && req[off] != 0) {
+        if (!name.empty()) {
+          name += '.';
+        }
+        name.append(reinterpret_cast<char*>(req) + off + 1, req[off]);
+        off += req[off] + 1;
+      }
+      off += 5;
+      if (off > static_cast<size_t>(n)) {
+        continue;
+      }
+      ++queries[name];
+      uint16_t qtype = req[off - 4] << 8 | req[off - 3];
+
+      auto it = records.find(name);
+      if (it != records.end() && it->second.drop) {
+        continue;
+      }
+      std::string resp(reinterpret_cast<char*>(req), off);
+      resp[2] = static_cast<char>(0x84 | (req[2] & 0x01));  // response, authoritative
+      resp[3] = it == records.end() ? 3 : it->second.rcode;  // NXDOMAIN
+      resp[6] = resp[7] = resp[8] = resp[9] = resp[10] = resp[11] = 0;
+      if (it != records.end() && it->second.rcode == 0 && qtype == 1) {
+        resp[7] = static_cast<char>(it->second.addrs.size());
+        for (auto& a : it->second.addrs) {
+          uint32_t ttl = htonl(it->second.ttl);
+          in_addr in;
+          inet_pton(AF_INET, a.c_str(), &in);
+          resp.append("\xc0\x0c\x00\x01\x00\x01", 6);  // name pointer, A, IN
+          resp.append(reinterpret_cast<char*>(&ttl), 4);
+          resp.append("\x00\x04", 2);
+          resp.append(reinterpret_cast<char*>(&in), 4);
+        }
+      }
+      sendto(fd_, resp.data(), resp.size(), 0, reinterpret_cast<sockaddr*>(&from), from_len);
+      from_len = sizeof(from);
+    }
+  }
+  void OnWritable(int fd) override {}
+
+  event::Poller* poller_{nullptr};
+  int fd_{BAD_FD};
+  uint16_t port_{0};
+  std::unordered_map<std::string, Record> records;
+  std::unordered_map<std::string, int> queries;
+};
+
+struct Result {
+  bool done{false};
+  ResolveStatus status{kResolveFailure};
+  AddrList addrs;
+};
+
+ResolveCb SaveTo(Result* result) {
+  return [result](ResolveStatus status, AddrList&& addrs) {
+    result->done = true;
+    result->status = status;
+    result->addrs = std::move(addrs);
+  };
+}
+
+void WaitFor(event::Poller* poller, const Result& result) {
+  while (!result.done) {
+    poller->DoPoll();
+  }
+}
+
+AddrList MakeAddrList(const std::vector<std::string>& ips) {
+  AddrList addrs;
+  for (auto& ip : ips) {
+    address::SockAddr addr;
+    addr.sockaddr_in.sin_family = AF_INET;
+    addr.sockaddr_in.sin_port = 0;
+    inet_pton(AF_INET, ip.c_str(), &addr.sockaddr_in.sin_addr);
+    addrs.push_back(addr);
+  }
+  return addrs;
+}
+
 }  // namespace test
 }  // namespace dns
 }  // namespace LNETNS
 
 #define TESTNS LNETNS::dns::test
 
+GTEST_TEST(DnsTest, CacheTest) {
+  LNETNS::dns::DnsCache::Options opts;
+  opts.capacity = 2;
+  opts.min_ttl = 10;
+  opts.max_ttl = 100;
+  opts.negative_ttl = 3;
+  LNETNS::dns::DnsCache cache(opts);
+  using LNETNS::dns::AddrFamily;
+  auto addrs = TESTNS::MakeAddrList({"10.0.0.1", "10.0.0.2"});
+
+  // TTLs are clamped, names are case-insensitive, families apart.
+  cache.Insert("low.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 1, 0);
+  cache.Insert("high.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 1000, 0);
+  auto entry = cache.Lookup("LOW.test", AddrFamily::kInet4, 9999);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->status, LNETNS::dns::kResolveSuccess);
+  EXPECT_EQ(entry->addrs.size(), 2);
+  EXPECT_EQ(entry->expire_ms, 10000);
+  EXPECT_EQ(cache.Lookup("low.test", AddrFamily::kInet6, 0), nullptr);
+  EXPECT_EQ(cache.Lookup("low.test", AddrFamily::kInet4, 10000), nullptr);
+  EXPECT_EQ(cache.Size(), 1);
+  entry = cache.Lookup("high.test", AddrFamily::kInet4, 0);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->expire_ms, 100000);
+
+  // Failures live negative_ttl whatever the records said.
+  cache.Insert("nx.test", AddrFamily::kInet4, LNETNS::dns::kResolveFailure, {}, 60, 0);
+  entry = cache.Lookup("nx.test", AddrFamily::kInet4, 2999);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->status, LNETNS::dns::kResolveFailure);
+  EXPECT_EQ(cache.Lookup("nx.test", AddrFamily::kInet4, 3000), nullptr);
+
+  // The least recently used one goes first.
+  cache.Insert("a.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 60, 0);
+  cache.Insert("b.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 60, 0);
+  EXPECT_NE(cache.Lookup("a.test", AddrFamily::kInet4, 0), nullptr);
+  cache.Insert("c.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 60, 0);
+  EXPECT_EQ(cache.Size(), 2);
+  EXPECT_NE(cache.Lookup("a.test", AddrFamily::kInet4, 0), nullptr);
+  EXPECT_EQ(cache.Lookup("b.test", AddrFamily::kInet4, 0), nullptr);
+  EXPECT_NE(cache.Lookup("c.test", AddrFamily::kInet4, 0), nullptr);
+
+  LNETNS::dns::DnsCache::Options off;
+  off.capacity = 0;
+  LNETNS::dns::DnsCache disabled(off);
+  disabled.Insert("a.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 60, 0);
+  EXPECT_EQ(disabled.Size(), 0);
+}
+
+GTEST_TEST(DnsTest, CacheRefreshTest) {
+  LNETNS::dns::DnsCache::Options opts;
+  opts.refresh_ahead = 20;
+  opts.max_stale = 30;
+  LNETNS::dns::DnsCache cache(opts);
+  using LNETNS::dns::AddrFamily;
+  auto addrs = TESTNS::MakeAddrList({"10.0.0.1"});
+  cache.Insert("a.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 100, 0);
+  cache.Insert("nx.test", AddrFamily::kInet4, LNETNS::dns::kResolveFailure, {}, 0, 0);
+
+  // Looked up within the last 20s of 100s, once.
+  EXPECT_NE(cache.Lookup("a.test", AddrFamily::kInet4, 79999), nullptr);
+  EXPECT_EQ(cache.RefreshCount(), 0);
+  EXPECT_NE(cache.Lookup("A.test", AddrFamily::kInet4, 80000), nullptr);
+  EXPECT_NE(cache.Lookup("a.test", AddrFamily::kInet4, 90000), nullptr);
+  EXPECT_NE(cache.Lookup("nx.test", AddrFamily::kInet4, 4000), nullptr);
+  auto refreshes = cache.TakeRefreshes();
+  ASSERT_EQ(refreshes.size(), 1);
+  EXPECT_EQ(refreshes[0].first, "a.test");
+  EXPECT_EQ(refreshes[0].second, AddrFamily::kInet4);
+  EXPECT_EQ(cache.RefreshCount(), 0);
+
+  // Expired but kept for 30s for LookupStale() only, which allows another refresh.
+  EXPECT_EQ(cache.Lookup("a.test", AddrFamily::kInet4, 100000), nullptr);
+  auto entry = cache.LookupStale("a.test", AddrFamily::kInet4, 129999);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->addrs.size(), 1);
+  EXPECT_FALSE(entry->refresh);
+  EXPECT_EQ(cache.LookupStale("nx.test", AddrFamily::kInet4, 0), nullptr);
+  EXPECT_EQ(cache.Lookup("a.test", AddrFamily::kInet4, 130000), nullptr);
+  EXPECT_EQ(cache.LookupStale("a.test", AddrFamily::kInet4, 0), nullptr);
+}
+
+GTEST_TEST(DnsTest, ResolverCacheTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["www.cached.test"] = {{"10.0.0.1", "10.0.0.2"}, 60};
+  server.records["www.nocache.test"] = {{"10.0.0.3"}, 0};
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  using LNETNS::dns::AddrFamily;
+
+  for (auto name : {"www.cached.test", "www.nocache.test", "nx.test"}) {
+    TESTNS::Result first;
+    ASSERT_NE(resolver.Resolve(name, AddrFamily::kInet4, TESTNS::SaveTo(&first)), nullptr);
+    TESTNS::WaitFor(poller.get(), first);
+    EXPECT_EQ(server.queries[name], 1);
+
+    // Cached ones complete right away.
+    TESTNS::Result second;
+    auto query = resolver.Resolve(name, AddrFamily::kInet4, TESTNS::SaveTo(&second));
+    bool cached = server.records[name].ttl > 0;
+    EXPECT_EQ(query == nullptr, cached) << name;
+    TESTNS::WaitFor(poller.get(), second);
+    EXPECT_EQ(server.queries[name], cached ? 1 : 2);
+    EXPECT_EQ(second.status, first.status);
+    EXPECT_EQ(TESTNS::StringifySockAddrList(second.addrs),
+              TESTNS::StringifySockAddrList(first.addrs));
+  }
+  EXPECT_EQ(resolver.GetCache().Size(), 2);
+  EXPECT_EQ(resolver.GetCache().Hits(), 2);
+}
+
 GTEST_TEST(DnsTest, CallbackLeakTest) {
   auto poller = std::make_unique<LNETNS::event::Poller>();
 
@@ -180,4 +457,412 @@ GTEST_TEST(DnsTest, ParallelResolveTest) {
   poller.reset();  // release
 }
 
+
+GTEST_TEST(DnsTest, CoalesceTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["www.hot.test"] = {{"10.0.0.1"}, 60};
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  dns_opts.cache.capacity = 0;
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  using LNETNS::dns::AddrFamily;
+
+  // One request for all of them. The first waiter cancels the fourth one while the
+  // result is being fanned out.
+  constexpr int kQueries = 5;
+  TESTNS::Result results[kQueries];
+  LNETNS::dns::DnsQuery* queries[kQueries];
+  auto cb = TESTNS::SaveTo(&results[0]);
+  queries[0] = resolver.Resolve("www.hot.test", AddrFamily::kInet4,
+    [&](LNETNS::dns::ResolveStatus status, LNETNS::dns::AddrList&& addrs) {
+      queries[3]->Cancel();
+      cb(status, std::move(addrs));
+    });
+  ASSERT_NE(queries[0], nullptr);
+  for (int i = 1; i < kQueries; ++i) {
+    queries[i] = resolver.Resolve("www.HOT.test", AddrFamily::kInet4, TESTNS::SaveTo(&results[i]));
+    ASSERT_NE(queries[i], nullptr);
+  }
+  EXPECT_EQ(resolver.PendingCount(), 1);
+  queries[1]->Cancel();
+
+  TESTNS::Result aaaa;
+  auto other = resolver.Resolve("www.hot.test", AddrFamily::kInet6, TESTNS::SaveTo(&aaaa));
+  ASSERT_NE(other, nullptr);
+  EXPECT_EQ(resolver.PendingCount(), 2);
+  other->Cancel();
+
+  TESTNS::WaitFor(poller.get(), results[4]);
+  while (resolver.PendingCount() > 0) {
+    poller->DoPoll();
+  }
+
+  EXPECT_EQ(server.queries["www.hot.test"], 2);  // A and AAAA
+  for (int i : {0, 2, 4}) {
+    EXPECT_TRUE(results[i].done) << i;
+    EXPECT_EQ(results[i].status, LNETNS::dns::kResolveSuccess);
+    EXPECT_EQ(TESTNS::StringifySockAddrList(results[i].addrs), "family=AF_INET, addr=10.0.0.1");
+  }
+  EXPECT_FALSE(results[1].done);
+  EXPECT_FALSE(results[3].done);
+
+  // Completed flights are not joined.
+  TESTNS::Result again;
+  ASSERT_NE(resolver.Resolve("www.hot.test", AddrFamily::kInet4, TESTNS::SaveTo(&again)), nullptr);
+  TESTNS::WaitFor(poller.get(), again);
+  EXPECT_EQ(server.queries["www.hot.test"], 3);
+}
+
+
+GTEST_TEST(DnsTest, RefreshAheadTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["www.hot.test"] = {{"10.0.0.1"}, 60};
+
+  // Every hit is within the refresh window.
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  dns_opts.cache.refresh_ahead = 100;
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  using LNETNS::dns::AddrFamily;
+
+  TESTNS::Result result;
+  ASSERT_NE(resolver.Resolve("www.hot.test", AddrFamily::kInet4, TESTNS::SaveTo(&result)), nullptr);
+  TESTNS::WaitFor(poller.get(), result);
+  server.records["www.hot.test"].addrs = {"10.0.0.2"};
+
+  // Served from the cache while the refresh goes on in the background.
+  for (int i = 0; i < 3; ++i) {
+    TESTNS::Result hit;
+    EXPECT_EQ(resolver.Resolve("www.hot.test", AddrFamily::kInet4, TESTNS::SaveTo(&hit)), nullptr);
+    EXPECT_TRUE(hit.done);
+    EXPECT_EQ(TESTNS::StringifySockAddrList(hit.addrs), "family=AF_INET, addr=10.0.0.1");
+  }
+  EXPECT_EQ(server.queries["www.hot.test"], 1);
+  do {
+    poller->DoPoll();
+  } while (resolver.PendingCount() > 0 || server.queries["www.hot.test"] < 2);
+  EXPECT_EQ(server.queries["www.hot.test"], 2);
+
+  TESTNS::Result refreshed;
+  EXPECT_EQ(resolver.Resolve("www.hot.test", AddrFamily::kInet4, TESTNS::SaveTo(&refreshed)),
+            nullptr);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(refreshed.addrs), "family=AF_INET, addr=10.0.0.2");
+}
+
+GTEST_TEST(DnsTest, ServeStaleTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["www.flaky.test"] = {{"10.0.0.1"}, 1};
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  dns_opts.cache.refresh_ahead = 0;
+  dns_opts.cache.max_stale = 60;
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  using LNETNS::dns::AddrFamily;
+
+  TESTNS::Result result;
+  ASSERT_NE(resolver.Resolve("www.flaky.test", AddrFamily::kInet4, TESTNS::SaveTo(&result)),
+            nullptr);
+  TESTNS::WaitFor(poller.get(), result);
+  EXPECT_EQ(result.status, LNETNS::dns::kResolveSuccess);
+
+  // Expired, and the server fails: the last result is served.
+  usleep(1100 * 1000);
+  server.records["www.flaky.test"].rcode = 2;  // SERVFAIL
+  TESTNS::Result stale;
+  ASSERT_NE(resolver.Resolve("www.flaky.test", AddrFamily::kInet4, TESTNS::SaveTo(&stale)),
+            nullptr);
+  TESTNS::WaitFor(poller.get(), stale);
+  EXPECT_GT(server.queries["www.flaky.test"], 1);
+  EXPECT_EQ(stale.status, LNETNS::dns::kResolveSuccess);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(stale.addrs), "family=AF_INET, addr=10.0.0.1");
+
+  // NXDOMAIN is an answer, not an outage.
+  server.records.clear();
+  TESTNS::Result gone;
+  ASSERT_NE(resolver.Resolve("www.flaky.test", AddrFamily::kInet4, TESTNS::SaveTo(&gone)),
+            nullptr);
+  TESTNS::WaitFor(poller.get(), gone);
+  EXPECT_EQ(gone.status, LNETNS::dns::kResolveFailure);
+}
+
+
+GTEST_TEST(DnsTest, SnapshotTest) {
+  LNETNS::dns::DnsCache::Options opts;
+  opts.max_stale = 10;
+  LNETNS::dns::DnsCache cache(opts);
+  using LNETNS::dns::AddrFamily;
+  auto addrs = TESTNS::MakeAddrList({"10.0.0.1", "10.0.0.2"});
+  LNETNS::address::SockAddr addr6;
+  addr6.sockaddr_in6.sin6_family = AF_INET6;
+  addr6.sockaddr_in6.sin6_port = 0;
+  inet_pton(AF_INET6, "2001:db8::1", &addr6.sockaddr_in6.sin6_addr);
+  cache.Insert("a.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 60, 100000);
+  cache.Insert("b.test", AddrFamily::kUnSpec, LNETNS::dns::kResolveSuccess, {addr6}, 60, 100000);
+  cache.Insert("nx.test", AddrFamily::kInet4, LNETNS::dns::kResolveFailure, {}, 0, 100000);
+  cache.Insert("stale.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 1, 95000);
+  cache.Insert("gone.test", AddrFamily::kInet4, LNETNS::dns::kResolveSuccess, addrs, 1, 80000);
+
+  char dir[] = "/tmp/dns_snapshot_XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  auto path = std::string(dir) + "/cache";
+  ASSERT_TRUE(cache.Save(path, 100000));
+
+  // Another process, another monotonic clock: expiry is relative to the wall clock.
+  LNETNS::dns::DnsCache loaded(opts);
+  ASSERT_TRUE(loaded.Load(path, 5000));
+  EXPECT_EQ(loaded.Size(), 4);
+  auto entry = loaded.Lookup("a.test", AddrFamily::kInet4, 5000);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->status, LNETNS::dns::kResolveSuccess);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(entry->addrs),
+            "family=AF_INET, addr=10.0.0.1; family=AF_INET, addr=10.0.0.2");
+  EXPECT_NEAR(static_cast<double>(entry->expire_ms), 65000, 1000);
+  entry = loaded.Lookup("b.test", AddrFamily::kUnSpec, 5000);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(entry->addrs), "family=AF_INET6, addr=2001:db8::1");
+  entry = loaded.Lookup("nx.test", AddrFamily::kInet4, 5000);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->status, LNETNS::dns::kResolveFailure);
+  EXPECT_EQ(loaded.Lookup("stale.test", AddrFamily::kInet4, 5000), nullptr);
+  EXPECT_NE(loaded.LookupStale("stale.test", AddrFamily::kInet4, 5000), nullptr);
+  EXPECT_EQ(loaded.LookupStale("gone.test", AddrFamily::kInet4, 5000), nullptr);
+
+  // Damaged files are refused as a whole.
+  auto fd = open(path.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(pwrite(fd, "X", 1, 40), 1);
+  ASSERT_EQ(ftruncate(fd, 60), 0);
+  close(fd);
+  LNETNS::dns::DnsCache damaged(opts);
+  EXPECT_FALSE(damaged.Load(path, 5000));
+  EXPECT_EQ(errno, EPROTO);
+  EXPECT_EQ(damaged.Size(), 0);
+  EXPECT_FALSE(damaged.Load(std::string(dir) + "/missing", 5000));
+  EXPECT_EQ(errno, ENOENT);
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+GTEST_TEST(DnsTest, WarmRestartTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["www.upstream.test"] = {{"10.0.0.1"}, 60};
+  char dir[] = "/tmp/dns_snapshot_XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  auto path = std::string(dir) + "/cache";
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  using LNETNS::dns::AddrFamily;
+  {
+    LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+    ASSERT_TRUE(resolver.SetServers(server.Address()));
+    TESTNS::Result result;
+    ASSERT_NE(resolver.Resolve("www.upstream.test", AddrFamily::kInet4, TESTNS::SaveTo(&result)),
+              nullptr);
+    TESTNS::WaitFor(poller.get(), result);
+    ASSERT_TRUE(resolver.SaveCache(path));
+  }
+
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  EXPECT_FALSE(resolver.LoadCache(path + ".missing"));
+  EXPECT_FALSE(resolver.GetLastError().empty());
+  ASSERT_TRUE(resolver.LoadCache(path));
+  TESTNS::Result result;
+  EXPECT_EQ(resolver.Resolve("www.upstream.test", AddrFamily::kInet4, TESTNS::SaveTo(&result)),
+            nullptr);
+  EXPECT_TRUE(result.done);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(result.addrs), "family=AF_INET, addr=10.0.0.1");
+  EXPECT_EQ(server.queries["www.upstream.test"], 1);
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+
+GTEST_TEST(DnsTest, ResolveManyTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["a.test"] = {{"10.0.0.1"}, 60};
+  server.records["b.test"] = {{"10.0.0.2", "10.0.0.3"}, 60};
+  server.records["slow.test"] = {{"10.0.0.4"}, 60, 0, true};
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  dns_opts.timeout = 100;
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  using LNETNS::dns::AddrFamily;
+
+  // The duplicate is coalesced, the unanswered one fails at the deadline.
+  std::vector<std::string> names = {"a.test", "b.test", "nx.test", "a.test", "slow.test"};
+  std::vector<size_t> order;
+  std::vector<LNETNS::dns::ResolveResult> results;
+  bool done = false;
+  auto start = LNETNS::event::BasePoller::GetNowMs();
+  auto batch = resolver.ResolveMany(names, AddrFamily::kInet4, 100,
+    [&](std::vector<LNETNS::dns::ResolveResult>&& all) {
+      results = std::move(all);
+      done = true;
+    },
+    [&](size_t index, LNETNS::dns::ResolveStatus status, LNETNS::dns::AddrList&& addrs) {
+      order.push_back(index);
+    });
+  ASSERT_NE(batch, nullptr);
+  while (!done) {
+    poller->DoPoll();
+  }
+  EXPECT_GE(LNETNS::event::BasePoller::GetNowMs() - start, 100);
+  ASSERT_EQ(results.size(), names.size());
+  EXPECT_EQ(server.queries["a.test"], 1);
+  EXPECT_EQ(results[0].status, LNETNS::dns::kResolveSuccess);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(results[0].addrs), "family=AF_INET, addr=10.0.0.1");
+  EXPECT_EQ(TESTNS::StringifySockAddrList(results[3].addrs), "family=AF_INET, addr=10.0.0.1");
+  EXPECT_EQ(results[1].addrs.size(), 2);
+  EXPECT_EQ(results[2].status, LNETNS::dns::kResolveFailure);
+  EXPECT_EQ(results[4].status, LNETNS::dns::kResolveFailure);
+  ASSERT_EQ(order.size(), names.size());
+  EXPECT_EQ(order.back(), 4);
+  // Still asked for the cache, answered by the next retry.
+  EXPECT_EQ(resolver.PendingCount(), 1);
+  server.records["slow.test"].drop = false;
+
+  // Cached now: all synchronous.
+  done = false;
+  EXPECT_EQ(resolver.ResolveMany({"a.test", "b.test"}, AddrFamily::kInet4, 100,
+    [&](std::vector<LNETNS::dns::ResolveResult>&& all) {
+      results = std::move(all);
+      done = true;
+    }), nullptr);
+  EXPECT_TRUE(done);
+  EXPECT_EQ(results.size(), 2);
+
+  // Cancelled as a whole.
+  done = false;
+  batch = resolver.ResolveMany({"c.test", "d.test"}, AddrFamily::kInet4, 100,
+    [&](std::vector<LNETNS::dns::ResolveResult>&& all) {
+      done = true;
+    });
+  ASSERT_NE(batch, nullptr);
+  batch->Cancel();
+  while (resolver.PendingCount() > 0) {
+    poller->DoPoll();
+  }
+  EXPECT_FALSE(done);
+  EXPECT_EQ(poller->TimerCount(), 0);
+  EXPECT_EQ(server.queries["slow.test"], 2);
+  EXPECT_EQ(resolver.GetCache().Size(), 6);
+}
+
+GTEST_TEST(DnsTest, ResolveManyBlockingTest) {
+  // The server runs its own loop, the caller's thread blocks.
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["a.test"] = {{"10.0.0.1"}, 60};
+  std::atomic<bool> stop{false};
+  std::thread thread([&]() {
+    while (!stop.load()) {
+      poller->AddTimer(10, nullptr);
+      poller->DoPoll();
+    }
+  });
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  auto results = LNETNS::dns::AresResolver::ResolveManyBlocking(
+    {"a.test", "nx.test"}, LNETNS::dns::AddrFamily::kInet4, 1000, dns_opts, server.Address());
+  stop = true;
+  thread.join();
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].status, LNETNS::dns::kResolveSuccess);
+  EXPECT_EQ(TESTNS::StringifySockAddrList(results[0].addrs), "family=AF_INET, addr=10.0.0.1");
+  EXPECT_EQ(results[1].status, LNETNS::dns::kResolveFailure);
+}
+
+GTEST_TEST(DnsTest, SmallVectorTest) {
+  using Vector = LNETNS::dns::SmallVector<int, 2>;
+  Vector inline_vec{1, 2};
+  EXPECT_EQ(inline_vec.capacity(), 2);
+  Vector heap_vec = inline_vec;
+  for (int i = 0; i < 10; ++i) {
+    heap_vec.push_back(heap_vec[0]);
+  }
+  EXPECT_EQ(heap_vec.size(), 12);
+  EXPECT_GE(heap_vec.capacity(), 12);
+  EXPECT_EQ(heap_vec.back(), 1);
+
+  // Moving steals heap storage, inline elements are copied.
+  auto data = heap_vec.data();
+  Vector moved(std::move(heap_vec));
+  EXPECT_EQ(moved.data(), data);
+  EXPECT_TRUE(heap_vec.empty());
+  EXPECT_EQ(heap_vec.capacity(), 2);
+  Vector moved_inline(std::move(inline_vec));
+  EXPECT_NE(moved_inline.data(), inline_vec.data());
+  EXPECT_EQ(moved_inline.size(), 2);
+  EXPECT_EQ(moved_inline[1], 2);
+
+  moved_inline = moved;
+  EXPECT_EQ(moved_inline.size(), 12);
+  moved = Vector{7};
+  EXPECT_EQ(moved.size(), 1);
+  EXPECT_EQ(moved.front(), 7);
+}
+
+GTEST_TEST(DnsTest, NoAllocationTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::FakeDnsServer server(poller.get());
+  ASSERT_TRUE(server.Start());
+  server.records["www.hot.test"] = {{"10.0.0.1", "10.0.0.2"}, 60};
+  server.records["www.cold.test"] = {{"10.0.0.3"}, 0};
+
+  LNETNS::dns::AresResolver::Options dns_opts;
+  dns_opts.no_search = true;
+  LNETNS::dns::AresResolver resolver(poller.get(), dns_opts);
+  ASSERT_TRUE(resolver.SetServers(server.Address()));
+  using LNETNS::dns::AddrFamily;
+
+  TESTNS::Result first;
+  auto query = resolver.Resolve("www.hot.test", AddrFamily::kInet4, TESTNS::SaveTo(&first));
+  ASSERT_NE(query, nullptr);
+  TESTNS::WaitFor(poller.get(), first);
+
+  // Completed queries are reused.
+  TESTNS::Result cold;
+  EXPECT_EQ(resolver.Resolve("www.cold.test", AddrFamily::kInet4, TESTNS::SaveTo(&cold)), query);
+  TESTNS::WaitFor(poller.get(), cold);
+
+  // A cache hit allocates nothing: neither the key, the addresses nor the callback.
+  std::string name = "www.hot.test";
+  size_t count = 0;
+  LNETNS::address::SockAddr last;
+  TESTNS::allocations = 0;
+  TESTNS::counting = true;
+  for (int i = 0; i < 100; ++i) {
+    resolver.Resolve(name, AddrFamily::kInet4,
+      [&count, &last](LNETNS::dns::ResolveStatus status, LNETNS::dns::AddrList&& addrs) {
+        count += addrs.size();
+        last = addrs.back();
+      });
+  }
+  TESTNS::counting = false;
+  EXPECT_EQ(TESTNS::allocations, 0);
+  EXPECT_EQ(count, 200);
+  EXPECT_EQ(TESTNS::StringifySockAddr(last), "family=AF_INET, addr=10.0.0.2");
+}
+
 #undef TESTNS
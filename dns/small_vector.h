@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "macros.h"
+
+namespace LNETNS {
+namespace dns {
+
+// Contiguous vector of trivially copyable elements keeping up to N of them inline,
+// on the heap beyond. Building, copying or moving a small one doesn't allocate.
+template <typename T, size_t N>
+class SmallVector {
+  static_assert(std::is_trivially_copyable<T>::value, "elements are copied with memcpy");
+  static_assert(N > 0, "inline capacity must not be 0");
+
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+public:
+  SmallVector() = default;
+  SmallVector(std::initializer_list<T> init) { Assign(init.begin(), init.size()); }
+  SmallVector(const SmallVector& other) { Assign(other.data_, other.size_); }
+  SmallVector(SmallVector&& other) noexcept { Steal(&other); }
+  ~SmallVector() { Release(); }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      Assign(other.data_, other.size_);
+    }
+    return *this;
+  }
+  SmallVector& operator=(SmallVector&& other) noexcept {
+    if (this != &other) {
+      Release();
+      Steal(&other);
+    }
+    return *this;
+  }
+
+  inline iterator begin() { return data_; }
+  inline iterator end() { return data_ + size_; }
+  inline const_iterator begin() const { return data_; }
+  inline const_iterator end() const { return data_ + size_; }
+
+  inline T* data() { return data_; }
+  inline const T* data() const { return data_; }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline size_t capacity() const { return capacity_; }
+  static constexpr size_t inline_capacity() { return N; }
+
+  inline T& operator[](size_t i) { return data_[i]; }
+  inline const T& operator[](size_t i) const { return data_[i]; }
+  inline T& front() { return data_[0]; }
+  inline const T& front() const { return data_[0]; }
+  inline T& back() { return data_[size_ - 1]; }
+  inline const T& back() const { return data_[size_ - 1]; }
+
+  void push_back(const T& value) {
+    if (size_ == capacity_) {
+      T copy = value;  // may be one of ours
+      Grow(size_ + 1);
+      data_[size_++] = copy;
+    } else {
+      data_[size_++] = value;
+    }
+  }
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    push_back(T(std::forward<Args>(args)...));
+    return back();
+  }
+  inline void pop_back() { --size_; }
+  inline void clear() { size_ = 0; }
+
+  void reserve(size_t n) {
+    if (n > capacity_) {
+      Grow(n);
+    }
+  }
+
+private:
+  inline T* Inline() { return reinterpret_cast<T*>(inline_); }
+  inline bool IsInline() const { return data_ == reinterpret_cast<const T*>(inline_); }
+
+  void Assign(const T* src, size_t n) {
+    size_ = 0;
+    reserve(n);
+    if (n > 0) {
+      std::memcpy(static_cast<void*>(data_), src, n * sizeof(T));
+    }
+    size_ = n;
+  }
+
+  // Heap storage is taken over, inline elements are copied.
+  void Steal(SmallVector* other) {
+    if (other->IsInline()) {
+      data_ = Inline();
+      capacity_ = N;
+      std::memcpy(static_cast<void*>(data_), other->data_, other->size_ * sizeof(T));
+    } else {
+      data_ = other->data_;
+      capacity_ = other->capacity_;
+      other->data_ = other->Inline();
+      other->capacity_ = N;
+    }
+    size_ = other->size_;
+    other->size_ = 0;
+  }
+
+  void Release() {
+    if (!IsInline()) {
+      ::operator delete(data_);
+    }
+    data_ = Inline();
+    capacity_ = N;
+    size_ = 0;
+  }
+
+  void Grow(size_t min) {
+    size_t cap = std::max(capacity_ * 2, min);
+    auto p = static_cast<T*>(::operator new(cap * sizeof(T)));
+    std::memcpy(static_cast<void*>(p), data_, size_ * sizeof(T));
+    if (!IsInline()) {
+      ::operator delete(data_);
+    }
+    data_ = p;
+    capacity_ = cap;
+  }
+
+private:
+  alignas(T) unsigned char inline_[N * sizeof(T)];
+  T* data_{reinterpret_cast<T*>(inline_)};
+  size_t size_{0};
+  size_t capacity_{N};
+};
+
+}  // namespace dns
+}  // namespace LNETNS
@@ -1,9 +1,15 @@
 #include "base_poller.h"
 #include <algorithm>
+#include "signal_source.h"
 
 namespace LNETNS {
 namespace event {
 
+BasePoller::BasePoller() = default;
+
+// Defined here since SignalSource is incomplete in the header.
+BasePoller::~BasePoller() = default;
+
 TimerKey BasePoller::AddTimer(uint32_t timeout, EventHandler* handler, int id) {
   uint64_t expiration = GetNowMs() + timeout;
   auto& lst = timers_[expiration];
@@ -39,7 +45,100 @@ bool BasePoller::CancelTimer(TimerKey expiration, EventHandler* handler, int id)
   return true;
 }
 
+bool BasePoller::AddSignal(int signo, EventHandler* handler) {
+  if (bad_) {
+    return false;
+  }
+  if (!signal_source_) {
+    signal_source_ = std::make_unique<SignalSource>(this);
+  }
+  if (!signal_source_->Add(signo, handler)) {
+    errno_ = signal_source_->GetLastErrno();
+    return false;
+  }
+  return true;
+}
+
+bool BasePoller::RemoveSignal(int signo) {
+  if (!signal_source_) {
+    return false;
+  }
+  return signal_source_->Remove(signo);
+}
+
+bool BasePoller::HookList::Add(EventHandler* handler) {
+  if (!handler || !index_.emplace(handler, handlers_.size()).second) {
+    return false;
+  }
+  handlers_.push_back(handler);
+  return true;
+}
+
+bool BasePoller::HookList::Remove(EventHandler* handler) {
+  auto it = index_.find(handler);
+  if (it == index_.end()) {
+    return false;
+  }
+  handlers_[it->second] = nullptr;
+  index_.erase(it);
+  ++holes_;
+  return true;
+}
+
+void BasePoller::HookList::Run(void (EventHandler::*fn)()) {
+  size_t n = handlers_.size();
+  for (size_t i = 0; i < n; ++i) {
+    if (handlers_[i]) {
+      (handlers_[i]->*fn)();
+    }
+  }
+
+  if (holes_ == 0) {
+    return;
+  }
+  size_t j = 0;
+  for (size_t i = 0; i < handlers_.size(); ++i) {
+    if (handlers_[i]) {
+      index_[handlers_[i]] = j;
+      handlers_[j++] = handlers_[i];
+    }
+  }
+  handlers_.resize(j);
+  holes_ = 0;
+}
+
+bool BasePoller::AddIdle(EventHandler* handler) {
+  return idles_.Add(handler);
+}
+
+bool BasePoller::RemoveIdle(EventHandler* handler) {
+  return idles_.Remove(handler);
+}
+
+bool BasePoller::AddPrepare(EventHandler* handler) {
+  return prepares_.Add(handler);
+}
+
+bool BasePoller::RemovePrepare(EventHandler* handler) {
+  return prepares_.Remove(handler);
+}
+
+bool BasePoller::AddCheck(EventHandler* handler) {
+  if (!checks_.Add(handler)) {
+    return false;
+  }
+  new_checks_ = true;
+  return true;
+}
+
+bool BasePoller::RemoveCheck(EventHandler* handler) {
+  return checks_.Remove(handler);
+}
+
 int BasePoller::EarliestTimeout() {
+  if (new_checks_ || !idles_.Empty()) {
+    return 0;
+  }
   if (timers_.empty()) {
     return -1;
   }
@@ -74,6 +173,42 @@ int BasePoller::ProcessTimeEvents() {
   return fired_timers.size();
 }
 
+int BasePoller::BeginIteration() {
+  idles_.Run(&EventHandler::OnIdle);
+  prepares_.Run(&EventHandler::OnPrepare);
+  wait_begin_ = MonotonicClock::now();
+  if (wake_time_.time_since_epoch().count() != 0) {
+    // Since the previous wait returned: callbacks, timers, checks and the hooks above.
+    auto busy = std::chrono::duration_cast<std::chrono::microseconds>(wait_begin_ - wake_time_);
+    busy_us_.store(busy_us_.load(std::memory_order_relaxed) + busy.count(),
+                   std::memory_order_relaxed);
+  }
+  return EarliestTimeout();
+}
+
+void BasePoller::EndWait() {
+  wake_time_ = MonotonicClock::now();
+  auto wait = std::chrono::duration_cast<std::chrono::microseconds>(wake_time_ - wait_begin_);
+  wait_us_.store(wait_us_.load(std::memory_order_relaxed) + wait.count(),
+                 std::memory_order_relaxed);
+  iterations_.store(iterations_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+LoopStats BasePoller::GetLoopStats() const {
+  LoopStats stats;
+  stats.iterations = iterations_.load(std::memory_order_relaxed);
+  stats.busy_us = busy_us_.load(std::memory_order_relaxed);
+  stats.wait_us = wait_us_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+int BasePoller::EndIteration(int nevents) {
+  nevents += ProcessTimeEvents();
+  new_checks_ = false;
+  checks_.Run(&EventHandler::OnCheck);
+  return nevents;
+}
+
 uint64_t BasePoller::GetNowMs() {
   return std::chrono::duration_cast<std::chrono::milliseconds>(
     MonotonicClock::now().time_since_epoch()).count();
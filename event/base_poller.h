@@ -1,18 +1,32 @@
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <map>
 #include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "macros.h"
 #include "event_handler.h"
 
 namespace LNETNS {
 namespace event {
 
+class SignalSource;
+
 using TimerKey = uint64_t;
 static constexpr TimerKey kBadTimerKey = 0;
 static constexpr int kDefaultTimerID = 0;
 
-// Note: user should call RemoveFd() or CancelTimer() before release EventHandler.
+// Where the time of a loop goes, see BasePoller::GetLoopStats().
+struct LoopStats {
+  uint64_t iterations{0};
+  uint64_t busy_us{0};  // running hooks, callbacks and timers
+  uint64_t wait_us{0};  // blocked waiting for events
+};
+
+// Note: user should call RemoveFd(), CancelTimer() or Remove*() hooks before release
+// EventHandler.
 // If "handler" has been released but fd or timer is still there, the saved "handler"
 // pointer in poller becomes dangling, which will cause segfault when event occurs.
 //
@@ -20,8 +34,8 @@ static constexpr int kDefaultTimerID = 0;
 // nothing when timed out, just pass a null "handler" when AddTimer.
 class BasePoller {
 public:
-  BasePoller() = default;
-  virtual ~BasePoller() = default;
+  BasePoller();
+  virtual ~BasePoller();
 
   // Check if the constructor succeeded using the following functions
   // since C++ constructor has no return value.
@@ -59,15 +73,51 @@ public:
     return CancelTimer(key, handler, kDefaultTimerID);
   }
 
+  // Deliver signal "signo" to handler->OnSignal() from DoPoll(), see signal_source.h
+  // for how signals are captured. A signal has at most one handler, adding it again
+  // replaces the handler.
+  bool AddSignal(int signo, EventHandler* handler);
+  bool RemoveSignal(int signo);
+
+  // Loop phase hooks, each iteration of DoPoll() runs:
+  //   idle -> prepare -> wait -> I/O events -> timers -> check
+  // A hook is called once per iteration until removed, in the order of addition.
+  // Hooks added from a hook of the same phase run from the next iteration.
+  //
+  // - Idle: handler->OnIdle(). While any is added, DoPoll() does not wait, use it
+  //   for background work which must not delay I/O.
+  // - Prepare: handler->OnPrepare() right before waiting, e.g. to publish
+  //   statistics or arm timers. Timers and checks it adds are honored by the wait.
+  // - Check: handler->OnCheck() after the callbacks of the iteration, the place to
+  //   batch work they produced, e.g. flushing output once. A check added outside
+  //   DoPoll() makes the next DoPoll() not wait.
+  //
+  // Add*() returns false if "handler" is already added to that phase.
+  bool AddIdle(EventHandler* handler);
+  bool RemoveIdle(EventHandler* handler);
+  bool AddPrepare(EventHandler* handler);
+  bool RemovePrepare(EventHandler* handler);
+  bool AddCheck(EventHandler* handler);
+  bool RemoveCheck(EventHandler* handler);
+
+  // Waits for events and dispatches them. A wait interrupted by a signal (EINTR)
+  // is resumed with the remaining timeout, it is not reported as an error.
   virtual int DoPoll() = 0;
 
   virtual uint32_t FdCount() const = 0;
   inline uint32_t TimerCount() const { return timers_.size(); }
+  inline uint32_t IdleCount() const { return idles_.Size(); }
+  inline uint32_t PrepareCount() const { return prepares_.Size(); }
+  inline uint32_t CheckCount() const { return checks_.Size(); }
   virtual int MaxFd() const { return BAD_FD; }
 
   inline int GetLastErrno() const { return errno_; }
   static uint64_t GetNowMs();
 
+  // Cumulative, may be read from any thread. The utilisation over a period is the
+  // share of busy time in the difference of two samples.
+  LoopStats GetLoopStats() const;
+
 protected:
   struct TimerData {
     EventHandler* handler{nullptr};
@@ -78,18 +128,55 @@ protected:
   using TimerStore = std::map<uint64_t, std::list<TimerData> >;
   using MonotonicClock = std::chrono::steady_clock;
 
+  // Handlers of a loop phase. Removed ones leave a null slot until the next Run()
+  // compacts the vector, so that hooks may be removed from any callback.
+  class HookList {
+  public:
+    bool Add(EventHandler* handler);
+    bool Remove(EventHandler* handler);
+    // Calls "fn" of the handlers added before the call.
+    void Run(void (EventHandler::*fn)());
+    inline uint32_t Size() const { return index_.size(); }
+    inline bool Empty() const { return index_.empty(); }
+
+  private:
+    std::vector<EventHandler*> handlers_;
+    std::unordered_map<EventHandler*, size_t> index_;
+    size_t holes_{0};
+  };
+
   // Returns number of milliseconds to wait to match the next timer or
-  // 0 meaning "there is timed out timer" or -1 meaning "no timer".
+  // 0 meaning "there is timed out timer, idle hook or new check" or -1 meaning "no timer".
   int EarliestTimeout();
 
   // Executes any timers that are due.
   // Returns the number of fired timers.
   int ProcessTimeEvents();
+  // Called by DoPoll() before waiting, runs the idle and prepare hooks.
+  // Returns the wait timeout, see EarliestTimeout().
+  int BeginIteration();
+  // Called by DoPoll() after dispatching "nevents" I/O events, returns the total
+  // number of events including fired timers.
+  int EndIteration(int nevents);
+  // Called by DoPoll() as soon as the wait returned, for the loop statistics.
+  void EndWait();
 
 protected:
   bool bad_{false};
   int errno_{0};
   TimerStore timers_;
+  HookList idles_;
+  HookList prepares_;
+  HookList checks_;
+  bool new_checks_{false};  // added since the last check phase
+  std::unique_ptr<SignalSource> signal_source_;
+
+  // Single writer (the loop thread), atomic for the readers of GetLoopStats().
+  std::atomic<uint64_t> iterations_{0};
+  std::atomic<uint64_t> busy_us_{0};
+  std::atomic<uint64_t> wait_us_{0};
+  MonotonicClock::time_point wait_begin_;
+  MonotonicClock::time_point wake_time_;  // end of the last wait, epoch before any
 };
 
 }  // namespace event
@@ -0,0 +1,155 @@
+#include "channel.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#include "base_poller.h"
+
+namespace LNETNS {
+namespace event {
+
+#ifndef HAVE_EVENTFD
+namespace {
+
+bool SetNonBlockCloExec(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return false;
+  }
+  flags = fcntl(fd, F_GETFD, 0);
+  return flags != -1 && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) != -1;
+}
+
+}  // unnamed namespace
+#endif
+
+ChannelBase::ChannelBase(BasePoller* poller) : poller_(poller) {
+  // Created up front and kept until destruction: producers may wake the consumer
+  // while it opens or closes the channel.
+#ifdef HAVE_EVENTFD
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd_ == -1) {
+    errno_ = errno;
+    fd_ = BAD_FD;
+    return;
+  }
+  write_fd_ = fd_;
+#else
+  int fds[2];
+  if (pipe(fds) != 0) {
+    errno_ = errno;
+    return;
+  }
+  if (!SetNonBlockCloExec(fds[0]) || !SetNonBlockCloExec(fds[1])) {
+    errno_ = errno;
+    close(fds[0]);
+    close(fds[1]);
+    return;
+  }
+  fd_ = fds[0];
+  write_fd_ = fds[1];
+#endif
+}
+
+ChannelBase::~ChannelBase() {
+  Close();
+  if (fd_ == BAD_FD) {
+    return;
+  }
+  if (write_fd_ != fd_) {
+    close(write_fd_);
+  }
+  close(fd_);
+}
+
+bool ChannelBase::Open() {
+  if (opened_) {
+    return true;
+  }
+  if (fd_ == BAD_FD) {
+    return false;  // errno_ was set by the constructor
+  }
+
+  if (!poller_->UpsertFd(fd_, this, kEventIn)) {
+    errno_ = poller_->GetLastErrno();
+    return false;
+  }
+  opened_ = true;
+  // Messages sent before the channel was opened.
+  if (!QueueEmpty()) {
+    idle_.store(false);
+    Wake();
+  }
+  return true;
+}
+
+void ChannelBase::Close() {
+  if (!opened_) {
+    return;
+  }
+  poller_->RemoveFd(fd_);
+  opened_ = false;
+}
+
+void ChannelBase::Notify() {
+  // Pairs with the fence in OnReadable(): either the consumer sees the message
+  // when checking the queue after going idle, or the producer sees it idle.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (idle_.load(std::memory_order_relaxed) && idle_.exchange(false)) {
+    notify_count_.fetch_add(1, std::memory_order_relaxed);
+    Wake();
+  }
+}
+
+void ChannelBase::Wake() {
+  if (write_fd_ == BAD_FD) {
+    return;  // could not be created, Open() fails
+  }
+#ifdef HAVE_EVENTFD
+  uint64_t one = 1;
+  auto rc = write(write_fd_, &one, sizeof(one));
+#else
+  char byte = 0;
+  // A full pipe already holds a wake-up.
+  auto rc = write(write_fd_, &byte, 1);
+#endif
+  (void)rc;
+}
+
+void ChannelBase::OnReadable(int fd) {
+#ifdef HAVE_EVENTFD
+  uint64_t count;
+  auto rc = read(fd_, &count, sizeof(count));
+  (void)rc;
+#else
+  char buf[64];
+  while (read(fd_, buf, sizeof(buf)) > 0) {
+  }
+#endif
+
+  size_t delivered = 0;
+  for (;;) {
+    // The callback may close the channel.
+    delivered += Drain(max_per_wakeup_ - delivered);
+    if (!opened_) {
+      return;
+    }
+    if (delivered >= max_per_wakeup_) {
+      // Let other events run, still busy: producers don't need to notify.
+      Wake();
+      return;
+    }
+
+    idle_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (QueueEmpty() || !idle_.exchange(false)) {
+      // Empty, or a producer saw us idle and wrote a wake-up already.
+      return;
+    }
+  }
+}
+
+}  // namespace event
+}  // namespace LNETNS
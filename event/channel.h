@@ -0,0 +1,305 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "macros.h"
+#include "event_handler.h"
+
+namespace LNETNS {
+namespace event {
+
+class BasePoller;
+
+constexpr size_t kCacheLineSize = 64;
+
+// Bounded lock-free queue for one producer thread and one consumer thread.
+// Capacity is rounded up to a power of 2. Slots are default constructed up front
+// and moved in and out, so T must be default constructible and movable.
+//
+// Each side keeps a cached copy of the other side's index and only reloads it
+// when the queue looks full (or empty), so the shared cache lines are touched
+// about once per batch rather than once per message.
+template <typename T>
+class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity)
+    : mask_(RoundUp(capacity) - 1), slots_(new T[mask_ + 1]) {
+  }
+  SpscQueue() = delete;
+
+  // Producer side. Returns false if full, "value" is left untouched then.
+  bool TryPush(T&& value) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  bool TryPop(T* value) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;
+      }
+    }
+    *value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pop up to "max" values at once, returns their number.
+  size_t PopBatch(T* values, size_t max) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ - head < max) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    size_t n = std::min(max, cached_tail_ - head);
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = std::move(slots_[(head + i) & mask_]);
+    }
+    if (n > 0) {
+      head_.store(head + n, std::memory_order_release);
+    }
+    return n;
+  }
+
+  // Approximate when called from another thread than the consumer.
+  inline bool Empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+  inline size_t Capacity() const { return mask_ + 1; }
+
+private:
+  static size_t RoundUp(size_t n) {
+    size_t cap = 2;
+    while (cap < n) {
+      cap <<= 1;
+    }
+    return cap;
+  }
+
+private:
+  const size_t mask_;
+  std::unique_ptr<T[]> slots_;
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t cached_tail_{0};  // consumer's view of tail_
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t cached_head_{0};  // producer's view of head_
+
+  NON_COPYABLE_NOR_MOVABLE(SpscQueue)
+};
+
+// Bounded lock-free queue for many producer threads and one consumer thread
+// (Vyukov's bounded queue). Each slot carries a sequence number telling whether it
+// is free for the producer of a given position or ready for the consumer, so that
+// producers only contend on the tail with a CAS.
+template <typename T>
+class MpscQueue {
+public:
+  explicit MpscQueue(size_t capacity)
+    : mask_(RoundUp(capacity) - 1), slots_(new Slot[mask_ + 1]) {
+    for (size_t i = 0; i <= mask_; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  MpscQueue() = delete;
+
+  // Any thread. Returns false if full, "value" is left untouched then.
+  bool TryPush(T&& value) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& slot = slots_[pos & mask_];
+      auto seq = slot.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot.value = std::move(value);
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // the consumer hasn't freed the slot yet
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer side.
+  bool TryPop(T* value) {
+    auto& slot = slots_[head_ & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != head_ + 1) {
+      return false;  // empty, or the producer of this slot is still writing
+    }
+    *value = std::move(slot.value);
+    slot.seq.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  size_t PopBatch(T* values, size_t max) {
+    size_t n = 0;
+    while (n < max && TryPop(values + n)) {
+      ++n;
+    }
+    return n;
+  }
+
+  // Approximate, a value being pushed may not be visible yet.
+  inline bool Empty() const {
+    return slots_[head_ & mask_].seq.load(std::memory_order_acquire) != head_ + 1;
+  }
+  inline size_t Capacity() const { return mask_ + 1; }
+
+private:
+  struct alignas(kCacheLineSize) Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  static size_t RoundUp(size_t n) {
+    size_t cap = 2;
+    while (cap < n) {
+      cap <<= 1;
+    }
+    return cap;
+  }
+
+private:
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(kCacheLineSize) size_t head_{0};  // consumer only
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+
+  NON_COPYABLE_NOR_MOVABLE(MpscQueue)
+};
+
+// Wake-up side of a channel: an eventfd (a pipe where not available) registered
+// on the consumer's poller. It is created with the channel and closed with it,
+// Open() and Close() only register it.
+//
+// Producers only write to it when the consumer is idle. The consumer marks itself
+// idle after draining the queue, then checks the queue again, so a message pushed
+// meanwhile is either seen by that check or triggers a wake-up: a busy consumer
+// costs producers no system call.
+class ChannelBase : public EventHandler {
+public:
+  explicit ChannelBase(BasePoller* poller);
+  ChannelBase() = delete;
+  ~ChannelBase() override;
+
+  // Register to the poller, from the consumer thread. Fails as well if the
+  // wake-up fd could not be created.
+  bool Open();
+  void Close();
+
+  inline int Fd() const { return fd_; }
+  inline int GetLastErrno() const { return errno_; }
+  // Wake-ups written by producers.
+  inline uint64_t NotifyCount() const { return notify_count_.load(std::memory_order_relaxed); }
+
+protected:
+  // Producer side, after a push.
+  void Notify();
+  // Deliver up to "max" messages, returns their number.
+  virtual size_t Drain(size_t max) = 0;
+  virtual bool QueueEmpty() const = 0;
+
+  // Messages delivered per OnReadable() before yielding to other events.
+  size_t max_per_wakeup_{1024};
+
+private:
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override {}
+  void Wake();
+
+private:
+  BasePoller* poller_{nullptr};
+  int fd_{BAD_FD};
+  int write_fd_{BAD_FD};  // same as fd_ with eventfd
+  bool opened_{false};
+  int errno_{0};
+  std::atomic<bool> idle_{true};
+  std::atomic<uint64_t> notify_count_{0};
+
+  NON_COPYABLE_NOR_MOVABLE(ChannelBase)
+};
+
+// Typed channel from other threads to the loop of "poller". Messages are pushed
+// with Send() from producer threads and delivered on the loop thread to the batch
+// callback, up to max_batch at a time:
+//
+//   event::MpscChannel<Task> ch(poller, 4096, [](Task* tasks, size_t n) { ... });
+//   ch.Open();                      // loop thread
+//   ch.Send(std::move(task));       // any thread
+//
+// Queue is SpscQueue<T> (one producer thread) or MpscQueue<T>. The channel must
+// outlive the producers' use of it.
+template <typename T, typename Queue = SpscQueue<T>>
+class Channel final : public ChannelBase {
+public:
+  using BatchCb = std::function<void(T* messages, size_t count)>;
+
+  Channel(BasePoller* poller, size_t capacity, BatchCb callback, size_t max_batch = 64)
+    : ChannelBase(poller), queue_(capacity), callback_(std::move(callback)),
+      batch_(max_batch > 0 ? max_batch : 1) {
+  }
+  Channel() = delete;
+
+  // Producer side. Returns false if the channel is full.
+  bool Send(T&& value) {
+    if (!queue_.TryPush(std::move(value))) {
+      return false;
+    }
+    Notify();
+    return true;
+  }
+  bool Send(const T& value) {
+    T copy(value);
+    return Send(std::move(copy));
+  }
+
+  inline size_t Capacity() const { return queue_.Capacity(); }
+
+private:
+  size_t Drain(size_t max) override {
+    size_t total = 0;
+    while (total < max) {
+      auto n = queue_.PopBatch(batch_.data(), std::min(batch_.size(), max - total));
+      if (n == 0) {
+        break;
+      }
+      total += n;
+      callback_(batch_.data(), n);
+    }
+    return total;
+  }
+
+  bool QueueEmpty() const override { return queue_.Empty(); }
+
+private:
+  Queue queue_;
+  BatchCb callback_;
+  std::vector<T> batch_;
+};
+
+template <typename T>
+using SpscChannel = Channel<T, SpscQueue<T>>;
+template <typename T>
+using MpscChannel = Channel<T, MpscQueue<T>>;
+
+}  // namespace event
+}  // namespace LNETNS
@@ -0,0 +1,178 @@
+#include "channel.h"
+#include "poller.h"
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+GTEST_TEST(ChannelTest, QueueTest) {
+  LNETNS::event::SpscQueue<int> spsc(3);
+  EXPECT_EQ(spsc.Capacity(), 4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(spsc.TryPush(int(i)));
+  }
+  EXPECT_FALSE(spsc.TryPush(4));
+  int values[8];
+  EXPECT_EQ(spsc.PopBatch(values, 3), 3);
+  EXPECT_EQ(values[2], 2);
+  EXPECT_TRUE(spsc.TryPush(4));
+  EXPECT_EQ(spsc.PopBatch(values, 8), 2);
+  EXPECT_EQ(values[0], 3);
+  EXPECT_EQ(values[1], 4);
+  EXPECT_TRUE(spsc.Empty());
+
+  LNETNS::event::MpscQueue<int> mpsc(4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(mpsc.TryPush(int(i)));
+  }
+  EXPECT_FALSE(mpsc.TryPush(4));
+  int value;
+  ASSERT_TRUE(mpsc.TryPop(&value));
+  EXPECT_EQ(value, 0);
+  EXPECT_TRUE(mpsc.TryPush(4));
+  EXPECT_EQ(mpsc.PopBatch(values, 8), 4);
+  EXPECT_EQ(values[3], 4);
+  EXPECT_TRUE(mpsc.Empty());
+}
+
+GTEST_TEST(ChannelTest, BatchTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  std::vector<size_t> batches;
+  std::vector<int> received;
+  LNETNS::event::SpscChannel<int> ch(poller.get(), 64, [&](int* values, size_t n) {
+    batches.push_back(n);
+    received.insert(received.end(), values, values + n);
+  }, 8);
+
+  // Sent before Open(), delivered once opened.
+  EXPECT_TRUE(ch.Send(0));
+  ASSERT_TRUE(ch.Open());
+  for (int i = 1; i < 20; ++i) {
+    EXPECT_TRUE(ch.Send(i));
+  }
+  // Only the first message wakes up the consumer.
+  EXPECT_EQ(ch.NotifyCount(), 1);
+
+  poller->DoPoll();
+  ASSERT_EQ(received.size(), 20);
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(received[i], i);
+  }
+  EXPECT_EQ(batches, (std::vector<size_t>{8, 8, 4}));
+
+  // Idle again: the next message notifies.
+  EXPECT_TRUE(ch.Send(20));
+  EXPECT_EQ(ch.NotifyCount(), 2);
+  poller->DoPoll();
+  EXPECT_EQ(received.size(), 21);
+}
+
+GTEST_TEST(ChannelTest, SpscThreadTest) {
+  constexpr int kCount = 200000;
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int next = 0;
+  bool ordered = true;
+  LNETNS::event::SpscChannel<int> ch(poller.get(), 1024, [&](int* values, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      ordered = ordered && values[i] == next;
+      ++next;
+    }
+  });
+  ASSERT_TRUE(ch.Open());
+
+  std::thread producer([&ch] {
+    for (int i = 0; i < kCount;) {
+      if (ch.Send(int(i))) {
+        ++i;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  while (next < kCount) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  producer.join();
+  EXPECT_TRUE(ordered);
+  // Wake-ups are suppressed while the consumer is busy.
+  EXPECT_LT(ch.NotifyCount(), kCount);
+}
+
+GTEST_TEST(ChannelTest, MpscThreadTest) {
+  constexpr int kProducers = 4;
+  constexpr int kCount = 50000;
+  struct Message {
+    int producer{0};
+    int seq{0};
+  };
+
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  std::vector<int> next(kProducers, 0);
+  int total = 0;
+  bool ordered = true;
+  LNETNS::event::MpscChannel<Message> ch(poller.get(), 256, [&](Message* msgs, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      ordered = ordered && msgs[i].seq == next[msgs[i].producer];
+      ++next[msgs[i].producer];
+    }
+    total += n;
+  });
+  ASSERT_TRUE(ch.Open());
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&ch, p] {
+      for (int i = 0; i < kCount;) {
+        if (ch.Send(Message{p, i})) {
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  while (total < kProducers * kCount) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  // Each producer's messages arrive in order.
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(total, kProducers * kCount);
+}
+
+GTEST_TEST(ChannelTest, ReopenTest) {
+  constexpr int kCount = 100000;
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int total = 0;
+  LNETNS::event::SpscChannel<int> ch(poller.get(), 256, [&](int* values, size_t n) {
+    total += n;
+  });
+  // The wake-up fd exists before Open() and stays across Close().
+  int fd = ch.Fd();
+  ASSERT_NE(fd, BAD_FD);
+
+  // The producer keeps notifying while the loop closes and reopens the channel.
+  std::thread producer([&ch] {
+    for (int i = 0; i < kCount;) {
+      if (ch.Send(int(i))) {
+        ++i;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  while (total < kCount) {
+    ASSERT_TRUE(ch.Open());
+    poller->AddTimer(1, nullptr);
+    poller->DoPoll();
+    ch.Close();
+  }
+  producer.join();
+  EXPECT_EQ(ch.Fd(), fd);
+  EXPECT_EQ(poller->FdCount(), 0);
+}
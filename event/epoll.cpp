@@ -67,6 +67,16 @@ bool Epoll::UpsertFd(int fd, EventHandler* handler, int mask) {
 
   int rc = 0;
   auto iter = fd_table_.find(fd);
+  if (mask & kEventExclusive) {
+#ifdef HAVE_EPOLLEXCLUSIVE
+    if (iter != fd_table_.end()) {
+      // EPOLLEXCLUSIVE is only allowed with EPOLL_CTL_ADD.
+      errno_ = EINVAL;
+      return false;
+    }
+    ev.events |= EPOLLEXCLUSIVE;
+#endif  // HAVE_EPOLLEXCLUSIVE
+  }
   if (iter == fd_table_.end()) {
     rc = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
   } else {
@@ -271,11 +281,12 @@ int Epoll::DoPoll() {
   }
   errno_ = 0;
 
-  // 0 means there is due timer, -1 means there is no timer.
-  int timeout = EarliestTimeout();
-  // Avoid waiting infinitely.
+  // 0 means there is due timer (or idle hook), -1 means there is no timer.
+  int timeout = BeginIteration();
+  // Avoid waiting infinitely, the iteration still ends for the checks.
   if (fd_table_.empty() && timeout < 0) {
-    return 0;
+    EndWait();
+    return EndIteration(0);
   }
 
   // If FdTable is empty and timeout > 0, DoPoll() act as sleep.
@@ -284,8 +295,14 @@ int Epoll::DoPoll() {
   // timeout > 0 - waiting for timeout milliseconds;
   // timeout = -1 - infinitely wait (must have fd to listen).
   int n = epoll_wait(epoll_fd_, fired_events_.get(), option_->max_events, timeout);
+  while (n == -1 && errno == EINTR) {
+    // Interrupted by a signal handler, wait again. The timeout is recomputed from
+    // the timer store, so it shrinks by the time already spent waiting.
+    timeout = EarliestTimeout();
+    n = epoll_wait(epoll_fd_, fired_events_.get(), option_->max_events, timeout);
+  }
+  EndWait();
   if (n == -1) {
-    // TODO: try again if errno is EINTR (a signal was caught)?
     errno_ = errno;  // https://en.cppreference.com/w/cpp/error/errno
     return -1;
   }
@@ -321,7 +338,7 @@ int Epoll::DoPoll() {
     }
   }
 
-  return nevents + ProcessTimeEvents();
+  return EndIteration(nevents);
 }
 
 }  // namespace event
@@ -8,6 +8,11 @@ enum EventType {
   kEventIn = 1,
   kEventOut = 2,
   kEventError = 4,  // output only
+  // Input only, honored by epoll (EPOLLEXCLUSIVE) when registering a new fd and
+  // ignored by other pollers. Wakes up only one of the pollers waiting on the same
+  // fd. Note that the events of such an fd cannot be modified afterwards, remove
+  // and add it again instead.
+  kEventExclusive = 8,
 };
 
 class EventHandler {
@@ -26,6 +31,16 @@ public:
   // If the timer is just used to set timeout for poller, don't override it.
   virtual void OnTimeout(int id) {}
 
+  // Called when a signal registered by BasePoller::AddSignal() is delivered.
+  // Unlike a signal handler, it runs in the polling thread and may do anything.
+  virtual void OnSignal(int signo) {}
+
+  // Loop phase hooks, called once per poller iteration while added by
+  // BasePoller::AddIdle(), AddPrepare() or AddCheck().
+  virtual void OnIdle() {}
+  virtual void OnPrepare() {}
+  virtual void OnCheck() {}
+
 protected:
   // Set constructor protected to make the base class not instantiable.
   EventHandler() = default;
@@ -1,5 +1,6 @@
 #include "poll.h"  // POSIX poll() system call is in header <poll.h>
 #if defined POLLER_USE_POLL
+#include <errno.h>
 #include <algorithm>
 
 namespace LNETNS {
@@ -195,11 +196,12 @@ bool Poll::ResetEventOut(int fd) {
 int Poll::DoPoll() {
   errno_ = 0;
 
-  // 0 means there is due timer, -1 means there is no timer.
-  int timeout = EarliestTimeout();
-  // Avoid waiting infinitely.
+  // 0 means there is due timer (or idle hook), -1 means there is no timer.
+  int timeout = BeginIteration();
+  // Avoid waiting infinitely, the iteration still ends for the checks.
   if (fd_table_.empty() && timeout < 0) {
-    return 0;
+    EndWait();
+    return EndIteration(0);
   }
 
   ShrinkPollSet();
@@ -219,14 +221,19 @@ int Poll::DoPoll() {
   // timeout > 0 - waiting for timeout milliseconds;
   // timeout = -1 - infinitely wait (must have fd to listen).
   int rc = poll(poll_set_.data(), poll_set_.size(), timeout);
+  while (rc == -1 && errno == EINTR) {
+    // Interrupted by a signal handler, wait again with the remaining time.
+    timeout = EarliestTimeout();
+    rc = poll(poll_set_.data(), poll_set_.size(), timeout);
+  }
+  EndWait();
   if (rc == -1) {
-    // TODO: try again if errno is EINTR (a signal was caught)?
     errno_ = errno;  // https://en.cppreference.com/w/cpp/error/errno
     return -1;
   }
   if (rc == 0) {
     // No event occurs.
-    return ProcessTimeEvents();
+    return EndIteration(0);
   }
 
   int nevents = 0;
@@ -276,7 +283,7 @@ int Poll::DoPoll() {
     }
   }
 
-  return nevents + ProcessTimeEvents();
+  return EndIteration(nevents);
 }
 
 void Poll::ShrinkPollSet() {
@@ -0,0 +1,170 @@
+#include "poller.h"
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace LNETNS {
+namespace event {
+namespace test {
+
+// Records the order of the callbacks.
+struct Recorder : public EventHandler {
+  explicit Recorder(Poller* poller) : poller(poller) {}
+
+  void OnReadable(int fd) override {
+    char c;
+    while (read(fd, &c, 1) == 1) {}
+    log += "r";
+  }
+  void OnWritable(int fd) override {}
+  void OnTimeout(int id) override {
+    log += "t";
+  }
+  void OnIdle() override {
+    log += "i";
+  }
+  void OnPrepare() override {
+    log += "p";
+    if (timer_from_prepare) {
+      poller->AddTimer(0, this);
+      timer_from_prepare = false;
+    }
+  }
+  void OnCheck() override {
+    log += "c";
+    if (--checks == 0) {
+      poller->RemoveCheck(this);
+    }
+  }
+
+  Poller* poller;
+  std::string log;
+  int checks{0};
+  bool timer_from_prepare{false};
+};
+
+}  // namespace test
+}  // namespace event
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::event::test
+
+GTEST_TEST(PollerTest, CheckTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  TESTNS::Recorder recorder(poller.get());
+  ASSERT_TRUE(poller->UpsertFd(fds[0], &recorder, LNETNS::event::kEventIn));
+
+  recorder.checks = 2;
+  ASSERT_TRUE(poller->AddCheck(&recorder));
+  EXPECT_FALSE(poller->AddCheck(&recorder));
+  EXPECT_EQ(poller->CheckCount(), 1);
+
+  // Not waiting for the pipe, the new check is due.
+  EXPECT_EQ(poller->DoPoll(), 0);
+  EXPECT_EQ(recorder.log, "c");
+
+  // After I/O events and timers.
+  ASSERT_EQ(write(fds[1], "x", 1), 1);
+  poller->AddTimer(0, &recorder);
+  usleep(1000);
+  EXPECT_EQ(poller->DoPoll(), 2);
+  EXPECT_EQ(recorder.log, "crtc");
+  EXPECT_EQ(poller->CheckCount(), 0);
+
+  // Removed, not called anymore.
+  ASSERT_EQ(write(fds[1], "x", 1), 1);
+  poller->DoPoll();
+  EXPECT_EQ(recorder.log, "crtcr");
+  EXPECT_FALSE(poller->RemoveCheck(&recorder));
+
+  poller->RemoveFd(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+GTEST_TEST(PollerTest, PhaseOrderTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  TESTNS::Recorder recorder(poller.get());
+  ASSERT_TRUE(poller->UpsertFd(fds[0], &recorder, LNETNS::event::kEventIn));
+
+  ASSERT_TRUE(poller->AddIdle(&recorder));
+  ASSERT_TRUE(poller->AddPrepare(&recorder));
+  recorder.checks = -1;  // never removed
+  ASSERT_TRUE(poller->AddCheck(&recorder));
+  EXPECT_FALSE(poller->AddPrepare(&recorder));
+  EXPECT_EQ(poller->IdleCount(), 1);
+  EXPECT_EQ(poller->PrepareCount(), 1);
+
+  // The idle hook keeps the wait from blocking on the silent pipe.
+  ASSERT_EQ(write(fds[1], "x", 1), 1);
+  recorder.timer_from_prepare = true;
+  EXPECT_EQ(poller->DoPoll(), 2);
+  EXPECT_EQ(recorder.log, "iprtc");
+  EXPECT_EQ(poller->DoPoll(), 0);
+  EXPECT_EQ(recorder.log, "iprtcipc");
+
+  // Without idle hooks, the prepare hook runs before a blocking wait.
+  ASSERT_TRUE(poller->RemoveIdle(&recorder));
+  recorder.log.clear();
+  poller->AddTimer(20, &recorder);
+  auto start = LNETNS::event::Poller::GetNowMs();
+  EXPECT_EQ(poller->DoPoll(), 1);
+  EXPECT_GE(LNETNS::event::Poller::GetNowMs() - start, 10);
+  EXPECT_EQ(recorder.log, "ptc");
+
+  poller->RemovePrepare(&recorder);
+  poller->RemoveCheck(&recorder);
+  EXPECT_EQ(poller->PrepareCount() + poller->CheckCount() + poller->IdleCount(), 0);
+  poller->RemoveFd(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+GTEST_TEST(PollerTest, NothingToWaitTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::Recorder recorder(poller.get());
+  ASSERT_TRUE(poller->AddPrepare(&recorder));
+  recorder.checks = -1;
+  ASSERT_TRUE(poller->AddCheck(&recorder));
+  poller->DoPoll();
+  recorder.log.clear();
+
+  // No fd nor timer: returns at once, the iteration still ends with the checks.
+  auto before = poller->GetLoopStats();
+  EXPECT_EQ(poller->DoPoll(), 0);
+  EXPECT_EQ(recorder.log, "pc");
+  EXPECT_EQ(poller->GetLoopStats().iterations - before.iterations, 1);
+
+  poller->RemovePrepare(&recorder);
+  poller->RemoveCheck(&recorder);
+}
+
+GTEST_TEST(PollerTest, LoopStatsTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+
+  // Waits 20ms, then burns 10ms before the next wait.
+  poller->AddTimer(20, nullptr);
+  auto before = poller->GetLoopStats();
+  poller->DoPoll();
+  auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+  while (std::chrono::steady_clock::now() < end) {
+  }
+  poller->AddTimer(0, nullptr);
+  poller->DoPoll();
+
+  auto stats = poller->GetLoopStats();
+  EXPECT_EQ(stats.iterations - before.iterations, 2);
+  EXPECT_GE(stats.wait_us - before.wait_us, 15000);
+  // The busy time since the first wait includes the time spent between the calls.
+  EXPECT_GE(stats.busy_us - before.busy_us, 9000);
+}
+
+#undef TESTNS
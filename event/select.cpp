@@ -1,5 +1,6 @@
 #include "select.h"  // POSIX select() system call is in header <sys/select.h>
 #if defined POLLER_USE_SELECT
+#include <errno.h>
 
 namespace LNETNS {
 namespace event {
@@ -151,11 +152,12 @@ bool Select::ResetEventOut(int fd) {
 int Select::DoPoll() {
   errno_ = 0;
 
-  // 0 means there is due timer, -1 means there is no timer.
-  int timeout = EarliestTimeout();
-  // Avoid waiting infinitely.
+  // 0 means there is due timer (or idle hook), -1 means there is no timer.
+  int timeout = BeginIteration();
+  // Avoid waiting infinitely, the iteration still ends for the checks.
   if (fd_table_.empty() && timeout < 0) {
-    return 0;
+    EndWait();
+    return EndIteration(0);
   }
 
   // std::map is sorted by key, so the last key in fd_entries_ is maximum.
@@ -164,12 +166,8 @@ int Select::DoPoll() {
     max_fd = fd_table_.rbegin()->first;
   }
 
-  // Note that select() will change the input fd_set, so we should pass a copy.
-  FdSet tmp_fd_set = fd_set_;
+  FdSet tmp_fd_set;
   timeval tv;
-  if (timeout >= 0) {
-    tv = {static_cast<long>(timeout / 1000), static_cast<long>(timeout % 1000 * 1000)};
-  }
   // Empty sets (nfds zero):
   // select act as sleep when run with empty sets, see:
   // https://man7.org/linux/man-pages/man2/select.2.html
@@ -181,16 +179,30 @@ int Select::DoPoll() {
   // timeout = 0 - return immediately;
   // timeout > 0 - waiting for timeout milliseconds;
   // timeout = -1 - infinitely wait (must have fd to listen).
-  int rc = select(max_fd + 1, &tmp_fd_set.read, &tmp_fd_set.write,
-                  &tmp_fd_set.error, timeout >= 0 ? &tv : NULL);
+  int rc = -1;
+  for (;;) {
+    // Note that select() will change the input fd_set (and the timeval on Linux),
+    // so we should pass a copy.
+    tmp_fd_set = fd_set_;
+    if (timeout >= 0) {
+      tv = {static_cast<long>(timeout / 1000), static_cast<long>(timeout % 1000 * 1000)};
+    }
+    rc = select(max_fd + 1, &tmp_fd_set.read, &tmp_fd_set.write,
+                &tmp_fd_set.error, timeout >= 0 ? &tv : NULL);
+    if (rc != -1 || errno != EINTR) {
+      break;
+    }
+    // Interrupted by a signal handler, wait again with the remaining time.
+    timeout = EarliestTimeout();
+  }
+  EndWait();
   if (rc == -1) {
-    // TODO: try again if errno is EINTR (a signal was caught)?
     errno_ = errno;  // https://en.cppreference.com/w/cpp/error/errno
     return -1;
   }
   if (rc == 0) {
     // No event occurs.
-    return ProcessTimeEvents();
+    return EndIteration(0);
   }
 
   int nevents = 0;
@@ -214,7 +226,7 @@ int Select::DoPoll() {
   }
   TriggerFdEvents(fired_fds);
 
-  return nevents + ProcessTimeEvents();
+  return EndIteration(nevents);
 }
 
 void Select::TriggerFdEvents(std::vector<std::pair<int, int> >& fired_fds) {
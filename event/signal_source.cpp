@@ -0,0 +1,242 @@
+#include "signal_source.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include "base_poller.h"
+#if defined POLLER_USE_EPOLL
+#include <sys/signalfd.h>
+#else
+#include <atomic>
+#endif
+
+namespace LNETNS {
+namespace event {
+
+#if !defined POLLER_USE_EPOLL
+namespace {
+
+// Write end of the self-pipe for each signal, stored as "fd + 1" so that the
+// zero-initialized array means "no pipe".
+std::atomic<int> signal_pipes[NSIG];
+
+void WriteSignalToPipe(int signo) {
+  int saved_errno = errno;
+  int fd = signal_pipes[signo].load(std::memory_order_relaxed) - 1;
+  if (fd >= 0) {
+    unsigned char byte = static_cast<unsigned char>(signo);
+    // Nothing can be done if the pipe is full, the signal is coalesced.
+    auto rc = write(fd, &byte, 1);
+    (void)rc;
+  }
+  errno = saved_errno;
+}
+
+bool SetNonBlockCloExec(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return false;
+  }
+  flags = fcntl(fd, F_GETFD, 0);
+  return flags != -1 && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) != -1;
+}
+
+}  // unnamed namespace
+#endif  // !POLLER_USE_EPOLL
+
+SignalSource::SignalSource(BasePoller* poller) : poller_(poller) {
+  sigemptyset(&mask_);
+}
+
+SignalSource::~SignalSource() {
+  // Note: the poller is being destroyed, don't call it.
+#if defined POLLER_USE_EPOLL
+  if (!handlers_.empty()) {
+    pthread_sigmask(SIG_UNBLOCK, &mask_, nullptr);
+  }
+#else
+  for (auto& entry : old_actions_) {
+    sigaction(entry.first, &entry.second, nullptr);
+    signal_pipes[entry.first].store(0);
+  }
+  if (write_fd_ != BAD_FD) {
+    close(write_fd_);
+  }
+#endif
+  if (fd_ != BAD_FD) {
+    close(fd_);
+  }
+}
+
+bool SignalSource::Open() {
+  if (fd_ != BAD_FD) {
+    return true;
+  }
+
+#if defined POLLER_USE_EPOLL
+  fd_ = signalfd(-1, &mask_, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd_ == -1) {
+    errno_ = errno;
+    fd_ = BAD_FD;
+    return false;
+  }
+#else
+  int fds[2];
+  if (pipe(fds) != 0) {
+    errno_ = errno;
+    return false;
+  }
+  if (!SetNonBlockCloExec(fds[0]) || !SetNonBlockCloExec(fds[1])) {
+    errno_ = errno;
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  fd_ = fds[0];
+  write_fd_ = fds[1];
+#endif
+
+  if (!poller_->UpsertFd(fd_, this, kEventIn)) {
+    errno_ = poller_->GetLastErrno();
+    close(fd_);
+    fd_ = BAD_FD;
+#if !defined POLLER_USE_EPOLL
+    close(write_fd_);
+    write_fd_ = BAD_FD;
+#endif
+    return false;
+  }
+  return true;
+}
+
+bool SignalSource::Add(int signo, EventHandler* handler) {
+  if (signo <= 0 || signo >= NSIG || !handler) {
+    return false;
+  }
+
+  auto iter = handlers_.find(signo);
+  if (iter != handlers_.end()) {
+    iter->second = handler;
+    return true;
+  }
+  if (!Open()) {
+    return false;
+  }
+
+#if defined POLLER_USE_EPOLL
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, signo);
+  // Block the signal so that it is only reported through the signalfd.
+  errno_ = pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+  if (errno_ != 0) {
+    return false;
+  }
+  sigaddset(&mask_, signo);
+  if (signalfd(fd_, &mask_, 0) == -1) {
+    errno_ = errno;
+    sigdelset(&mask_, signo);
+    pthread_sigmask(SIG_UNBLOCK, &sigs, nullptr);
+    return false;
+  }
+#else
+  signal_pipes[signo].store(write_fd_ + 1);
+  struct sigaction action = {};
+  action.sa_handler = WriteSignalToPipe;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  struct sigaction old_action;
+  if (sigaction(signo, &action, &old_action) != 0) {
+    errno_ = errno;
+    signal_pipes[signo].store(0);
+    return false;
+  }
+  old_actions_.emplace(signo, old_action);
+  sigaddset(&mask_, signo);
+#endif
+
+  handlers_.emplace(signo, handler);
+  return true;
+}
+
+bool SignalSource::Remove(int signo) {
+  auto iter = handlers_.find(signo);
+  if (iter == handlers_.end()) {
+    return false;
+  }
+  handlers_.erase(iter);
+  sigdelset(&mask_, signo);
+
+#if defined POLLER_USE_EPOLL
+  signalfd(fd_, &mask_, 0);
+  // Note: a pending instance of the signal is delivered with its default
+  // disposition once unblocked.
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, signo);
+  pthread_sigmask(SIG_UNBLOCK, &sigs, nullptr);
+#else
+  auto action_iter = old_actions_.find(signo);
+  if (action_iter != old_actions_.end()) {
+    sigaction(signo, &action_iter->second, nullptr);
+    old_actions_.erase(action_iter);
+  }
+  signal_pipes[signo].store(0);
+#endif
+
+  if (handlers_.empty()) {
+    poller_->RemoveFd(fd_);
+    close(fd_);
+    fd_ = BAD_FD;
+#if !defined POLLER_USE_EPOLL
+    close(write_fd_);
+    write_fd_ = BAD_FD;
+#endif
+  }
+  return true;
+}
+
+void SignalSource::OnReadable(int fd) {
+#if defined POLLER_USE_EPOLL
+  signalfd_siginfo infos[16];
+  for (;;) {
+    auto n = read(fd, infos, sizeof(infos));
+    if (n <= 0) {
+      break;
+    }
+    auto count = n / sizeof(signalfd_siginfo);
+    for (decltype(count) i = 0; i < count; ++i) {
+      Dispatch(static_cast<int>(infos[i].ssi_signo));
+    }
+    // Note: the handler may have removed the last signal and closed the fd.
+    if (fd_ != fd) {
+      break;
+    }
+  }
+#else
+  unsigned char signos[64];
+  for (;;) {
+    auto n = read(fd, signos, sizeof(signos));
+    if (n <= 0) {
+      break;
+    }
+    for (decltype(n) i = 0; i < n; ++i) {
+      Dispatch(signos[i]);
+    }
+    if (fd_ != fd) {
+      break;
+    }
+  }
+#endif
+}
+
+void SignalSource::Dispatch(int signo) {
+  // Look up every time, a handler may add or remove signals.
+  auto iter = handlers_.find(signo);
+  if (iter != handlers_.end()) {
+    iter->second->OnSignal(signo);
+  }
+}
+
+}  // namespace event
+}  // namespace LNETNS
@@ -0,0 +1,56 @@
+#pragma once
+#include <signal.h>
+#include <map>
+#include "macros.h"
+#include "event_handler.h"
+
+namespace LNETNS {
+namespace event {
+
+class BasePoller;
+
+// Turns signal delivery into a readable fd so that signals are dispatched by the
+// poller like any other event (EventHandler::OnSignal).
+//
+// With epoll, a signalfd is used and registered signals are blocked with
+// pthread_sigmask(). Since a signal directed to the process can be delivered to
+// any thread that does not block it, register signals before creating other
+// threads (they inherit the mask) or block them in those threads too.
+//
+// Other pollers use the self-pipe trick: a sigaction() handler writes the signal
+// number into a non-blocking pipe. The previous disposition is restored when the
+// signal is removed.
+class SignalSource final : public EventHandler {
+public:
+  explicit SignalSource(BasePoller* poller);
+  SignalSource() = delete;
+  ~SignalSource() override;
+
+  bool Add(int signo, EventHandler* handler);
+  bool Remove(int signo);
+
+  inline bool Empty() const { return handlers_.empty(); }
+  inline int GetLastErrno() const { return errno_; }
+
+private:
+  bool Open();
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override {}
+  void Dispatch(int signo);
+
+private:
+  BasePoller* poller_{nullptr};
+  int fd_{BAD_FD};
+#if !defined POLLER_USE_EPOLL
+  int write_fd_{BAD_FD};
+  std::map<int, struct sigaction> old_actions_;
+#endif
+  sigset_t mask_;
+  std::map<int, EventHandler*> handlers_;
+  int errno_{0};
+
+  NON_COPYABLE_NOR_MOVABLE(SignalSource)
+};
+
+}  // namespace event
+}  // namespace LNETNS
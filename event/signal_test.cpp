@@ -0,0 +1,90 @@
+#include "poller.h"
+#include "gtest/gtest.h"
+
+#include <signal.h>
+#include <sys/time.h>
+#include <memory>
+
+namespace LNETNS {
+namespace event {
+namespace test {
+
+struct SignalCounter : public EventHandler {
+  void OnReadable(int fd) override {}
+  void OnWritable(int fd) override {}
+  void OnSignal(int signo) override {
+    ++counts_[signo];
+  }
+
+  std::map<int, int> counts_;
+};
+
+struct Sleeper : public EventHandler {
+  void OnReadable(int fd) override {}
+  void OnWritable(int fd) override {}
+  void OnTimeout(int id) override {
+    fired_ = true;
+  }
+
+  bool fired_{false};
+};
+
+void OnAlarm(int signo) {}
+
+}  // namespace test
+}  // namespace event
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::event::test
+
+GTEST_TEST(SignalTest, DispatchTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  auto counter = std::make_unique<TESTNS::SignalCounter>();
+
+  ASSERT_TRUE(poller->AddSignal(SIGUSR1, counter.get()));
+  ASSERT_TRUE(poller->AddSignal(SIGUSR2, counter.get()));
+  EXPECT_EQ(poller->FdCount(), 1);
+
+  raise(SIGUSR1);
+  raise(SIGUSR2);
+  poller->AddTimer(10, nullptr);  // don't wait forever if something goes wrong
+  while (counter->counts_.size() < 2 && poller->TimerCount()) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(counter->counts_[SIGUSR1], 1);
+  EXPECT_EQ(counter->counts_[SIGUSR2], 1);
+
+  EXPECT_TRUE(poller->RemoveSignal(SIGUSR1));
+  EXPECT_FALSE(poller->RemoveSignal(SIGUSR1));
+  EXPECT_TRUE(poller->RemoveSignal(SIGUSR2));
+  EXPECT_EQ(poller->FdCount(), 0);
+
+  poller.reset();  // release
+  counter.reset();  // release
+}
+
+GTEST_TEST(SignalTest, InterruptedWaitTest) {
+  struct sigaction action = {};
+  action.sa_handler = TESTNS::OnAlarm;
+  sigemptyset(&action.sa_mask);
+  struct sigaction old_action;
+  ASSERT_EQ(sigaction(SIGALRM, &action, &old_action), 0);
+
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  auto sleeper = std::make_unique<TESTNS::Sleeper>();
+  poller->AddTimer(50, sleeper.get());
+
+  // The signal arrives while DoPoll() is waiting.
+  itimerval it = {};
+  it.it_value.tv_usec = 10 * 1000;
+  setitimer(ITIMER_REAL, &it, nullptr);
+
+  auto start = LNETNS::event::BasePoller::GetNowMs();
+  EXPECT_EQ(poller->DoPoll(), 1);
+  EXPECT_TRUE(sleeper->fired_);
+  EXPECT_GE(LNETNS::event::BasePoller::GetNowMs() - start, 50);
+
+  sigaction(SIGALRM, &old_action, nullptr);
+}
+
+#undef TESTNS
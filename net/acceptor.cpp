@@ -0,0 +1,256 @@
+#include "acceptor.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+#include "socket.h"
+#include "rate_limiter.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+int OpenReservedFd() {
+#ifdef HAVE_O_CLOEXEC
+  return open("/dev/null", O_RDONLY | O_CLOEXEC);
+#else
+  int fd = open("/dev/null", O_RDONLY);
+  if (fd != -1) {
+    SetCloseOnExec(fd);
+  }
+  return fd;
+#endif
+}
+
+}  // unnamed namespace
+
+const Acceptor::Options Acceptor::kDefaultOptions;
+
+Acceptor::Acceptor(event::Poller* poller, NewConnectionCb callback)
+  : Acceptor(poller, std::move(callback), kDefaultOptions) {
+}
+
+Acceptor::Acceptor(event::Poller* poller, NewConnectionCb callback, const Options& opt)
+  : poller_(poller), callback_(std::move(callback)) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+}
+
+Acceptor::~Acceptor() {
+  Close();
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+bool Acceptor::Listen(const address::SockAddr& addr) {
+  if (listen_fd_ != BAD_FD) {
+    return false;
+  }
+
+  int family = addr.sockaddr.sa_family;
+  int fd = CreateSocket(family, options_->socket_type);
+  if (fd == BAD_FD) {
+    errno_ = errno;
+    return false;
+  }
+  // Neither applies to unix domain sockets.
+  bool inet = family != AF_UNIX;
+  if ((inet && options_->reuse_addr && !SetReuseAddr(fd, true)) ||
+      (inet && options_->reuse_port && !SetReusePort(fd, true)) ||
+      bind(fd, &addr.sockaddr, address::GetSockLen(addr)) != 0 ||
+      listen(fd, options_->backlog) != 0) {
+    errno_ = errno;
+    close(fd);
+    return false;
+  }
+
+  listen_fd_ = fd;
+  owns_fd_ = true;
+  exclusive_ = false;
+  if (!Register()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool Acceptor::Attach(int listen_fd, bool exclusive) {
+  if (listen_fd_ != BAD_FD || listen_fd < 0) {
+    return false;
+  }
+
+  listen_fd_ = listen_fd;
+  owns_fd_ = false;
+  exclusive_ = exclusive;
+  if (!Register()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool Acceptor::Register() {
+  int mask = event::kEventIn;
+  if (exclusive_) {
+    mask |= event::kEventExclusive;
+  }
+  if (!poller_->UpsertFd(listen_fd_, this, mask)) {
+    errno_ = poller_->GetLastErrno();
+    return false;
+  }
+  if (reserved_fd_ == BAD_FD) {
+    reserved_fd_ = OpenReservedFd();
+  }
+  return true;
+}
+
+void Acceptor::Close() {
+  if (pause_timer_ != event::kBadTimerKey) {
+    poller_->CancelTimer(pause_timer_, this);
+    pause_timer_ = event::kBadTimerKey;
+  }
+  if (listen_fd_ != BAD_FD) {
+    poller_->RemoveFd(listen_fd_);
+    if (owns_fd_) {
+      close(listen_fd_);
+    }
+    listen_fd_ = BAD_FD;
+  }
+  if (reserved_fd_ != BAD_FD) {
+    close(reserved_fd_);
+    reserved_fd_ = BAD_FD;
+  }
+}
+
+void Acceptor::SetAcceptLimit(TokenBucket* bucket) {
+  accept_bucket_ = bucket;
+}
+
+int Acceptor::AcceptOne(address::SockAddr* peer) {
+  socklen_t len = sizeof(address::SockAddr);
+  // The peer of a unix socket is usually unnamed, only the family is filled in:
+  // make it read as such rather than as a stale abstract name.
+  peer->sockaddr_un.sun_path[0] = '\0';
+  peer->sockaddr_un.sun_path[1] = '\0';
+#if defined HAVE_ACCEPT4 && defined HAVE_SOCK_CLOEXEC
+  return accept4(listen_fd_, &peer->sockaddr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int fd = accept(listen_fd_, &peer->sockaddr, &len);
+  if (fd == -1) {
+    return -1;
+  }
+  if (!SetNonBlock(fd) || !SetCloseOnExec(fd)) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+bool Acceptor::ShedOne() {
+  if (reserved_fd_ == BAD_FD) {
+    reserved_fd_ = OpenReservedFd();
+    if (reserved_fd_ == BAD_FD) {
+      return false;
+    }
+  }
+
+  close(reserved_fd_);
+  int fd = accept(listen_fd_, nullptr, nullptr);
+  if (fd != -1) {
+    close(fd);
+    ++shed_count_;
+  }
+  reserved_fd_ = OpenReservedFd();
+  return fd != -1 && reserved_fd_ != BAD_FD;
+}
+
+void Acceptor::Pause() {
+  LOG_WARN("Pause accepting for {}ms: {}", options_->pause_on_exhausted, strerror(errno_));
+  PauseFor(options_->pause_on_exhausted);
+}
+
+void Acceptor::PauseFor(uint32_t ms) {
+  if (exclusive_) {
+    // Events of an exclusive fd cannot be modified.
+    poller_->RemoveFd(listen_fd_);
+  } else {
+    poller_->ResetEventIn(listen_fd_);
+  }
+  pause_timer_ = poller_->AddTimer(ms, this);
+}
+
+void Acceptor::OnReadable(int fd) {
+  for (int i = 0; i < options_->max_accepts && listen_fd_ != BAD_FD; ++i) {
+    // Tokens may have been taken by another acceptor sharing the bucket.
+    uint32_t wait = accept_bucket_ ? accept_bucket_->WaitTime() : 0;
+    if (wait > 0) {
+      PauseFor(wait);
+      return;
+    }
+
+    address::SockAddr peer;
+    int conn_fd = AcceptOne(&peer);
+    if (conn_fd != -1) {
+      if (accept_bucket_) {
+        accept_bucket_->Consume(1);
+      }
+      // Note: the callback may close the acceptor.
+      callback_(conn_fd, peer);
+      continue;
+    }
+
+    switch (errno) {
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+      // Backlog drained.
+      return;
+    case EINTR:
+    case ECONNABORTED:
+    case EPROTO:
+      // The pending connection is gone, try the next one.
+      continue;
+    case EMFILE:
+    case ENFILE:
+      errno_ = errno;
+      if (!ShedOne()) {
+        Pause();
+        return;
+      }
+      continue;
+    default:
+      // ENOBUFS, ENOMEM, EPERM (firewall), ...
+      errno_ = errno;
+      LOG_ERROR("accept failed: {}", strerror(errno_));
+      Pause();
+      return;
+    }
+  }
+}
+
+void Acceptor::OnTimeout(int id) {
+  pause_timer_ = event::kBadTimerKey;
+  if (listen_fd_ == BAD_FD) {
+    return;
+  }
+  if (exclusive_) {
+    Register();
+  } else {
+    poller_->SetEventIn(listen_fd_);
+  }
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,98 @@
+#pragma once
+#include <functional>
+#include "event/poller.h"
+#include "address/sockaddr.h"
+
+namespace LNETNS {
+namespace net {
+
+class TokenBucket;
+
+// The accepted fd is non-blocking and close-on-exec, its ownership is transferred
+// to the callback.
+using NewConnectionCb = std::function<void(int fd, const address::SockAddr& peer)>;
+
+// Listens on a stream (or SOCK_SEQPACKET) socket and accepts connections when it
+// becomes readable. Unix domain addresses are supported, the socket file of a
+// path is not removed by the acceptor.
+//
+// Each readiness event drains the backlog with at most "max_accepts" accept calls,
+// so that a connection storm cannot starve the other fds of the poller.
+//
+// To survive fd exhaustion (EMFILE/ENFILE) an fd is reserved up front. When the
+// limit is hit, the reserved fd is released to accept and immediately close the
+// pending connection (the peer gets a FIN instead of hanging in the backlog), and
+// then reserved again. If that is not possible either, accepting is paused for
+// "pause_on_exhausted" milliseconds rather than busy looping on a readable socket.
+//
+// With SetAcceptLimit(), each accepted connection takes a token from a bucket and
+// accepting is paused the same way until tokens return. Connections wait in the
+// backlog meanwhile.
+class Acceptor : public event::EventHandler {
+public:
+  struct Options {
+    int backlog{SOMAXCONN};
+    int max_accepts{64};  // max accept calls per readiness event
+    bool reuse_addr{true};  // SO_REUSEADDR
+    // SO_REUSEPORT, several acceptors (typically one per event loop) can listen on
+    // the same address and the kernel balances incoming connections among them.
+    bool reuse_port{false};
+    uint32_t pause_on_exhausted{100};  // milliseconds
+    int socket_type{SOCK_STREAM};  // or SOCK_SEQPACKET
+  };
+
+public:
+  Acceptor(event::Poller* poller, NewConnectionCb callback);
+  Acceptor(event::Poller* poller, NewConnectionCb callback, const Options& opt);
+  Acceptor() = delete;
+  ~Acceptor() override;
+
+  bool Listen(const address::SockAddr& addr);
+  // Accept on a listen socket shared with other acceptors (each one registered on
+  // its own poller), the fd is not owned by the acceptor. With "exclusive", the fd
+  // is registered with kEventExclusive so that a connection wakes up only one of
+  // the pollers instead of all of them.
+  bool Attach(int listen_fd, bool exclusive);
+  void Close();
+  // Take a token from "bucket" per accepted connection, pass null to remove. The
+  // bucket may be shared with the acceptors of the same poller.
+  void SetAcceptLimit(TokenBucket* bucket);
+
+  inline int Fd() const { return listen_fd_; }
+  inline bool Paused() const { return pause_timer_ != event::kBadTimerKey; }
+  inline int GetLastErrno() const { return errno_; }
+  // Connections closed because of fd exhaustion.
+  inline uint64_t ShedCount() const { return shed_count_; }
+
+private:
+  bool Register();
+  int AcceptOne(address::SockAddr* peer);
+  bool ShedOne();
+  // Log errno_ and pause for "pause_on_exhausted".
+  void Pause();
+  void PauseFor(uint32_t ms);
+
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override {}
+  void OnTimeout(int id) override;
+
+private:
+  event::Poller* poller_{nullptr};
+  NewConnectionCb callback_;
+  const Options* options_{nullptr};
+
+  int listen_fd_{BAD_FD};
+  bool owns_fd_{false};
+  bool exclusive_{false};
+  int reserved_fd_{BAD_FD};
+  event::TimerKey pause_timer_{event::kBadTimerKey};
+  TokenBucket* accept_bucket_{nullptr};
+  uint64_t shed_count_{0};
+  int errno_{0};
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(Acceptor)
+};
+
+}  // namespace net
+}  // namespace LNETNS
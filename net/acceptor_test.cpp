@@ -0,0 +1,220 @@
+#include "acceptor.h"
+#include "listener_group.h"
+#include "rate_limiter.h"
+#include "socket.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+int Connect(const address::SockAddr& addr) {
+  int fd = socket(addr.sockaddr.sa_family, SOCK_STREAM, 0);
+  if (connect(fd, &addr.sockaddr, address::GetSockLen(addr)) != 0) {
+    close(fd);
+    return BAD_FD;
+  }
+  return fd;
+}
+
+struct Server {
+  void OnNewConnection(int fd, const address::SockAddr& peer) {
+    fds_.push_back(fd);
+  }
+  ~Server() {
+    for (auto fd : fds_) {
+      close(fd);
+    }
+  }
+
+  std::vector<int> fds_;
+};
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(AcceptorTest, BatchAcceptTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::Server server;
+  LNETNS::net::Acceptor::Options opts;
+  opts.max_accepts = 2;
+  auto acceptor = std::make_unique<LNETNS::net::Acceptor>(
+    poller.get(), [&server](int fd, const LNETNS::address::SockAddr& peer) {
+      server.OnNewConnection(fd, peer);
+    }, opts);
+
+  ASSERT_TRUE(acceptor->Listen(*LNETNS::address::ParseIPPort("127.0.0.1:0")));
+  LNETNS::address::SockAddr addr;
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(acceptor->Fd(), &addr));
+
+  std::vector<int> clients;
+  for (int i = 0; i < 5; ++i) {
+    clients.push_back(TESTNS::Connect(addr));
+    ASSERT_NE(clients.back(), BAD_FD);
+  }
+
+  // At most 2 connections are accepted per readiness event.
+  poller->DoPoll();
+  EXPECT_EQ(server.fds_.size(), 2);
+  poller->DoPoll();
+  poller->DoPoll();
+  EXPECT_EQ(server.fds_.size(), 5);
+
+  for (auto fd : clients) {
+    close(fd);
+  }
+  acceptor.reset();  // release
+  EXPECT_EQ(poller->FdCount(), 0);
+}
+
+GTEST_TEST(AcceptorTest, ShedLoadTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::Server server;
+  auto acceptor = std::make_unique<LNETNS::net::Acceptor>(
+    poller.get(), [&server](int fd, const LNETNS::address::SockAddr& peer) {
+      server.OnNewConnection(fd, peer);
+    });
+
+  ASSERT_TRUE(acceptor->Listen(*LNETNS::address::ParseIPPort("127.0.0.1:0")));
+  LNETNS::address::SockAddr addr;
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(acceptor->Fd(), &addr));
+
+  std::vector<int> clients;
+  for (int i = 0; i < 3; ++i) {
+    clients.push_back(TESTNS::Connect(addr));
+    ASSERT_NE(clients.back(), BAD_FD);
+  }
+
+  // Allow just one more fd to be opened.
+  rlimit old_limit;
+  getrlimit(RLIMIT_NOFILE, &old_limit);
+  int probe = dup(0);
+  close(probe);
+  rlimit limit = old_limit;
+  limit.rlim_cur = probe + 1;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  poller->DoPoll();
+  setrlimit(RLIMIT_NOFILE, &old_limit);
+
+  EXPECT_EQ(server.fds_.size(), 1);
+  EXPECT_EQ(acceptor->ShedCount(), 2);
+  EXPECT_EQ(acceptor->GetLastErrno(), EMFILE);
+
+  // Shed connections are closed by the server.
+  char c;
+  int closed = 0;
+  for (auto fd : clients) {
+    closed += recv(fd, &c, 1, MSG_DONTWAIT) == 0;
+    close(fd);
+  }
+  EXPECT_EQ(closed, 2);
+}
+
+GTEST_TEST(AcceptorTest, AcceptLimitTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::Server server;
+  LNETNS::net::Acceptor acceptor(
+    poller.get(), [&server](int fd, const LNETNS::address::SockAddr& peer) {
+      server.OnNewConnection(fd, peer);
+    });
+  LNETNS::net::TokenBucket bucket(100, 2);  // a connection per 10ms
+  acceptor.SetAcceptLimit(&bucket);
+  ASSERT_TRUE(acceptor.Listen(*LNETNS::address::ParseIPPort("127.0.0.1:0")));
+  LNETNS::address::SockAddr addr;
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(acceptor.Fd(), &addr));
+
+  std::vector<int> clients;
+  for (int i = 0; i < 5; ++i) {
+    clients.push_back(TESTNS::Connect(addr));
+    ASSERT_NE(clients.back(), BAD_FD);
+  }
+
+  // The burst, then the others wait in the backlog.
+  auto start = LNETNS::event::Poller::GetNowMs();
+  poller->DoPoll();
+  EXPECT_EQ(server.fds_.size(), 2);
+  EXPECT_TRUE(acceptor.Paused());
+  while (server.fds_.size() < clients.size()) {
+    poller->DoPoll();
+  }
+  EXPECT_GE(LNETNS::event::Poller::GetNowMs() - start, 20);
+
+  for (auto fd : clients) {
+    close(fd);
+  }
+  acceptor.Close();
+  EXPECT_EQ(poller->FdCount(), 0);
+  EXPECT_EQ(poller->TimerCount(), 0);
+}
+
+void RunGroupTest(LNETNS::net::ListenerGroup::Mode mode) {
+  std::vector<std::unique_ptr<LNETNS::event::Poller> > pollers;
+  std::vector<LNETNS::event::Poller*> loops;
+  for (int i = 0; i < 2; ++i) {
+    pollers.emplace_back(std::make_unique<LNETNS::event::Poller>());
+    loops.push_back(pollers.back().get());
+  }
+
+  TESTNS::Server server;
+  std::vector<int> accepted(loops.size());
+  LNETNS::net::ListenerGroup::Options opts;
+  opts.mode = mode;
+  opts.steer_by_cpu = mode == LNETNS::net::ListenerGroup::Mode::kReusePort;
+  LNETNS::net::ListenerGroup group(loops, [&](size_t loop, int fd, const LNETNS::address::SockAddr& peer) {
+    ++accepted[loop];
+    server.OnNewConnection(fd, peer);
+  }, opts);
+
+  // Port 0: all the loops listen on the port picked for the first one.
+  ASSERT_TRUE(group.Listen(*LNETNS::address::ParseIPPort("127.0.0.1:0")));
+  ASSERT_EQ(group.Size(), 2);
+  auto addr = group.LocalAddr();
+  EXPECT_NE(addr.sockaddr_in.sin_port, 0);
+  for (size_t i = 0; i < group.Size(); ++i) {
+    LNETNS::address::SockAddr local;
+    ASSERT_TRUE(LNETNS::net::GetLocalAddr(group.GetAcceptor(i)->Fd(), &local));
+    EXPECT_EQ(local.sockaddr_in.sin_port, addr.sockaddr_in.sin_port);
+  }
+
+  std::vector<int> clients;
+  for (int i = 0; i < 16; ++i) {
+    clients.push_back(TESTNS::Connect(addr));
+    ASSERT_NE(clients.back(), BAD_FD);
+  }
+  for (int round = 0; round < 10 && server.fds_.size() < clients.size(); ++round) {
+    for (auto loop : loops) {
+      loop->AddTimer(1, nullptr);
+      loop->DoPoll();
+    }
+  }
+  EXPECT_EQ(server.fds_.size(), clients.size());
+  EXPECT_EQ(accepted[0] + accepted[1], clients.size());
+
+  for (auto fd : clients) {
+    close(fd);
+  }
+  group.Close();
+  for (auto loop : loops) {
+    EXPECT_EQ(loop->FdCount(), 0);
+  }
+}
+
+GTEST_TEST(AcceptorTest, ReusePortGroupTest) {
+  RunGroupTest(LNETNS::net::ListenerGroup::Mode::kReusePort);
+}
+
+GTEST_TEST(AcceptorTest, ExclusiveGroupTest) {
+  RunGroupTest(LNETNS::net::ListenerGroup::Mode::kExclusive);
+}
+
+#undef TESTNS
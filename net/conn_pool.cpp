@@ -0,0 +1,422 @@
+#include "conn_pool.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include "socket.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+const ConnPool::Options ConnPool::kDefaultOptions;
+
+ConnPool::ConnPool(event::Poller* poller)
+  : ConnPool(poller, kDefaultOptions) {
+}
+
+ConnPool::ConnPool(event::Poller* poller, const Options& opt)
+  : poller_(poller) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+}
+
+ConnPool::~ConnPool() {
+  for (auto& item : pending_) {
+    if (item.second.timer != event::kBadTimerKey) {
+      poller_->CancelTimer(item.second.timer, this, item.first);
+    }
+    poller_->RemoveFd(item.first);
+    close(item.first);
+  }
+  pending_.clear();
+  for (auto& item : hosts_) {
+    auto& host = item.second;
+    while (!host.idle.empty()) {
+      int fd = host.idle.back().fd;
+      RemoveIdle(&host, host.idle.size() - 1);
+      close(fd);
+    }
+  }
+  if (idle_timer_ != event::kBadTimerKey) {
+    poller_->CancelTimer(idle_timer_, this, kIdleTimerId);
+    idle_timer_ = event::kBadTimerKey;
+  }
+  if (sweep_timer_ != event::kBadTimerKey) {
+    poller_->CancelTimer(sweep_timer_, this, kSweepTimerId);
+    sweep_timer_ = event::kBadTimerKey;
+  }
+  if (sweep_scheduled_) {
+    poller_->RemoveCheck(this);
+    sweep_scheduled_ = false;
+  }
+
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+int ConnPool::Acquire(const address::SockAddr& addr, AcquireCb callback) {
+  auto host = GetHost(addr);
+  auto now = event::Poller::GetNowMs();
+
+  // Last in, first out.
+  while (!host->idle.empty()) {
+    auto conn = host->idle.back();
+    RemoveIdle(host, host->idle.size() - 1);
+    if (conn.since + options_->idle_timeout <= now) {
+      close(conn.fd);
+      continue;
+    }
+    ++host->active;
+    return conn.fd;
+  }
+
+  if (IsDown(host, now)) {
+    errno_ = EHOSTDOWN;
+    Unused(host);
+    return BAD_FD;
+  }
+  if (Count(host) >= options_->max_per_host) {
+    host->waiters.push_back(std::move(callback));
+    errno_ = EINPROGRESS;
+    return BAD_FD;
+  }
+  if (host->down_until) {
+    // The backoff elapsed, this connect probes the host.
+    host->probing = true;
+  }
+  if (!StartConnect(host, std::move(callback))) {
+    Unused(host);
+    return BAD_FD;
+  }
+  errno_ = EINPROGRESS;
+  return BAD_FD;
+}
+
+void ConnPool::Release(const address::SockAddr& addr, int fd) {
+  auto host = GetHost(addr);
+  --host->active;
+  Recycle(host, fd);
+}
+
+void ConnPool::Discard(const address::SockAddr& addr, int fd) {
+  auto host = GetHost(addr);
+  --host->active;
+  close(fd);
+  ServeWaiters(host);
+  Unused(host);
+}
+
+void ConnPool::Clear() {
+  for (auto& item : hosts_) {
+    auto& host = item.second;
+    while (!host.idle.empty()) {
+      int fd = host.idle.back().fd;
+      RemoveIdle(&host, host.idle.size() - 1);
+      close(fd);
+    }
+    FailWaiters(&host, ECANCELED);
+    Unused(&host);
+  }
+}
+
+ConnPool::HostStats ConnPool::GetHostStats(const address::SockAddr& addr) const {
+  HostStats stats;
+  auto it = hosts_.find(addr);
+  if (it != hosts_.end()) {
+    auto& host = it->second;
+    stats.active = host.active;
+    stats.connecting = host.connecting;
+    stats.idle = host.idle.size();
+    stats.waiting = host.waiters.size();
+    stats.failures = host.failures;
+    stats.down = host.down_until > event::Poller::GetNowMs();
+  }
+  return stats;
+}
+
+ConnPool::Host* ConnPool::GetHost(const address::SockAddr& addr) {
+  auto& host = hosts_[addr];
+  host.addr = addr;
+  return &host;
+}
+
+void ConnPool::Unused(Host* host) {
+  if (host->unused || Count(host) > 0 || !host->waiters.empty()) {
+    return;
+  }
+  host->unused = true;
+  unused_.push_back(host->addr);
+  if (!sweep_scheduled_) {
+    sweep_scheduled_ = poller_->AddCheck(this);
+  }
+}
+
+void ConnPool::Sweep() {
+  auto now = event::Poller::GetNowMs();
+  uint64_t earliest = UINT64_MAX;
+  size_t kept = 0;
+  for (auto& addr : unused_) {
+    auto it = hosts_.find(addr);
+    if (it == hosts_.end()) {
+      continue;
+    }
+    auto& host = it->second;
+    if (Count(&host) > 0 || !host.waiters.empty()) {
+      host.unused = false;  // used again
+      continue;
+    }
+    uint64_t expiry = host.failures ? host.last_failure + options_->max_backoff : 0;
+    if (expiry <= now) {
+      hosts_.erase(it);
+      continue;
+    }
+    // Its health is remembered a while.
+    earliest = std::min(earliest, expiry);
+    unused_[kept++] = addr;
+  }
+  unused_.resize(kept);
+
+  if (!unused_.empty() && sweep_timer_ == event::kBadTimerKey) {
+    sweep_timer_ = poller_->AddTimer(earliest - now, this, kSweepTimerId);
+  }
+}
+
+bool ConnPool::IsDown(Host* host, uint64_t now) {
+  // While the probe is in flight, the others still fail fast.
+  return host->down_until && (now < host->down_until || host->probing);
+}
+
+int ConnPool::Count(const Host* host) const {
+  return host->active + host->connecting + static_cast<int>(host->idle.size());
+}
+
+bool ConnPool::StartConnect(Host* host, AcquireCb callback) {
+  auto& addr = host->addr;
+  int fd = CreateSocket(addr.sockaddr.sa_family, SOCK_STREAM);
+  if (fd == BAD_FD) {
+    errno_ = errno;
+    host->probing = false;
+    return false;
+  }
+  if (options_->keepalive) {
+    SetKeepAlive(fd, true, options_->keepalive_idle, options_->keepalive_interval,
+                 options_->keepalive_count);
+  }
+  if (connect(fd, &addr.sockaddr, address::GetSockLen(addr)) != 0 && errno != EINPROGRESS) {
+    errno_ = errno;
+    close(fd);
+    host->probing = false;
+    MarkFailure(host);
+    return false;
+  }
+  if (!poller_->UpsertFd(fd, this, event::kEventOut)) {
+    errno_ = poller_->GetLastErrno();
+    close(fd);
+    host->probing = false;
+    return false;
+  }
+
+  auto timer = poller_->AddTimer(options_->connect_timeout, this, fd);
+  pending_.emplace(fd, Pending{host, std::move(callback), timer});
+  ++host->connecting;
+  return true;
+}
+
+void ConnPool::OnConnected(int fd, int err) {
+  auto it = pending_.find(fd);
+  if (it == pending_.end()) {
+    return;
+  }
+  auto pending = std::move(it->second);
+  pending_.erase(it);
+  if (pending.timer != event::kBadTimerKey) {
+    poller_->CancelTimer(pending.timer, this, fd);
+  }
+  poller_->RemoveFd(fd);
+
+  auto host = pending.host;
+  --host->connecting;
+  host->probing = false;
+  if (err) {
+    LOG_DEBUG("Pool connect failed: addr={}, err={}", address::ToString(host->addr), err);
+    close(fd);
+    MarkFailure(host);
+    if (host->down_until) {
+      FailWaiters(host, EHOSTDOWN);
+    } else {
+      ServeWaiters(host);
+    }
+    Unused(host);
+    pending.callback(BAD_FD, err);
+    return;
+  }
+
+  host->failures = 0;
+  host->backoff = 0;
+  host->down_until = 0;
+  ++host->active;
+  pending.callback(fd, 0);
+}
+
+void ConnPool::MarkFailure(Host* host) {
+  ++host->failures;
+  host->last_failure = event::Poller::GetNowMs();
+  if (host->failures < options_->failure_threshold) {
+    return;
+  }
+  host->backoff = host->backoff
+    ? std::min(host->backoff * 2, options_->max_backoff) : options_->min_backoff;
+  host->down_until = event::Poller::GetNowMs() + host->backoff;
+  LOG_DEBUG("Host marked down: addr={}, backoff={}", address::ToString(host->addr), host->backoff);
+}
+
+void ConnPool::Recycle(Host* host, int fd) {
+  if (!host->waiters.empty()) {
+    auto callback = std::move(host->waiters.front());
+    host->waiters.pop_front();
+    ++host->active;
+    callback(fd, 0);
+    return;
+  }
+
+  if (static_cast<int>(host->idle.size()) >= options_->max_idle_per_host ||
+      idle_count_ >= static_cast<size_t>(options_->max_idle) ||
+      !poller_->UpsertFd(fd, this, event::kEventIn)) {
+    close(fd);
+    Unused(host);
+    return;
+  }
+  host->idle.push_back(IdleConn{fd, event::Poller::GetNowMs()});
+  idle_fds_[fd] = host;
+  ++idle_count_;
+  ScheduleExpiry();
+}
+
+void ConnPool::ServeWaiters(Host* host) {
+  while (!host->waiters.empty() && Count(host) < options_->max_per_host) {
+    if (IsDown(host, event::Poller::GetNowMs())) {
+      FailWaiters(host, EHOSTDOWN);
+      return;
+    }
+    auto callback = std::move(host->waiters.front());
+    host->waiters.pop_front();
+    if (!StartConnect(host, callback)) {
+      callback(BAD_FD, errno_);
+    }
+  }
+  Unused(host);
+}
+
+void ConnPool::FailWaiters(Host* host, int err) {
+  auto waiters = std::move(host->waiters);
+  host->waiters.clear();
+  for (auto& callback : waiters) {
+    callback(BAD_FD, err);
+  }
+}
+
+void ConnPool::RemoveIdle(Host* host, size_t index) {
+  int fd = host->idle[index].fd;
+  poller_->RemoveFd(fd);
+  idle_fds_.erase(fd);
+  host->idle.erase(host->idle.begin() + index);
+  --idle_count_;
+}
+
+void ConnPool::ScheduleExpiry() {
+  // A connection released now expires after the ones already idle.
+  if (idle_timer_ != event::kBadTimerKey || idle_count_ == 0) {
+    return;
+  }
+
+  uint64_t earliest = UINT64_MAX;
+  for (auto& item : hosts_) {
+    auto& idle = item.second.idle;
+    if (!idle.empty()) {
+      earliest = std::min(earliest, idle.front().since + options_->idle_timeout);
+    }
+  }
+  auto now = event::Poller::GetNowMs();
+  uint32_t timeout = earliest > now ? earliest - now : 0;
+  idle_timer_ = poller_->AddTimer(timeout, this, kIdleTimerId);
+}
+
+void ConnPool::ExpireIdle() {
+  auto now = event::Poller::GetNowMs();
+  for (auto& item : hosts_) {
+    auto& host = item.second;
+    // The oldest connections are at the front.
+    while (!host.idle.empty() && host.idle.front().since + options_->idle_timeout <= now) {
+      int fd = host.idle.front().fd;
+      RemoveIdle(&host, 0);
+      close(fd);
+    }
+    Unused(&host);
+  }
+  ScheduleExpiry();
+}
+
+void ConnPool::OnReadable(int fd) {
+  // Data or EOF on an idle connection, it is not reusable.
+  auto it = idle_fds_.find(fd);
+  if (it == idle_fds_.end()) {
+    return;
+  }
+  auto host = it->second;
+  for (size_t i = 0; i < host->idle.size(); ++i) {
+    if (host->idle[i].fd == fd) {
+      LOG_DEBUG("Idle connection closed: fd={}", fd);
+      RemoveIdle(host, i);
+      close(fd);
+      Unused(host);
+      break;
+    }
+  }
+}
+
+void ConnPool::OnWritable(int fd) {
+  OnConnected(fd, GetSocketError(fd));
+}
+
+void ConnPool::OnError(int fd) {
+  if (pending_.count(fd)) {
+    int err = GetSocketError(fd);
+    OnConnected(fd, err ? err : ECONNREFUSED);
+  } else {
+    OnReadable(fd);
+  }
+}
+
+void ConnPool::OnTimeout(int id) {
+  if (id == kIdleTimerId) {
+    idle_timer_ = event::kBadTimerKey;
+    ExpireIdle();
+    return;
+  }
+  if (id == kSweepTimerId) {
+    sweep_timer_ = event::kBadTimerKey;
+    Sweep();
+    return;
+  }
+
+  auto it = pending_.find(id);
+  if (it != pending_.end()) {
+    it->second.timer = event::kBadTimerKey;  // fired
+    OnConnected(id, ETIMEDOUT);
+  }
+}
+
+void ConnPool::OnCheck() {
+  poller_->RemoveCheck(this);
+  sweep_scheduled_ = false;
+  Sweep();
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,163 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "event/poller.h"
+#include "address/sockaddr.h"
+
+namespace LNETNS {
+namespace net {
+
+// Called with a connected fd (ownership is transferred until Release/Discard) or
+// BAD_FD and an error: errno of the connect, ETIMEDOUT, or EHOSTDOWN if the host
+// has been marked down meanwhile.
+using AcquireCb = std::function<void(int fd, int err)>;
+
+// Per-loop pool of outbound TCP connections keyed by destination address.
+//
+// Idle connections are reused last-in first-out, the most recently used socket
+// has the warmest state (congestion window, caches). While idle, a connection is
+// watched for readability: data or EOF from the peer means it cannot be reused
+// and it is closed. Idle connections expire after "idle_timeout" with a single
+// poller timer for the whole pool.
+//
+// At most "max_per_host" connections (in use, connecting and idle) exist per host,
+// further requests wait for a released connection. New connections get TCP
+// keepalive.
+//
+// Health is tracked passively: after "failure_threshold" consecutive connect
+// failures the host is marked down, requests fail fast with EHOSTDOWN until the
+// backoff elapses, then one connect is let through to probe it. The backoff
+// doubles on each further failure up to "max_backoff".
+//
+// A host left without connections nor waiters is forgotten at the end of the loop
+// iteration, or "max_backoff" after its last failure so that its health outlives
+// the connections.
+class ConnPool : public event::EventHandler {
+public:
+  struct Options {
+    int max_per_host{64};
+    int max_idle_per_host{16};
+    int max_idle{1024};  // whole pool
+    uint32_t idle_timeout{60000};  // milliseconds
+    uint32_t connect_timeout{3000};  // milliseconds
+
+    bool keepalive{true};
+    int keepalive_idle{60};  // seconds
+    int keepalive_interval{10};  // seconds
+    int keepalive_count{3};
+
+    int failure_threshold{3};
+    uint32_t min_backoff{1000};  // milliseconds
+    uint32_t max_backoff{30000};  // milliseconds
+  };
+
+  struct HostStats {
+    int active{0};  // handed out
+    int connecting{0};
+    int idle{0};
+    int waiting{0};
+    int failures{0};  // consecutive connect failures
+    bool down{false};
+  };
+
+public:
+  explicit ConnPool(event::Poller* poller);
+  ConnPool(event::Poller* poller, const Options& opt);
+  ConnPool() = delete;
+  ~ConnPool() override;
+
+  // Returns an idle connection right away if there is one. Otherwise returns
+  // BAD_FD and GetLastErrno() tells why:
+  // - EINPROGRESS: "callback" will be invoked later (never from Acquire()).
+  // - EHOSTDOWN: the host is marked down.
+  // - others: the socket could not be created or the connect failed right away.
+  int Acquire(const address::SockAddr& addr, AcquireCb callback);
+  // Give a healthy connection back for reuse.
+  void Release(const address::SockAddr& addr, int fd);
+  // Close a connection which must not be reused (protocol error, peer closed...).
+  void Discard(const address::SockAddr& addr, int fd);
+
+  // Close idle connections and fail waiting requests with ECANCELED.
+  void Clear();
+
+  HostStats GetHostStats(const address::SockAddr& addr) const;
+  inline size_t IdleCount() const { return idle_count_; }
+  inline size_t HostCount() const { return hosts_.size(); }
+  inline int GetLastErrno() const { return errno_; }
+
+private:
+  struct IdleConn {
+    int fd;
+    uint64_t since;  // GetNowMs()
+  };
+
+  struct Host {
+    address::SockAddr addr;
+    std::vector<IdleConn> idle;  // back is the most recent
+    std::deque<AcquireCb> waiters;
+    int active{0};
+    int connecting{0};
+    int failures{0};
+    uint32_t backoff{0};
+    uint64_t down_until{0};
+    uint64_t last_failure{0};  // GetNowMs()
+    bool probing{false};  // a connect is let through while down
+    bool unused{false};  // in unused_
+  };
+
+  struct Pending {
+    Host* host;
+    AcquireCb callback;
+    event::TimerKey timer;
+  };
+
+  static constexpr int kIdleTimerId = -1;  // other timer ids are fds
+  static constexpr int kSweepTimerId = -2;
+
+  Host* GetHost(const address::SockAddr& addr);
+  bool IsDown(Host* host, uint64_t now);
+  int Count(const Host* host) const;
+  bool StartConnect(Host* host, AcquireCb callback);
+  void OnConnected(int fd, int err);
+  void MarkFailure(Host* host);
+  // Hand "fd" to a waiter, keep it idle or close it.
+  void Recycle(Host* host, int fd);
+  // Start connects for waiters if there is room.
+  void ServeWaiters(Host* host);
+  void FailWaiters(Host* host, int err);
+  void RemoveIdle(Host* host, size_t index);
+  void ScheduleExpiry();
+  void ExpireIdle();
+  // Queue "host" to be forgotten if it has no connection nor waiter. Hosts are only
+  // erased by Sweep(), outside of any callback.
+  void Unused(Host* host);
+  void Sweep();
+
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override;
+  void OnError(int fd) override;
+  void OnTimeout(int id) override;
+  void OnCheck() override;
+
+private:
+  event::Poller* poller_{nullptr};
+  const Options* options_{nullptr};
+
+  std::unordered_map<address::SockAddr, Host, address::SockAddrHash, address::SockAddrEqual> hosts_;
+  std::unordered_map<int, Pending> pending_;  // fd -> connect in progress
+  std::unordered_map<int, Host*> idle_fds_;  // fd -> owner
+  size_t idle_count_{0};
+  event::TimerKey idle_timer_{event::kBadTimerKey};
+  std::vector<address::SockAddr> unused_;  // hosts to sweep
+  bool sweep_scheduled_{false};  // check added
+  event::TimerKey sweep_timer_{event::kBadTimerKey};
+  int errno_{0};
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(ConnPool)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,237 @@
+#include "conn_pool.h"
+#include "socket.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <memory>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+struct Result {
+  bool done{false};
+  int fd{BAD_FD};
+  int err{0};
+};
+
+// Listening socket on a loopback ephemeral port.
+int Listen(address::SockAddr* addr) {
+  *addr = *address::ParseIPPort("127.0.0.1:0");
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  bind(fd, &addr->sockaddr, address::GetSockLen(*addr));
+  listen(fd, 16);
+  GetLocalAddr(fd, addr);
+  return fd;
+}
+
+int AcquireSync(event::Poller* poller, ConnPool* pool, const address::SockAddr& addr,
+                int* err) {
+  Result result;
+  int fd = pool->Acquire(addr, [&](int fd, int err) { result = {true, fd, err}; });
+  if (fd != BAD_FD || pool->GetLastErrno() != EINPROGRESS) {
+    *err = fd == BAD_FD ? pool->GetLastErrno() : 0;
+    return fd;
+  }
+  while (!result.done) {
+    poller->DoPoll();
+  }
+  *err = result.err;
+  return result.fd;
+}
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(ConnPoolTest, ReuseTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::address::SockAddr addr;
+  int listen_fd = TESTNS::Listen(&addr);
+  LNETNS::net::ConnPool pool(poller.get());
+
+  int err = 0;
+  int fd1 = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  ASSERT_NE(fd1, BAD_FD);
+  int fd2 = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  ASSERT_NE(fd2, BAD_FD);
+  EXPECT_EQ(pool.GetHostStats(addr).active, 2);
+
+  pool.Release(addr, fd1);
+  pool.Release(addr, fd2);
+  EXPECT_EQ(pool.IdleCount(), 2);
+  EXPECT_EQ(pool.GetHostStats(addr).idle, 2);
+
+  // Last in, first out, returned right away.
+  EXPECT_EQ(pool.Acquire(addr, nullptr), fd2);
+  EXPECT_EQ(pool.Acquire(addr, nullptr), fd1);
+  EXPECT_EQ(pool.IdleCount(), 0);
+
+  pool.Discard(addr, fd1);
+  pool.Discard(addr, fd2);
+  EXPECT_EQ(pool.GetHostStats(addr).active, 0);
+  EXPECT_EQ(poller->FdCount(), 0);
+  close(listen_fd);
+}
+
+GTEST_TEST(ConnPoolTest, MaxPerHostTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::address::SockAddr addr;
+  int listen_fd = TESTNS::Listen(&addr);
+  LNETNS::net::ConnPool::Options opts;
+  opts.max_per_host = 1;
+  LNETNS::net::ConnPool pool(poller.get(), opts);
+
+  int err = 0;
+  int fd = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  ASSERT_NE(fd, BAD_FD);
+
+  TESTNS::Result waiter;
+  EXPECT_EQ(pool.Acquire(addr, [&](int fd, int err) { waiter = {true, fd, err}; }), BAD_FD);
+  EXPECT_EQ(pool.GetLastErrno(), EINPROGRESS);
+  EXPECT_EQ(pool.GetHostStats(addr).waiting, 1);
+
+  // Handed over to the waiter instead of going idle.
+  pool.Release(addr, fd);
+  ASSERT_TRUE(waiter.done);
+  EXPECT_EQ(waiter.fd, fd);
+  EXPECT_EQ(pool.IdleCount(), 0);
+
+  // A discarded connection makes room for a new connect.
+  waiter = {};
+  EXPECT_EQ(pool.Acquire(addr, [&](int fd, int err) { waiter = {true, fd, err}; }), BAD_FD);
+  pool.Discard(addr, fd);
+  EXPECT_EQ(pool.GetHostStats(addr).connecting, 1);
+  while (!waiter.done) {
+    poller->DoPoll();
+  }
+  ASSERT_NE(waiter.fd, BAD_FD);
+  pool.Discard(addr, waiter.fd);
+  close(listen_fd);
+}
+
+GTEST_TEST(ConnPoolTest, IdleCloseTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::address::SockAddr addr;
+  int listen_fd = TESTNS::Listen(&addr);
+  LNETNS::net::ConnPool::Options opts;
+  opts.idle_timeout = 50;
+  LNETNS::net::ConnPool pool(poller.get(), opts);
+
+  int err = 0;
+  int fd1 = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  int fd2 = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  ASSERT_NE(fd1, BAD_FD);
+  ASSERT_NE(fd2, BAD_FD);
+  int peer1 = accept(listen_fd, nullptr, nullptr);
+  ASSERT_NE(peer1, BAD_FD);
+  pool.Release(addr, fd1);
+  pool.Release(addr, fd2);
+  EXPECT_EQ(pool.IdleCount(), 2);
+
+  // The peer closes one of them.
+  close(peer1);
+  while (pool.IdleCount() == 2) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(pool.IdleCount(), 1);
+
+  // The other one expires.
+  while (pool.IdleCount() == 1) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(pool.IdleCount(), 0);
+  EXPECT_EQ(poller->FdCount(), 0);
+  EXPECT_EQ(poller->TimerCount(), 0);
+  close(listen_fd);
+}
+
+GTEST_TEST(ConnPoolTest, HealthTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::address::SockAddr addr;
+  close(TESTNS::Listen(&addr));  // nobody listens anymore
+  LNETNS::net::ConnPool::Options opts;
+  opts.failure_threshold = 2;
+  opts.min_backoff = 50;
+  LNETNS::net::ConnPool pool(poller.get(), opts);
+
+  int err = 0;
+  EXPECT_EQ(TESTNS::AcquireSync(poller.get(), &pool, addr, &err), BAD_FD);
+  EXPECT_EQ(err, ECONNREFUSED);
+  EXPECT_FALSE(pool.GetHostStats(addr).down);
+  EXPECT_EQ(TESTNS::AcquireSync(poller.get(), &pool, addr, &err), BAD_FD);
+  EXPECT_EQ(err, ECONNREFUSED);
+  EXPECT_TRUE(pool.GetHostStats(addr).down);
+  EXPECT_EQ(pool.GetHostStats(addr).failures, 2);
+
+  // Fails fast while down.
+  EXPECT_EQ(pool.Acquire(addr, nullptr), BAD_FD);
+  EXPECT_EQ(pool.GetLastErrno(), EHOSTDOWN);
+
+  // A probe is let through after the backoff, the host is back.
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  ASSERT_EQ(bind(listen_fd, &addr.sockaddr, LNETNS::address::GetSockLen(addr)), 0);
+  listen(listen_fd, 16);
+  usleep(60 * 1000);
+  int fd = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  ASSERT_NE(fd, BAD_FD);
+  EXPECT_FALSE(pool.GetHostStats(addr).down);
+  EXPECT_EQ(pool.GetHostStats(addr).failures, 0);
+  pool.Discard(addr, fd);
+  close(listen_fd);
+}
+
+GTEST_TEST(ConnPoolTest, ForgetHostTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::ConnPool::Options opts;
+  opts.max_backoff = 100;
+  LNETNS::net::ConnPool pool(poller.get(), opts);
+
+  // Hosts are forgotten once their connections are gone.
+  constexpr int kHosts = 10;
+  int err = 0;
+  for (int i = 0; i < kHosts; ++i) {
+    LNETNS::address::SockAddr addr;
+    int listen_fd = TESTNS::Listen(&addr);
+    int fd = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+    ASSERT_NE(fd, BAD_FD);
+    pool.Discard(addr, fd);
+    close(listen_fd);
+  }
+  EXPECT_GT(pool.HostCount(), 0);
+  poller->AddTimer(0, nullptr);
+  poller->DoPoll();
+  EXPECT_EQ(pool.HostCount(), 0);
+
+  // Not with connections left.
+  LNETNS::address::SockAddr addr;
+  int listen_fd = TESTNS::Listen(&addr);
+  int fd = TESTNS::AcquireSync(poller.get(), &pool, addr, &err);
+  ASSERT_NE(fd, BAD_FD);
+  pool.Release(addr, fd);
+  poller->AddTimer(0, nullptr);
+  poller->DoPoll();
+  EXPECT_EQ(pool.HostCount(), 1);
+  EXPECT_EQ(pool.GetHostStats(addr).idle, 1);
+  pool.Clear();
+  close(listen_fd);
+
+  // Failures are remembered until max_backoff after the last one.
+  EXPECT_EQ(TESTNS::AcquireSync(poller.get(), &pool, addr, &err), BAD_FD);
+  poller->AddTimer(0, nullptr);
+  poller->DoPoll();
+  EXPECT_EQ(pool.GetHostStats(addr).failures, 1);
+  while (pool.HostCount() > 0) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(pool.GetHostStats(addr).failures, 0);
+}
+
+#undef TESTNS
@@ -0,0 +1,341 @@
+#include "connector.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include "socket.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+inline void SetPort(address::SockAddr* addr, uint16_t port) {
+  if (addr->sockaddr.sa_family == AF_INET6) {
+    addr->sockaddr_in6.sin6_port = htons(port);
+  } else {
+    addr->sockaddr_in.sin_port = htons(port);
+  }
+}
+
+}  // unnamed namespace
+
+const Connector::Options Connector::kDefaultOptions;
+
+Connector::Connector(event::Poller* poller, dns::AresResolver* resolver, ConnectCb callback)
+  : Connector(poller, resolver, std::move(callback), kDefaultOptions) {
+}
+
+Connector::Connector(event::Poller* poller, dns::AresResolver* resolver, ConnectCb callback,
+                     const Options& opt)
+  : poller_(poller), resolver_(resolver), callback_(std::move(callback)) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+}
+
+Connector::~Connector() {
+  Cancel();
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+bool Connector::Connect(const std::string& host, uint16_t port) {
+  if (in_progress_) {
+    return false;
+  }
+
+  Reset();
+  in_progress_ = true;
+  in_connect_ = true;
+  port_ = port;
+  attempts_made_ = 0;
+  last_error_ = 0;
+  if (options_->timeout > 0) {
+    StartTimer(&timeout_timer_, options_->timeout, kTimeoutTimer);
+  }
+
+  // Both are pending before any answer is handled, the first answer (even a
+  // synchronous one) must not conclude that resolution is over.
+  pending6_ = true;
+  pending4_ = true;
+  query6_ = resolver_->Resolve(host, dns::AddrFamily::kInet6,
+    [this](dns::ResolveStatus status, dns::AddrList&& addrs) {
+      query6_ = nullptr;
+      OnResolved(AF_INET6, status, std::move(addrs));
+    });
+  query4_ = resolver_->Resolve(host, dns::AddrFamily::kInet4,
+    [this](dns::ResolveStatus status, dns::AddrList&& addrs) {
+      query4_ = nullptr;
+      OnResolved(AF_INET, status, std::move(addrs));
+    });
+  in_connect_ = false;
+  return true;
+}
+
+bool Connector::Connect(const dns::AddrList& addrs) {
+  if (in_progress_) {
+    return false;
+  }
+
+  Reset();
+  in_progress_ = true;
+  in_connect_ = true;
+  attempts_made_ = 0;
+  last_error_ = 0;
+  if (options_->timeout > 0) {
+    StartTimer(&timeout_timer_, options_->timeout, kTimeoutTimer);
+  }
+
+  AddCandidates(dns::AddrList(addrs));
+  started_ = true;
+  StartAttempt();
+  in_connect_ = false;
+  return true;
+}
+
+void Connector::Cancel() {
+  Reset();
+}
+
+void Connector::OnResolved(int family, dns::ResolveStatus status, dns::AddrList&& addrs) {
+  if (family == AF_INET6) {
+    pending6_ = false;
+  } else {
+    pending4_ = false;
+  }
+  LOG_DEBUG("Resolved: family={}, status={}, count={}", family, status, addrs.size());
+
+  if (status == dns::kResolveSuccess) {
+    for (auto& addr : addrs) {
+      SetPort(&addr, port_);
+    }
+    AddCandidates(std::move(addrs));
+  }
+
+  if (!started_) {
+    bool preferred_done = options_->prefer_ipv6 ? !pending6_ : !pending4_;
+    if (preferred_done || (!pending6_ && !pending4_)) {
+      StopTimer(&resolution_timer_, kResolutionDelayTimer);
+      started_ = true;
+      StartAttempt();
+      return;
+    }
+    // The other family answered first, give the preferred one a little time.
+    if (!candidates6_.empty() || !candidates4_.empty()) {
+      if (resolution_timer_ == event::kBadTimerKey) {
+        StartTimer(&resolution_timer_, options_->resolution_delay, kResolutionDelayTimer);
+      }
+    }
+    return;
+  }
+
+  // Late answers join the remaining candidates.
+  if (attempts_.empty()) {
+    StartAttempt();
+  } else {
+    if (attempt_timer_ == event::kBadTimerKey) {
+      StartTimer(&attempt_timer_, options_->attempt_delay, kAttemptTimer);
+    }
+    CheckExhausted();
+  }
+}
+
+void Connector::AddCandidates(dns::AddrList&& addrs) {
+  for (auto& addr : addrs) {
+    if (addr.sockaddr.sa_family == AF_INET6) {
+      candidates6_.push_back(addr);
+    } else if (addr.sockaddr.sa_family == AF_INET) {
+      candidates4_.push_back(addr);
+    }
+  }
+}
+
+bool Connector::NextCandidate(address::SockAddr* addr) {
+  int preferred_family = options_->prefer_ipv6 ? AF_INET6 : AF_INET;
+  auto& preferred = options_->prefer_ipv6 ? candidates6_ : candidates4_;
+  auto& other = options_->prefer_ipv6 ? candidates4_ : candidates6_;
+
+  std::deque<address::SockAddr>* from;
+  if (preferred_started_ < options_->first_family_count && !preferred.empty()) {
+    from = &preferred;
+    ++preferred_started_;
+  } else if (last_family_ == preferred_family) {
+    from = other.empty() ? &preferred : &other;
+  } else {
+    from = preferred.empty() ? &other : &preferred;
+  }
+  if (from->empty()) {
+    return false;
+  }
+
+  *addr = from->front();
+  from->pop_front();
+  last_family_ = addr->sockaddr.sa_family;
+  return true;
+}
+
+void Connector::StartAttempt() {
+  StopTimer(&attempt_timer_, kAttemptTimer);
+
+  address::SockAddr addr;
+  while (NextCandidate(&addr)) {
+    ++attempts_made_;
+    LOG_DEBUG("Connecting to {}", address::ToString(addr));
+    int fd = CreateSocket(addr.sockaddr.sa_family, SOCK_STREAM);
+    if (fd == BAD_FD) {
+      last_error_ = errno;
+      continue;
+    }
+    if (connect(fd, &addr.sockaddr, address::GetSockLen(addr)) != 0 && errno != EINPROGRESS) {
+      last_error_ = errno;
+      close(fd);
+      continue;
+    }
+    // Completion is reported as writable, even if connect() succeeded already.
+    if (!poller_->UpsertFd(fd, this, event::kEventOut)) {
+      last_error_ = poller_->GetLastErrno();
+      close(fd);
+      continue;
+    }
+    attempts_[fd] = addr;
+
+    if (!candidates6_.empty() || !candidates4_.empty() || pending6_ || pending4_) {
+      StartTimer(&attempt_timer_, options_->attempt_delay, kAttemptTimer);
+    }
+    return;
+  }
+  CheckExhausted();
+}
+
+void Connector::OnAttemptFailed(int fd, int err) {
+  LOG_DEBUG("Connect failed: fd={}, err={}", fd, err);
+  poller_->RemoveFd(fd);
+  close(fd);
+  attempts_.erase(fd);
+  last_error_ = err;
+  // Don't wait for the attempt delay.
+  StartAttempt();
+}
+
+void Connector::CheckExhausted() {
+  if (in_progress_ && attempts_.empty() && candidates6_.empty() && candidates4_.empty() &&
+      !pending6_ && !pending4_) {
+    Fail(last_error_ ? last_error_ : EHOSTUNREACH);
+  }
+}
+
+void Connector::Succeed(int fd) {
+  auto addr = attempts_[fd];
+  poller_->RemoveFd(fd);
+  attempts_.erase(fd);
+  // Cancels the losers. The callback may release this connector.
+  Reset();
+  callback_(fd, addr, 0);
+}
+
+void Connector::Fail(int err) {
+  if (in_connect_) {
+    last_error_ = err;
+    if (fail_timer_ == event::kBadTimerKey) {
+      StartTimer(&fail_timer_, 0, kFailTimer);
+    }
+    return;
+  }
+  Reset();
+  callback_(BAD_FD, address::SockAddr{}, err);
+}
+
+void Connector::Reset() {
+  if (query6_) {
+    query6_->Cancel();
+    query6_ = nullptr;
+  }
+  if (query4_) {
+    query4_->Cancel();
+    query4_ = nullptr;
+  }
+  StopTimer(&resolution_timer_, kResolutionDelayTimer);
+  StopTimer(&attempt_timer_, kAttemptTimer);
+  StopTimer(&timeout_timer_, kTimeoutTimer);
+  StopTimer(&fail_timer_, kFailTimer);
+  for (auto& attempt : attempts_) {
+    poller_->RemoveFd(attempt.first);
+    close(attempt.first);
+  }
+  attempts_.clear();
+  candidates6_.clear();
+  candidates4_.clear();
+  in_progress_ = false;
+  started_ = false;
+  pending6_ = false;
+  pending4_ = false;
+  last_family_ = AF_UNSPEC;
+  preferred_started_ = 0;
+}
+
+void Connector::StartTimer(event::TimerKey* key, uint32_t timeout, int id) {
+  StopTimer(key, id);
+  *key = poller_->AddTimer(timeout, this, id);
+}
+
+void Connector::StopTimer(event::TimerKey* key, int id) {
+  if (*key != event::kBadTimerKey) {
+    poller_->CancelTimer(*key, this, id);
+    *key = event::kBadTimerKey;
+  }
+}
+
+void Connector::OnWritable(int fd) {
+  if (attempts_.find(fd) == attempts_.end()) {
+    return;
+  }
+  int err = GetSocketError(fd);
+  if (err == 0) {
+    Succeed(fd);
+  } else {
+    OnAttemptFailed(fd, err);
+  }
+}
+
+void Connector::OnError(int fd) {
+  if (attempts_.find(fd) == attempts_.end()) {
+    return;
+  }
+  int err = GetSocketError(fd);
+  OnAttemptFailed(fd, err ? err : ECONNREFUSED);
+}
+
+void Connector::OnTimeout(int id) {
+  switch (id) {
+  case kResolutionDelayTimer:
+    resolution_timer_ = event::kBadTimerKey;
+    if (!started_) {
+      started_ = true;
+      StartAttempt();
+    }
+    break;
+  case kAttemptTimer:
+    attempt_timer_ = event::kBadTimerKey;
+    StartAttempt();
+    break;
+  case kTimeoutTimer:
+    timeout_timer_ = event::kBadTimerKey;
+    Fail(ETIMEDOUT);
+    break;
+  case kFailTimer:
+    fail_timer_ = event::kBadTimerKey;
+    Fail(last_error_);
+    break;
+  default:
+    break;
+  }
+}
+
+}  // namespace net
+}  // namespace LNETNS
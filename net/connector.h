@@ -0,0 +1,118 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include "event/poller.h"
+#include "address/sockaddr.h"
+#include "dns/dns.h"
+
+namespace LNETNS {
+namespace net {
+
+// Called once with the connected fd (non-blocking, close-on-exec, ownership is
+// transferred) and its address, or with BAD_FD and the last error (errno value,
+// EHOSTUNREACH if nothing was resolved, ETIMEDOUT on timeout).
+using ConnectCb = std::function<void(int fd, const address::SockAddr& addr, int err)>;
+
+// Happy Eyeballs (RFC 8305) connector.
+//
+// AAAA and A queries are sent in parallel. Connecting starts as soon as the AAAA
+// answer arrives, or "resolution_delay" after the A answer if AAAA is still pending.
+// Candidates alternate between the address families, starting with
+// "first_family_count" addresses of the preferred family. A new attempt starts
+// every "attempt_delay" milliseconds, or right away when the previous one fails,
+// while the earlier attempts keep running. Answers arriving late are merged into
+// the remaining candidates. The first socket to become writable without error
+// wins, the other attempts and pending queries are cancelled.
+//
+// The callback is never invoked from Connect().
+class Connector : public event::EventHandler {
+public:
+  struct Options {
+    uint32_t resolution_delay{50};  // milliseconds
+    uint32_t attempt_delay{250};  // milliseconds, RFC 8305 recommends 100 to 2000
+    uint32_t timeout{10000};  // milliseconds, for the whole process, 0 means none
+    bool prefer_ipv6{true};
+    int first_family_count{1};
+  };
+
+public:
+  Connector(event::Poller* poller, dns::AresResolver* resolver, ConnectCb callback);
+  Connector(event::Poller* poller, dns::AresResolver* resolver, ConnectCb callback,
+            const Options& opt);
+  Connector() = delete;
+  ~Connector() override;
+
+  // Returns false if a connect is already in progress.
+  bool Connect(const std::string& host, uint16_t port);
+  // Race already known addresses (ports included), no resolution.
+  bool Connect(const dns::AddrList& addrs);
+  void Cancel();
+
+  inline bool InProgress() const { return in_progress_; }
+  // Connection attempts made by the last Connect().
+  inline int Attempts() const { return attempts_made_; }
+
+private:
+  enum TimerId {
+    kResolutionDelayTimer = 1,
+    kAttemptTimer,
+    kTimeoutTimer,
+    kFailTimer,  // reports a failure found in Connect()
+  };
+
+  void OnResolved(int family, dns::ResolveStatus status, dns::AddrList&& addrs);
+  void AddCandidates(dns::AddrList&& addrs);
+  // Start attempts until one is in flight or the candidates are exhausted.
+  void StartAttempt();
+  bool NextCandidate(address::SockAddr* addr);
+  void OnAttemptFailed(int fd, int err);
+  // All queries done and all attempts failed?
+  void CheckExhausted();
+  void Succeed(int fd);
+  void Fail(int err);
+  void Reset();
+
+  void StartTimer(event::TimerKey* key, uint32_t timeout, int id);
+  void StopTimer(event::TimerKey* key, int id);
+
+  void OnReadable(int fd) override {}
+  void OnWritable(int fd) override;
+  void OnError(int fd) override;
+  void OnTimeout(int id) override;
+
+private:
+  event::Poller* poller_{nullptr};
+  dns::AresResolver* resolver_{nullptr};
+  ConnectCb callback_;
+  const Options* options_{nullptr};
+
+  bool in_progress_{false};
+  bool in_connect_{false};  // inside Connect()
+  bool started_{false};  // connecting has started
+  uint16_t port_{0};
+  dns::DnsQuery* query6_{nullptr};
+  dns::DnsQuery* query4_{nullptr};
+  bool pending6_{false};
+  bool pending4_{false};
+
+  std::deque<address::SockAddr> candidates6_;
+  std::deque<address::SockAddr> candidates4_;
+  int last_family_{AF_UNSPEC};
+  int preferred_started_{0};  // attempts of the preferred family at the beginning
+  std::unordered_map<int, address::SockAddr> attempts_;  // fd -> address in flight
+  int attempts_made_{0};
+  int last_error_{0};
+
+  event::TimerKey resolution_timer_{event::kBadTimerKey};
+  event::TimerKey attempt_timer_{event::kBadTimerKey};
+  event::TimerKey timeout_timer_{event::kBadTimerKey};
+  event::TimerKey fail_timer_{event::kBadTimerKey};
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(Connector)
+};
+
+}  // namespace net
+}  // namespace LNETNS
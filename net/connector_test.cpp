@@ -0,0 +1,131 @@
+#include "connector.h"
+#include "socket.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+struct Result {
+  bool done{false};
+  int fd{BAD_FD};
+  int err{0};
+  address::SockAddr addr;
+};
+
+// Listening socket on a loopback ephemeral port.
+int Listen(address::SockAddr* addr, int backlog) {
+  *addr = *address::ParseIPPort("127.0.0.1:0");
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  bind(fd, &addr->sockaddr, address::GetSockLen(*addr));
+  listen(fd, backlog);
+  GetLocalAddr(fd, addr);
+  return fd;
+}
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(ConnectorTest, ResolveAndConnectTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::dns::AresResolver resolver(poller.get());
+  LNETNS::address::SockAddr addr;
+  int listen_fd = TESTNS::Listen(&addr, 16);
+
+  TESTNS::Result result;
+  LNETNS::net::Connector connector(poller.get(), &resolver,
+    [&](int fd, const LNETNS::address::SockAddr& peer, int err) {
+      result = {true, fd, err, peer};
+    });
+  // The IPv4 literal answers A only, connecting starts after the resolution delay
+  // whether or not the AAAA query is still pending.
+  ASSERT_TRUE(connector.Connect("127.0.0.1", ntohs(addr.sockaddr_in.sin_port)));
+  EXPECT_TRUE(connector.InProgress());
+  EXPECT_FALSE(result.done);
+  while (!result.done) {
+    poller->DoPoll();
+  }
+  ASSERT_NE(result.fd, BAD_FD);
+  EXPECT_EQ(result.err, 0);
+  EXPECT_EQ(LNETNS::address::ToString(result.addr), LNETNS::address::ToString(addr));
+  EXPECT_FALSE(connector.InProgress());
+  close(result.fd);
+  close(listen_fd);
+}
+
+GTEST_TEST(ConnectorTest, StaggeredAttemptTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::dns::AresResolver resolver(poller.get());
+
+  // A full accept queue drops SYNs, which looks like a blackholed address.
+  LNETNS::address::SockAddr blackhole;
+  int blackhole_fd = TESTNS::Listen(&blackhole, 0);
+  int filler = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_EQ(connect(filler, &blackhole.sockaddr, LNETNS::address::GetSockLen(blackhole)), 0);
+
+  LNETNS::address::SockAddr good;
+  int good_fd = TESTNS::Listen(&good, 16);
+
+  TESTNS::Result result;
+  LNETNS::net::Connector::Options opts;
+  opts.attempt_delay = 50;
+  LNETNS::net::Connector connector(poller.get(), &resolver,
+    [&](int fd, const LNETNS::address::SockAddr& peer, int err) {
+      result = {true, fd, err, peer};
+    }, opts);
+  ASSERT_TRUE(connector.Connect(LNETNS::dns::AddrList{blackhole, good}));
+  while (!result.done) {
+    poller->DoPoll();
+  }
+  ASSERT_NE(result.fd, BAD_FD);
+  EXPECT_EQ(LNETNS::address::ToString(result.addr), LNETNS::address::ToString(good));
+  EXPECT_EQ(connector.Attempts(), 2);
+  // The losing attempt has been cancelled.
+  EXPECT_EQ(poller->FdCount(), 0);
+  EXPECT_EQ(poller->TimerCount(), 0);
+
+  close(result.fd);
+  close(filler);
+  close(blackhole_fd);
+  close(good_fd);
+}
+
+GTEST_TEST(ConnectorTest, AllFailedTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::dns::AresResolver resolver(poller.get());
+  LNETNS::address::SockAddr addr;
+  close(TESTNS::Listen(&addr, 1));  // nobody listens anymore
+
+  TESTNS::Result result;
+  LNETNS::net::Connector connector(poller.get(), &resolver,
+    [&](int fd, const LNETNS::address::SockAddr& peer, int err) {
+      result = {true, fd, err, peer};
+    });
+  ASSERT_TRUE(connector.Connect(LNETNS::dns::AddrList{addr, addr}));
+  EXPECT_FALSE(result.done);
+  while (!result.done) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(result.fd, BAD_FD);
+  EXPECT_EQ(result.err, ECONNREFUSED);
+  EXPECT_EQ(connector.Attempts(), 2);
+  EXPECT_EQ(poller->FdCount(), 0);
+
+  // Nothing to connect to.
+  result.done = false;
+  ASSERT_TRUE(connector.Connect(LNETNS::dns::AddrList{}));
+  EXPECT_FALSE(result.done);
+  while (!result.done) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(result.err, EHOSTUNREACH);
+}
+
+#undef TESTNS
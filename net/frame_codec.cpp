@@ -0,0 +1,233 @@
+#include "frame_codec.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "tcp_connection.h"
+
+namespace LNETNS {
+namespace net {
+
+size_t FrameView::CopyTo(void* out, size_t len) const {
+  auto dst = static_cast<char*>(out);
+  size_t copied = 0;
+  for (int i = 0; i < count && copied < len; ++i) {
+    auto n = std::min(len - copied, iov[i].iov_len);
+    std::memcpy(dst + copied, iov[i].iov_base, n);
+    copied += n;
+  }
+  return copied;
+}
+
+std::string FrameView::ToString() const {
+  std::string s(size, '\0');
+  CopyTo(&s[0], size);
+  return s;
+}
+
+const FrameCodec::Options FrameCodec::kDefaultOptions;
+
+FrameCodec::FrameCodec() : FrameCodec(kDefaultOptions) {
+}
+
+FrameCodec::FrameCodec(const Options& opt) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+}
+
+FrameCodec::~FrameCodec() {
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+size_t FrameCodec::ParseHeader(const char* data, size_t avail, size_t* len) {
+  auto p = reinterpret_cast<const uint8_t*>(data);
+  size_t hlen = 0;
+  uint64_t value = 0;
+  switch (options_->header) {
+  case kFixed16:
+    if (avail < 2) {
+      return 0;
+    }
+    value = (uint64_t(p[0]) << 8) | p[1];
+    hlen = 2;
+    break;
+  case kFixed32:
+    if (avail < 4) {
+      return 0;
+    }
+    value = (uint64_t(p[0]) << 24) | (uint64_t(p[1]) << 16) | (uint64_t(p[2]) << 8) | p[3];
+    hlen = 4;
+    break;
+  case kVarint:
+    for (size_t i = 0;; ++i) {
+      if (i == avail) {
+        return 0;
+      }
+      if (i == kMaxHeaderSize || (i == kMaxHeaderSize - 1 && p[i] > 1)) {
+        error_ = kBadHeader;  // more than 64 bits
+        return 0;
+      }
+      value |= uint64_t(p[i] & 0x7f) << (7 * i);
+      if (!(p[i] & 0x80)) {
+        hlen = i + 1;
+        break;
+      }
+    }
+    break;
+  }
+
+  if (value > options_->max_frame_size) {
+    error_ = kFrameTooLarge;
+    return 0;
+  }
+  *len = value;
+  return hlen;
+}
+
+bool FrameCodec::Decode(RingBuffer* input, const FramesCb& cb) {
+  error_ = kNoError;
+  frames_.clear();
+  size_t size = input->Size();
+  size_t off = 0;
+  size_t missing = 0;  // of the incomplete frame
+  while (off < size) {
+    char header[kMaxHeaderSize];
+    size_t avail = input->Peek(header, sizeof(header), off);
+    size_t len = 0;
+    size_t hlen = ParseHeader(header, avail, &len);
+    if (hlen == 0) {
+      break;
+    }
+    if (size - off - hlen < len) {
+      missing = hlen + len - (size - off);
+      break;
+    }
+
+    FrameView frame;
+    frame.count = input->ReadableIovecs(frame.iov, off + hlen, len);
+    frame.size = len;
+    frames_.push_back(frame);
+    off += hlen + len;
+  }
+
+  // The frames before an error are still delivered.
+  if (!frames_.empty()) {
+    cb(frames_.data(), frames_.size());
+    frames_.clear();
+    input->Consume(off);
+  }
+  if (missing > 0) {
+    // Room for the rest of the frame, it is read at once.
+    input->Reserve(missing);
+  }
+  return error_ == kNoError;
+}
+
+bool FrameCodec::Decode(IOBuf* input, std::vector<IOBuf>* frames) {
+  error_ = kNoError;
+  while (!input->Empty()) {
+    char header[kMaxHeaderSize];
+    size_t avail = input->CopyTo(header, sizeof(header));
+    size_t len = 0;
+    size_t hlen = ParseHeader(header, avail, &len);
+    if (hlen == 0 || input->Size() - hlen < len) {
+      break;
+    }
+    input->Consume(hlen);
+    // Shares the segments, frames spanning several of them included.
+    frames->push_back(input->Split(len));
+  }
+  return error_ == kNoError;
+}
+
+size_t FrameCodec::EncodeHeader(size_t len, char out[kMaxHeaderSize]) {
+  error_ = kNoError;
+  uint64_t max_len = options_->max_frame_size;
+  if (options_->header == kFixed16) {
+    max_len = std::min<uint64_t>(max_len, UINT16_MAX);
+  } else if (options_->header == kFixed32) {
+    max_len = std::min<uint64_t>(max_len, UINT32_MAX);
+  }
+  if (len > max_len) {
+    error_ = kFrameTooLarge;
+    return 0;
+  }
+
+  auto p = reinterpret_cast<uint8_t*>(out);
+  switch (options_->header) {
+  case kFixed16:
+    p[0] = len >> 8;
+    p[1] = len;
+    return 2;
+  case kFixed32:
+    p[0] = len >> 24;
+    p[1] = len >> 16;
+    p[2] = len >> 8;
+    p[3] = len;
+    return 4;
+  case kVarint:
+  default:
+    size_t i = 0;
+    while (len >= 0x80) {
+      p[i++] = (len & 0x7f) | 0x80;
+      len >>= 7;
+    }
+    p[i++] = len;
+    return i;
+  }
+}
+
+bool FrameCodec::Encode(const void* data, size_t len, RingBuffer* out) {
+  char header[kMaxHeaderSize];
+  size_t hlen = EncodeHeader(len, header);
+  if (hlen == 0) {
+    return false;
+  }
+  out->Append(header, hlen);
+  out->Append(data, len);
+  return true;
+}
+
+bool FrameCodec::Encode(IOBuf&& payload, IOBuf* out) {
+  char header[kMaxHeaderSize];
+  size_t hlen = EncodeHeader(payload.Size(), header);
+  if (hlen == 0) {
+    return false;
+  }
+  out->Append(header, hlen);
+  out->Append(std::move(payload));
+  return true;
+}
+
+bool FrameCodec::Send(TcpConnection* conn, const void* data, size_t len) {
+  constexpr size_t kCopyLimit = 4096;
+  char buf[kMaxHeaderSize + kCopyLimit];
+  size_t hlen = EncodeHeader(len, buf);
+  if (hlen == 0) {
+    return false;
+  }
+  if (len <= kCopyLimit) {
+    // One send for small frames.
+    std::memcpy(buf + hlen, data, len);
+    return conn->Send(buf, hlen + len);
+  }
+  return conn->Send(buf, hlen) && conn->Send(data, len);
+}
+
+bool FrameCodec::Send(TcpConnection* conn, IOBuf&& payload) {
+  char header[kMaxHeaderSize];
+  size_t hlen = EncodeHeader(payload.Size(), header);
+  if (hlen == 0) {
+    return false;
+  }
+  payload.Prepend(header, hlen);
+  return conn->Send(std::move(payload));
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,112 @@
+#pragma once
+#include <sys/uio.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "macros.h"
+#include "ring_buffer.h"
+#include "iobuf.h"
+
+namespace LNETNS {
+namespace net {
+
+class TcpConnection;
+
+// Non-owning view of a frame payload inside a RingBuffer. A frame which wraps
+// around the end of the ring has two pieces. Only valid during the callback it
+// is passed to.
+struct FrameView {
+  iovec iov[2];
+  int count{0};
+  size_t size{0};
+
+  inline bool Contiguous() const { return count <= 1; }
+  // First byte, all of the payload if Contiguous().
+  inline const char* Data() const {
+    return count ? static_cast<const char*>(iov[0].iov_base) : nullptr;
+  }
+  size_t CopyTo(void* out, size_t len) const;
+  std::string ToString() const;
+};
+
+// Called with all the complete frames found at once. The input buffer is consumed
+// after it returns: neither the codec nor the connection owning the buffer must be
+// released from it, call Close() rather.
+using FramesCb = std::function<void(const FrameView* frames, size_t count)>;
+
+// Length-prefixed framing: each frame is a header holding the payload length,
+// followed by the payload.
+//
+// Decode() parses every complete frame at the front of the input buffer and hands
+// them to the callback in one batch as views into the buffer, then consumes them:
+// no copy per message. Use it from the data callback of a TcpConnection:
+//
+//   conn->SetDataCallback([&](TcpConnection* c, RingBuffer* input) {
+//     if (!codec.Decode(input, on_frames)) {
+//       c->Close();
+//     }
+//   });
+//
+// The IOBuf flavour splits frames off as reference counted slices instead, frames
+// spanning segments included.
+class FrameCodec {
+public:
+  enum HeaderType {
+    kFixed16,  // big-endian
+    kFixed32,  // big-endian
+    kVarint,  // unsigned LEB128, as protobuf
+  };
+
+  enum Error {
+    kNoError,
+    kFrameTooLarge,
+    kBadHeader,  // varint longer than 10 bytes
+  };
+
+  static constexpr size_t kMaxHeaderSize = 10;
+
+  struct Options {
+    HeaderType header{kFixed32};
+    size_t max_frame_size{16 * 1024 * 1024};  // payload
+  };
+
+public:
+  FrameCodec();
+  explicit FrameCodec(const Options& opt);
+  ~FrameCodec();
+
+  // Returns false on a protocol error, the frames before it are still delivered and
+  // consumed, the rest of the input is left as is.
+  bool Decode(RingBuffer* input, const FramesCb& cb);
+  // Appends complete frames to "frames" and removes them from "input".
+  bool Decode(IOBuf* input, std::vector<IOBuf>* frames);
+
+  // Header followed by the payload. Fail with kFrameTooLarge, writing nothing, if
+  // the length doesn't fit the header or is above max_frame_size.
+  bool Encode(const void* data, size_t len, RingBuffer* out);
+  bool Encode(IOBuf&& payload, IOBuf* out);
+  bool Send(TcpConnection* conn, const void* data, size_t len);
+  bool Send(TcpConnection* conn, IOBuf&& payload);
+
+  // Returns the size of the header of a "len" bytes payload written to "out", 0 if
+  // the payload is too large.
+  size_t EncodeHeader(size_t len, char out[kMaxHeaderSize]);
+
+  inline Error GetLastError() const { return error_; }
+
+private:
+  // Parse the header at the front of "data" ("avail" bytes). Returns the header
+  // size, 0 if incomplete or on error.
+  size_t ParseHeader(const char* data, size_t avail, size_t* len);
+
+private:
+  const Options* options_{nullptr};
+  std::vector<FrameView> frames_;  // reused between batches
+  Error error_{kNoError};
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(FrameCodec)
+};
+
+}  // namespace net
+}  // namespace LNETNS
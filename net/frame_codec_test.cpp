@@ -0,0 +1,237 @@
+#include "frame_codec.h"
+#include "tcp_connection.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(FrameCodecTest, BatchTest) {
+  LNETNS::net::FrameCodec codec;
+  LNETNS::net::RingBuffer input;
+  codec.Encode("hello", 5, &input);
+  codec.Encode("", 0, &input);
+  codec.Encode("world!", 6, &input);
+  // Incomplete: header and half of the payload.
+  std::string partial;
+  {
+    LNETNS::net::RingBuffer tmp;
+    codec.Encode("pending", 7, &tmp);
+    partial.resize(tmp.Size());
+    tmp.Peek(&partial[0], partial.size());
+  }
+  input.Append(partial.data(), 7);
+
+  int batches = 0;
+  std::vector<std::string> frames;
+  auto on_frames = [&](const LNETNS::net::FrameView* views, size_t count) {
+    ++batches;
+    for (size_t i = 0; i < count; ++i) {
+      frames.push_back(views[i].ToString());
+    }
+  };
+  ASSERT_TRUE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(batches, 1);
+  EXPECT_EQ(frames, (std::vector<std::string>{"hello", "", "world!"}));
+  EXPECT_EQ(input.Size(), 7);
+
+  input.Append(partial.data() + 7, partial.size() - 7);
+  ASSERT_TRUE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(batches, 2);
+  EXPECT_EQ(frames.back(), "pending");
+  EXPECT_TRUE(input.Empty());
+
+  // Nothing complete, no callback.
+  input.Append(partial.data(), 2);
+  ASSERT_TRUE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(batches, 2);
+}
+
+GTEST_TEST(FrameCodecTest, WrapTest) {
+  LNETNS::net::FrameCodec::Options opts;
+  opts.header = LNETNS::net::FrameCodec::kFixed16;
+  LNETNS::net::FrameCodec codec(opts);
+  LNETNS::net::RingBuffer input(64);
+  // A first frame, then the header of the second one.
+  std::string first(46, 'f');
+  codec.Encode(first.data(), first.size(), &input);
+  std::string payload(30, 'p');
+  payload[0] = 'a';
+  payload[29] = 'z';
+  char header[LNETNS::net::FrameCodec::kMaxHeaderSize];
+  input.Append(header, codec.EncodeHeader(payload.size(), header));
+  size_t count = 0;
+  ASSERT_TRUE(codec.Decode(&input, [&](const LNETNS::net::FrameView* views, size_t n) {
+    count += n;
+  }));
+  EXPECT_EQ(count, 1);
+
+  // The payload spans the end of the ring, the view has two pieces pointing into it.
+  input.Append(payload.data(), payload.size());
+  EXPECT_EQ(input.Capacity(), 64);
+  bool called = false;
+  ASSERT_TRUE(codec.Decode(&input, [&](const LNETNS::net::FrameView* views, size_t count) {
+    ASSERT_EQ(count, 1);
+    EXPECT_FALSE(views[0].Contiguous());
+    EXPECT_EQ(views[0].size, payload.size());
+    EXPECT_EQ(views[0].ToString(), payload);
+    called = true;
+  }));
+  EXPECT_TRUE(called);
+}
+
+GTEST_TEST(FrameCodecTest, VarintAndLimitTest) {
+  LNETNS::net::FrameCodec::Options opts;
+  opts.header = LNETNS::net::FrameCodec::kVarint;
+  opts.max_frame_size = 1000;
+  LNETNS::net::FrameCodec codec(opts);
+  char header[LNETNS::net::FrameCodec::kMaxHeaderSize];
+  EXPECT_EQ(codec.EncodeHeader(127, header), 1);
+  EXPECT_EQ(codec.EncodeHeader(300, header), 2);
+  EXPECT_EQ(static_cast<uint8_t>(header[0]), 0xac);
+  EXPECT_EQ(header[1], 0x02);
+
+  LNETNS::net::RingBuffer input;
+  std::string payload(300, 'v');
+  codec.Encode(payload.data(), payload.size(), &input);
+  size_t got = 0;
+  auto on_frames = [&](const LNETNS::net::FrameView* views, size_t count) {
+    got += count;
+  };
+  ASSERT_TRUE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(got, 1);
+
+  // Larger than the limit, rejected from the header alone.
+  auto unlimited = opts;
+  unlimited.max_frame_size = SIZE_MAX;
+  LNETNS::net::FrameCodec encoder(unlimited);
+  ASSERT_EQ(encoder.EncodeHeader(1001, header), 2);
+  input.Append(header, 2);
+  EXPECT_FALSE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(codec.GetLastError(), LNETNS::net::FrameCodec::kFrameTooLarge);
+  input.Clear();
+
+  // Incomplete until the tenth byte.
+  std::string overlong(9, '\xff');
+  input.Append(overlong.data(), overlong.size());
+  EXPECT_TRUE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(input.Size(), 9);
+  input.Append("\xff\xff", 2);
+  EXPECT_FALSE(codec.Decode(&input, on_frames));
+  EXPECT_EQ(codec.GetLastError(), LNETNS::net::FrameCodec::kBadHeader);
+}
+
+GTEST_TEST(FrameCodecTest, EncodeLimitTest) {
+  LNETNS::net::FrameCodec::Options opts;
+  opts.header = LNETNS::net::FrameCodec::kFixed16;
+  LNETNS::net::FrameCodec codec16(opts);
+  char header[LNETNS::net::FrameCodec::kMaxHeaderSize];
+  EXPECT_EQ(codec16.EncodeHeader(65535, header), 2);
+  EXPECT_EQ(codec16.GetLastError(), LNETNS::net::FrameCodec::kNoError);
+
+  // Not truncated to the header, nothing is written.
+  std::string payload(65536, 'p');
+  LNETNS::net::RingBuffer out;
+  EXPECT_FALSE(codec16.Encode(payload.data(), payload.size(), &out));
+  EXPECT_EQ(codec16.GetLastError(), LNETNS::net::FrameCodec::kFrameTooLarge);
+  EXPECT_EQ(out.Size(), 0);
+  LNETNS::net::IOBuf buf;
+  buf.Append(payload);
+  LNETNS::net::IOBuf buf_out;
+  EXPECT_FALSE(codec16.Encode(std::move(buf), &buf_out));
+  EXPECT_TRUE(buf_out.Empty());
+
+  opts.header = LNETNS::net::FrameCodec::kFixed32;
+  opts.max_frame_size = SIZE_MAX;
+  LNETNS::net::FrameCodec codec32(opts);
+  EXPECT_EQ(codec32.EncodeHeader(UINT32_MAX, header), 4);
+  EXPECT_EQ(codec32.EncodeHeader(uint64_t(UINT32_MAX) + 1, header), 0);
+  EXPECT_EQ(codec32.GetLastError(), LNETNS::net::FrameCodec::kFrameTooLarge);
+
+  // Above max_frame_size, whatever the header.
+  opts.header = LNETNS::net::FrameCodec::kVarint;
+  opts.max_frame_size = 100;
+  LNETNS::net::FrameCodec limited(opts);
+  EXPECT_TRUE(limited.Encode(payload.data(), 100, &out));
+  EXPECT_FALSE(limited.Encode(payload.data(), 101, &out));
+  EXPECT_EQ(limited.GetLastError(), LNETNS::net::FrameCodec::kFrameTooLarge);
+  EXPECT_EQ(out.Size(), 101);
+
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+  LNETNS::net::TcpConnection conn(poller.get(), fds[0]);
+  ASSERT_TRUE(conn.Start());
+  EXPECT_FALSE(limited.Send(&conn, payload.data(), 101));
+  LNETNS::net::IOBuf large;
+  large.Append(payload);
+  EXPECT_FALSE(limited.Send(&conn, std::move(large)));
+  EXPECT_EQ(conn.BytesWritten() + conn.OutputSize(), 0);
+  close(fds[1]);
+}
+
+GTEST_TEST(FrameCodecTest, IOBufTest) {
+  LNETNS::net::FrameCodec codec;
+  LNETNS::net::IOBuf input;
+  // Two segments.
+  std::string big(10000, 'b');
+  LNETNS::net::IOBuf payload;
+  payload.Append(big.substr(0, 5000));
+  LNETNS::net::IOBuf tail;
+  tail.Append(big.substr(5000));
+  payload.Append(std::move(tail));
+  codec.Encode(std::move(payload), &input);
+  LNETNS::net::IOBuf small;
+  small.Append(std::string("small"));
+  codec.Encode(std::move(small), &input);
+  char header[LNETNS::net::FrameCodec::kMaxHeaderSize];
+  input.Append(header, codec.EncodeHeader(100, header));  // incomplete
+
+  std::vector<LNETNS::net::IOBuf> frames;
+  ASSERT_TRUE(codec.Decode(&input, &frames));
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_GT(frames[0].SliceCount(), 1);  // spans segments
+  EXPECT_EQ(frames[0].ToString(), big);
+  EXPECT_EQ(frames[1].ToString(), "small");
+  EXPECT_EQ(input.Size(), 4);
+}
+
+GTEST_TEST(FrameCodecTest, ConnectionTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+  LNETNS::net::TcpConnection client(poller.get(), fds[0]);
+  LNETNS::net::TcpConnection server(poller.get(), fds[1]);
+  LNETNS::net::FrameCodec codec;
+
+  std::vector<std::string> frames;
+  server.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* input) {
+    ASSERT_TRUE(codec.Decode(input, [&](const LNETNS::net::FrameView* views, size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+        frames.push_back(views[i].ToString());
+      }
+    }));
+  });
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(server.Start());
+
+  std::string large(100000, 'L');
+  ASSERT_TRUE(codec.Send(&client, "one", 3));
+  ASSERT_TRUE(codec.Send(&client, large.data(), large.size()));
+  LNETNS::net::IOBuf buf;
+  buf.Append(std::string("three"));
+  ASSERT_TRUE(codec.Send(&client, std::move(buf)));
+  while (frames.size() < 3) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(frames[0], "one");
+  EXPECT_EQ(frames[1], large);
+  EXPECT_EQ(frames[2], "three");
+}
+
+#undef TESTNS
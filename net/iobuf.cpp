@@ -0,0 +1,421 @@
+#include "iobuf.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+
+constexpr size_t SegmentPool::kClassSizes[];
+
+namespace {
+
+// Free segments are linked through their data area.
+inline Segment* NextFree(Segment* seg) {
+  Segment* next;
+  std::memcpy(&next, seg->Data(), sizeof(next));
+  return next;
+}
+
+inline void SetNextFree(Segment* seg, Segment* next) {
+  std::memcpy(seg->Data(), &next, sizeof(next));
+}
+
+struct Depot {
+  std::mutex mutex;
+  std::vector<Segment*> free[SegmentPool::kNumClasses];
+};
+
+// Never destroyed: segments may be released by threads that outlive main().
+Depot& GetDepot() {
+  static Depot* depot = new Depot;
+  return *depot;
+}
+
+struct ThreadCache {
+  ~ThreadCache() {
+    auto& depot = GetDepot();
+    std::lock_guard<std::mutex> lock(depot.mutex);
+    for (size_t cls = 0; cls < SegmentPool::kNumClasses; ++cls) {
+      for (auto seg = heads[cls]; seg; seg = NextFree(seg)) {
+        depot.free[cls].push_back(seg);
+      }
+      heads[cls] = nullptr;
+      counts[cls] = 0;
+    }
+  }
+
+  inline void Push(size_t cls, Segment* seg) {
+    SetNextFree(seg, heads[cls]);
+    heads[cls] = seg;
+    ++counts[cls];
+  }
+
+  inline Segment* Pop(size_t cls) {
+    auto seg = heads[cls];
+    if (seg) {
+      heads[cls] = NextFree(seg);
+      --counts[cls];
+    }
+    return seg;
+  }
+
+  Segment* heads[SegmentPool::kNumClasses] = {};
+  size_t counts[SegmentPool::kNumClasses] = {};
+};
+
+thread_local ThreadCache cache;
+
+inline size_t SegmentStride(size_t cls) {
+  // Keep segment headers aligned.
+  constexpr size_t kAlign = alignof(Segment);
+  return (sizeof(Segment) + SegmentPool::kClassSizes[cls] + kAlign - 1) / kAlign * kAlign;
+}
+
+bool RefillFromDepot(size_t cls) {
+  auto& depot = GetDepot();
+  std::lock_guard<std::mutex> lock(depot.mutex);
+  auto& free = depot.free[cls];
+  if (free.empty()) {
+    return false;
+  }
+  auto n = std::min(free.size(), SegmentPool::kSegmentsPerSlab);
+  for (size_t i = 0; i < n; ++i) {
+    cache.Push(cls, free.back());
+    free.pop_back();
+  }
+  return true;
+}
+
+void AllocateSlab(size_t cls) {
+  auto stride = SegmentStride(cls);
+  auto slab = static_cast<char*>(::operator new(stride * SegmentPool::kSegmentsPerSlab));
+  for (size_t i = 0; i < SegmentPool::kSegmentsPerSlab; ++i) {
+    auto seg = new (slab + i * stride) Segment;
+    seg->size_class = cls;
+    seg->capacity = SegmentPool::kClassSizes[cls];
+    cache.Push(cls, seg);
+  }
+}
+
+void SpillToDepot(size_t cls) {
+  auto& depot = GetDepot();
+  std::lock_guard<std::mutex> lock(depot.mutex);
+  auto n = cache.counts[cls] / 2;
+  for (size_t i = 0; i < n; ++i) {
+    depot.free[cls].push_back(cache.Pop(cls));
+  }
+}
+
+}  // unnamed namespace
+
+Segment* SegmentPool::Allocate(size_t size) {
+  size_t cls = 0;
+  while (cls < kNumClasses && kClassSizes[cls] < size) {
+    ++cls;
+  }
+  if (cls == kNumClasses) {
+    auto seg = new (::operator new(sizeof(Segment) + size)) Segment;
+    seg->size_class = kUnpooled;
+    seg->capacity = size;
+    return seg;
+  }
+
+  auto seg = cache.Pop(cls);
+  if (!seg) {
+    if (!RefillFromDepot(cls)) {
+      AllocateSlab(cls);
+    }
+    seg = cache.Pop(cls);
+  }
+  seg->refs.store(1, std::memory_order_relaxed);
+  seg->used = 0;
+  return seg;
+}
+
+void SegmentPool::Unref(Segment* seg) {
+  if (seg->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    Release(seg);
+  }
+}
+
+void SegmentPool::Release(Segment* seg) {
+  if (seg->size_class == kUnpooled) {
+    seg->~Segment();
+    ::operator delete(seg);
+    return;
+  }
+
+  auto cls = seg->size_class;
+  cache.Push(cls, seg);
+  if (cache.counts[cls] > kMaxCachedPerClass) {
+    SpillToDepot(cls);
+  }
+}
+
+size_t SegmentPool::CachedCount() {
+  size_t n = 0;
+  for (size_t cls = 0; cls < kNumClasses; ++cls) {
+    n += cache.counts[cls];
+  }
+  return n;
+}
+
+IOBuf::IOBuf(IOBuf&& other) noexcept
+  : slices_(std::move(other.slices_)), size_(other.size_) {
+  other.slices_.clear();
+  other.size_ = 0;
+}
+
+IOBuf& IOBuf::operator=(IOBuf&& other) noexcept {
+  if (this != &other) {
+    Clear();
+    slices_ = std::move(other.slices_);
+    size_ = other.size_;
+    other.slices_.clear();
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+void IOBuf::Append(const void* data, size_t len) {
+  auto src = static_cast<const char*>(data);
+  if (len > 0 && !slices_.empty() && Extendable(slices_.back())) {
+    auto& last = slices_.back();
+    auto n = std::min(len, last.seg->Room());
+    std::memcpy(last.seg->Data() + last.seg->used, src, n);
+    last.seg->used += n;
+    last.len += n;
+    size_ += n;
+    src += n;
+    len -= n;
+  }
+
+  while (len > 0) {
+    auto seg = SegmentPool::Allocate(
+      std::min(len, SegmentPool::kClassSizes[SegmentPool::kNumClasses - 1]));
+    auto n = std::min(len, seg->capacity);
+    std::memcpy(seg->Data(), src, n);
+    seg->used = n;
+    slices_.push_back(Slice{seg, 0, n});
+    size_ += n;
+    src += n;
+    len -= n;
+  }
+}
+
+void IOBuf::Append(IOBuf&& other) {
+  if (&other == this) {
+    return;
+  }
+  for (auto& s : other.slices_) {
+    slices_.push_back(s);
+  }
+  size_ += other.size_;
+  other.slices_.clear();
+  other.size_ = 0;
+}
+
+void IOBuf::Append(const IOBuf& other) {
+  // Note: "other" may be this buffer.
+  auto n = other.slices_.size();
+  auto size = other.size_;
+  for (size_t i = 0; i < n; ++i) {
+    auto s = other.slices_[i];
+    SegmentPool::Ref(s.seg);
+    slices_.push_back(s);
+  }
+  size_ += size;
+}
+
+void IOBuf::Prepend(const void* data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  if (!slices_.empty()) {
+    auto& first = slices_.front();
+    if (first.off >= len && first.seg->refs.load(std::memory_order_acquire) == 1) {
+      first.off -= len;
+      first.len += len;
+      std::memcpy(first.seg->Data() + first.off, data, len);
+      size_ += len;
+      return;
+    }
+  }
+
+  IOBuf head;
+  head.Append(data, len);
+  Prepend(std::move(head));
+}
+
+void IOBuf::Prepend(IOBuf&& other) {
+  if (&other == this) {
+    return;
+  }
+  slices_.insert(slices_.begin(), other.slices_.begin(), other.slices_.end());
+  size_ += other.size_;
+  other.slices_.clear();
+  other.size_ = 0;
+}
+
+IOBuf IOBuf::Split(size_t n) {
+  IOBuf head;
+  n = std::min(n, size_);
+  while (n > 0) {
+    auto& s = slices_.front();
+    if (s.len <= n) {
+      n -= s.len;
+      head.size_ += s.len;
+      head.slices_.push_back(s);
+      slices_.pop_front();
+    } else {
+      SegmentPool::Ref(s.seg);
+      head.slices_.push_back(Slice{s.seg, s.off, n});
+      head.size_ += n;
+      s.off += n;
+      s.len -= n;
+      n = 0;
+    }
+  }
+  size_ -= head.size_;
+  return head;
+}
+
+IOBuf IOBuf::Clone() const {
+  IOBuf copy;
+  copy.Append(*this);
+  return copy;
+}
+
+void IOBuf::Consume(size_t n) {
+  n = std::min(n, size_);
+  size_ -= n;
+  while (n > 0) {
+    auto& s = slices_.front();
+    if (s.len <= n) {
+      n -= s.len;
+      SegmentPool::Unref(s.seg);
+      slices_.pop_front();
+    } else {
+      s.off += n;
+      s.len -= n;
+      n = 0;
+    }
+  }
+}
+
+void IOBuf::Clear() {
+  for (auto& s : slices_) {
+    SegmentPool::Unref(s.seg);
+  }
+  slices_.clear();
+  size_ = 0;
+}
+
+size_t IOBuf::CopyTo(void* out, size_t len, size_t off) const {
+  auto dst = static_cast<char*>(out);
+  size_t copied = 0;
+  for (auto& s : slices_) {
+    if (copied == len) {
+      break;
+    }
+    if (off >= s.len) {
+      off -= s.len;
+      continue;
+    }
+    auto n = std::min(s.len - off, len - copied);
+    std::memcpy(dst + copied, s.seg->Data() + s.off + off, n);
+    copied += n;
+    off = 0;
+  }
+  return copied;
+}
+
+std::string IOBuf::ToString() const {
+  std::string s(size_, '\0');
+  CopyTo(&s[0], s.size());
+  return s;
+}
+
+int IOBuf::FillIovecs(iovec* iov, int max, size_t off) const {
+  int cnt = 0;
+  for (auto& s : slices_) {
+    if (cnt == max) {
+      break;
+    }
+    if (off >= s.len) {
+      off -= s.len;
+      continue;
+    }
+    iov[cnt].iov_base = s.seg->Data() + s.off + off;
+    iov[cnt].iov_len = s.len - off;
+    ++cnt;
+    off = 0;
+  }
+  return cnt;
+}
+
+ssize_t IOBuf::WriteTo(int fd) {
+  constexpr int kMaxIovecs = 64;
+  iovec iov[kMaxIovecs];
+  int cnt = FillIovecs(iov, kMaxIovecs);
+  if (cnt == 0) {
+    return 0;
+  }
+  auto n = writev(fd, iov, cnt);
+  if (n > 0) {
+    Consume(n);
+  }
+  return n;
+}
+
+ssize_t IOBuf::ReadFrom(int fd, size_t max) {
+  iovec iov[2];
+  int cnt = 0;
+  size_t room = 0;
+  if (!slices_.empty() && Extendable(slices_.back())) {
+    auto seg = slices_.back().seg;
+    room = std::min(seg->Room(), max);
+    if (room > 0) {
+      iov[cnt].iov_base = seg->Data() + seg->used;
+      iov[cnt].iov_len = room;
+      ++cnt;
+    }
+  }
+  Segment* fresh = nullptr;
+  if (room < max) {
+    fresh = SegmentPool::Allocate(
+      std::min(max - room, SegmentPool::kClassSizes[SegmentPool::kNumClasses - 1]));
+    iov[cnt].iov_base = fresh->Data();
+    iov[cnt].iov_len = std::min(fresh->capacity, max - room);
+    ++cnt;
+  }
+
+  auto n = readv(fd, iov, cnt);
+  size_t left = n > 0 ? n : 0;
+  if (room > 0 && left > 0) {
+    auto& last = slices_.back();
+    auto k = std::min(left, room);
+    last.seg->used += k;
+    last.len += k;
+    size_ += k;
+    left -= k;
+  }
+  if (fresh) {
+    if (left > 0) {
+      fresh->used = left;
+      slices_.push_back(Slice{fresh, 0, left});
+      size_ += left;
+    } else {
+      SegmentPool::Unref(fresh);
+    }
+  }
+  return n;
+}
+
+}  // namespace net
+}  // namespace LNETNS
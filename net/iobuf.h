@@ -0,0 +1,124 @@
+#pragma once
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace LNETNS {
+namespace net {
+
+// Reference-counted block of memory shared by IOBufs. Data is only ever appended
+// to a segment, bytes that have been handed out are immutable.
+struct Segment {
+  std::atomic<uint32_t> refs{1};
+  uint32_t size_class{0};
+  size_t capacity{0};
+  size_t used{0};  // bytes written so far
+
+  inline char* Data() { return reinterpret_cast<char*>(this + 1); }
+  inline size_t Room() const { return capacity - used; }
+};
+
+// Size-classed slab pool of segments.
+//
+// Segments of a class are carved out of slabs of kSegmentsPerSlab segments, one
+// allocation per slab. Released segments go to a per-thread cache first; an
+// overflowing cache spills half of it to a global depot (mutex protected) where
+// other threads refill from, so a producer/consumer pair of threads does not
+// grow the memory forever. Slabs are never returned to the system.
+//
+// Requests larger than the largest class get an unpooled segment.
+class SegmentPool {
+public:
+  static constexpr size_t kNumClasses = 4;
+  static constexpr size_t kClassSizes[kNumClasses] = {1024, 4096, 16384, 65536};
+  static constexpr size_t kSegmentsPerSlab = 16;
+  static constexpr size_t kMaxCachedPerClass = 256;
+  static constexpr uint32_t kUnpooled = kNumClasses;
+
+  // Returns a segment with at least "size" bytes of capacity and refs = 1.
+  static Segment* Allocate(size_t size);
+  static inline void Ref(Segment* seg) {
+    seg->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  static void Unref(Segment* seg);
+
+  // Segments cached by the calling thread.
+  static size_t CachedCount();
+
+private:
+  static void Release(Segment* seg);
+};
+
+// Chained zero-copy buffer: a list of slices into shared segments.
+//
+// Appending or splitting IOBufs only moves or shares slices, payload bytes are
+// copied once when they enter an IOBuf (Append(data)/ReadFrom()) and once when they
+// leave it (CopyTo()), or never if they are written out with WriteTo()/iovecs.
+class IOBuf {
+public:
+  IOBuf() = default;
+  ~IOBuf() { Clear(); }
+  IOBuf(IOBuf&& other) noexcept;
+  IOBuf& operator=(IOBuf&& other) noexcept;
+  // Use Clone() or Append(const IOBuf&) to share the content explicitly.
+  IOBuf(const IOBuf&) = delete;
+  IOBuf& operator=(const IOBuf&) = delete;
+
+  inline size_t Size() const { return size_; }
+  inline bool Empty() const { return size_ == 0; }
+  inline size_t SliceCount() const { return slices_.size(); }
+
+  // Copy bytes in, filling the room of the last segment first.
+  void Append(const void* data, size_t len);
+  inline void Append(const std::string& s) { Append(s.data(), s.size()); }
+  // Move/share the slices of another buffer, no payload copy.
+  void Append(IOBuf&& other);
+  void Append(const IOBuf& other);
+
+  // Typically for headers, uses the headroom of the first segment if possible.
+  void Prepend(const void* data, size_t len);
+  void Prepend(IOBuf&& other);
+
+  // Remove and return the first n bytes. A segment on the boundary is shared by
+  // both buffers.
+  IOBuf Split(size_t n);
+  IOBuf Clone() const;
+  void Consume(size_t n);
+  void Clear();
+
+  size_t CopyTo(void* out, size_t len, size_t off = 0) const;
+  std::string ToString() const;
+
+  // Export up to "max" iovecs starting at offset "off", returns the count.
+  int FillIovecs(iovec* iov, int max, size_t off = 0) const;
+
+  // Vectored write of the buffer, consumes what has been written.
+  ssize_t WriteTo(int fd);
+  // Read up to "max" bytes into the room of the last segment and a fresh one.
+  ssize_t ReadFrom(int fd, size_t max = 65536);
+
+private:
+  struct Slice {
+    Segment* seg;
+    size_t off;
+    size_t len;
+  };
+
+  // Can bytes be appended right after this slice?
+  static inline bool Extendable(const Slice& s) {
+    return s.off + s.len == s.seg->used && s.seg->refs.load(std::memory_order_acquire) == 1;
+  }
+
+private:
+  std::deque<Slice> slices_;
+  size_t size_{0};
+};
+
+}  // namespace net
+}  // namespace LNETNS
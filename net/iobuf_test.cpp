@@ -0,0 +1,147 @@
+#include "iobuf.h"
+#include "tcp_connection.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+using LNETNS::net::IOBuf;
+using LNETNS::net::SegmentPool;
+
+GTEST_TEST(IOBufTest, AppendSplitTest) {
+  IOBuf buf;
+  buf.Append(std::string(1000, 'a'));
+  buf.Append(std::string(24, 'b'));
+  // Fits the room of the first segment.
+  EXPECT_EQ(buf.SliceCount(), 1);
+  buf.Append(std::string(100, 'c'));
+  EXPECT_EQ(buf.SliceCount(), 2);
+  EXPECT_EQ(buf.Size(), 1124);
+
+  auto head = buf.Split(1010);
+  EXPECT_EQ(head.Size(), 1010);
+  EXPECT_EQ(buf.Size(), 114);
+  EXPECT_EQ(head.ToString(), std::string(1000, 'a') + std::string(10, 'b'));
+  EXPECT_EQ(buf.ToString(), std::string(14, 'b') + std::string(100, 'c'));
+
+  // Appending moves slices.
+  head.Append(std::move(buf));
+  EXPECT_TRUE(buf.Empty());
+  EXPECT_EQ(head.Size(), 1124);
+  EXPECT_EQ(head.SliceCount(), 3);
+
+  char out[4];
+  EXPECT_EQ(head.CopyTo(out, sizeof(out), 1008), 4);
+  EXPECT_EQ(std::string(out, 4), "bbbb");
+}
+
+GTEST_TEST(IOBufTest, ShareTest) {
+  IOBuf buf;
+  buf.Append(std::string("payload"));
+  auto copy = buf.Clone();
+  EXPECT_EQ(copy.ToString(), "payload");
+
+  // Shared segments are not written to.
+  buf.Append(std::string("-more"));
+  EXPECT_EQ(buf.SliceCount(), 2);
+  EXPECT_EQ(copy.ToString(), "payload");
+  EXPECT_EQ(buf.ToString(), "payload-more");
+
+  // Headroom is only available after consuming from an unshared segment.
+  copy.Clear();
+  buf.Consume(3);
+  buf.Prepend("PAY", 3);
+  EXPECT_EQ(buf.SliceCount(), 2);
+  EXPECT_EQ(buf.ToString(), "PAYload-more");
+  buf.Prepend("<", 1);
+  EXPECT_EQ(buf.SliceCount(), 3);
+  EXPECT_EQ(buf.ToString(), "<PAYload-more");
+
+  iovec iov[8];
+  ASSERT_EQ(buf.FillIovecs(iov, 8, 2), 2);
+  EXPECT_EQ(std::string(static_cast<char*>(iov[0].iov_base), iov[0].iov_len), "AYload");
+}
+
+GTEST_TEST(IOBufTest, PoolTest) {
+  auto seg = SegmentPool::Allocate(100);
+  EXPECT_EQ(seg->capacity, 1024);
+  SegmentPool::Unref(seg);
+  auto cached = SegmentPool::CachedCount();
+
+  // Reused from the thread cache.
+  auto seg2 = SegmentPool::Allocate(1000);
+  EXPECT_EQ(seg2, seg);
+  EXPECT_EQ(SegmentPool::CachedCount(), cached - 1);
+  SegmentPool::Ref(seg2);
+  SegmentPool::Unref(seg2);
+  EXPECT_EQ(SegmentPool::CachedCount(), cached - 1);
+  SegmentPool::Unref(seg2);
+  EXPECT_EQ(SegmentPool::CachedCount(), cached);
+
+  // Not pooled.
+  auto big = SegmentPool::Allocate(1 << 20);
+  EXPECT_GE(big->capacity, 1 << 20);
+  SegmentPool::Unref(big);
+  EXPECT_EQ(SegmentPool::CachedCount(), cached);
+}
+
+GTEST_TEST(IOBufTest, ReadWriteTest) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  IOBuf out;
+  out.Append(std::string(3000, 'x'));
+  out.Append(std::string(5000, 'y'));
+  EXPECT_EQ(out.WriteTo(fds[1]), 8000);
+  EXPECT_TRUE(out.Empty());
+
+  IOBuf in;
+  while (in.Size() < 8000) {
+    ASSERT_GT(in.ReadFrom(fds[0], 4096), 0);
+  }
+  EXPECT_EQ(in.ToString(), std::string(3000, 'x') + std::string(5000, 'y'));
+  close(fds[0]);
+  close(fds[1]);
+}
+
+GTEST_TEST(IOBufTest, ChainedSendTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  LNETNS::net::TcpConnection server(poller.get(), fds[0]);
+  LNETNS::net::TcpConnection client(poller.get(), fds[1]);
+  std::string received;
+  server.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* input) {
+    std::string s(input->Size(), '\0');
+    input->Peek(&s[0], s.size());
+    received += s;
+    input->Consume(input->Size());
+  });
+  ASSERT_TRUE(server.Start());
+  ASSERT_TRUE(client.Start());
+
+  // Mix copied and chained output, larger than the socket buffers.
+  std::string expected;
+  for (int i = 0; expected.size() < 4 * 1024 * 1024; ++i) {
+    auto s = std::string(4000, 'a' + i % 26) + std::to_string(i);
+    if (i % 2) {
+      ASSERT_TRUE(client.Send(s.data(), s.size()));
+    } else {
+      IOBuf buf;
+      buf.Append(s);
+      ASSERT_TRUE(client.Send(std::move(buf)));
+    }
+    expected += s;
+  }
+  EXPECT_GT(client.OutputSize(), 0);
+
+  while (received.size() < expected.size()) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(received, expected);
+  EXPECT_EQ(client.OutputSize(), 0);
+  EXPECT_EQ(client.BytesWritten(), expected.size());
+}
@@ -0,0 +1,134 @@
+#include "listener_group.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#if defined __linux__
+#include <linux/filter.h>
+#endif
+#include "socket.h"
+
+namespace LNETNS {
+namespace net {
+
+ListenerGroup::ListenerGroup(const std::vector<event::Poller*>& pollers, GroupConnectionCb callback)
+  : ListenerGroup(pollers, std::move(callback), Options()) {
+}
+
+ListenerGroup::ListenerGroup(const std::vector<event::Poller*>& pollers, GroupConnectionCb callback,
+                             const Options& opt)
+  : pollers_(pollers), callback_(std::move(callback)), options_(opt) {
+}
+
+ListenerGroup::~ListenerGroup() {
+  Close();
+}
+
+bool ListenerGroup::Listen(const address::SockAddr& addr) {
+  if (!acceptors_.empty() || pollers_.empty()) {
+    return false;
+  }
+
+  bool ok = false;
+  if (options_.mode == Mode::kReusePort) {
+    ok = ListenReusePort(addr);
+  } else {
+    ok = ListenExclusive(addr);
+  }
+  if (!ok) {
+    Close();
+  }
+  return ok;
+}
+
+void ListenerGroup::Close() {
+  // Acceptors must be closed before the shared socket.
+  acceptors_.clear();
+  if (shared_fd_ != BAD_FD) {
+    close(shared_fd_);
+    shared_fd_ = BAD_FD;
+  }
+}
+
+std::unique_ptr<Acceptor> ListenerGroup::MakeAcceptor(size_t loop, const Acceptor::Options& opt) {
+  auto cb = [this, loop](int fd, const address::SockAddr& peer) {
+    callback_(loop, fd, peer);
+  };
+  return std::make_unique<Acceptor>(pollers_[loop], cb, opt);
+}
+
+bool ListenerGroup::ListenReusePort(const address::SockAddr& addr) {
+  auto opt = options_.acceptor;
+  opt.reuse_port = true;
+  // The sockets join the reuseport group in loop order, which is the order the
+  // steering program indexes them.
+  for (size_t i = 0; i < pollers_.size(); ++i) {
+    auto acceptor = MakeAcceptor(i, opt);
+    // The others bind to the port of the first one, which may have been picked.
+    if (!acceptor->Listen(i == 0 ? addr : local_addr_)) {
+      errno_ = acceptor->GetLastErrno();
+      return false;
+    }
+    if (i == 0 && !GetLocalAddr(acceptor->Fd(), &local_addr_)) {
+      errno_ = errno;
+      return false;
+    }
+    acceptors_.emplace_back(std::move(acceptor));
+  }
+
+  if (options_.steer_by_cpu && !AttachCpuSteering()) {
+    return false;
+  }
+  return true;
+}
+
+bool ListenerGroup::ListenExclusive(const address::SockAddr& addr) {
+  shared_fd_ = CreateSocket(addr.sockaddr.sa_family, SOCK_STREAM);
+  if (shared_fd_ == BAD_FD) {
+    errno_ = errno;
+    return false;
+  }
+  if ((options_.acceptor.reuse_addr && !SetReuseAddr(shared_fd_, true)) ||
+      bind(shared_fd_, &addr.sockaddr, address::GetSockLen(addr)) != 0 ||
+      listen(shared_fd_, options_.acceptor.backlog) != 0 ||
+      !GetLocalAddr(shared_fd_, &local_addr_)) {
+    errno_ = errno;
+    return false;
+  }
+
+  for (size_t i = 0; i < pollers_.size(); ++i) {
+    auto acceptor = MakeAcceptor(i, options_.acceptor);
+    if (!acceptor->Attach(shared_fd_, true)) {
+      errno_ = acceptor->GetLastErrno();
+      return false;
+    }
+    acceptors_.emplace_back(std::move(acceptor));
+  }
+  return true;
+}
+
+bool ListenerGroup::AttachCpuSteering() {
+#if defined SO_ATTACH_REUSEPORT_CBPF
+  // A = cpu; A %= loops; return A
+  sock_filter code[] = {
+    {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(acceptors_.size())},
+    {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  sock_fprog prog = {};
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  // Attaching to any socket applies to the whole reuseport group.
+  if (setsockopt(acceptors_[0]->Fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                 &prog, sizeof(prog)) != 0) {
+    errno_ = errno;
+    return false;
+  }
+  return true;
+#else
+  errno_ = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,77 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <vector>
+#include "acceptor.h"
+
+namespace LNETNS {
+namespace net {
+
+// "loop" is the index of the poller that accepted the connection.
+using GroupConnectionCb = std::function<void(size_t loop, int fd, const address::SockAddr& peer)>;
+
+// Listens on one address from several event loops (one poller per thread), so that
+// accepting is not capped by a single reactor.
+//
+// kReusePort: every loop gets its own SO_REUSEPORT listen socket, the kernel hashes
+// incoming connections among them. With "steer_by_cpu", a classic BPF program is
+// attached to the group which selects the socket by the CPU that processed the
+// packet (cpu % loops). Pin the thread of loop i to CPU i (and line up the NIC
+// queues/IRQs) to accept each connection on the core that received it.
+//
+// kExclusive: one listen socket is shared by all loops and registered with
+// EPOLLEXCLUSIVE, so that a new connection wakes up one loop only.
+//
+// Note: pollers are not thread-safe. Call Listen() and Close() before the loops
+// start running or after they stop. The callback is invoked in the accepting loop.
+class ListenerGroup {
+public:
+  enum class Mode {
+    kReusePort,
+    kExclusive,
+  };
+
+  struct Options {
+    Mode mode{Mode::kReusePort};
+    bool steer_by_cpu{false};  // kReusePort only
+    Acceptor::Options acceptor;
+  };
+
+public:
+  ListenerGroup(const std::vector<event::Poller*>& pollers, GroupConnectionCb callback);
+  ListenerGroup(const std::vector<event::Poller*>& pollers, GroupConnectionCb callback,
+                const Options& opt);
+  ListenerGroup() = delete;
+  ~ListenerGroup();
+
+  // With port 0, the port picked by the kernel for the first socket is used for all
+  // of them, see LocalAddr().
+  bool Listen(const address::SockAddr& addr);
+  void Close();
+
+  // Address bound by the last successful Listen().
+  inline const address::SockAddr& LocalAddr() const { return local_addr_; }
+  inline size_t Size() const { return acceptors_.size(); }
+  inline Acceptor* GetAcceptor(size_t loop) { return acceptors_[loop].get(); }
+  inline int GetLastErrno() const { return errno_; }
+
+private:
+  bool ListenReusePort(const address::SockAddr& addr);
+  bool ListenExclusive(const address::SockAddr& addr);
+  bool AttachCpuSteering();
+  std::unique_ptr<Acceptor> MakeAcceptor(size_t loop, const Acceptor::Options& opt);
+
+private:
+  std::vector<event::Poller*> pollers_;
+  GroupConnectionCb callback_;
+  Options options_;
+  std::vector<std::unique_ptr<Acceptor> > acceptors_;
+  int shared_fd_{BAD_FD};  // kExclusive
+  address::SockAddr local_addr_{};
+  int errno_{0};
+
+  NON_COPYABLE_NOR_MOVABLE(ListenerGroup)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,165 @@
+#include "loop_balancer.h"
+#include <algorithm>
+#include <utility>
+#include "tcp_connection.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+uint64_t BytesMoved(TcpConnection* conn) {
+  return conn->BytesRead() + conn->BytesWritten();
+}
+
+}  // unnamed namespace
+
+LoopBalancer::Loop::Loop(LoopBalancer* owner, size_t index, event::Poller* poller)
+  : owner(owner), index(index), poller(poller),
+    inbox(poller, owner->options_.channel_capacity, [this](Migration* migrations, size_t count) {
+      Receive(migrations, count);
+    }) {
+}
+
+void LoopBalancer::Loop::OnTimeout(int id) {
+  timer = poller->AddTimer(owner->options_.interval, this);
+
+  auto stats = poller->GetLoopStats();
+  auto busy = stats.busy_us - last.busy_us;
+  auto total = busy + stats.wait_us - last.wait_us;
+  last = stats;
+  uint32_t util = total > 0 ? busy * 1000 / total : 0;
+  utilisation.store(util, std::memory_order_relaxed);
+
+  const auto& opt = owner->options_;
+  if (owner->loops_.size() > 1 && util >= opt.high_utilisation * 1000) {
+    auto target = owner->Coolest(index);
+    auto other = owner->loops_[target]->utilisation.load(std::memory_order_relaxed);
+    if (util >= other + opt.min_gap * 1000) {
+      MigrateTo(target);
+      return;
+    }
+  }
+  for (auto& entry : conns) {
+    entry.second = BytesMoved(entry.first);
+  }
+}
+
+void LoopBalancer::Loop::MigrateTo(size_t target) {
+  std::vector<std::pair<uint64_t, TcpConnection*> > hot;
+  hot.reserve(conns.size());
+  for (auto& entry : conns) {
+    auto bytes = BytesMoved(entry.first);
+    hot.emplace_back(bytes - entry.second, entry.first);
+    entry.second = bytes;
+  }
+  std::sort(hot.begin(), hot.end(), [](const std::pair<uint64_t, TcpConnection*>& a,
+                                       const std::pair<uint64_t, TcpConnection*>& b) {
+    return a.first > b.first;
+  });
+
+  auto& to = owner->loops_[target];
+  size_t moved = 0;
+  // The busiest one stays.
+  for (size_t i = 1; i < hot.size() && moved < owner->options_.max_migrations; ++i) {
+    auto conn = hot[i].second;
+    if (hot[i].first == 0 || !conn->Detach()) {
+      continue;
+    }
+    if (!to->inbox.Send(Migration{conn, index})) {
+      conn->Attach(poller);
+      continue;
+    }
+    conns.erase(conn);
+    ++moved;
+  }
+  if (moved > 0) {
+    owner->migrations_.fetch_add(moved, std::memory_order_relaxed);
+    LOG_DEBUG("Migrated {} connections from loop {} to {}", moved, index, target);
+  }
+}
+
+void LoopBalancer::Loop::Receive(Migration* migrations, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    auto conn = migrations[i].conn;
+    if (!conn->Attach(poller)) {
+      // The close callback tells the owner.
+      conn->Close();
+      continue;
+    }
+    conns[conn] = BytesMoved(conn);
+    if (owner->callback_) {
+      owner->callback_(conn, migrations[i].from, index);
+    }
+  }
+}
+
+LoopBalancer::LoopBalancer(const std::vector<event::Poller*>& pollers, MigratedCb callback)
+  : LoopBalancer(pollers, std::move(callback), Options()) {
+}
+
+LoopBalancer::LoopBalancer(const std::vector<event::Poller*>& pollers, MigratedCb callback,
+                           const Options& opt)
+  : callback_(std::move(callback)), options_(opt) {
+  for (size_t i = 0; i < pollers.size(); ++i) {
+    loops_.push_back(std::make_unique<Loop>(this, i, pollers[i]));
+  }
+}
+
+LoopBalancer::~LoopBalancer() {
+  Stop();
+}
+
+bool LoopBalancer::Start() {
+  for (auto& loop : loops_) {
+    if (!loop->inbox.Open()) {
+      errno_ = loop->inbox.GetLastErrno();
+      Stop();
+      return false;
+    }
+    if (loop->timer == event::kBadTimerKey) {
+      loop->last = loop->poller->GetLoopStats();
+      loop->timer = loop->poller->AddTimer(options_.interval, loop.get());
+    }
+  }
+  return true;
+}
+
+void LoopBalancer::Stop() {
+  for (auto& loop : loops_) {
+    if (loop->timer != event::kBadTimerKey) {
+      loop->poller->CancelTimer(loop->timer, loop.get());
+      loop->timer = event::kBadTimerKey;
+    }
+    loop->inbox.Close();
+  }
+}
+
+void LoopBalancer::Add(size_t loop, TcpConnection* conn) {
+  loops_[loop]->conns[conn] = BytesMoved(conn);
+}
+
+void LoopBalancer::Remove(size_t loop, TcpConnection* conn) {
+  loops_[loop]->conns.erase(conn);
+}
+
+double LoopBalancer::Utilisation(size_t loop) const {
+  return loops_[loop]->utilisation.load(std::memory_order_relaxed) / 1000.0;
+}
+
+size_t LoopBalancer::Coolest(size_t loop) const {
+  size_t best = loop;
+  uint32_t best_util = UINT32_MAX;
+  for (size_t i = 0; i < loops_.size(); ++i) {
+    auto util = loops_[i]->utilisation.load(std::memory_order_relaxed);
+    if (i != loop && util < best_util) {
+      best = i;
+      best_util = util;
+    }
+  }
+  return best;
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "event/poller.h"
+#include "event/channel.h"
+
+namespace LNETNS {
+namespace net {
+
+class TcpConnection;
+
+// Called in the new loop once "conn" has moved from loop "from" to loop "to", e.g.
+// to update the owner of the connection, or to set its read limit and timers again.
+using MigratedCb = std::function<void(TcpConnection* conn, size_t from, size_t to)>;
+
+// Moves hot connections away from saturated event loops (one poller per thread).
+//
+// Every "interval", each loop samples its own utilisation, the share of time spent
+// in callbacks rather than waiting (BasePoller::GetLoopStats()), and publishes it.
+// A loop above "high_utilisation" whose utilisation exceeds the least loaded loop
+// by "min_gap" detaches up to "max_migrations" of its busiest connections (by bytes
+// moved since the last sample) from the timer callback, a safe point between I/O
+// callbacks, and hands them to the other loop through a channel, where they are
+// attached again. The busiest connection stays: moving it alone would only move
+// the hot spot.
+//
+// Add() and Remove() are called from the loop owning the connection, e.g. Remove()
+// from its close callback. Start() and Stop() are called before the loops start
+// running or after they stop, like ListenerGroup.
+class LoopBalancer {
+public:
+  struct Options {
+    uint32_t interval{500};  // milliseconds between samples
+    double high_utilisation{0.8};
+    double min_gap{0.3};
+    size_t max_migrations{2};  // per loop and interval
+    size_t channel_capacity{1024};
+  };
+
+public:
+  LoopBalancer(const std::vector<event::Poller*>& pollers, MigratedCb callback);
+  LoopBalancer(const std::vector<event::Poller*>& pollers, MigratedCb callback,
+               const Options& opt);
+  LoopBalancer() = delete;
+  ~LoopBalancer();
+
+  bool Start();
+  void Stop();
+
+  void Add(size_t loop, TcpConnection* conn);
+  void Remove(size_t loop, TcpConnection* conn);
+
+  inline size_t Size() const { return loops_.size(); }
+  // Of the last interval, from any thread.
+  double Utilisation(size_t loop) const;
+  inline uint64_t MigrationCount() const { return migrations_.load(std::memory_order_relaxed); }
+  inline int GetLastErrno() const { return errno_; }
+
+private:
+  struct Migration {
+    TcpConnection* conn{nullptr};
+    size_t from{0};
+  };
+
+  class Loop : public event::EventHandler {
+  public:
+    Loop(LoopBalancer* owner, size_t index, event::Poller* poller);
+
+    void OnReadable(int fd) override {}
+    void OnWritable(int fd) override {}
+    void OnTimeout(int id) override;
+    void Receive(Migration* migrations, size_t count);
+    void MigrateTo(size_t target);
+
+    LoopBalancer* owner;
+    size_t index;
+    event::Poller* poller;
+    event::MpscChannel<Migration> inbox;
+    std::unordered_map<TcpConnection*, uint64_t> conns;  // -> bytes at the last sample
+    event::LoopStats last;
+    std::atomic<uint32_t> utilisation{0};  // per mille
+    event::TimerKey timer{event::kBadTimerKey};
+  };
+
+  // Least loaded loop other than "loop".
+  size_t Coolest(size_t loop) const;
+
+private:
+  std::vector<std::unique_ptr<Loop> > loops_;
+  MigratedCb callback_;
+  Options options_;
+  std::atomic<uint64_t> migrations_{0};
+  int errno_{0};
+
+  NON_COPYABLE_NOR_MOVABLE(LoopBalancer)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,145 @@
+#include "loop_balancer.h"
+#include "tcp_connection.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+std::string TakeAll(RingBuffer* input) {
+  std::string s(input->Size(), '\0');
+  input->Peek(&s[0], s.size());
+  input->Consume(s.size());
+  return s;
+}
+
+void Spin(int ms) {
+  auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(LoopBalancerTest, DetachAttachTest) {
+  auto poller1 = std::make_unique<LNETNS::event::Poller>();
+  auto poller2 = std::make_unique<LNETNS::event::Poller>();
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+
+  LNETNS::net::TcpConnection::Options opts;
+  opts.coalesce_writes = true;
+  LNETNS::net::TcpConnection conn(poller1.get(), sv[0], opts);
+  std::string input;
+  conn.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* buf) {
+    input += TESTNS::TakeAll(buf);
+  });
+  ASSERT_TRUE(conn.Start());
+
+  ASSERT_EQ(write(sv[1], "a", 1), 1);
+  poller1->DoPoll();
+  EXPECT_EQ(input, "a");
+
+  // Output waiting for the check phase of the old poller, and input arriving while
+  // detached, are both handled by the new one.
+  ASSERT_TRUE(conn.Send("x", 1));
+  ASSERT_TRUE(conn.Detach());
+  EXPECT_EQ(poller1->FdCount(), 0);
+  EXPECT_EQ(poller1->CheckCount(), 0);
+  EXPECT_FALSE(conn.Detach());
+  ASSERT_EQ(write(sv[1], "b", 1), 1);
+
+  ASSERT_TRUE(conn.Attach(poller2.get()));
+  EXPECT_EQ(conn.GetPoller(), poller2.get());
+  EXPECT_FALSE(conn.Attach(poller1.get()));
+  poller2->DoPoll();
+  EXPECT_EQ(input, "ab");
+  char c;
+  ASSERT_EQ(read(sv[1], &c, 1), 1);
+  EXPECT_EQ(c, 'x');
+  close(sv[1]);
+}
+
+GTEST_TEST(LoopBalancerTest, MigrateTest) {
+  auto poller0 = std::make_unique<LNETNS::event::Poller>();
+  auto poller1 = std::make_unique<LNETNS::event::Poller>();
+
+  std::vector<std::pair<LNETNS::net::TcpConnection*, size_t> > migrated;
+  LNETNS::net::LoopBalancer::Options opts;
+  opts.interval = 20;
+  opts.high_utilisation = 0.5;
+  opts.min_gap = 0.2;
+  LNETNS::net::LoopBalancer balancer(
+    {poller0.get(), poller1.get()},
+    [&](LNETNS::net::TcpConnection* conn, size_t from, size_t to) {
+      EXPECT_EQ(from, 0);
+      migrated.emplace_back(conn, to);
+    }, opts);
+  ASSERT_TRUE(balancer.Start());
+
+  // Three connections on loop 0, each burning 2ms per read.
+  constexpr int kConns = 3;
+  std::vector<std::unique_ptr<LNETNS::net::TcpConnection> > conns;
+  std::vector<int> clients;
+  size_t reads = 0;
+  for (int i = 0; i < kConns; ++i) {
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+    conns.push_back(std::make_unique<LNETNS::net::TcpConnection>(poller0.get(), sv[0]));
+    conns.back()->SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* buf) {
+      buf->Consume(buf->Size());
+      ++reads;
+      TESTNS::Spin(2);
+    });
+    ASSERT_TRUE(conns.back()->Start());
+    balancer.Add(0, conns.back().get());
+    clients.push_back(sv[1]);
+  }
+
+  for (int round = 0; round < 40; ++round) {
+    for (auto fd : clients) {
+      ASSERT_EQ(write(fd, "x", 1), 1);
+    }
+    poller0->AddTimer(5, nullptr);
+    poller0->DoPoll();
+    poller1->AddTimer(5, nullptr);
+    poller1->DoPoll();
+  }
+
+  // Loop 0 is saturated, loop 1 mostly waits: all but the busiest one moved.
+  EXPECT_GT(balancer.Utilisation(0), 0.5);
+  EXPECT_EQ(balancer.MigrationCount(), kConns - 1);
+  ASSERT_EQ(migrated.size(), kConns - 1);
+  for (auto& m : migrated) {
+    EXPECT_EQ(m.second, 1);
+    EXPECT_EQ(m.first->GetPoller(), poller1.get());
+  }
+
+  // The migrated connections are served by loop 1 now.
+  reads = 0;
+  for (auto& m : migrated) {
+    for (size_t i = 0; i < conns.size(); ++i) {
+      if (conns[i].get() == m.first) {
+        ASSERT_EQ(write(clients[i], "y", 1), 1);
+      }
+    }
+  }
+  poller1->DoPoll();
+  EXPECT_EQ(reads, kConns - 1);
+
+  balancer.Stop();
+  for (auto fd : clients) {
+    close(fd);
+  }
+}
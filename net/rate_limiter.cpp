@@ -0,0 +1,187 @@
+#include "rate_limiter.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst)
+  : rate_(rate), burst_(burst), tokens_(burst), last_refill_(event::Poller::GetNowMs()) {
+}
+
+void TokenBucket::Refill() {
+  auto now = event::Poller::GetNowMs();
+  if (now <= last_refill_) {
+    return;
+  }
+  tokens_ = std::min<double>(burst_, tokens_ + static_cast<double>(now - last_refill_) * rate_ / 1000);
+  last_refill_ = now;
+}
+
+bool TokenBucket::Consume(uint64_t n) {
+  Refill();
+  tokens_ -= n;
+  return tokens_ >= 1;
+}
+
+bool TokenBucket::TryConsume(uint64_t n) {
+  Refill();
+  if (tokens_ < n) {
+    return false;
+  }
+  tokens_ -= n;
+  return true;
+}
+
+int64_t TokenBucket::Available() {
+  Refill();
+  return static_cast<int64_t>(std::floor(tokens_));
+}
+
+uint32_t TokenBucket::WaitTime() {
+  Refill();
+  if (tokens_ >= 1) {
+    return 0;
+  }
+  if (rate_ == 0) {
+    return UINT32_MAX;
+  }
+  return static_cast<uint32_t>(std::ceil((1 - tokens_) * 1000 / rate_));
+}
+
+void TokenBucket::SetRate(uint64_t rate, uint64_t burst) {
+  Refill();
+  rate_ = rate;
+  burst_ = burst;
+  tokens_ = std::min<double>(tokens_, burst_);
+}
+
+RateLimiter::RateLimiter(event::Poller* poller) : poller_(poller) {
+}
+
+RateLimiter::~RateLimiter() {
+  if (timer_ != event::kBadTimerKey) {
+    poller_->CancelTimer(timer_, this);
+  }
+}
+
+bool RateLimiter::Throttle(int fd, int events, TokenBucket* bucket, ResumeCb callback) {
+  if ((events & event::kEventIn) && !poller_->ResetEventIn(fd)) {
+    return false;
+  }
+  if ((events & event::kEventOut) && !poller_->ResetEventOut(fd)) {
+    return false;
+  }
+
+  auto now = event::Poller::GetNowMs();
+  for (int ev : {event::kEventIn, event::kEventOut}) {
+    if (!(events & ev)) {
+      continue;
+    }
+    auto key = Key(fd, ev);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      auto& entry = it->second;
+      entry.bucket = bucket;
+      if (callback) {
+        entry.callback = callback;
+      }
+      if (entry.pos != ready_.end()) {
+        ready_.erase(entry.pos);
+      }
+      Schedule(key, &entry, now);
+    } else {
+      auto& entry = entries_[key];
+      entry = Entry{bucket, callback, ready_.end()};
+      Schedule(key, &entry, now);
+    }
+  }
+  ArmTimer();
+  return true;
+}
+
+void RateLimiter::Unthrottle(int fd, int events) {
+  for (int ev : {event::kEventIn, event::kEventOut}) {
+    if (!(events & ev)) {
+      continue;
+    }
+    auto it = entries_.find(Key(fd, ev));
+    if (it == entries_.end()) {
+      continue;
+    }
+    if (it->second.pos != ready_.end()) {
+      ready_.erase(it->second.pos);  // not if due and about to resume
+    }
+    entries_.erase(it);
+  }
+  // The timer fires for nothing if it was the earliest, not worth re-arming.
+}
+
+bool RateLimiter::Throttled(int fd, int events) const {
+  return ((events & event::kEventIn) && entries_.count(Key(fd, event::kEventIn)) > 0) ||
+         ((events & event::kEventOut) && entries_.count(Key(fd, event::kEventOut)) > 0);
+}
+
+void RateLimiter::Schedule(uint64_t key, Entry* entry, uint64_t now) {
+  // At least 1ms later, a bucket which is just short of a token isn't spun on.
+  uint64_t wait = std::max<uint32_t>(entry->bucket->WaitTime(), 1);
+  entry->pos = ready_.emplace(now + wait, key);
+}
+
+void RateLimiter::ArmTimer() {
+  if (ready_.empty()) {
+    return;
+  }
+  auto due = ready_.begin()->first;
+  if (timer_ != event::kBadTimerKey) {
+    if (timer_ <= due) {
+      return;
+    }
+    poller_->CancelTimer(timer_, this);
+  }
+  auto now = event::Poller::GetNowMs();
+  timer_ = poller_->AddTimer(due > now ? due - now : 0, this);
+}
+
+void RateLimiter::OnTimeout(int id) {
+  timer_ = event::kBadTimerKey;
+  auto now = event::Poller::GetNowMs();
+
+  // Callbacks may throttle or unthrottle fds, collect the due ones first.
+  std::vector<uint64_t> due;
+  for (auto it = ready_.begin(); it != ready_.end() && it->first <= now;) {
+    auto key = it->second;
+    auto& entry = entries_[key];
+    it = ready_.erase(it);
+    if (entry.bucket->WaitTime() > 0) {
+      // Tokens were taken by another fd sharing the bucket.
+      Schedule(key, &entry, now);
+    } else {
+      entry.pos = ready_.end();
+      due.push_back(key);
+    }
+  }
+
+  for (auto key : due) {
+    auto it = entries_.find(key);
+    if (it == entries_.end() || it->second.pos != ready_.end()) {
+      continue;  // unthrottled or throttled again meanwhile
+    }
+    auto callback = std::move(it->second.callback);
+    entries_.erase(it);
+    int fd = static_cast<int>(key >> 2);
+    if (key & event::kEventIn) {
+      poller_->SetEventIn(fd);
+    } else {
+      poller_->SetEventOut(fd);
+    }
+    if (callback) {
+      callback(fd);
+    }
+  }
+  ArmTimer();
+}
+
+}  // namespace net
+}  // namespace LNETNS
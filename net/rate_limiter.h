@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include "event/poller.h"
+
+namespace LNETNS {
+namespace net {
+
+// Classic token bucket: "rate" tokens per second are added up to "burst". A token
+// is whatever the caller counts, a byte or an operation. One bucket may be shared
+// by many connections, e.g. all the connections of a tenant or of a listener.
+class TokenBucket {
+public:
+  TokenBucket(uint64_t rate, uint64_t burst);
+  TokenBucket() = delete;
+
+  // Take "n" tokens. The balance may go below zero, so that a read larger than the
+  // balance is still accounted for: the debt is paid back by the refill.
+  // Returns false if there is no token left afterwards.
+  bool Consume(uint64_t n);
+  // Take "n" tokens only if they are all available.
+  bool TryConsume(uint64_t n);
+  // Tokens currently available, negative while in debt.
+  int64_t Available();
+  // Milliseconds until at least one token is available, 0 if there is one.
+  uint32_t WaitTime();
+
+  void SetRate(uint64_t rate, uint64_t burst);
+  inline uint64_t Rate() const { return rate_; }
+  inline uint64_t Burst() const { return burst_; }
+
+private:
+  void Refill();
+
+private:
+  uint64_t rate_;
+  uint64_t burst_;
+  double tokens_;
+  uint64_t last_refill_;  // GetNowMs()
+
+  NON_COPYABLE_NOR_MOVABLE(TokenBucket)
+};
+
+// Called after a throttled event of "fd" has been enabled again.
+using ResumeCb = std::function<void(int fd)>;
+
+// Pauses fds whose token bucket ran dry and resumes them when tokens return.
+//
+// Throttle() disables the given events with ResetEventIn()/ResetEventOut(). Each
+// event of an fd is throttled on its own, so that reads and writes of a connection
+// may be limited by different buckets. All the throttled fds of a poller share a
+// single timer, armed for the earliest one that can resume, so that many throttled
+// connections only cost a map entry per event.
+class RateLimiter : public event::EventHandler {
+public:
+  explicit RateLimiter(event::Poller* poller);
+  RateLimiter() = delete;
+  ~RateLimiter() override;
+
+  // Disable "events" (kEventIn and/or kEventOut) of "fd" until "bucket" has tokens,
+  // then enable each of them again and call "callback". Throttling a throttled
+  // event again replaces its bucket, and its callback if one is given.
+  bool Throttle(int fd, int events, TokenBucket* bucket, ResumeCb callback = nullptr);
+  // Forget "events" of "fd" without touching them, call it before closing the fd.
+  void Unthrottle(int fd, int events = event::kEventIn | event::kEventOut);
+
+  bool Throttled(int fd, int events = event::kEventIn | event::kEventOut) const;
+  // Throttled events of all the fds.
+  inline size_t ThrottledCount() const { return entries_.size(); }
+
+private:
+  using ReadyQueue = std::multimap<uint64_t, uint64_t>;  // resume time -> key
+
+  struct Entry {
+    TokenBucket* bucket;
+    ResumeCb callback;
+    ReadyQueue::iterator pos;
+  };
+
+  // An event (kEventIn or kEventOut) of an fd.
+  static inline uint64_t Key(int fd, int ev) { return uint64_t(fd) << 2 | ev; }
+  void Schedule(uint64_t key, Entry* entry, uint64_t now);
+  void ArmTimer();
+  void OnReadable(int fd) override {}
+  void OnWritable(int fd) override {}
+  void OnTimeout(int id) override;
+
+private:
+  event::Poller* poller_{nullptr};
+  std::unordered_map<uint64_t, Entry> entries_;
+  ReadyQueue ready_;
+  event::TimerKey timer_{event::kBadTimerKey};  // expires at its key
+
+  NON_COPYABLE_NOR_MOVABLE(RateLimiter)
+};
+
+}  // namespace net
+}  // namespace LNETNS
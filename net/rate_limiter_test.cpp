@@ -0,0 +1,248 @@
+#include "rate_limiter.h"
+#include "tcp_connection.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+struct Sink : public event::EventHandler {
+  void OnReadable(int fd) override { ++reads; }
+  void OnWritable(int fd) override {}
+
+  int reads{0};
+};
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(RateLimiterTest, TokenBucketTest) {
+  LNETNS::net::TokenBucket bucket(1000, 100);  // 1 token per millisecond
+  EXPECT_EQ(bucket.Available(), 100);
+  EXPECT_TRUE(bucket.TryConsume(60));
+  EXPECT_FALSE(bucket.TryConsume(60));
+  EXPECT_EQ(bucket.WaitTime(), 0);
+
+  // Debt is paid back by the refill.
+  EXPECT_FALSE(bucket.Consume(90));
+  EXPECT_LE(bucket.Available(), -50 + 5);
+  EXPECT_GE(bucket.WaitTime(), 45);
+  usleep(80 * 1000);
+  EXPECT_GT(bucket.Available(), 0);
+
+  // Never above the burst.
+  usleep(150 * 1000);
+  EXPECT_EQ(bucket.Available(), 100);
+}
+
+GTEST_TEST(RateLimiterTest, SharedTimerTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::RateLimiter limiter(poller.get());
+  LNETNS::net::TokenBucket bucket(1000, 10);
+  ASSERT_FALSE(bucket.Consume(30));  // 20ms in debt
+
+  // Many readable fds, all throttled by the same bucket.
+  constexpr int kCount = 100;
+  TESTNS::Sink sink;
+  std::vector<int> fds;
+  for (int i = 0; i < kCount; ++i) {
+    int pair[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair), 0);
+    ASSERT_EQ(write(pair[1], "x", 1), 1);
+    ASSERT_TRUE(poller->UpsertFd(pair[0], &sink, LNETNS::event::kEventIn));
+    ASSERT_TRUE(limiter.Throttle(pair[0], LNETNS::event::kEventIn, &bucket));
+    fds.push_back(pair[0]);
+    fds.push_back(pair[1]);
+  }
+  EXPECT_EQ(limiter.ThrottledCount(), kCount);
+  EXPECT_EQ(poller->TimerCount(), 1);
+
+  // Input is ignored while throttled.
+  auto start = LNETNS::event::Poller::GetNowMs();
+  int resumed = 0;
+  limiter.Unthrottle(fds[0]);
+  poller->RemoveFd(fds[0]);
+  while (sink.reads == 0) {
+    poller->DoPoll();
+  }
+  EXPECT_GE(LNETNS::event::Poller::GetNowMs() - start, 15);
+  EXPECT_EQ(limiter.ThrottledCount(), 0);
+  EXPECT_EQ(sink.reads, kCount - 1);
+
+  // The callback follows re-enabling.
+  ASSERT_FALSE(bucket.Consume(bucket.Available() + 5));
+  ASSERT_TRUE(limiter.Throttle(fds[2], LNETNS::event::kEventIn, &bucket,
+                               [&](int fd) { ++resumed; }));
+  while (resumed == 0) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(poller->TimerCount(), 0);
+
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if (i % 2 == 0) {
+      poller->RemoveFd(fds[i]);
+    }
+    close(fds[i]);
+  }
+}
+
+GTEST_TEST(RateLimiterTest, ResumeCallbackTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::RateLimiter limiter(poller.get());
+  LNETNS::net::TokenBucket bucket(1000, 10);
+  TESTNS::Sink sink;
+  int pairs[2][2];
+  for (auto& pair : pairs) {
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair), 0);
+    ASSERT_TRUE(poller->UpsertFd(pair[0], &sink, LNETNS::event::kEventIn));
+  }
+  int a = pairs[0][0];
+  int b = pairs[1][0];
+
+  // Both are due together, the first resumed one unthrottles the other.
+  std::vector<int> resumed;
+  auto unthrottle_other = [&](int fd) {
+    resumed.push_back(fd);
+    limiter.Unthrottle(fd == a ? b : a);
+  };
+  ASSERT_FALSE(bucket.Consume(15));
+  ASSERT_TRUE(limiter.Throttle(a, LNETNS::event::kEventIn, &bucket, unthrottle_other));
+  ASSERT_TRUE(limiter.Throttle(b, LNETNS::event::kEventIn, &bucket, unthrottle_other));
+  usleep(30 * 1000);
+  poller->DoPoll();
+  EXPECT_EQ(resumed.size(), 1);
+  EXPECT_EQ(limiter.ThrottledCount(), 0);
+
+  // Or throttles it again, it then resumes later.
+  resumed.clear();
+  auto throttle_other = [&](int fd) {
+    resumed.push_back(fd);
+    if (resumed.size() == 1) {
+      ASSERT_FALSE(bucket.Consume(bucket.Available() + 5));
+      ASSERT_TRUE(limiter.Throttle(fd == a ? b : a, LNETNS::event::kEventIn, &bucket));
+    }
+  };
+  ASSERT_FALSE(bucket.Consume(bucket.Available() + 5));
+  ASSERT_TRUE(limiter.Throttle(a, LNETNS::event::kEventIn, &bucket, throttle_other));
+  ASSERT_TRUE(limiter.Throttle(b, LNETNS::event::kEventIn, &bucket, throttle_other));
+  usleep(30 * 1000);
+  poller->DoPoll();
+  EXPECT_EQ(resumed.size(), 1);
+  EXPECT_EQ(limiter.ThrottledCount(), 1);
+  while (limiter.ThrottledCount() > 0) {
+    poller->DoPoll();
+  }
+  ASSERT_EQ(resumed.size(), 2);
+  EXPECT_NE(resumed[0], resumed[1]);
+
+  for (auto& pair : pairs) {
+    poller->RemoveFd(pair[0]);
+    close(pair[0]);
+    close(pair[1]);
+  }
+}
+
+GTEST_TEST(RateLimiterTest, ConnectionReadLimitTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  LNETNS::net::RateLimiter limiter(poller.get());
+  LNETNS::net::TokenBucket bucket(1024 * 1024, 64 * 1024);  // 1MB/s
+  LNETNS::net::TcpConnection conn(poller.get(), fds[0]);
+  size_t received = 0;
+  conn.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* input) {
+    received += input->Size();
+    input->Consume(input->Size());
+  });
+  conn.SetReadLimit(&limiter, &bucket);
+  ASSERT_TRUE(conn.Start());
+
+  std::string data(256 * 1024, 'x');
+  size_t sent = 0;
+  auto start = LNETNS::event::Poller::GetNowMs();
+  bool throttled = false;
+  while (received < data.size()) {
+    if (sent < data.size()) {
+      auto n = write(fds[1], data.data() + sent, data.size() - sent);
+      if (n > 0) {
+        sent += n;
+      }
+    }
+    poller->DoPoll();
+    throttled = throttled || conn.ReadingThrottled();
+  }
+  // The burst goes through right away, the rest at the rate.
+  EXPECT_TRUE(throttled);
+  EXPECT_GE(LNETNS::event::Poller::GetNowMs() - start, 150);
+  EXPECT_EQ(received, data.size());
+
+  conn.Close();
+  EXPECT_EQ(limiter.ThrottledCount(), 0);
+  close(fds[1]);
+}
+
+GTEST_TEST(RateLimiterTest, ConnectionWriteLimitTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  LNETNS::net::RateLimiter limiter(poller.get());
+  LNETNS::net::TokenBucket bucket(1024 * 1024, 64 * 1024);  // 1MB/s
+  LNETNS::net::TcpConnection conn(poller.get(), fds[0]);
+  int completes = 0;
+  conn.SetWriteCompleteCallback([&](LNETNS::net::TcpConnection* c) { ++completes; });
+  conn.SetWriteLimit(&limiter, &bucket);
+  ASSERT_TRUE(conn.Start());
+
+  // Only the burst is written right away.
+  std::string data(256 * 1024, 'x');
+  auto start = LNETNS::event::Poller::GetNowMs();
+  ASSERT_TRUE(conn.Send(data.data(), data.size()));
+  EXPECT_EQ(conn.BytesWritten(), 64 * 1024);
+  EXPECT_TRUE(conn.WritingThrottled());
+
+  // The rest at the rate, completed once.
+  std::string buf(data.size(), '\0');
+  size_t received = 0;
+  while (received < data.size()) {
+    auto n = read(fds[1], &buf[0], buf.size());
+    if (n > 0) {
+      received += n;
+    }
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_GE(LNETNS::event::Poller::GetNowMs() - start, 150);
+  poller->AddTimer(10, nullptr);
+  poller->DoPoll();
+  EXPECT_EQ(completes, 1);
+  EXPECT_FALSE(conn.WritingThrottled());
+
+  // Reads and writes of the fd are throttled on their own by the same limiter.
+  LNETNS::net::TokenBucket empty(1000, 1);
+  ASSERT_FALSE(empty.Consume(10));
+  ASSERT_TRUE(limiter.Throttle(conn.Fd(), LNETNS::event::kEventIn, &empty));
+  ASSERT_TRUE(limiter.Throttle(conn.Fd(), LNETNS::event::kEventOut, &empty));
+  EXPECT_EQ(limiter.ThrottledCount(), 2);
+  limiter.Unthrottle(conn.Fd(), LNETNS::event::kEventIn);
+  EXPECT_FALSE(limiter.Throttled(conn.Fd(), LNETNS::event::kEventIn));
+  EXPECT_TRUE(limiter.Throttled(conn.Fd(), LNETNS::event::kEventOut));
+  limiter.Unthrottle(conn.Fd());
+  EXPECT_EQ(limiter.ThrottledCount(), 0);
+
+  conn.Close();
+  close(fds[1]);
+}
+
+#undef TESTNS
@@ -0,0 +1,131 @@
+#include "ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+size_t RoundUpPowerOfTwo(size_t n) {
+  size_t cap = 1;
+  while (cap < n) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+}  // unnamed namespace
+
+RingBuffer::RingBuffer(size_t capacity)
+  : capacity_(RoundUpPowerOfTwo(std::max<size_t>(capacity, 64))) {
+  buffer_.reset(new char[capacity_]);
+}
+
+int RingBuffer::ReadableIovecs(iovec iov[2]) const {
+  auto size = Size();
+  if (size == 0) {
+    return 0;
+  }
+  auto start = head_ & (capacity_ - 1);
+  auto first = std::min(size, capacity_ - start);
+  iov[0].iov_base = buffer_.get() + start;
+  iov[0].iov_len = first;
+  if (first == size) {
+    return 1;
+  }
+  iov[1].iov_base = buffer_.get();
+  iov[1].iov_len = size - first;
+  return 2;
+}
+
+int RingBuffer::ReadableIovecs(iovec iov[2], size_t off, size_t len) const {
+  if (off >= Size()) {
+    return 0;
+  }
+  len = std::min(len, Size() - off);
+  if (len == 0) {
+    return 0;
+  }
+  auto start = (head_ + off) & (capacity_ - 1);
+  auto first = std::min(len, capacity_ - start);
+  iov[0].iov_base = buffer_.get() + start;
+  iov[0].iov_len = first;
+  if (first == len) {
+    return 1;
+  }
+  iov[1].iov_base = buffer_.get();
+  iov[1].iov_len = len - first;
+  return 2;
+}
+
+int RingBuffer::WritableIovecs(iovec iov[2]) {
+  auto space = Writable();
+  if (space == 0) {
+    return 0;
+  }
+  auto start = tail_ & (capacity_ - 1);
+  auto first = std::min(space, capacity_ - start);
+  iov[0].iov_base = buffer_.get() + start;
+  iov[0].iov_len = first;
+  if (first == space) {
+    return 1;
+  }
+  iov[1].iov_base = buffer_.get();
+  iov[1].iov_len = space - first;
+  return 2;
+}
+
+void RingBuffer::Consume(size_t n) {
+  head_ += std::min(n, Size());
+  if (head_ == tail_) {
+    // Start over from the beginning, keeps the next read/write in one span.
+    head_ = tail_ = 0;
+  }
+}
+
+void RingBuffer::Commit(size_t n) {
+  tail_ += std::min(n, Writable());
+}
+
+void RingBuffer::Reserve(size_t n) {
+  if (Writable() < n) {
+    Grow(Size() + n);
+  }
+}
+
+void RingBuffer::Append(const void* data, size_t len) {
+  Reserve(len);
+  auto src = static_cast<const char*>(data);
+  auto start = tail_ & (capacity_ - 1);
+  auto first = std::min(len, capacity_ - start);
+  std::memcpy(buffer_.get() + start, src, first);
+  std::memcpy(buffer_.get(), src + first, len - first);
+  tail_ += len;
+}
+
+size_t RingBuffer::Peek(void* out, size_t len, size_t off) const {
+  if (off >= Size()) {
+    return 0;
+  }
+  len = std::min(len, Size() - off);
+  auto dst = static_cast<char*>(out);
+  auto start = (head_ + off) & (capacity_ - 1);
+  auto first = std::min(len, capacity_ - start);
+  std::memcpy(dst, buffer_.get() + start, first);
+  std::memcpy(dst + first, buffer_.get(), len - first);
+  return len;
+}
+
+void RingBuffer::Grow(size_t min_capacity) {
+  auto capacity = RoundUpPowerOfTwo(min_capacity);
+  std::unique_ptr<char[]> buffer(new char[capacity]);
+  auto size = Peek(buffer.get(), Size());
+  buffer_ = std::move(buffer);
+  capacity_ = capacity;
+  head_ = 0;
+  tail_ = size;
+}
+
+}  // namespace net
+}  // namespace LNETNS
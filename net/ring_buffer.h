@@ -0,0 +1,67 @@
+#pragma once
+#include "config.h"
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <memory>
+
+namespace LNETNS {
+namespace net {
+
+// Growable byte ring buffer. The capacity is always a power of two so that
+// positions wrap with a mask. Readable and writable regions are exposed as (at
+// most) two iovecs to be filled/drained with readv/writev directly, without an
+// intermediate copy.
+class RingBuffer {
+public:
+  static constexpr size_t kDefaultCapacity = 4096;
+
+  RingBuffer() : RingBuffer(kDefaultCapacity) {}
+  explicit RingBuffer(size_t capacity);
+
+  RingBuffer(RingBuffer&&) noexcept = default;
+  RingBuffer& operator=(RingBuffer&&) noexcept = default;
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  inline size_t Size() const { return tail_ - head_; }
+  inline bool Empty() const { return tail_ == head_; }
+  inline size_t Capacity() const { return capacity_; }
+  inline size_t Writable() const { return capacity_ - Size(); }
+
+  // Returns the number of iovecs (0, 1 or 2) covering the readable bytes.
+  int ReadableIovecs(iovec iov[2]) const;
+  // Same for the readable bytes [off, off + len), clamped to Size().
+  int ReadableIovecs(iovec iov[2], size_t off, size_t len) const;
+  // Returns the number of iovecs (0, 1 or 2) covering the free space.
+  int WritableIovecs(iovec iov[2]);
+
+  // Drop n readable bytes from the front.
+  void Consume(size_t n);
+  // Mark n bytes written through WritableIovecs() as readable.
+  void Commit(size_t n);
+
+  // Make sure at least n bytes can be written without growing.
+  void Reserve(size_t n);
+  void Append(const void* data, size_t len);
+
+  // Copy up to len readable bytes from offset "off" without consuming them.
+  size_t Peek(void* out, size_t len, size_t off = 0) const;
+  // Byte at readable offset "off" (off < Size()).
+  inline char At(size_t off) const { return buffer_[(head_ + off) & (capacity_ - 1)]; }
+
+  void Clear() { head_ = tail_ = 0; }
+
+private:
+  void Grow(size_t min_capacity);
+
+private:
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_{0};
+  // Monotonic positions, the index into buffer_ is "pos & (capacity_ - 1)".
+  size_t head_{0};
+  size_t tail_{0};
+};
+
+}  // namespace net
+}  // namespace LNETNS
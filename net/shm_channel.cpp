@@ -0,0 +1,432 @@
+#include "shm_channel.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#include "unix_socket.h"
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x4c4e5348;  // "LNSH"
+constexpr char kSetupMessage[] = "lightnet-shm";
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+size_t HeaderSize() {
+  return (sizeof(ShmChannel::RingHeader) + 63) & ~size_t(63);
+}
+
+size_t RoundUp(size_t n) {
+  size_t cap = 4096;
+  while (cap < n) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+inline void CpuRelax() {
+#if defined __x86_64__ || defined __i386__
+  __builtin_ia32_pause();
+#elif defined __aarch64__
+  asm volatile("yield");
+#endif
+}
+
+}  // unnamed namespace
+
+const ShmChannel::Options ShmChannel::kDefaultOptions;
+
+ShmChannel::ShmChannel(event::Poller* poller) : ShmChannel(poller, kDefaultOptions) {
+}
+
+ShmChannel::ShmChannel(event::Poller* poller, const Options& opt) : poller_(poller) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+  spin_us_ = options_->max_spin_us;
+}
+
+ShmChannel::~ShmChannel() {
+  Close();
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+bool ShmChannel::Create() {
+  if (mem_ || mem_fd_ != BAD_FD) {
+    return false;
+  }
+#if defined HAVE_MEMFD_CREATE && defined HAVE_EVENTFD
+  capacity_ = RoundUp(options_->capacity);
+  mem_fd_ = memfd_create("lightnet-shm", MFD_CLOEXEC);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  peer_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mem_fd_ == -1 || event_fd_ == -1 || peer_event_fd_ == -1 ||
+      ftruncate(mem_fd_, 2 * (HeaderSize() + capacity_)) != 0) {
+    errno_ = errno;
+    Close();
+    return false;
+  }
+  creator_ = true;
+  if (!Map(mem_fd_, true)) {
+    Close();
+    return false;
+  }
+  return true;
+#else
+  errno_ = ENOSYS;
+  return false;
+#endif
+}
+
+bool ShmChannel::Map(int mem_fd, bool init) {
+  struct stat st;
+  if (fstat(mem_fd, &st) != 0) {
+    errno_ = errno;
+    return false;
+  }
+  mem_size_ = st.st_size;
+  if (mem_size_ < 2 * HeaderSize()) {
+    errno_ = EPROTO;
+    return false;
+  }
+  mem_ = mmap(nullptr, mem_size_, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+  if (mem_ == MAP_FAILED) {
+    errno_ = errno;
+    mem_ = nullptr;
+    return false;
+  }
+
+  auto base = static_cast<char*>(mem_);
+  auto ring0 = reinterpret_cast<RingHeader*>(base);
+  if (init) {
+    new (ring0) RingHeader();
+    ring0->magic = kMagic;
+    ring0->capacity = capacity_;
+  } else {
+    capacity_ = ring0->capacity;
+    // Both rings must fit exactly, the peer is trusted no further than that.
+    if (ring0->magic != kMagic || capacity_ == 0 || (capacity_ & (capacity_ - 1)) != 0 ||
+        mem_size_ != 2 * (HeaderSize() + capacity_)) {
+      errno_ = EPROTO;
+      Unmap();
+      return false;
+    }
+  }
+  auto ring1 = reinterpret_cast<RingHeader*>(base + HeaderSize() + capacity_);
+  if (init) {
+    new (ring1) RingHeader();
+    ring1->magic = kMagic;
+    ring1->capacity = capacity_;
+    // Nobody has read yet: the first write wakes the reader up.
+    ring0->reader_waiting.store(1);
+    ring1->reader_waiting.store(1);
+  }
+
+  // The creator writes ring 0 and reads ring 1, the peer the other way around.
+  auto data0 = base + HeaderSize();
+  auto data1 = base + 2 * HeaderSize() + capacity_;
+  tx_ = creator_ ? ring0 : ring1;
+  tx_data_ = creator_ ? data0 : data1;
+  rx_ = creator_ ? ring1 : ring0;
+  rx_data_ = creator_ ? data1 : data0;
+  cached_head_ = tx_->head.load(std::memory_order_acquire);
+  delivered_ = rx_->head.load(std::memory_order_acquire);
+  return true;
+}
+
+bool ShmChannel::SendTo(int unix_fd) {
+  if (mem_fd_ == BAD_FD || !creator_) {
+    return false;
+  }
+  // The peer's eventfd first.
+  int fds[3] = {mem_fd_, peer_event_fd_, event_fd_};
+  if (SendWithFds(unix_fd, kSetupMessage, sizeof(kSetupMessage), fds, 3) !=
+      static_cast<ssize_t>(sizeof(kSetupMessage))) {
+    errno_ = errno;
+    return false;
+  }
+  return true;
+}
+
+bool ShmChannel::ReceiveFrom(int unix_fd) {
+  if (mem_) {
+    return false;
+  }
+  char buf[sizeof(kSetupMessage)];
+  int fds[3];
+  int nfds = 0;
+  auto n = RecvWithFds(unix_fd, buf, sizeof(buf), fds, &nfds, 3);
+  if (n < 0) {
+    errno_ = errno;
+    return false;
+  }
+  if (n != sizeof(buf) || nfds != 3 || std::memcmp(buf, kSetupMessage, sizeof(buf)) != 0) {
+    for (int i = 0; i < nfds; ++i) {
+      close(fds[i]);
+    }
+    errno_ = EPROTO;
+    return false;
+  }
+
+  creator_ = false;
+  event_fd_ = fds[1];
+  peer_event_fd_ = fds[2];
+  bool ok = Map(fds[0], false);
+  // The mapping keeps the memory alive.
+  close(fds[0]);
+  if (!ok) {
+    Close();
+  }
+  return ok;
+}
+
+bool ShmChannel::Start() {
+  if (!mem_ || closed_) {
+    return false;
+  }
+  if (mem_fd_ != BAD_FD) {
+    close(mem_fd_);
+    mem_fd_ = BAD_FD;
+  }
+  if (!poller_->UpsertFd(event_fd_, this, event::kEventIn)) {
+    errno_ = poller_->GetLastErrno();
+    return false;
+  }
+  started_ = true;
+  // Data written before we started.
+  WakeSelf();
+  return true;
+}
+
+void ShmChannel::Close() {
+  if (tx_ && !closed_) {
+    tx_->closed.store(1, std::memory_order_release);
+    WakePeer();
+  }
+  closed_ = true;
+  if (started_) {
+    poller_->RemoveFd(event_fd_);
+    started_ = false;
+  }
+  for (auto fd : {&mem_fd_, &event_fd_, &peer_event_fd_}) {
+    if (*fd != BAD_FD) {
+      close(*fd);
+      *fd = BAD_FD;
+    }
+  }
+  Unmap();
+}
+
+void ShmChannel::Unmap() {
+  if (mem_) {
+    munmap(mem_, mem_size_);
+    mem_ = nullptr;
+  }
+  tx_ = rx_ = nullptr;
+  tx_data_ = rx_data_ = nullptr;
+}
+
+size_t ShmChannel::Writable() const {
+  if (!tx_ || closed_) {
+    return 0;
+  }
+  size_t used = tx_->tail.load(std::memory_order_relaxed) -
+                tx_->head.load(std::memory_order_acquire);
+  return used > capacity_ ? 0 : capacity_ - used;
+}
+
+size_t ShmChannel::Write(const void* data, size_t len) {
+  if (!tx_ || closed_) {
+    return 0;
+  }
+  auto tail = tx_->tail.load(std::memory_order_relaxed);
+  size_t used = tail - cached_head_;
+  if (used > capacity_ || capacity_ - used < len) {
+    cached_head_ = tx_->head.load(std::memory_order_acquire);
+    used = tail - cached_head_;
+    if (used > capacity_) {
+      // The head went backwards or past the tail.
+      Close();
+      errno_ = EPROTO;
+      return 0;
+    }
+  }
+  size_t n = std::min(len, capacity_ - used);
+  if (n > 0) {
+    size_t off = tail & (capacity_ - 1);
+    size_t first = std::min(n, capacity_ - off);
+    std::memcpy(tx_data_ + off, data, first);
+    std::memcpy(tx_data_, static_cast<const char*>(data) + first, n - first);
+    tx_->tail.store(tail + n, std::memory_order_release);
+
+    // Pairs with the fence of the reader going to sleep, see event::ChannelBase.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (tx_->reader_waiting.load(std::memory_order_relaxed) && tx_->reader_waiting.exchange(0)) {
+      WakePeer();
+    }
+  }
+
+  if (n < len) {
+    want_write_ = true;
+    tx_->writer_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (tx_->head.load(std::memory_order_acquire) != cached_head_ &&
+        tx_->writer_waiting.exchange(0)) {
+      // Room was made meanwhile, the reader won't tell.
+      WakeSelf();
+    }
+  }
+  return n;
+}
+
+void ShmChannel::Deliver(uint64_t head, uint64_t tail) {
+  size_t avail = tail - head;
+  size_t off = head & (capacity_ - 1);
+  iovec iov[2];
+  int cnt = 1;
+  iov[0].iov_base = rx_data_ + off;
+  iov[0].iov_len = std::min(avail, capacity_ - off);
+  if (iov[0].iov_len < avail) {
+    iov[1].iov_base = rx_data_;
+    iov[1].iov_len = avail - iov[0].iov_len;
+    cnt = 2;
+  }
+
+  size_t consumed = data_cb_ ? std::min(data_cb_(this, iov, cnt), avail) : avail;
+  if (consumed == 0 || !rx_) {
+    return;  // nothing, or closed by the callback
+  }
+  rx_->head.store(head + consumed, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (rx_->writer_waiting.load(std::memory_order_relaxed) && rx_->writer_waiting.exchange(0)) {
+    WakePeer();
+  }
+}
+
+bool ShmChannel::Spin() {
+  if (options_->max_spin_us == 0) {
+    return false;
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spin_us_);
+  do {
+    for (int i = 0; i < 64; ++i) {
+      if (rx_->tail.load(std::memory_order_acquire) != delivered_ ||
+          rx_->closed.load(std::memory_order_relaxed)) {
+        // Worth spinning longer next time.
+        spin_us_ = std::min(options_->max_spin_us, spin_us_ * 2);
+        return true;
+      }
+      CpuRelax();
+    }
+  } while (std::chrono::steady_clock::now() < deadline);
+  spin_us_ = std::max<uint32_t>(spin_us_ / 2, 1);
+  return false;
+}
+
+bool ShmChannel::Drain() {
+  // Yield to other events after a full ring, without going to sleep.
+  uint64_t budget = delivered_ + capacity_;
+  for (;;) {
+    auto closed = rx_->closed.load(std::memory_order_acquire);
+    auto tail = rx_->tail.load(std::memory_order_acquire);
+    if (tail != delivered_) {
+      // Shared with the peer, which may be broken: never trust a size above the ring.
+      auto head = rx_->head.load(std::memory_order_relaxed);
+      if (tail - head > capacity_) {
+        errno_ = EPROTO;
+        tx_->closed.store(1, std::memory_order_release);
+        WakePeer();
+        return false;
+      }
+      delivered_ = tail;
+      Deliver(head, tail);
+      if (closed_) {
+        return true;
+      }
+      if (tail >= budget) {
+        WakeSelf();
+        return true;
+      }
+      continue;
+    }
+    if (closed) {
+      return false;
+    }
+    if (Spin()) {
+      continue;
+    }
+
+    rx_->reader_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rx_->tail.load(std::memory_order_acquire) == tail || !rx_->reader_waiting.exchange(0)) {
+      // Nothing new, or the writer saw us waiting and woke us up already.
+      return true;
+    }
+  }
+}
+
+void ShmChannel::OnReadable(int fd) {
+  uint64_t count;
+  auto rc = read(event_fd_, &count, sizeof(count));
+  (void)rc;
+
+  bool peer_open = Drain();
+  if (closed_) {
+    return;
+  }
+  if (want_write_ && Writable() > 0) {
+    want_write_ = false;
+    if (writable_cb_) {
+      writable_cb_(this);
+    }
+    if (closed_) {
+      return;
+    }
+  }
+  if (!peer_open) {
+    // Our side stays mapped until Close() or the destructor.
+    closed_ = true;
+    poller_->RemoveFd(event_fd_);
+    started_ = false;
+    if (close_cb_) {
+      close_cb_(this);
+    }
+  }
+}
+
+void ShmChannel::WakePeer() {
+  if (peer_event_fd_ == BAD_FD) {
+    return;
+  }
+  uint64_t one = 1;
+  auto rc = write(peer_event_fd_, &one, sizeof(one));
+  (void)rc;
+  ++wakeups_;
+}
+
+void ShmChannel::WakeSelf() {
+  if (event_fd_ == BAD_FD) {
+    return;
+  }
+  uint64_t one = 1;
+  auto rc = write(event_fd_, &one, sizeof(one));
+  (void)rc;
+}
+
+}  // namespace net
+}  // namespace LNETNS
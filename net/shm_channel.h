@@ -0,0 +1,138 @@
+#pragma once
+#include <sys/uio.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "macros.h"
+#include "event/poller.h"
+
+namespace LNETNS {
+namespace net {
+
+class ShmChannel;
+
+// Called with the readable bytes (one or two pieces when they wrap around the end
+// of the ring), returns the number of bytes consumed. Bytes left are passed again
+// with the next ones.
+using ShmDataCb = std::function<size_t(ShmChannel* ch, const iovec* iov, int count)>;
+// Called when the ring has room again after a short Write().
+using ShmWritableCb = std::function<void(ShmChannel* ch)>;
+// Called once when the peer closed its side, or broke the ring protocol (then
+// GetLastErrno() is EPROTO). The channel may be released in it.
+using ShmCloseCb = std::function<void(ShmChannel* ch)>;
+
+// Duplex byte stream between two processes of the same host over shared memory.
+//
+// A memfd holds two single-producer/single-consumer byte rings, one per direction.
+// Each side has an eventfd, registered on its poller, which the peer writes to
+// wake it up. Like event::Channel, a side only writes to the peer's eventfd when
+// the peer announced it is going to sleep, so busy peers exchange data with no
+// system call at all. Before sleeping, the reader spins for a while on the ring;
+// the spin time adapts to whether spinning found data recently.
+//
+// Setup: one side Create()s the memory and the eventfds and passes them over a unix
+// socket with SendTo(), the other side maps them with ReceiveFrom(). Both then
+// Start() on their poller.
+//
+// Requires memfd_create() and eventfd(), Create() fails with ENOSYS otherwise.
+class ShmChannel : public event::EventHandler {
+public:
+  struct Options {
+    size_t capacity{1 << 20};  // per direction, rounded up to a power of 2
+    uint32_t max_spin_us{20};  // 0 disables spinning
+  };
+
+public:
+  explicit ShmChannel(event::Poller* poller);
+  ShmChannel(event::Poller* poller, const Options& opt);
+  ShmChannel() = delete;
+  ~ShmChannel() override;
+
+  bool Create();
+  // Send the memfd and eventfds over a connected unix socket.
+  bool SendTo(int unix_fd);
+  // Map the memory sent by the peer's SendTo(). Fails with EAGAIN if it hasn't
+  // arrived yet (non-blocking socket), call it again once readable.
+  bool ReceiveFrom(int unix_fd);
+
+  // Register to the poller and deliver what the peer already wrote.
+  bool Start();
+  // Tell the peer and release the memory. Unlike the peer closing, it doesn't invoke
+  // the close callback.
+  void Close();
+
+  // Copy up to "len" bytes into the ring, returns the number of bytes written. A
+  // short count means the ring is full: the writable callback is invoked once the
+  // reader made room. If the peer corrupted the ring, the channel is closed and
+  // GetLastErrno() is EPROTO.
+  size_t Write(const void* data, size_t len);
+  size_t Writable() const;
+
+  inline void SetDataCallback(ShmDataCb cb) { data_cb_ = std::move(cb); }
+  inline void SetWritableCallback(ShmWritableCb cb) { writable_cb_ = std::move(cb); }
+  inline void SetCloseCallback(ShmCloseCb cb) { close_cb_ = std::move(cb); }
+
+  inline bool Connected() const { return rx_ != nullptr && !closed_; }
+  inline size_t Capacity() const { return capacity_; }
+  // Eventfd writes of this side, i.e. the system calls of the data path.
+  inline uint64_t WakeupCount() const { return wakeups_; }
+  inline int GetLastErrno() const { return errno_; }
+
+  // Shared ring state. The indexes only grow, their difference is the size.
+  struct RingHeader {
+    alignas(64) std::atomic<uint64_t> head;  // consumer
+    alignas(64) std::atomic<uint64_t> tail;  // producer
+    alignas(64) std::atomic<uint32_t> reader_waiting;
+    std::atomic<uint32_t> writer_waiting;
+    std::atomic<uint32_t> closed;  // by the producer
+    uint32_t magic;
+    uint64_t capacity;
+  };
+
+protected:
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override {}
+
+  bool Map(int mem_fd, bool init);
+  // Deliver the readable bytes, returns false if the peer closed.
+  bool Drain();
+  void Deliver(uint64_t head, uint64_t tail);
+  // Wait for data for up to the adaptive spin time, returns true if some came.
+  bool Spin();
+  void WakePeer();
+  void WakeSelf();
+  void Unmap();
+
+protected:
+  event::Poller* poller_{nullptr};
+  const Options* options_{nullptr};
+  void* mem_{nullptr};
+  size_t mem_size_{0};
+  size_t capacity_{0};
+  RingHeader* tx_{nullptr};
+  char* tx_data_{nullptr};
+  RingHeader* rx_{nullptr};
+  char* rx_data_{nullptr};
+  int mem_fd_{BAD_FD};
+  int event_fd_{BAD_FD};  // ours, registered on the poller
+  int peer_event_fd_{BAD_FD};
+  bool creator_{false};
+  bool started_{false};
+  bool closed_{false};
+  bool want_write_{false};
+  uint64_t cached_head_{0};  // of tx_
+  uint64_t delivered_{0};  // rx_ tail last passed to the data callback
+  uint32_t spin_us_{0};  // current adaptive spin time
+  uint64_t wakeups_{0};
+  int errno_{0};
+
+  ShmDataCb data_cb_;
+  ShmWritableCb writable_cb_;
+  ShmCloseCb close_cb_;
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(ShmChannel)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,294 @@
+#include "shm_channel.h"
+#include "unix_socket.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+// Connected pair of channels, "a" created the memory.
+struct Pair {
+  explicit Pair(event::Poller* poller, const ShmChannel::Options& opt = ShmChannel::Options())
+    : a(poller, opt), b(poller, opt) {
+  }
+
+  bool Setup() {
+    int sv[2];
+    if (!CreateUnixPair(SOCK_SEQPACKET, sv)) {
+      return false;
+    }
+    bool ok = a.Create() && a.SendTo(sv[0]) && b.ReceiveFrom(sv[1]) && a.Start() && b.Start();
+    close(sv[0]);
+    close(sv[1]);
+    return ok;
+  }
+
+  ShmChannel a;
+  ShmChannel b;
+};
+
+// Access to the shared ring of a channel, to play a broken peer.
+struct RawChannel : public ShmChannel {
+  using ShmChannel::ShmChannel;
+  inline RingHeader* Tx() { return tx_; }
+  inline void Wake() { WakePeer(); }
+};
+
+size_t Append(std::string* out, const iovec* iov, int count, size_t max = SIZE_MAX) {
+  size_t n = 0;
+  for (int i = 0; i < count && n < max; ++i) {
+    auto len = std::min(iov[i].iov_len, max - n);
+    out->append(static_cast<const char*>(iov[i].iov_base), len);
+    n += len;
+  }
+  return n;
+}
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(ShmChannelTest, PingPongTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::ShmChannel::Options opts;
+  opts.max_spin_us = 0;
+  TESTNS::Pair pair(poller.get(), opts);
+  // Written before the peer mapped the memory.
+  ASSERT_TRUE(pair.a.Create());
+  EXPECT_EQ(pair.a.Write("early", 5), 5);
+  int sv[2];
+  ASSERT_TRUE(LNETNS::net::CreateUnixPair(SOCK_SEQPACKET, sv));
+  ASSERT_TRUE(pair.a.SendTo(sv[0]));
+  ASSERT_TRUE(pair.b.ReceiveFrom(sv[1]));
+  close(sv[0]);
+  close(sv[1]);
+  EXPECT_EQ(pair.b.Capacity(), pair.a.Capacity());
+
+  std::string at_a;
+  std::string at_b;
+  pair.a.SetDataCallback([&](LNETNS::net::ShmChannel* ch, const iovec* iov, int count) {
+    return TESTNS::Append(&at_a, iov, count);
+  });
+  pair.b.SetDataCallback([&](LNETNS::net::ShmChannel* ch, const iovec* iov, int count) {
+    auto n = TESTNS::Append(&at_b, iov, count);
+    ch->Write("pong", 4);
+    return n;
+  });
+  ASSERT_TRUE(pair.a.Start());
+  ASSERT_TRUE(pair.b.Start());
+
+  poller->DoPoll();
+  EXPECT_EQ(at_b, "early");
+  EXPECT_EQ(pair.a.Write("ping", 4), 4);
+  for (int i = 0; i < 3 && at_a.size() < 8; ++i) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(at_b, "earlyping");
+  EXPECT_EQ(at_a, "pongpong");
+
+  // Writes to a reader which hasn't gone back to sleep need no wake-up.
+  auto wakeups = pair.a.WakeupCount();
+  for (int i = 0; i < 100; ++i) {
+    pair.a.Write("x", 1);
+  }
+  EXPECT_EQ(pair.a.WakeupCount(), wakeups + 1);
+}
+
+GTEST_TEST(ShmChannelTest, BackpressureTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::ShmChannel::Options opts;
+  opts.capacity = 4096;
+  opts.max_spin_us = 0;
+  TESTNS::Pair pair(poller.get(), opts);
+  ASSERT_TRUE(pair.Setup());
+  EXPECT_EQ(pair.a.Capacity(), 4096);
+
+  std::string data;
+  for (int i = 0; data.size() < 20000; ++i) {
+    data += std::to_string(i) + ",";
+  }
+  size_t sent = pair.a.Write(data.data(), data.size());
+  EXPECT_EQ(sent, 4096);
+  int writable = 0;
+  pair.a.SetWritableCallback([&](LNETNS::net::ShmChannel* ch) {
+    ++writable;
+    sent += ch->Write(data.data() + sent, data.size() - sent);
+  });
+
+  // Consume 1000 bytes at most per call while more is coming, the rest is passed
+  // again with the next bytes.
+  std::string received;
+  bool wrapped = false;
+  pair.b.SetDataCallback([&](LNETNS::net::ShmChannel* ch, const iovec* iov, int count) {
+    wrapped = wrapped || count == 2;
+    return TESTNS::Append(&received, iov, count, sent < data.size() ? 1000 : SIZE_MAX);
+  });
+  for (int i = 0; i < 1000 && received.size() < data.size(); ++i) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(received, data);
+  EXPECT_GT(writable, 0);
+  EXPECT_TRUE(wrapped);
+}
+
+GTEST_TEST(ShmChannelTest, CloseTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  TESTNS::Pair pair(poller.get());
+  ASSERT_TRUE(pair.Setup());
+  std::string received;
+  bool closed = false;
+  pair.b.SetDataCallback([&](LNETNS::net::ShmChannel* ch, const iovec* iov, int count) {
+    return TESTNS::Append(&received, iov, count);
+  });
+  pair.b.SetCloseCallback([&](LNETNS::net::ShmChannel* ch) {
+    closed = true;
+  });
+
+  // What was written before closing is still delivered.
+  pair.a.Write("bye", 3);
+  pair.a.Close();
+  EXPECT_FALSE(pair.a.Connected());
+  poller->DoPoll();
+  EXPECT_EQ(received, "bye");
+  EXPECT_TRUE(closed);
+  EXPECT_FALSE(pair.b.Connected());
+  EXPECT_EQ(pair.b.Write("x", 1), 0);
+}
+
+GTEST_TEST(ShmChannelTest, CorruptionTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::ShmChannel::Options opts;
+  opts.capacity = 4096;
+  opts.max_spin_us = 0;
+  TESTNS::RawChannel a(poller.get(), opts);
+  LNETNS::net::ShmChannel b(poller.get(), opts);
+  int sv[2];
+  ASSERT_TRUE(LNETNS::net::CreateUnixPair(SOCK_SEQPACKET, sv));
+  ASSERT_TRUE(a.Create() && a.SendTo(sv[0]) && b.ReceiveFrom(sv[1]));
+  close(sv[0]);
+  close(sv[1]);
+  size_t delivered = 0;
+  bool closed = false;
+  b.SetDataCallback([&](LNETNS::net::ShmChannel* ch, const iovec* iov, int count) {
+    for (int i = 0; i < count; ++i) {
+      delivered += iov[i].iov_len;
+    }
+    return delivered;
+  });
+  b.SetCloseCallback([&](LNETNS::net::ShmChannel* ch) {
+    closed = true;
+  });
+  ASSERT_TRUE(a.Start());
+  ASSERT_TRUE(b.Start());
+  ASSERT_EQ(a.Write("ok", 2), 2);
+  poller->DoPoll();
+  ASSERT_EQ(delivered, 2);
+
+  // Data claimed past the ring is never delivered.
+  a.Tx()->tail.store(2 + 3 * a.Capacity());
+  a.Wake();
+  for (int i = 0; i < 3 && !closed; ++i) {
+    poller->DoPoll();
+  }
+  EXPECT_TRUE(closed);
+  EXPECT_EQ(b.GetLastErrno(), EPROTO);
+  EXPECT_EQ(delivered, 2);
+  EXPECT_FALSE(b.Connected());
+
+  // Nor is more written than the ring holds. The head is read when the room known
+  // doesn't suffice.
+  a.Tx()->tail.store(2);
+  a.Tx()->head.store(3);  // past the tail
+  std::string full(a.Capacity(), 'f');
+  EXPECT_EQ(a.Write(full.data(), full.size()), 0);
+  EXPECT_EQ(a.GetLastErrno(), EPROTO);
+  EXPECT_FALSE(a.Connected());
+}
+
+GTEST_TEST(ShmChannelTest, ProcessTest) {
+  int sv[2];
+  ASSERT_TRUE(LNETNS::net::CreateUnixPair(SOCK_SEQPACKET, sv));
+  constexpr size_t kSize = 1 << 22;
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // Echo everything back until the parent closes.
+    close(sv[0]);
+    LNETNS::event::Poller poller;
+    LNETNS::net::ShmChannel ch(&poller);
+    while (!ch.ReceiveFrom(sv[1])) {
+      if (ch.GetLastErrno() != EAGAIN) {
+        _exit(1);
+      }
+      usleep(1000);
+    }
+    bool done = false;
+    ch.SetDataCallback([](LNETNS::net::ShmChannel* c, const iovec* iov, int count) {
+      size_t n = 0;
+      for (int i = 0; i < count; ++i) {
+        auto written = c->Write(iov[i].iov_base, iov[i].iov_len);
+        n += written;
+        if (written < iov[i].iov_len) {
+          break;  // the rest is passed again
+        }
+      }
+      return n;
+    });
+    ch.SetWritableCallback([](LNETNS::net::ShmChannel* c) {});
+    ch.SetCloseCallback([&done](LNETNS::net::ShmChannel* c) { done = true; });
+    if (!ch.Start()) {
+      _exit(2);
+    }
+    while (!done) {
+      poller.AddTimer(100, nullptr);
+      poller.DoPoll();
+    }
+    _exit(0);
+  }
+
+  close(sv[1]);
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  LNETNS::net::ShmChannel::Options opts;
+  opts.capacity = 65536;
+  LNETNS::net::ShmChannel ch(poller.get(), opts);
+  ASSERT_TRUE(ch.Create());
+  ASSERT_TRUE(ch.SendTo(sv[0]));
+  close(sv[0]);
+
+  std::string data(kSize, '\0');
+  for (size_t i = 0; i < kSize; ++i) {
+    data[i] = static_cast<char>(i * 131 + (i >> 12));
+  }
+  size_t sent = 0;
+  std::string received;
+  ch.SetDataCallback([&](LNETNS::net::ShmChannel* c, const iovec* iov, int count) {
+    return TESTNS::Append(&received, iov, count);
+  });
+  ch.SetWritableCallback([&](LNETNS::net::ShmChannel* c) {
+    sent += c->Write(data.data() + sent, data.size() - sent);
+  });
+  ASSERT_TRUE(ch.Start());
+  sent += ch.Write(data.data(), data.size());
+  while (received.size() < kSize) {
+    poller->AddTimer(100, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_TRUE(received == data);
+  // Far fewer wake-ups than the ~64 refills of the ring each way.
+  EXPECT_LT(ch.WakeupCount(), kSize / opts.capacity * 4);
+
+  ch.Close();
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 0);
+}
@@ -0,0 +1,135 @@
+#include "socket.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+
+namespace LNETNS {
+namespace net {
+
+int CreateSocket(int family, int type, int protocol) {
+#if defined HAVE_SOCK_CLOEXEC && defined SOCK_NONBLOCK
+  return socket(family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+#else
+  int fd = socket(family, type, protocol);
+  if (fd == -1) {
+    return BAD_FD;
+  }
+  if (!SetNonBlock(fd) || !SetCloseOnExec(fd)) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return BAD_FD;
+  }
+  return fd;
+#endif
+}
+
+bool SetNonBlock(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1) {
+    return false;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+bool SetCloseOnExec(int fd) {
+  int flags = fcntl(fd, F_GETFD, 0);
+  if (flags == -1) {
+    return false;
+  }
+  return fcntl(fd, F_SETFD, flags | FD_CLOEXEC) != -1;
+}
+
+bool SetReuseAddr(int fd, bool on) {
+  int opt = on ? 1 : 0;
+  return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == 0;
+}
+
+bool SetReusePort(int fd, bool on) {
+#ifdef HAVE_SO_REUSEPORT
+  int opt = on ? 1 : 0;
+  return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == 0;
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+bool SetTcpNoDelay(int fd, bool on) {
+  int opt = on ? 1 : 0;
+  return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == 0;
+}
+
+bool SetKeepAlive(int fd, bool on, int idle, int interval, int count) {
+#ifdef HAVE_SO_KEEPALIVE
+  int opt = on ? 1 : 0;
+  if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt)) != 0) {
+    return false;
+  }
+  if (!on) {
+    return true;
+  }
+#if defined HAVE_TCP_KEEPIDLE
+  if (idle > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) != 0) {
+    return false;
+  }
+#elif defined HAVE_TCP_KEEPALIVE
+  if (idle > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle)) != 0) {
+    return false;
+  }
+#endif
+#ifdef HAVE_TCP_KEEPINTVL
+  if (interval > 0 &&
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) != 0) {
+    return false;
+  }
+#endif
+#ifdef HAVE_TCP_KEEPCNT
+  if (count > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) != 0) {
+    return false;
+  }
+#endif
+  return true;
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+bool SetZeroCopy(int fd, bool on) {
+#if defined HAVE_MSG_ZEROCOPY && defined SO_ZEROCOPY
+  int opt = on ? 1 : 0;
+  return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == 0;
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+int GetSocketError(int fd) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+    return errno;
+  }
+  return err;
+}
+
+bool GetLocalAddr(int fd, address::SockAddr* addr) {
+  std::memset(addr, 0, sizeof(address::SockAddr));
+  socklen_t len = sizeof(address::SockAddr);
+  return getsockname(fd, &addr->sockaddr, &len) == 0;
+}
+
+bool GetPeerAddr(int fd, address::SockAddr* addr) {
+  std::memset(addr, 0, sizeof(address::SockAddr));
+  socklen_t len = sizeof(address::SockAddr);
+  return getpeername(fd, &addr->sockaddr, &len) == 0;
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,33 @@
+#pragma once
+#include "macros.h"
+#include "address/sockaddr.h"
+
+namespace LNETNS {
+namespace net {
+
+// Thin wrappers of socket system calls. All of them return false (or BAD_FD) on
+// failure and leave errno untouched for the caller to inspect.
+
+// Creates a non-blocking, close-on-exec socket.
+int CreateSocket(int family, int type, int protocol = 0);
+
+bool SetNonBlock(int fd);
+bool SetCloseOnExec(int fd);
+bool SetReuseAddr(int fd, bool on);
+// Fails with ENOPROTOOPT if SO_REUSEPORT is not supported.
+bool SetReusePort(int fd, bool on);
+bool SetTcpNoDelay(int fd, bool on);
+// SO_KEEPALIVE, and the probe timing where supported (TCP_KEEPIDLE/KEEPINTVL/KEEPCNT,
+// TCP_KEEPALIVE on macOS). Non-positive values keep the system defaults.
+bool SetKeepAlive(int fd, bool on, int idle = 0, int interval = 0, int count = 0);
+// SO_ZEROCOPY, fails with ENOPROTOOPT if MSG_ZEROCOPY is not supported.
+bool SetZeroCopy(int fd, bool on);
+
+// Returns the pending error of a socket (SO_ERROR), or errno if getsockopt failed.
+int GetSocketError(int fd);
+
+bool GetLocalAddr(int fd, address::SockAddr* addr);
+bool GetPeerAddr(int fd, address::SockAddr* addr);
+
+}  // namespace net
+}  // namespace LNETNS
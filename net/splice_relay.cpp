@@ -0,0 +1,177 @@
+#include "splice_relay.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "tcp_connection.h"
+
+namespace LNETNS {
+namespace net {
+
+SpliceRelay::SpliceRelay(TcpConnection* src, TcpConnection* dst)
+  : src_(src), dst_(dst) {
+}
+
+SpliceRelay::~SpliceRelay() {
+  Stop();
+}
+
+bool SpliceRelay::Start(size_t pipe_size) {
+#ifdef HAVE_SPLICE
+  if (pipe_[0] != BAD_FD) {
+    return true;
+  }
+  if (!src_ || !dst_ || src_->relay_out_ || dst_->relay_in_) {
+    errno_ = EBUSY;
+    return false;
+  }
+  if (pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) != 0) {
+    errno_ = errno;
+    return false;
+  }
+  int size = fcntl(pipe_[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+  if (size <= 0) {
+    size = fcntl(pipe_[1], F_GETPIPE_SZ);
+  }
+  pipe_size_ = size > 0 ? size : kDefaultPipeSize;
+
+  src_->relay_out_ = this;
+  dst_->relay_in_ = this;
+
+  // Forward what has been read already.
+  auto input = src_->Input();
+  if (!input->Empty()) {
+    iovec iov[2];
+    int cnt = input->ReadableIovecs(iov);
+    for (int i = 0; i < cnt; ++i) {
+      dst_->Send(iov[i].iov_base, iov[i].iov_len);
+    }
+    bytes_relayed_ += input->Size();
+    input->Consume(input->Size());
+  }
+  return true;
+#else
+  errno_ = ENOSYS;
+  return false;
+#endif
+}
+
+void SpliceRelay::Stop() {
+  if (src_ && src_->relay_out_ == this) {
+    src_->Resume(TcpConnection::kPauseRelay);  // paused after EOF as well
+    src_->relay_out_ = nullptr;
+  }
+  if (dst_ && dst_->relay_in_ == this) {
+    dst_->relay_in_ = nullptr;
+  }
+  for (auto& fd : pipe_) {
+    if (fd != BAD_FD) {
+      close(fd);
+      fd = BAD_FD;
+    }
+  }
+  pipe_bytes_ = 0;
+}
+
+void SpliceRelay::OnSourceReadable() {
+#ifdef HAVE_SPLICE
+  while (!eof_ && pipe_bytes_ < pipe_size_) {
+    auto n = splice(src_->fd_, nullptr, pipe_[1], nullptr, pipe_size_ - pipe_bytes_,
+                    SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (n > 0) {
+      pipe_bytes_ += n;
+      src_->bytes_read_ += n;
+      continue;
+    }
+    if (n == 0) {
+      eof_ = true;
+      break;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Socket drained or pipe full.
+      break;
+    }
+    // The close callback may release this relay.
+    errno_ = errno;
+    src_->HandleClose(errno_);
+    return;
+  }
+  if (eof_) {
+    PauseSource();
+  }
+  Pump();
+#endif
+}
+
+void SpliceRelay::Pump() {
+#ifdef HAVE_SPLICE
+  if (!dst_ || dst_->state_ == TcpConnection::kClosed || dst_->error_) {
+    return;
+  }
+  if (dst_->OutputSize() > 0) {
+    // Queued output of "dst" goes first, it pumps again once drained.
+    if (pipe_bytes_ > 0) {
+      PauseSource();
+    }
+    return;
+  }
+
+  while (pipe_bytes_ > 0) {
+    auto n = splice(pipe_[0], nullptr, dst_->fd_, nullptr, pipe_bytes_,
+                    SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (n > 0) {
+      pipe_bytes_ -= n;
+      dst_->bytes_written_ += n;
+      bytes_relayed_ += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      // Reported from OnWritable() of "dst".
+      errno_ = errno;
+      dst_->error_ = errno;
+    }
+    if (!dst_->writing_) {
+      dst_->writing_ = dst_->poller_->SetEventOut(dst_->fd_);
+    }
+    break;
+  }
+
+  if (pipe_bytes_ > 0) {
+    PauseSource();
+  } else if (eof_) {
+    shut_down_ = true;
+    dst_->Shutdown();
+  } else {
+    ResumeSource();
+  }
+#endif
+}
+
+void SpliceRelay::PauseSource() {
+  if (src_) {
+    src_->Pause(TcpConnection::kPauseRelay);
+  }
+}
+
+void SpliceRelay::ResumeSource() {
+  if (src_ && !eof_) {
+    src_->Resume(TcpConnection::kPauseRelay);
+  }
+}
+
+void SpliceRelay::Detach(TcpConnection* conn) {
+  if (conn == src_) {
+    src_ = nullptr;
+  }
+  if (conn == dst_) {
+    dst_ = nullptr;
+  }
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,68 @@
+#pragma once
+#include "macros.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace LNETNS {
+namespace net {
+
+class TcpConnection;
+
+// One-way relay from "src" to "dst" through a pipe with splice(), the payload
+// never enters user space.
+//
+// While started, readable events of "src" are served by the relay instead of the
+// input buffer (the data callback is not invoked), and "dst" empties the pipe
+// after its own queued output. Reading "src" is paused while "dst" cannot take
+// more (TcpConnection::kPauseRelay, other pause reasons still hold). EOF of "src"
+// is forwarded as dst->Shutdown() once the pipe is drained.
+//
+// Errors are reported by the close callbacks of the connections. For a proxy,
+// use one relay per direction. Note splice() has no MSG_NOSIGNAL, ignore SIGPIPE.
+class SpliceRelay {
+public:
+  static constexpr size_t kDefaultPipeSize = 65536;
+
+  SpliceRelay(TcpConnection* src, TcpConnection* dst);
+  SpliceRelay() = delete;
+  ~SpliceRelay();
+
+  // Bytes already in the input buffer of "src" are sent to "dst" first.
+  // "pipe_size" is a hint (F_SETPIPE_SZ).
+  bool Start(size_t pipe_size = kDefaultPipeSize);
+  // Bytes left in the pipe are lost, "src" reads on its own again.
+  void Stop();
+
+  inline size_t Pending() const { return pipe_bytes_; }
+  inline bool SourceEof() const { return eof_; }
+  inline uint64_t BytesRelayed() const { return bytes_relayed_; }
+  inline int GetLastErrno() const { return errno_; }
+
+private:
+  friend class TcpConnection;
+  void OnSourceReadable();
+  // Move the pipe to "dst" as far as it goes.
+  void Pump();
+  void PauseSource();
+  void ResumeSource();
+  // A connection is being destroyed.
+  void Detach(TcpConnection* conn);
+  // Bytes or the EOF of "src" are left to forward to "dst".
+  inline bool Forwarding() const { return pipe_bytes_ > 0 || (eof_ && !shut_down_); }
+
+private:
+  TcpConnection* src_{nullptr};
+  TcpConnection* dst_{nullptr};
+  int pipe_[2]{BAD_FD, BAD_FD};
+  size_t pipe_size_{0};
+  size_t pipe_bytes_{0};
+  bool eof_{false};
+  bool shut_down_{false};  // EOF forwarded
+  uint64_t bytes_relayed_{0};
+  int errno_{0};
+  NON_COPYABLE_NOR_MOVABLE(SpliceRelay)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,785 @@
+#include "tcp_connection.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+#include "socket.h"
+#include "splice_relay.h"
+#include "rate_limiter.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+// Calls "cb(lo, hi, copied)" for each MSG_ZEROCOPY completion queued on the error
+// queue of "fd". Returns false if there was none.
+template <typename Cb>
+bool ReadZeroCopyCompletions(int fd, Cb cb) {
+  bool found = false;
+#ifdef HAVE_MSG_ZEROCOPY
+  for (;;) {
+    char control[128];
+    msghdr msg = {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      auto ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+      if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      found = true;
+      cb(ee->ee_info, ee->ee_data, ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+    }
+  }
+#endif
+  return found;
+}
+
+}  // unnamed namespace
+
+// Keeps the socket and the MSG_ZEROCOPY buffers of a closed connection until the
+// buffers complete, then closes the socket and deletes itself. Registered without
+// events, the completions are reported as errors, and checked every kCheckInterval
+// as well (select() doesn't report them). A peer which doesn't read gets the
+// connection reset after kTimeout, the kernel then drops the queued data and
+// completes the buffers. Leaked if the poller goes away first.
+class ZeroCopyLinger : public event::EventHandler {
+public:
+  static constexpr uint32_t kCheckInterval = 1000;  // milliseconds
+  static constexpr uint32_t kTimeout = 10000;
+
+  static void Start(event::Poller* poller, int fd, std::deque<TcpConnection::ZeroCopyBuf>&& bufs) {
+    auto linger = new ZeroCopyLinger(poller, fd, std::move(bufs));
+    if (!poller->UpsertFd(fd, linger, 0)) {
+      LOG_WARN("Zero-copy buffers released early: fd={}", fd);
+      close(fd);
+      delete linger;
+      return;
+    }
+    linger->timer_ = poller->AddTimer(kCheckInterval, linger);
+  }
+
+private:
+  ZeroCopyLinger(event::Poller* poller, int fd, std::deque<TcpConnection::ZeroCopyBuf>&& bufs)
+    : poller_(poller), fd_(fd), bufs_(std::move(bufs)) {
+  }
+
+  void OnReadable(int fd) override {}
+  void OnWritable(int fd) override {}
+
+  void OnError(int fd) override {
+    if (Drain()) {
+      poller_->CancelTimer(timer_, this);
+      Finish();
+    }
+  }
+
+  void OnTimeout(int id) override {
+    if (Drain()) {
+      Finish();
+      return;
+    }
+    waited_ += kCheckInterval;
+    if (waited_ == kTimeout) {
+      // Disconnect (AF_UNSPEC) resets the connection and purges its send queue.
+      sockaddr unspec = {};
+      unspec.sa_family = AF_UNSPEC;
+      connect(fd_, &unspec, sizeof(unspec));
+    }
+    timer_ = poller_->AddTimer(kCheckInterval, this);
+  }
+
+  // Returns true once all the buffers completed.
+  bool Drain() {
+    ReadZeroCopyCompletions(fd_, [this](uint32_t lo, uint32_t hi, bool copied) {
+      TcpConnection::ReleaseZeroCopy(&bufs_, lo, hi);
+    });
+    GetSocketError(fd_);  // clear a reset by the peer
+    return bufs_.empty();
+  }
+
+  void Finish() {
+    poller_->RemoveFd(fd_);
+    close(fd_);
+    delete this;
+  }
+
+private:
+  event::Poller* poller_;
+  int fd_;
+  std::deque<TcpConnection::ZeroCopyBuf> bufs_;
+  event::TimerKey timer_{event::kBadTimerKey};
+  uint32_t waited_{0};
+};
+
+const TcpConnection::Options TcpConnection::kDefaultOptions;
+
+TcpConnection::TcpConnection(event::Poller* poller, int fd)
+  : TcpConnection(poller, fd, kDefaultOptions) {
+}
+
+TcpConnection::TcpConnection(event::Poller* poller, int fd, const Options& opt)
+  : poller_(poller), fd_(fd),
+    input_(opt.input_buffer_size), output_(opt.output_buffer_size) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+}
+
+TcpConnection::~TcpConnection() {
+  if (relay_out_) {
+    relay_out_->Detach(this);
+  }
+  if (relay_in_) {
+    relay_in_->Detach(this);
+  }
+  SetUpstream(nullptr);
+  if (downstream_) {
+    downstream_->upstream_ = nullptr;
+  }
+  CancelFlush();
+  if (read_throttled_) {
+    read_limiter_->Unthrottle(fd_, event::kEventIn);
+  }
+  if (write_throttled_) {
+    write_limiter_->Unthrottle(fd_, event::kEventOut);
+  }
+  if (fd_ != BAD_FD) {
+    ReleaseFd();
+  }
+  ClearFiles();
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+bool TcpConnection::Start() {
+  if (state_ == kClosed || !poller_) {
+    return false;
+  }
+  if (options_->no_delay) {
+    SetTcpNoDelay(fd_, true);
+  }
+#ifndef POLLER_USE_SELECT
+  // select() does not report the error queue, completions would never be seen.
+  if (options_->zerocopy && !zerocopy_) {
+    zerocopy_ = SetZeroCopy(fd_, true);
+  }
+#endif
+  int mask = pause_reasons_ || read_throttled_ ? 0 : event::kEventIn;
+  if (writing_) {
+    mask |= event::kEventOut;
+  }
+  return poller_->UpsertFd(fd_, this, mask);
+}
+
+bool TcpConnection::Send(const void* data, size_t len) {
+  if (state_ != kConnected || error_) {
+    return false;
+  }
+
+  bool ok = true;
+  if (!files_.empty()) {
+    file_output_size_ += len;
+    files_.back().trailer.Append(data, len);
+  } else if (!chained_output_.Empty()) {
+    chained_output_.Append(data, len);
+  } else {
+    size_t written = 0;
+    if (output_.Empty() && !writing_ && !options_->coalesce_writes && !write_bucket_) {
+      // Nothing queued, try to write directly.
+      auto n = send(fd_, data, len, MSG_NOSIGNAL);
+      if (n >= 0) {
+        written = n;
+        bytes_written_ += n;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        // Report the error from OnWritable().
+        error_ = errno;
+        writing_ = poller_->SetEventOut(fd_);
+        return false;
+      }
+    }
+
+    if (written < len) {
+      output_.Append(static_cast<const char*>(data) + written, len - written);
+      if (options_->coalesce_writes) {
+        ok = ScheduleWrite();
+      } else if (write_bucket_) {
+        ok = StartWrite();  // as far as the tokens go
+      } else if (!writing_) {
+        writing_ = poller_->SetEventOut(fd_);
+      }
+    }
+  }
+  UpdateWatermarks();
+  return ok;
+}
+
+bool TcpConnection::Send(IOBuf&& buf) {
+  if (state_ != kConnected || error_) {
+    return false;
+  }
+
+  bool ok = true;
+  if (!files_.empty()) {
+    file_output_size_ += buf.Size();
+    files_.back().trailer.Append(std::move(buf));
+  } else {
+    chained_output_.Append(std::move(buf));
+    ok = ScheduleWrite();
+  }
+  UpdateWatermarks();
+  return ok;
+}
+
+bool TcpConnection::SendFile(int file_fd, off_t offset, size_t count) {
+#ifdef HAVE_SENDFILE
+  if (state_ != kConnected || error_) {
+    return false;
+  }
+
+  int fd = fcntl(file_fd, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  files_.push_back(PendingFile{fd, offset, count, IOBuf()});
+  file_output_size_ += count;
+  bool ok = ScheduleWrite();
+  UpdateWatermarks();
+  return ok;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+void TcpConnection::Shutdown() {
+  if (state_ != kConnected) {
+    return;
+  }
+  state_ = kDisconnecting;
+  if (OutputSize() == 0 && !writing_ && !flush_scheduled_) {
+    shutdown(fd_, SHUT_WR);
+  }
+}
+
+void TcpConnection::Close() {
+  HandleClose(0);
+}
+
+void TcpConnection::PauseReading() {
+  Pause(kPauseApplication);
+}
+
+void TcpConnection::ResumeReading() {
+  Resume(kPauseApplication);
+}
+
+void TcpConnection::Pause(int reason) {
+  if ((pause_reasons_ & reason) == reason || state_ == kClosed) {
+    return;
+  }
+  bool was_reading = pause_reasons_ == 0 && !read_throttled_;
+  pause_reasons_ |= reason;
+  if (was_reading && poller_) {
+    poller_->ResetEventIn(fd_);  // registered by Attach() otherwise
+  }
+}
+
+void TcpConnection::Resume(int reason) {
+  if (!(pause_reasons_ & reason) || state_ == kClosed) {
+    return;
+  }
+  pause_reasons_ &= ~reason;
+  if (pause_reasons_ == 0 && !read_throttled_ && poller_) {
+    poller_->SetEventIn(fd_);
+  }
+}
+
+void TcpConnection::SetReadLimit(RateLimiter* limiter, TokenBucket* bucket) {
+  if (read_throttled_) {
+    read_limiter_->Unthrottle(fd_, event::kEventIn);
+    read_throttled_ = false;
+    if (pause_reasons_ == 0) {
+      poller_->SetEventIn(fd_);
+    }
+  }
+  read_limiter_ = limiter;
+  read_bucket_ = limiter ? bucket : nullptr;
+}
+
+void TcpConnection::SetWriteLimit(RateLimiter* limiter, TokenBucket* bucket) {
+  if (write_throttled_) {
+    write_limiter_->Unthrottle(fd_, event::kEventOut);
+    write_throttled_ = false;
+    // Still writing, flush the rest from OnWritable().
+    poller_->SetEventOut(fd_);
+  }
+  write_limiter_ = limiter;
+  write_bucket_ = limiter ? bucket : nullptr;
+}
+
+bool TcpConnection::Detach() {
+  if (state_ == kClosed || !poller_ || relay_out_ || relay_in_ || upstream_ || downstream_) {
+    return false;
+  }
+  SetReadLimit(nullptr, nullptr);
+  SetWriteLimit(nullptr, nullptr);
+  if (flush_scheduled_) {
+    // Flushed from OnWritable() on the new poller instead.
+    CancelFlush();
+    writing_ = true;
+  }
+  poller_->RemoveFd(fd_);
+  poller_ = nullptr;
+  return true;
+}
+
+bool TcpConnection::Attach(event::Poller* poller) {
+  if (state_ == kClosed || poller_) {
+    return false;
+  }
+  poller_ = poller;
+  return Start();
+}
+
+void TcpConnection::ThrottleReading() {
+  read_throttled_ = read_limiter_->Throttle(fd_, event::kEventIn, read_bucket_, [this](int fd) {
+    read_throttled_ = false;
+    if (pause_reasons_ != 0) {
+      poller_->ResetEventIn(fd_);
+    }
+  });
+}
+
+size_t TcpConnection::WriteBudget() {
+  if (!write_bucket_) {
+    return SIZE_MAX;
+  }
+  auto avail = write_bucket_->Available();
+  if (avail > 0) {
+    return avail;
+  }
+  // kEventOut is enabled again once tokens return, the output is flushed from
+  // OnWritable() then.
+  write_throttled_ = write_limiter_->Throttle(fd_, event::kEventOut, write_bucket_, [this](int fd) {
+    write_throttled_ = false;
+  });
+  writing_ = writing_ || write_throttled_;
+  return 0;
+}
+
+void TcpConnection::SetUpstream(TcpConnection* upstream) {
+  if (upstream_) {
+    upstream_->downstream_ = nullptr;
+    if (above_high_watermark_) {
+      upstream_->Resume(kPauseWatermark);
+    }
+  }
+  upstream_ = upstream;
+  if (upstream_) {
+    upstream_->downstream_ = this;
+    if (above_high_watermark_) {
+      upstream_->Pause(kPauseWatermark);
+    }
+  }
+}
+
+void TcpConnection::UpdateWatermarks() {
+  if (options_->high_watermark == 0) {
+    return;
+  }
+
+  size_t size = OutputSize();
+  if (!above_high_watermark_ && size >= options_->high_watermark) {
+    above_high_watermark_ = true;
+    if (upstream_) {
+      upstream_->Pause(kPauseWatermark);
+    }
+    if (high_watermark_cb_) {
+      high_watermark_cb_(this, size);
+    }
+  } else if (above_high_watermark_ && size <= options_->low_watermark) {
+    above_high_watermark_ = false;
+    if (upstream_) {
+      upstream_->Resume(kPauseWatermark);
+    }
+    if (low_watermark_cb_) {
+      low_watermark_cb_(this);
+    }
+  }
+}
+
+bool TcpConnection::StartWrite() {
+  if (writing_) {
+    return true;
+  }
+  bool ok = FlushOutput();
+  if ((!ok || OutputSize() > 0) && !write_throttled_) {
+    // Errors are reported from OnWritable().
+    writing_ = poller_->SetEventOut(fd_);
+  }
+  return ok;
+}
+
+bool TcpConnection::ScheduleWrite() {
+  if (!options_->coalesce_writes) {
+    return StartWrite();
+  }
+  if (writing_ || flush_scheduled_) {
+    return true;
+  }
+  flush_scheduled_ = poller_->AddCheck(this);
+  return flush_scheduled_ || StartWrite();
+}
+
+void TcpConnection::CancelFlush() {
+  if (flush_scheduled_) {
+    poller_->RemoveCheck(this);
+    flush_scheduled_ = false;
+  }
+}
+
+void TcpConnection::OnCheck() {
+  CancelFlush();
+  if (state_ == kClosed || writing_) {
+    return;
+  }
+  StartWrite();
+  if (!writing_ && relay_in_ && relay_in_->Forwarding()) {
+    // The relay paused for the output flushed here.
+    relay_in_->Pump();
+  }
+  UpdateWatermarks();
+  if (!writing_ && state_ == kDisconnecting) {
+    shutdown(fd_, SHUT_WR);
+  }
+}
+
+bool TcpConnection::FlushOutput() {
+  for (;;) {
+    if (!FlushBuffers()) {
+      return false;
+    }
+    if (output_.Size() + chained_output_.Size() > 0 || files_.empty()) {
+      // Blocked or done.
+      return true;
+    }
+
+#ifdef HAVE_SENDFILE
+    auto& file = files_.front();
+    while (file.remaining > 0) {
+      size_t budget = WriteBudget();
+      if (budget == 0) {
+        return true;
+      }
+      auto n = sendfile(fd_, file.fd, &file.offset, std::min(file.remaining, budget));
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          return true;
+        }
+        error_ = errno;
+        return false;
+      }
+      if (n == 0) {
+        // The file is shorter than promised.
+        error_ = EIO;
+        return false;
+      }
+      file.remaining -= n;
+      file_output_size_ -= n;
+      bytes_written_ += n;
+      if (write_bucket_) {
+        write_bucket_->Consume(n);
+      }
+    }
+    close(file.fd);
+    file_output_size_ -= file.trailer.Size();
+    chained_output_ = std::move(file.trailer);
+    files_.pop_front();
+#endif
+  }
+}
+
+bool TcpConnection::FlushBuffers() {
+  while (output_.Size() + chained_output_.Size() > 0) {
+    size_t budget = WriteBudget();
+    if (budget == 0) {
+      break;
+    }
+    iovec iov[kMaxIovecs];
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    int cnt = output_.ReadableIovecs(iov);
+    cnt += chained_output_.FillIovecs(iov + cnt, kMaxIovecs - cnt);
+    msg.msg_iovlen = cnt;
+
+    size_t queued = 0;
+    for (int i = 0; i < cnt; ++i) {
+      iov[i].iov_len = std::min(iov[i].iov_len, budget - queued);
+      queued += iov[i].iov_len;
+    }
+    // sendmsg() is writev() with flags, MSG_NOSIGNAL avoids SIGPIPE.
+    int flags = MSG_NOSIGNAL;
+#ifdef HAVE_MSG_ZEROCOPY
+    // Only slices of IOBufs can be held until the completion.
+    bool zerocopy = zerocopy_ && output_.Empty() && queued >= options_->zerocopy_threshold;
+    if (zerocopy) {
+      flags |= MSG_ZEROCOPY;
+    }
+#endif
+    auto n = sendmsg(fd_, &msg, flags);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+#ifdef HAVE_MSG_ZEROCOPY
+      if (zerocopy && errno == ENOBUFS) {
+        // Out of optmem for notifications, copy this time.
+        n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        zerocopy = false;
+      }
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        error_ = errno;
+        return false;
+      }
+#else
+      error_ = errno;
+      return false;
+#endif
+    }
+
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zerocopy) {
+      zerocopy_bufs_.push_back(ZeroCopyBuf{zerocopy_next_id_++, chained_output_.Split(n)});
+      zerocopy_pending_ += n;
+    } else
+#endif
+    {
+      size_t from_ring = std::min<size_t>(n, output_.Size());
+      output_.Consume(from_ring);
+      chained_output_.Consume(n - from_ring);
+    }
+    bytes_written_ += n;
+    if (write_bucket_) {
+      write_bucket_->Consume(n);
+    }
+    if (static_cast<size_t>(n) < queued) {
+      // Socket send buffer is full.
+      break;
+    }
+  }
+  return true;
+}
+
+void TcpConnection::OnReadable(int fd) {
+  if (relay_out_) {
+    relay_out_->OnSourceReadable();
+    return;
+  }
+
+  // Free space of the input buffer first, then the stack area.
+  char extra[kExtraReadSize];
+  iovec iov[3];
+  int cnt = input_.WritableIovecs(iov);
+  iov[cnt].iov_base = extra;
+  iov[cnt].iov_len = sizeof(extra);
+  ++cnt;
+  if (read_bucket_) {
+    // Don't read much more than the tokens, the rest waits in the socket.
+    size_t budget = std::max<int64_t>(read_bucket_->Available(), 1);
+    for (int i = 0; i < cnt; ++i) {
+      iov[i].iov_len = std::min(iov[i].iov_len, budget);
+      budget -= iov[i].iov_len;
+    }
+  }
+
+  auto writable = input_.Writable();
+  auto n = readv(fd_, iov, cnt);
+  if (n > 0 && read_bucket_ && !read_bucket_->Consume(n)) {
+    ThrottleReading();
+  }
+  if (n > 0) {
+    if (static_cast<size_t>(n) <= writable) {
+      input_.Commit(n);
+    } else {
+      input_.Commit(writable);
+      input_.Append(extra, n - writable);
+    }
+    bytes_read_ += n;
+    if (data_cb_) {
+      data_cb_(this, &input_);
+    }
+  } else if (n == 0) {
+    HandleClose(0);
+  } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    HandleClose(errno);
+  }
+}
+
+void TcpConnection::OnWritable(int fd) {
+  if (error_ || !FlushOutput()) {
+    HandleClose(error_);
+    return;
+  }
+  UpdateWatermarks();
+  if (state_ == kClosed || OutputSize() > 0) {
+    return;
+  }
+  if (relay_in_ && relay_in_->Forwarding()) {
+    relay_in_->Pump();
+    if (error_) {
+      HandleClose(error_);
+      return;
+    }
+    if (relay_in_ && relay_in_->Pending() > 0) {
+      return;
+    }
+  }
+
+  poller_->ResetEventOut(fd_);
+  writing_ = false;
+  if (state_ == kDisconnecting) {
+    shutdown(fd_, SHUT_WR);
+  }
+  if (write_complete_cb_) {
+    write_complete_cb_(this);
+  }
+}
+
+void TcpConnection::OnError(int fd) {
+  // Completions on the error queue are not errors.
+  bool completions = zerocopy_ && ReadErrorQueue();
+  int err = GetSocketError(fd_);
+  if (completions && err == 0) {
+    return;
+  }
+  LOG_DEBUG("Connection error: fd={}, err={}", fd_, err);
+  HandleClose(err);
+}
+
+bool TcpConnection::ReadErrorQueue() {
+  return ReadZeroCopyCompletions(fd_, [this](uint32_t lo, uint32_t hi, bool copied) {
+    CompleteZeroCopy(lo, hi, copied);
+  });
+}
+
+size_t TcpConnection::ReleaseZeroCopy(std::deque<ZeroCopyBuf>* bufs, uint32_t lo, uint32_t hi) {
+  // Ids wrap around, completions normally arrive in order.
+  auto done = [lo, hi](uint32_t id) { return id - lo <= hi - lo; };
+  size_t released = 0;
+  for (auto it = bufs->begin(); it != bufs->end();) {
+    if (done(it->id)) {
+      released += it->buf.Size();
+      it = bufs->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return released;
+}
+
+void TcpConnection::CompleteZeroCopy(uint32_t lo, uint32_t hi, bool copied) {
+  zerocopy_pending_ -= ReleaseZeroCopy(&zerocopy_bufs_, lo, hi);
+  if (zerocopy_cb_) {
+    zerocopy_cb_(this, lo, hi, copied);
+  }
+}
+
+void TcpConnection::ReleaseFd() {
+  if (poller_) {
+    poller_->RemoveFd(fd_);  // null while detached
+  }
+  if (zerocopy_bufs_.empty()) {
+    close(fd_);
+  } else if (poller_) {
+    ZeroCopyLinger::Start(poller_, fd_, std::move(zerocopy_bufs_));
+  } else {
+    // No poller to wait on while detached: leaked rather than reused while the
+    // kernel may still read them.
+    LOG_WARN("Zero-copy buffers leaked: fd={}", fd_);
+    new std::deque<ZeroCopyBuf>(std::move(zerocopy_bufs_));
+    close(fd_);
+  }
+  fd_ = BAD_FD;
+  zerocopy_bufs_.clear();
+  zerocopy_pending_ = 0;
+}
+
+void TcpConnection::ClearFiles() {
+  for (auto& file : files_) {
+    close(file.fd);
+  }
+  files_.clear();
+  file_output_size_ = 0;
+}
+
+void TcpConnection::HandleClose(int err) {
+  if (state_ == kClosed) {
+    return;
+  }
+  state_ = kClosed;
+  writing_ = false;
+  CancelFlush();
+  if (read_throttled_) {
+    read_limiter_->Unthrottle(fd_, event::kEventIn);
+    read_throttled_ = false;
+  }
+  if (write_throttled_) {
+    write_limiter_->Unthrottle(fd_, event::kEventOut);
+    write_throttled_ = false;
+  }
+  if (above_high_watermark_) {
+    // Nothing will be written anymore.
+    above_high_watermark_ = false;
+    if (upstream_) {
+      upstream_->Resume(kPauseWatermark);
+    }
+  }
+  ReleaseFd();
+  ClearFiles();
+
+  // The callback may release this connection, don't touch members afterwards.
+  auto cb = std::move(close_cb_);
+  close_cb_ = nullptr;
+  if (cb) {
+    cb(this, err);
+  }
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,273 @@
+#pragma once
+#include <sys/types.h>
+#include <deque>
+#include <functional>
+#include "event/poller.h"
+#include "ring_buffer.h"
+#include "iobuf.h"
+
+namespace LNETNS {
+namespace net {
+
+class TcpConnection;
+class SpliceRelay;
+class ZeroCopyLinger;
+class RateLimiter;
+class TokenBucket;
+
+// Called with the input buffer after new data arrived, consume what has been processed.
+using DataCb = std::function<void(TcpConnection* conn, RingBuffer* input)>;
+// Called once when the connection is closed by the peer (err = 0) or on error.
+// The connection may be released in the callback.
+using CloseCb = std::function<void(TcpConnection* conn, int err)>;
+// Called when the output buffer has been drained.
+using WriteCompleteCb = std::function<void(TcpConnection* conn)>;
+// Called when the queued output reaches Options::high_watermark, and when it
+// drains down to low_watermark afterwards. Don't release the connection in them.
+using HighWatermarkCb = std::function<void(TcpConnection* conn, size_t size)>;
+using LowWatermarkCb = std::function<void(TcpConnection* conn)>;
+// Called when MSG_ZEROCOPY sends [lo, hi] completed and their buffers were released.
+// "copied" is true if the kernel fell back to copying, e.g. over loopback.
+using ZeroCopyCb = std::function<void(TcpConnection* conn, uint32_t lo, uint32_t hi, bool copied)>;
+
+// Buffered stream connection on top of a connected non-blocking socket.
+//
+// Reads use a single readv() into the free space of the input buffer plus a stack
+// area of kExtraReadSize bytes, so that one system call drains the socket without
+// keeping a large input buffer around for every connection. Writes are attempted
+// directly when nothing is queued, the remainder is queued in the output buffer and
+// flushed with one vectored write when the socket becomes writable. kEventOut is
+// only enabled while output is pending.
+//
+// Send(IOBuf&&) queues the slices of the buffer without copying them. Once such a
+// buffer is queued, later output is chained behind it to keep the ordering, and
+// both queues are flushed by the same sendmsg().
+//
+// Zero-copy paths:
+// - SendFile() queues a file range which is written with sendfile().
+// - With Options::zerocopy, queued IOBufs of at least zerocopy_threshold bytes are
+//   sent with MSG_ZEROCOPY. The sent slices are held until the completion arrives
+//   on the socket error queue, which is drained from OnError(). The kernel pins
+//   their pages rather than copying them: on close, the socket and the pending
+//   slices are handed over to a handler on the poller until they complete.
+// - SpliceRelay moves bytes between two connections through a pipe.
+//
+// With Options::coalesce_writes, sends are never written directly: output is queued
+// and each connection with new output is flushed once from a poller check hook at
+// the end of the iteration, after all callbacks ran (like TCP_CORK, automatically).
+// A pipelined peer then gets all the responses of an iteration with one writev().
+//
+// Backpressure: with Options::high_watermark, the high watermark callback fires once
+// the queued output reaches it, the low watermark callback once it drains down to
+// low_watermark. Meanwhile reading of the upstream connection set by SetUpstream()
+// is paused, so that a proxy never buffers more than the watermark for a slow peer.
+// Reading is paused for each reason on its own (see PauseReason), it resumes once
+// all of them are cleared.
+//
+// Rate limiting: with SetReadLimit(), reads take tokens from a bucket, possibly
+// shared with other connections. Once it is empty, reading is paused by the
+// RateLimiter until tokens return. With SetWriteLimit(), output is always queued
+// and flushed as far as the tokens go, kEventOut is disabled until they return.
+// Bytes moved by SpliceRelay are not limited.
+//
+// Migration: Detach() unregisters the connection from its poller, Attach() registers
+// it to another one, typically run by another thread. Buffers, queued output and
+// pending writes move along, bytes arriving meanwhile wait in the socket. See
+// LoopBalancer.
+//
+// Callbacks are only invoked from poller callbacks or Close(), never from Send(),
+// except the high watermark callback.
+class TcpConnection : public event::EventHandler {
+public:
+  static constexpr size_t kExtraReadSize = 65536;
+  static constexpr int kMaxIovecs = 64;  // per sendmsg()
+
+  struct Options {
+    size_t input_buffer_size{RingBuffer::kDefaultCapacity};
+    size_t output_buffer_size{RingBuffer::kDefaultCapacity};
+    bool no_delay{true};  // TCP_NODELAY
+    bool zerocopy{false};  // SO_ZEROCOPY, ignored if not supported or with select()
+    size_t zerocopy_threshold{16384};  // smaller sends are cheaper to copy
+    bool coalesce_writes{false};  // flush at the end of the poller iteration
+    size_t high_watermark{0};  // bytes of queued output, 0 disables
+    size_t low_watermark{0};
+  };
+
+  // Why reading is paused, a bitmask.
+  enum PauseReason {
+    kPauseApplication = 1,  // PauseReading()
+    kPauseWatermark = 2,  // the downstream connection is above its high watermark
+    kPauseRelay = 4,  // SpliceRelay waits for its destination
+  };
+
+  enum State {
+    kConnected,
+    kDisconnecting,  // shutdown requested, waiting for the output to drain
+    kClosed,
+  };
+
+public:
+  // Takes the ownership of "fd".
+  TcpConnection(event::Poller* poller, int fd);
+  TcpConnection(event::Poller* poller, int fd, const Options& opt);
+  TcpConnection() = delete;
+  ~TcpConnection() override;
+
+  // Register the socket to the poller and start reading.
+  bool Start();
+
+  // Returns false if the connection is not writable anymore.
+  bool Send(const void* data, size_t len);
+  bool Send(IOBuf&& buf);
+  // Queue "count" bytes of "file_fd" from "offset". The fd is duplicated, the
+  // caller may close it right away.
+  bool SendFile(int file_fd, off_t offset, size_t count);
+  // Half-close (SHUT_WR) once the queued output has been written.
+  void Shutdown();
+  // Close immediately, queued output is discarded. The close callback is invoked.
+  void Close();
+
+  // Stop/restart watching the socket for input. Reading stays paused while another
+  // reason holds it.
+  void PauseReading();
+  void ResumeReading();
+  // Pause reading "upstream" while the output of this connection is above the
+  // high watermark. The pairing is dropped when either connection is released.
+  void SetUpstream(TcpConnection* upstream);
+  // Take a token from "bucket" per byte read, reading is throttled by "limiter"
+  // when it runs out. Both must outlive the connection, pass null to remove.
+  void SetReadLimit(RateLimiter* limiter, TokenBucket* bucket);
+  // Same for the bytes written. The limiter may be the one of the read limit.
+  void SetWriteLimit(RateLimiter* limiter, TokenBucket* bucket);
+
+  // Call Detach() from the thread of the current poller, not from a callback of
+  // this connection, then Attach() from the thread of the new one. The read and
+  // write limits are removed since the limiter belongs to the old poller. A
+  // connection relaying with SpliceRelay or paired by SetUpstream() can't be
+  // detached. In between, only Attach(), Close() and the destructor may be called.
+  bool Detach();
+  bool Attach(event::Poller* poller);
+
+  inline void SetDataCallback(DataCb cb) { data_cb_ = std::move(cb); }
+  inline void SetCloseCallback(CloseCb cb) { close_cb_ = std::move(cb); }
+  inline void SetWriteCompleteCallback(WriteCompleteCb cb) { write_complete_cb_ = std::move(cb); }
+  inline void SetZeroCopyCallback(ZeroCopyCb cb) { zerocopy_cb_ = std::move(cb); }
+  inline void SetHighWatermarkCallback(HighWatermarkCb cb) { high_watermark_cb_ = std::move(cb); }
+  inline void SetLowWatermarkCallback(LowWatermarkCb cb) { low_watermark_cb_ = std::move(cb); }
+
+  inline int Fd() const { return fd_; }
+  inline event::Poller* GetPoller() const { return poller_; }
+  inline State GetState() const { return state_; }
+  inline bool Connected() const { return state_ == kConnected; }
+  inline RingBuffer* Input() { return &input_; }
+  inline size_t OutputSize() const {
+    return output_.Size() + chained_output_.Size() + file_output_size_;
+  }
+  inline bool ReadingPaused() const { return pause_reasons_ != 0; }
+  inline int PauseReasons() const { return pause_reasons_; }
+  inline bool ReadingThrottled() const { return read_throttled_; }
+  inline bool WritingThrottled() const { return write_throttled_; }
+  inline bool AboveHighWatermark() const { return above_high_watermark_; }
+  inline bool ZeroCopyEnabled() const { return zerocopy_; }
+  // Bytes sent with MSG_ZEROCOPY and not completed yet.
+  inline size_t ZeroCopyPending() const { return zerocopy_pending_; }
+  inline uint64_t BytesRead() const { return bytes_read_; }
+  inline uint64_t BytesWritten() const { return bytes_written_; }
+
+protected:
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override;
+  void OnError(int fd) override;
+  void OnCheck() override;
+
+  // Write as much queued output as possible, returns false on fatal error.
+  bool FlushOutput();
+  bool FlushBuffers();
+  // Flush now if not already waiting for kEventOut.
+  bool StartWrite();
+  // StartWrite() now, or from OnCheck() when coalescing writes.
+  bool ScheduleWrite();
+  void CancelFlush();
+  // Drain MSG_ZEROCOPY completions, returns false if there was none.
+  bool ReadErrorQueue();
+  void CompleteZeroCopy(uint32_t lo, uint32_t hi, bool copied);
+  // Unregister and close the socket, after pending MSG_ZEROCOPY sends completed.
+  void ReleaseFd();
+  void ClearFiles();
+  // Fire the watermark callbacks if the output size crossed a mark.
+  void UpdateWatermarks();
+  void ThrottleReading();
+  // Bytes the write limit allows now, SIZE_MAX without one. Writing is throttled
+  // and 0 returned once the bucket is empty.
+  size_t WriteBudget();
+  // Add/clear a PauseReason, kEventIn is enabled when none is left and reading is
+  // not throttled.
+  void Pause(int reason);
+  void Resume(int reason);
+  void HandleClose(int err);
+
+  struct PendingFile {
+    int fd;
+    off_t offset;
+    size_t remaining;
+    IOBuf trailer;  // output queued after the file
+  };
+
+  struct ZeroCopyBuf {
+    uint32_t id;
+    IOBuf buf;
+  };
+  // Remove the buffers of sends [lo, hi] from "bufs", returns their bytes.
+  static size_t ReleaseZeroCopy(std::deque<ZeroCopyBuf>* bufs, uint32_t lo, uint32_t hi);
+
+protected:
+  event::Poller* poller_{nullptr};
+  int fd_{BAD_FD};
+  State state_{kConnected};
+  bool writing_{false};  // kEventOut enabled
+  bool flush_scheduled_{false};  // check hook added
+  int pause_reasons_{0};
+  bool above_high_watermark_{false};
+  bool read_throttled_{false};
+  bool write_throttled_{false};  // writing_ stays set
+  int error_{0};  // pending fatal write error
+
+  RingBuffer input_;
+  RingBuffer output_;
+  IOBuf chained_output_;  // queued after output_
+  std::deque<PendingFile> files_;  // queued after chained_output_
+  size_t file_output_size_{0};  // file bytes and trailers
+  uint64_t bytes_read_{0};
+  uint64_t bytes_written_{0};
+
+  DataCb data_cb_;
+  CloseCb close_cb_;
+  WriteCompleteCb write_complete_cb_;
+  ZeroCopyCb zerocopy_cb_;
+  HighWatermarkCb high_watermark_cb_;
+  LowWatermarkCb low_watermark_cb_;
+
+  TcpConnection* upstream_{nullptr};  // paused above the high watermark
+  TcpConnection* downstream_{nullptr};  // the one pausing this
+  RateLimiter* read_limiter_{nullptr};
+  TokenBucket* read_bucket_{nullptr};
+  RateLimiter* write_limiter_{nullptr};
+  TokenBucket* write_bucket_{nullptr};
+
+  bool zerocopy_{false};  // SO_ZEROCOPY enabled
+  uint32_t zerocopy_next_id_{0};
+  size_t zerocopy_pending_{0};
+  std::deque<ZeroCopyBuf> zerocopy_bufs_;
+
+  SpliceRelay* relay_out_{nullptr};  // source of a relay
+  SpliceRelay* relay_in_{nullptr};  // destination of a relay
+  friend class SpliceRelay;
+  friend class ZeroCopyLinger;
+
+  const Options* options_{nullptr};
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(TcpConnection)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,275 @@
+#include "tcp_connection.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+std::string ReadAll(const RingBuffer& buf) {
+  std::string s(buf.Size(), '\0');
+  buf.Peek(&s[0], s.size());
+  return s;
+}
+
+// Echo everything back.
+struct EchoServer {
+  EchoServer(event::Poller* poller, int fd) : conn(poller, fd) {
+    conn.SetDataCallback([this](TcpConnection* c, RingBuffer* input) {
+      iovec iov[2];
+      int cnt = input->ReadableIovecs(iov);
+      for (int i = 0; i < cnt; ++i) {
+        c->Send(iov[i].iov_base, iov[i].iov_len);
+      }
+      input->Consume(input->Size());
+    });
+    conn.SetCloseCallback([this](TcpConnection* c, int err) {
+      closed = true;
+    });
+    conn.Start();
+  }
+
+  TcpConnection conn;
+  bool closed{false};
+};
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(RingBufferTest, WrapAndGrowTest) {
+  LNETNS::net::RingBuffer buf(64);
+  EXPECT_EQ(buf.Capacity(), 64);
+
+  std::string data(48, 'a');
+  buf.Append(data.data(), data.size());
+  buf.Consume(40);
+  // Wraps around the end.
+  std::string more(40, 'b');
+  buf.Append(more.data(), more.size());
+  EXPECT_EQ(buf.Size(), 48);
+  EXPECT_EQ(buf.Capacity(), 64);
+
+  iovec iov[2];
+  ASSERT_EQ(buf.ReadableIovecs(iov), 2);
+  EXPECT_EQ(iov[0].iov_len + iov[1].iov_len, 48);
+  EXPECT_EQ(TESTNS::ReadAll(buf), std::string(8, 'a') + more);
+  EXPECT_EQ(buf.At(8), 'b');
+
+  // Grows and keeps the order.
+  buf.Append(data.data(), data.size());
+  EXPECT_EQ(buf.Capacity(), 128);
+  EXPECT_EQ(TESTNS::ReadAll(buf), std::string(8, 'a') + more + data);
+  ASSERT_EQ(buf.ReadableIovecs(iov), 1);
+
+  buf.Consume(buf.Size());
+  EXPECT_TRUE(buf.Empty());
+  ASSERT_EQ(buf.WritableIovecs(iov), 1);
+  EXPECT_EQ(iov[0].iov_len, 128);
+}
+
+GTEST_TEST(TcpConnectionTest, EchoTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  auto server = std::make_unique<TESTNS::EchoServer>(poller.get(), fds[0]);
+  LNETNS::net::TcpConnection client(poller.get(), fds[1]);
+  std::string received;
+  client.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* input) {
+    received += TESTNS::ReadAll(*input);
+    input->Consume(input->Size());
+  });
+  ASSERT_TRUE(client.Start());
+
+  // Larger than the socket buffers, exercises queued output and kEventOut.
+  std::string payload;
+  for (int i = 0; payload.size() < 4 * 1024 * 1024; ++i) {
+    payload += std::to_string(i) + ",";
+  }
+  ASSERT_TRUE(client.Send(payload.data(), payload.size()));
+  EXPECT_GT(client.OutputSize(), 0);
+
+  while (received.size() < payload.size()) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(received, payload);
+  EXPECT_EQ(client.OutputSize(), 0);
+  EXPECT_EQ(client.BytesWritten(), payload.size());
+  EXPECT_EQ(server->conn.BytesRead(), payload.size());
+
+  // Half-close, the server sees EOF.
+  client.Shutdown();
+  while (!server->closed) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(server->conn.GetState(), LNETNS::net::TcpConnection::kClosed);
+  server.reset();  // release
+}
+
+GTEST_TEST(TcpConnectionTest, CoalesceWritesTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  LNETNS::net::TcpConnection::Options opts;
+  opts.coalesce_writes = true;
+  LNETNS::net::TcpConnection server(poller.get(), fds[0], opts);
+  size_t queued = 0;
+  // One response per pipelined request line.
+  server.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* input) {
+    auto data = TESTNS::ReadAll(*input);
+    input->Consume(input->Size());
+    for (auto ch : data) {
+      if (ch != '\n') {
+        std::string response = std::string("re:") + ch + "\n";
+        c->Send(response.data(), response.size());
+      }
+    }
+    if (data.find('q') != std::string::npos) {
+      c->Shutdown();
+    }
+    queued = c->OutputSize();
+  });
+  ASSERT_TRUE(server.Start());
+
+  std::string requests = "a\nb\nc\n";
+  ASSERT_EQ(write(fds[1], requests.data(), requests.size()), requests.size());
+  EXPECT_EQ(poller->DoPoll(), 1);
+  // Nothing was written from the callback, everything is flushed afterwards.
+  EXPECT_EQ(queued, 15);
+  EXPECT_EQ(server.OutputSize(), 0);
+  EXPECT_EQ(server.BytesWritten(), 15);
+  EXPECT_EQ(poller->CheckCount(), 0);
+
+  char buf[64];
+  EXPECT_EQ(read(fds[1], buf, sizeof(buf)), 15);
+  EXPECT_EQ(std::string(buf, 15), "re:a\nre:b\nre:c\n");
+
+  // Shutdown waits for the deferred flush.
+  ASSERT_EQ(write(fds[1], "q\n", 2), 2);
+  poller->DoPoll();
+  EXPECT_EQ(read(fds[1], buf, sizeof(buf)), 5);
+  EXPECT_EQ(read(fds[1], buf, sizeof(buf)), 0);
+
+  // Output queued outside the loop is flushed by the next DoPoll() without waiting.
+  LNETNS::net::TcpConnection::Options client_opts;
+  client_opts.coalesce_writes = true;
+  int fds2[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds2), 0);
+  LNETNS::net::TcpConnection client(poller.get(), fds2[0], client_opts);
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(client.Send("x", 1));
+  ASSERT_TRUE(client.Send("y", 1));
+  EXPECT_EQ(poller->CheckCount(), 1);
+  poller->DoPoll();
+  EXPECT_EQ(read(fds2[1], buf, sizeof(buf)), 2);
+  EXPECT_EQ(poller->CheckCount(), 0);
+
+  client.Close();
+  server.Close();
+  close(fds[1]);
+  close(fds2[1]);
+}
+
+GTEST_TEST(TcpConnectionTest, WatermarkTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int down_fds[2];
+  int up_fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, down_fds), 0);
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, up_fds), 0);
+
+  LNETNS::net::TcpConnection::Options opts;
+  opts.high_watermark = 256 * 1024;
+  opts.low_watermark = 64 * 1024;
+  LNETNS::net::TcpConnection downstream(poller.get(), down_fds[0], opts);
+  size_t high = 0;
+  int lows = 0;
+  downstream.SetHighWatermarkCallback([&](LNETNS::net::TcpConnection* c, size_t size) {
+    high = size;
+  });
+  downstream.SetLowWatermarkCallback([&](LNETNS::net::TcpConnection* c) { ++lows; });
+  ASSERT_TRUE(downstream.Start());
+
+  // Relays everything from upstream to downstream.
+  LNETNS::net::TcpConnection upstream(poller.get(), up_fds[0]);
+  upstream.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* input) {
+    auto data = TESTNS::ReadAll(*input);
+    input->Consume(input->Size());
+    downstream.Send(data.data(), data.size());
+  });
+  ASSERT_TRUE(upstream.Start());
+  downstream.SetUpstream(&upstream);
+
+  // The downstream peer doesn't read, output piles up to the high watermark.
+  std::string chunk(64 * 1024, 'x');
+  size_t produced = 0;
+  while (!upstream.ReadingPaused()) {
+    auto n = write(up_fds[1], chunk.data(), chunk.size());
+    if (n > 0) {
+      produced += n;
+    }
+    poller->DoPoll();
+  }
+  EXPECT_TRUE(downstream.AboveHighWatermark());
+  EXPECT_GE(high, opts.high_watermark);
+  EXPECT_EQ(lows, 0);
+
+  // Upstream input stays in its socket.
+  for (ssize_t n; (n = write(up_fds[1], chunk.data(), chunk.size())) > 0;) {
+    produced += n;
+  }
+  auto read_before = upstream.BytesRead();
+  auto queued = downstream.OutputSize();
+  for (int i = 0; i < 3; ++i) {
+    poller->AddTimer(10, nullptr);  // nothing is expected to happen
+    poller->DoPoll();
+  }
+  EXPECT_EQ(upstream.BytesRead(), read_before);
+  EXPECT_LT(queued, opts.high_watermark + 2 * chunk.size() + LNETNS::net::TcpConnection::kExtraReadSize);
+
+  // Paused by the application as well: the low watermark doesn't resume reading.
+  upstream.PauseReading();
+  EXPECT_EQ(upstream.PauseReasons(),
+            LNETNS::net::TcpConnection::kPauseApplication | LNETNS::net::TcpConnection::kPauseWatermark);
+  size_t consumed = 0;
+  std::string buf(256 * 1024, '\0');
+  while (lows == 0) {
+    auto n = read(down_fds[1], &buf[0], buf.size());
+    if (n > 0) {
+      consumed += n;
+    }
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_EQ(upstream.PauseReasons(), LNETNS::net::TcpConnection::kPauseApplication);
+  poller->AddTimer(10, nullptr);
+  poller->DoPoll();
+  EXPECT_EQ(upstream.BytesRead(), read_before);
+
+  // Resumed, everything goes through.
+  upstream.ResumeReading();
+  while (consumed < produced) {
+    auto n = read(down_fds[1], &buf[0], buf.size());
+    if (n > 0) {
+      consumed += n;
+    }
+    poller->AddTimer(10, nullptr);  // the rest may be in flight already
+    poller->DoPoll();
+  }
+  EXPECT_GE(lows, 1);
+  EXPECT_FALSE(upstream.ReadingPaused());
+  EXPECT_FALSE(downstream.AboveHighWatermark());
+
+  close(down_fds[1]);
+  close(up_fds[1]);
+}
+
+#undef TESTNS
@@ -0,0 +1,400 @@
+#include "udp_socket.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+#include "socket.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+namespace {
+
+constexpr size_t kGroSlotSize = 65536;
+constexpr size_t kControlSize = CMSG_SPACE(sizeof(int));
+// Kernel limits of a UDP_SEGMENT message.
+constexpr size_t kMaxSegments = 64;
+constexpr size_t kMaxSegmentedSize = 65000;
+
+}  // unnamed namespace
+
+const UdpSocket::Options UdpSocket::kDefaultOptions;
+
+UdpSocket::UdpSocket(event::Poller* poller, DatagramCb callback)
+  : UdpSocket(poller, std::move(callback), kDefaultOptions) {
+}
+
+UdpSocket::UdpSocket(event::Poller* poller, DatagramCb callback, const Options& opt)
+  : poller_(poller), callback_(std::move(callback)) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+}
+
+UdpSocket::~UdpSocket() {
+  Close();
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+bool UdpSocket::Bind(const address::SockAddr& addr) {
+  if (fd_ != BAD_FD) {
+    return false;
+  }
+
+  int fd = CreateSocket(addr.sockaddr.sa_family, SOCK_DGRAM);
+  if (fd == BAD_FD) {
+    errno_ = errno;
+    return false;
+  }
+  if ((options_->reuse_addr && !SetReuseAddr(fd, true)) ||
+      (options_->reuse_port && !SetReusePort(fd, true)) ||
+      bind(fd, &addr.sockaddr, address::GetSockLen(addr)) != 0) {
+    errno_ = errno;
+    close(fd);
+    return false;
+  }
+  return Setup(fd);
+}
+
+bool UdpSocket::Open(int family) {
+  if (fd_ != BAD_FD) {
+    return false;
+  }
+
+  int fd = CreateSocket(family, SOCK_DGRAM);
+  if (fd == BAD_FD) {
+    errno_ = errno;
+    return false;
+  }
+  return Setup(fd);
+}
+
+bool UdpSocket::Connect(const address::SockAddr& addr) {
+  if (fd_ == BAD_FD) {
+    return false;
+  }
+  if (connect(fd_, &addr.sockaddr, address::GetSockLen(addr)) != 0) {
+    errno_ = errno;
+    return false;
+  }
+  return true;
+}
+
+void UdpSocket::Close() {
+  if (fd_ == BAD_FD) {
+    return;
+  }
+  poller_->RemoveFd(fd_);
+  close(fd_);
+  fd_ = BAD_FD;
+  writing_ = false;
+  tx_entries_.clear();
+  tx_used_ = 0;
+}
+
+bool UdpSocket::Setup(int fd) {
+  gro_ = false;
+#ifdef HAVE_UDP_GRO
+  if (options_->gro) {
+    int on = 1;
+    gro_ = setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+  }
+#endif
+
+  // All buffers are allocated once, nothing is allocated per datagram.
+  size_t n = std::max(options_->batch_size, 1);
+  rx_slot_size_ = gro_ ? kGroSlotSize : options_->max_datagram_size;
+  rx_buffer_.reset(new char[n * rx_slot_size_]);
+  rx_control_.reset(new char[n * kControlSize]);
+  rx_msgs_.assign(n, mmsghdr{});
+  rx_iovs_.resize(n);
+  rx_peers_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    rx_iovs_[i].iov_base = rx_buffer_.get() + i * rx_slot_size_;
+    rx_iovs_[i].iov_len = rx_slot_size_;
+    auto& hdr = rx_msgs_[i].msg_hdr;
+    hdr.msg_name = &rx_peers_[i];
+    hdr.msg_iov = &rx_iovs_[i];
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = rx_control_.get() + i * kControlSize;
+  }
+  // Without GRO there is one datagram per message.
+  datagrams_.reserve(n);
+
+  tx_buffer_.reset(new char[options_->send_buffer_size]);
+  tx_control_.reset(new char[n * kControlSize]);
+  tx_entries_.reserve(n);
+  tx_msgs_.assign(n, mmsghdr{});
+  tx_iovs_.resize(n);
+  tx_used_ = 0;
+
+  fd_ = fd;
+  if (!poller_->UpsertFd(fd_, this, event::kEventIn)) {
+    errno_ = poller_->GetLastErrno();
+    close(fd_);
+    fd_ = BAD_FD;
+    return false;
+  }
+  return true;
+}
+
+bool UdpSocket::SendTo(const void* data, size_t len, const address::SockAddr& peer) {
+  return Enqueue(data, len, 0, &peer);
+}
+
+bool UdpSocket::Send(const void* data, size_t len) {
+  return Enqueue(data, len, 0, nullptr);
+}
+
+bool UdpSocket::SendSegmented(const void* data, size_t len, size_t segment_size,
+                              const address::SockAddr& peer) {
+  auto src = static_cast<const char*>(data);
+  if (segment_size == 0) {
+    errno_ = EINVAL;
+    return false;
+  }
+#ifdef HAVE_UDP_SEGMENT
+  auto per_message = std::min(kMaxSegments, kMaxSegmentedSize / segment_size) * segment_size;
+  if (per_message > segment_size && segment_size <= UINT16_MAX) {
+    while (len > 0) {
+      auto n = std::min(len, per_message);
+      // A single segment is sent as a plain datagram.
+      if (!Enqueue(src, n, n > segment_size ? segment_size : 0, &peer)) {
+        return false;
+      }
+      src += n;
+      len -= n;
+    }
+    return true;
+  }
+#endif
+  while (len > 0) {
+    auto n = std::min(len, segment_size);
+    if (!Enqueue(src, n, 0, &peer)) {
+      return false;
+    }
+    src += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool UdpSocket::Enqueue(const void* data, size_t len, uint16_t segment_size,
+                        const address::SockAddr* peer) {
+  if (fd_ == BAD_FD) {
+    errno_ = EBADF;
+    return false;
+  }
+  if (len > options_->send_buffer_size) {
+    errno_ = EMSGSIZE;
+    return false;
+  }
+  if (tx_entries_.size() == tx_msgs_.size() || options_->send_buffer_size - tx_used_ < len) {
+    Flush();
+    if (tx_entries_.size() == tx_msgs_.size() || options_->send_buffer_size - tx_used_ < len) {
+      errno_ = EAGAIN;
+      return false;
+    }
+  }
+
+  std::memcpy(tx_buffer_.get() + tx_used_, data, len);
+  TxEntry entry;
+  entry.off = tx_used_;
+  entry.len = len;
+  entry.segment_size = segment_size;
+  entry.has_peer = peer != nullptr;
+  if (peer) {
+    entry.peer = *peer;
+  }
+  tx_entries_.push_back(entry);
+  tx_used_ += len;
+  return true;
+}
+
+bool UdpSocket::Flush() {
+  size_t sent = 0;
+  while (sent < tx_entries_.size()) {
+    int n = SendBatch(sent, tx_entries_.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      // The first message failed, drop it.
+      errno_ = errno;
+      ++send_errors_;
+      LOG_DEBUG("Dropped datagram: fd={}, err={}", fd_, errno_);
+      ++sent;
+      continue;
+    }
+    for (int i = 0; i < n; ++i) {
+      auto& entry = tx_entries_[sent + i];
+      datagrams_sent_ += entry.segment_size
+        ? (entry.len + entry.segment_size - 1) / entry.segment_size : 1;
+    }
+    sent += n;
+  }
+
+  tx_entries_.erase(tx_entries_.begin(), tx_entries_.begin() + sent);
+  if (tx_entries_.empty()) {
+    tx_used_ = 0;
+    if (writing_) {
+      poller_->ResetEventOut(fd_);
+      writing_ = false;
+    }
+    return true;
+  }
+
+  // Move what is left to the front of the buffer.
+  auto base = tx_entries_.front().off;
+  if (base > 0) {
+    std::memmove(tx_buffer_.get(), tx_buffer_.get() + base, tx_used_ - base);
+    for (auto& entry : tx_entries_) {
+      entry.off -= base;
+    }
+    tx_used_ -= base;
+  }
+  if (!writing_) {
+    writing_ = poller_->SetEventOut(fd_);
+  }
+  return false;
+}
+
+int UdpSocket::SendBatch(size_t begin, size_t end) {
+  int cnt = static_cast<int>(end - begin);
+  for (int i = 0; i < cnt; ++i) {
+    auto& entry = tx_entries_[begin + i];
+    tx_iovs_[i].iov_base = tx_buffer_.get() + entry.off;
+    tx_iovs_[i].iov_len = entry.len;
+
+    auto& hdr = tx_msgs_[i].msg_hdr;
+    hdr = msghdr{};
+    if (entry.has_peer) {
+      hdr.msg_name = &entry.peer;
+      hdr.msg_namelen = address::GetSockLen(entry.peer);
+    }
+    hdr.msg_iov = &tx_iovs_[i];
+    hdr.msg_iovlen = 1;
+#ifdef HAVE_UDP_SEGMENT
+    if (entry.segment_size) {
+      hdr.msg_control = tx_control_.get() + i * kControlSize;
+      hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+      auto cm = CMSG_FIRSTHDR(&hdr);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      std::memcpy(CMSG_DATA(cm), &entry.segment_size, sizeof(uint16_t));
+    }
+#endif
+  }
+
+#ifdef HAVE_SENDMMSG
+  return sendmmsg(fd_, tx_msgs_.data(), cnt, 0);
+#else
+  int sent = 0;
+  for (; sent < cnt; ++sent) {
+    if (sendmsg(fd_, &tx_msgs_[sent].msg_hdr, 0) < 0) {
+      return sent > 0 ? sent : -1;
+    }
+  }
+  return sent;
+#endif
+}
+
+void UdpSocket::OnReadable(int fd) {
+  int n = static_cast<int>(rx_msgs_.size());
+  for (int i = 0; i < n; ++i) {
+    auto& hdr = rx_msgs_[i].msg_hdr;
+    hdr.msg_namelen = sizeof(address::SockAddr);
+    hdr.msg_controllen = gro_ ? kControlSize : 0;
+    hdr.msg_flags = 0;
+  }
+
+#ifdef HAVE_RECVMMSG
+  int count = recvmmsg(fd_, rx_msgs_.data(), n, 0, nullptr);
+#else
+  int count = 0;
+  for (; count < n; ++count) {
+    auto len = recvmsg(fd_, &rx_msgs_[count].msg_hdr, 0);
+    if (len < 0) {
+      break;
+    }
+    rx_msgs_[count].msg_len = len;
+  }
+  if (count == 0) {
+    count = -1;
+  }
+#endif
+  if (count < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      // E.g. ECONNREFUSED of a connected socket, not fatal.
+      errno_ = errno;
+    }
+    return;
+  }
+
+  Deliver(count);
+  // Replies queued by the callback go out together.
+  if (fd_ != BAD_FD && !tx_entries_.empty() && !writing_) {
+    Flush();
+  }
+}
+
+void UdpSocket::Deliver(int count) {
+  datagrams_.clear();
+  for (int i = 0; i < count; ++i) {
+    auto& msg = rx_msgs_[i];
+    auto data = static_cast<const char*>(rx_iovs_[i].iov_base);
+    size_t len = msg.msg_len;
+    auto peer = &rx_peers_[i];
+    if (msg.msg_hdr.msg_flags & MSG_TRUNC) {
+      // Larger than the receive buffer, the rest is lost.
+      ++datagrams_truncated_;
+      continue;
+    }
+
+    size_t segment = 0;
+#ifdef HAVE_UDP_GRO
+    if (gro_) {
+      for (auto cm = CMSG_FIRSTHDR(&msg.msg_hdr); cm; cm = CMSG_NXTHDR(&msg.msg_hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+          int size;
+          std::memcpy(&size, CMSG_DATA(cm), sizeof(size));
+          segment = size;
+        }
+      }
+    }
+#endif
+    if (segment == 0 || segment >= len) {
+      datagrams_.push_back(Datagram{data, len, peer});
+      continue;
+    }
+    // Coalesced by GRO.
+    for (size_t off = 0; off < len; off += segment) {
+      datagrams_.push_back(Datagram{data + off, std::min(segment, len - off), peer});
+    }
+  }
+
+  datagrams_received_ += datagrams_.size();
+  if (callback_ && !datagrams_.empty()) {
+    callback_(this, datagrams_.data(), datagrams_.size());
+  }
+}
+
+void UdpSocket::OnWritable(int fd) {
+  Flush();
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,148 @@
+#pragma once
+#include "macros.h"
+
+#include <sys/socket.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "event/poller.h"
+#include "address/sockaddr.h"
+
+namespace LNETNS {
+namespace net {
+
+class UdpSocket;
+
+#if !defined HAVE_RECVMMSG && !defined HAVE_SENDMMSG
+struct mmsghdr {
+  msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
+struct Datagram {
+  const char* data;  // valid during the callback only
+  size_t len;
+  const address::SockAddr* peer;
+};
+
+// Called once per readiness event with the datagrams received by it.
+using DatagramCb = std::function<void(UdpSocket* sock, const Datagram* datagrams, size_t count)>;
+
+// Batched UDP socket.
+//
+// Each readable event drains up to "batch_size" datagrams with a single recvmmsg()
+// into arrays allocated once by Bind()/Open(). Outgoing datagrams are copied to a send
+// queue and flushed with a single sendmmsg() after the datagram callback returns
+// (so that replies go out together), when the queue is full, or with Flush().
+//
+// With "gro", the kernel may coalesce datagrams of a flow into one buffer
+// (UDP_GRO), it is split back into datagrams before the callback. SendSegmented()
+// hands a large buffer to the kernel as one message cut into datagrams of
+// "segment_size" (UDP_SEGMENT, aka GSO).
+//
+// Without recvmmsg/sendmmsg, falls back to one recvmsg/sendmsg per datagram.
+class UdpSocket : public event::EventHandler {
+public:
+  struct Options {
+    int batch_size{64};  // datagrams per recvmmsg/sendmmsg
+    size_t max_datagram_size{2048};  // receive buffer per datagram, larger ones are dropped
+    bool reuse_addr{false};  // SO_REUSEADDR
+    bool reuse_port{false};  // SO_REUSEPORT
+    // UDP_GRO, receive buffers are enlarged to 64KB, mind batch_size.
+    bool gro{false};
+    size_t send_buffer_size{256 * 1024};  // send queue capacity in bytes
+  };
+
+public:
+  UdpSocket(event::Poller* poller, DatagramCb callback);
+  UdpSocket(event::Poller* poller, DatagramCb callback, const Options& opt);
+  UdpSocket() = delete;
+  ~UdpSocket() override;
+
+  // Create a socket of the family of "addr" and bind it.
+  bool Bind(const address::SockAddr& addr);
+  // Create an unbound socket.
+  bool Open(int family);
+  // Set the default destination, SendTo(data, len) can be used afterwards.
+  bool Connect(const address::SockAddr& addr);
+  void Close();
+
+  // Queue a datagram. Returns false if it could not be queued (GetLastErrno()).
+  bool SendTo(const void* data, size_t len, const address::SockAddr& peer);
+  bool Send(const void* data, size_t len);
+  // Queue "len" bytes sent as datagrams of "segment_size" bytes (the last one may
+  // be shorter). Without UDP_SEGMENT, they are queued one by one.
+  bool SendSegmented(const void* data, size_t len, size_t segment_size,
+                     const address::SockAddr& peer);
+  // Send the queued datagrams, returns false on EAGAIN (they are sent once writable).
+  bool Flush();
+
+  inline int Fd() const { return fd_; }
+  inline int GetLastErrno() const { return errno_; }
+  inline size_t Queued() const { return tx_entries_.size(); }
+  inline bool GroEnabled() const { return gro_; }
+  inline uint64_t DatagramsReceived() const { return datagrams_received_; }
+  inline uint64_t DatagramsSent() const { return datagrams_sent_; }
+  // Datagrams dropped for being larger than max_datagram_size.
+  inline uint64_t DatagramsTruncated() const { return datagrams_truncated_; }
+  // Datagrams dropped after a send error.
+  inline uint64_t SendErrors() const { return send_errors_; }
+
+private:
+  struct TxEntry {
+    size_t off;  // in tx_buffer_
+    size_t len;
+    uint16_t segment_size;  // 0 for a plain datagram
+    bool has_peer;
+    address::SockAddr peer;
+  };
+
+  bool Setup(int fd);
+  bool Enqueue(const void* data, size_t len, uint16_t segment_size,
+               const address::SockAddr* peer);
+  // Send tx_entries_[begin, end), returns the number of messages sent or -1.
+  int SendBatch(size_t begin, size_t end);
+  void Deliver(int count);
+
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override;
+
+private:
+  event::Poller* poller_{nullptr};
+  DatagramCb callback_;
+  const Options* options_{nullptr};
+
+  int fd_{BAD_FD};
+  bool gro_{false};
+  bool writing_{false};  // kEventOut enabled
+  int errno_{0};
+
+  // Receive side, sized in Setup().
+  size_t rx_slot_size_{0};
+  std::unique_ptr<char[]> rx_buffer_;
+  std::vector<mmsghdr> rx_msgs_;
+  std::vector<iovec> rx_iovs_;
+  std::vector<address::SockAddr> rx_peers_;
+  std::unique_ptr<char[]> rx_control_;
+  std::vector<Datagram> datagrams_;
+
+  // Send side.
+  std::unique_ptr<char[]> tx_buffer_;
+  size_t tx_used_{0};
+  std::vector<TxEntry> tx_entries_;
+  std::vector<mmsghdr> tx_msgs_;
+  std::vector<iovec> tx_iovs_;
+  std::unique_ptr<char[]> tx_control_;
+
+  uint64_t datagrams_received_{0};
+  uint64_t datagrams_sent_{0};
+  uint64_t datagrams_truncated_{0};
+  uint64_t send_errors_{0};
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(UdpSocket)
+};
+
+}  // namespace net
+}  // namespace LNETNS
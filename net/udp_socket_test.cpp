@@ -0,0 +1,126 @@
+#include "udp_socket.h"
+#include "socket.h"
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using LNETNS::net::Datagram;
+using LNETNS::net::UdpSocket;
+
+GTEST_TEST(UdpSocketTest, BatchEchoTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  auto addr = *LNETNS::address::ParseIPPort("127.0.0.1:0");
+
+  // Echo every datagram back to its sender.
+  int batches = 0;
+  UdpSocket server(poller.get(), [&](UdpSocket* sock, const Datagram* dgrams, size_t count) {
+    ++batches;
+    for (size_t i = 0; i < count; ++i) {
+      sock->SendTo(dgrams[i].data, dgrams[i].len, *dgrams[i].peer);
+    }
+  });
+  ASSERT_TRUE(server.Bind(addr));
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(server.Fd(), &addr));
+
+  std::vector<std::string> received;
+  UdpSocket client(poller.get(), [&](UdpSocket* sock, const Datagram* dgrams, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      received.emplace_back(dgrams[i].data, dgrams[i].len);
+    }
+  });
+  ASSERT_TRUE(client.Open(AF_INET));
+  ASSERT_TRUE(client.Connect(addr));
+
+  constexpr int kCount = 100;
+  for (int i = 0; i < kCount; ++i) {
+    auto s = "datagram-" + std::to_string(i);
+    ASSERT_TRUE(client.Send(s.data(), s.size()));
+  }
+  // Queue is full at batch_size, the first 64 went out already.
+  EXPECT_EQ(client.Queued(), kCount - UdpSocket::Options().batch_size);
+  EXPECT_TRUE(client.Flush());
+  EXPECT_EQ(client.Queued(), 0);
+  EXPECT_EQ(client.DatagramsSent(), kCount);
+
+  while (received.size() < kCount) {
+    poller->DoPoll();
+  }
+  for (int i = 0; i < kCount; ++i) {
+    EXPECT_EQ(received[i], "datagram-" + std::to_string(i));
+  }
+  EXPECT_EQ(server.DatagramsReceived(), kCount);
+  EXPECT_EQ(server.DatagramsSent(), kCount);
+  // Several datagrams per recvmmsg.
+  EXPECT_LT(batches, kCount);
+}
+
+GTEST_TEST(UdpSocketTest, TruncatedTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  auto addr = *LNETNS::address::ParseIPPort("127.0.0.1:0");
+  UdpSocket::Options opts;
+  opts.max_datagram_size = 16;
+  std::vector<std::string> received;
+  UdpSocket server(poller.get(), [&](UdpSocket* sock, const Datagram* dgrams, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      received.emplace_back(dgrams[i].data, dgrams[i].len);
+    }
+  }, opts);
+  ASSERT_TRUE(server.Bind(addr));
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(server.Fd(), &addr));
+
+  UdpSocket client(poller.get(), nullptr);
+  ASSERT_TRUE(client.Open(AF_INET));
+  ASSERT_TRUE(client.Connect(addr));
+  std::string large(100, 'l');
+  ASSERT_TRUE(client.Send(large.data(), large.size()));
+  ASSERT_TRUE(client.Send("small", 5));
+  ASSERT_TRUE(client.Flush());
+
+  // Not delivered cut to the buffer size.
+  while (received.empty()) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(received, std::vector<std::string>{"small"});
+  EXPECT_EQ(server.DatagramsTruncated(), 1);
+  EXPECT_EQ(server.DatagramsReceived(), 1);
+}
+
+GTEST_TEST(UdpSocketTest, SegmentTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  auto addr = *LNETNS::address::ParseIPPort("127.0.0.1:0");
+
+  std::vector<std::string> received;
+  UdpSocket::Options opts;
+  opts.gro = true;
+  UdpSocket server(poller.get(), [&](UdpSocket* sock, const Datagram* dgrams, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      received.emplace_back(dgrams[i].data, dgrams[i].len);
+    }
+  }, opts);
+  ASSERT_TRUE(server.Bind(addr));
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(server.Fd(), &addr));
+
+  UdpSocket client(poller.get(), nullptr);
+  ASSERT_TRUE(client.Open(AF_INET));
+
+  // 10 full segments and a short one, whether or not GSO/GRO are available.
+  std::string payload;
+  for (int i = 0; i < 10; ++i) {
+    payload += std::string(1000, 'a' + i);
+  }
+  payload += std::string(500, 'z');
+  ASSERT_TRUE(client.SendSegmented(payload.data(), payload.size(), 1000, addr));
+  EXPECT_TRUE(client.Flush());
+  EXPECT_EQ(client.DatagramsSent(), 11);
+
+  while (received.size() < 11) {
+    poller->DoPoll();
+  }
+  ASSERT_EQ(received.size(), 11);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(received[i], std::string(1000, 'a' + i));
+  }
+  EXPECT_EQ(received[10], std::string(500, 'z'));
+}
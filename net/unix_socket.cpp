@@ -0,0 +1,326 @@
+#include "unix_socket.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+#include "socket.h"
+#include "debug.h"
+
+namespace LNETNS {
+namespace net {
+
+bool CreateUnixPair(int type, int fds[2]) {
+#if defined HAVE_SOCK_CLOEXEC && defined SOCK_NONBLOCK
+  return socketpair(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0;
+#else
+  if (socketpair(AF_UNIX, type, 0, fds) != 0) {
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (!SetNonBlock(fds[i]) || !SetCloseOnExec(fds[i])) {
+      int saved_errno = errno;
+      close(fds[0]);
+      close(fds[1]);
+      errno = saved_errno;
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+ssize_t SendWithFds(int fd, const void* data, size_t len, const int* fds, int nfds) {
+  iovec iov;
+  iov.iov_base = const_cast<void*>(data);
+  iov.iov_len = len;
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  if (nfds > 0) {
+    if (nfds > kMaxPassedFds) {
+      errno = EINVAL;
+      return -1;
+    }
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+  }
+
+  ssize_t n;
+  do {
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+ssize_t RecvWithFds(int fd, void* buf, size_t len, int* fds, int* nfds, int max_fds) {
+  *nfds = 0;
+  max_fds = std::min(max_fds, kMaxPassedFds);
+  iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  if (max_fds > 0) {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * max_fds);
+  }
+
+  int flags = 0;
+#ifdef HAVE_MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  ssize_t n;
+  do {
+    n = recvmsg(fd, &msg, flags);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return -1;
+  }
+
+  // CMSG_SPACE() rounds up, room for one more fd than asked may have been filled.
+  bool extra = false;
+  if (msg.msg_controllen > 0) {
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        continue;
+      }
+      int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      auto data = reinterpret_cast<const unsigned char*>(CMSG_DATA(cmsg));
+      for (int i = 0; i < count; ++i) {
+        int received;
+        std::memcpy(&received, data + sizeof(int) * i, sizeof(int));
+        if (*nfds < max_fds) {
+          fds[(*nfds)++] = received;
+        } else {
+          close(received);
+          extra = true;
+        }
+      }
+    }
+  }
+#ifndef HAVE_MSG_CMSG_CLOEXEC
+  for (int i = 0; i < *nfds; ++i) {
+    SetCloseOnExec(fds[i]);
+  }
+#endif
+
+  if (extra || (msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC))) {
+    for (int i = 0; i < *nfds; ++i) {
+      close(fds[i]);
+    }
+    *nfds = 0;
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return n;
+}
+
+const UnixConnection::Options UnixConnection::kDefaultOptions;
+
+UnixConnection::UnixConnection(event::Poller* poller, int fd)
+  : UnixConnection(poller, fd, kDefaultOptions) {
+}
+
+UnixConnection::UnixConnection(event::Poller* poller, int fd, const Options& opt)
+  : poller_(poller), fd_(fd) {
+  if (&opt != &kDefaultOptions) {
+    options_ = new Options(opt);
+  } else {
+    options_ = &opt;
+  }
+  input_.resize(options_->max_message_size);
+  fds_.resize(std::min(options_->max_fds, kMaxPassedFds));
+}
+
+UnixConnection::~UnixConnection() {
+  if (fd_ != BAD_FD) {
+    poller_->RemoveFd(fd_);
+    close(fd_);
+    fd_ = BAD_FD;
+  }
+  for (auto& m : output_) {
+    for (auto fd : m.fds) {
+      close(fd);
+    }
+  }
+  if (options_ != &kDefaultOptions) {
+    delete options_;
+    options_ = nullptr;
+  }
+}
+
+bool UnixConnection::Start() {
+  if (closed_) {
+    return false;
+  }
+  int mask = event::kEventIn;
+  if (writing_) {
+    mask |= event::kEventOut;
+  }
+  return poller_->UpsertFd(fd_, this, mask);
+}
+
+bool UnixConnection::Send(const void* data, size_t len, const int* fds, int nfds) {
+  if (closed_ || errno_) {
+    return false;
+  }
+  if (nfds > kMaxPassedFds) {
+    errno = EINVAL;
+    return false;
+  }
+
+  size_t sent = 0;
+  if (output_.empty()) {
+    // Nothing queued, try to send directly.
+    auto n = SendWithFds(fd_, data, len, fds, nfds);
+    if (n >= 0) {
+      sent = n;
+      nfds = 0;  // passed with the first byte
+      if (sent == len) {
+        return true;
+      }
+    } else if (errno == EMSGSIZE) {
+      // Only this message is refused.
+      return false;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      // Report the error from OnWritable().
+      errno_ = errno;
+      writing_ = poller_->SetEventOut(fd_);
+      return false;
+    }
+  }
+
+  // Partially sent on a stream socket, or the socket is full.
+  Message m;
+  m.data.assign(static_cast<const char*>(data) + sent, len - sent);
+  for (int i = 0; i < nfds; ++i) {
+    int dup = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+    if (dup < 0) {
+      for (auto fd : m.fds) {
+        close(fd);
+      }
+      return false;
+    }
+    m.fds.push_back(dup);
+  }
+  output_.push_back(std::move(m));
+  if (!writing_) {
+    writing_ = poller_->SetEventOut(fd_);
+  }
+  return true;
+}
+
+void UnixConnection::Close() {
+  HandleClose(0);
+}
+
+bool UnixConnection::FlushOutput() {
+  while (!output_.empty()) {
+    auto& m = output_.front();
+    auto n = SendWithFds(fd_, m.data.data(), m.data.size(), m.fds.data(), m.fds.size());
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      errno_ = errno;
+      return false;
+    }
+    for (auto fd : m.fds) {
+      close(fd);
+    }
+    m.fds.clear();
+    if (static_cast<size_t>(n) < m.data.size()) {
+      m.data.erase(0, n);
+      return true;
+    }
+    output_.pop_front();
+  }
+  return true;
+}
+
+void UnixConnection::OnReadable(int fd) {
+  for (int i = 0; i < kMaxReadsPerEvent; ++i) {
+    int nfds = 0;
+    auto n = RecvWithFds(fd_, input_.data(), input_.size(), fds_.data(), &nfds, fds_.size());
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_DEBUG("Unix connection read error: fd={}, errno={}", fd_, errno);
+        HandleClose(errno);
+      }
+      return;
+    }
+    // An empty seqpacket message without fds can't be told apart from EOF.
+    if (n == 0 && nfds == 0) {
+      HandleClose(0);
+      return;
+    }
+
+    std::vector<int> fds(fds_.begin(), fds_.begin() + nfds);
+    if (message_cb_) {
+      message_cb_(this, input_.data(), n, &fds);
+    } else {
+      for (auto received : fds) {
+        close(received);
+      }
+    }
+    if (closed_) {
+      return;
+    }
+  }
+}
+
+void UnixConnection::OnWritable(int fd) {
+  if (errno_ || !FlushOutput()) {
+    HandleClose(errno_);
+    return;
+  }
+  if (output_.empty() && writing_) {
+    poller_->ResetEventOut(fd_);
+    writing_ = false;
+  }
+}
+
+void UnixConnection::OnError(int fd) {
+  int err = GetSocketError(fd_);
+  LOG_DEBUG("Unix connection error: fd={}, err={}", fd_, err);
+  HandleClose(err);
+}
+
+void UnixConnection::HandleClose(int err) {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  writing_ = false;
+  poller_->RemoveFd(fd_);
+  close(fd_);
+  fd_ = BAD_FD;
+  for (auto& m : output_) {
+    for (auto fd : m.fds) {
+      close(fd);
+    }
+  }
+  output_.clear();
+
+  // The callback may release this connection, don't touch members afterwards.
+  auto cb = std::move(close_cb_);
+  close_cb_ = nullptr;
+  if (cb) {
+    cb(this, err);
+  }
+}
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,127 @@
+#pragma once
+#include <sys/types.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "macros.h"
+#include "event/poller.h"
+
+namespace LNETNS {
+namespace net {
+
+// Helpers for unix domain sockets. Stream unix sockets work with TcpConnection as
+// is (TCP_NODELAY fails silently), UnixConnection adds message boundaries and fd
+// passing. Listen with an Acceptor on an address from address::ParseUnix(), with
+// Options::socket_type = SOCK_SEQPACKET for messages.
+
+// Max descriptors per message handled by the helpers below (the kernel allows 253).
+constexpr int kMaxPassedFds = 64;
+
+// Connected pair of non-blocking, close-on-exec sockets.
+bool CreateUnixPair(int type, int fds[2]);
+
+// Send "len" bytes with "nfds" descriptors attached (SCM_RIGHTS). The descriptors
+// stay owned by the caller. Returns the number of bytes sent, -1 with errno set.
+ssize_t SendWithFds(int fd, const void* data, size_t len, const int* fds, int nfds);
+
+// Receive up to "len" bytes and at most "max_fds" (up to kMaxPassedFds) descriptors
+// into "fds", their number is stored in "nfds". The received descriptors are
+// close-on-exec and owned by the caller. If the sender attached more than "max_fds",
+// or a datagram/seqpacket message was longer than "len", the rest is lost: the
+// received fds are closed and it fails with EMSGSIZE. Returns the number of bytes
+// received (0 on EOF), -1 with errno set.
+ssize_t RecvWithFds(int fd, void* buf, size_t len, int* fds, int* nfds, int max_fds);
+
+class UnixConnection;
+
+// Called for every message received, with the descriptors which came with it.
+// The callback owns them: it must close the ones it doesn't keep. Call Close()
+// rather than releasing the connection in it.
+using MessageCb = std::function<void(UnixConnection* conn, const char* data, size_t len,
+                                     std::vector<int>* fds)>;
+// Called once when the connection is closed by the peer (err = 0) or on error.
+// The connection may be released in the callback.
+using UnixCloseCb = std::function<void(UnixConnection* conn, int err)>;
+
+// Message connection on a connected non-blocking SOCK_SEQPACKET (or SOCK_DGRAM)
+// unix socket.
+//
+// Each Send() is one message, received whole by the peer, with optional fds.
+// Messages are sent directly when nothing is queued, otherwise they are queued
+// along with duplicates of their fds, and flushed when the socket is writable.
+// Reads loop on recvmsg() into a buffer of max_message_size bytes, a larger message
+// closes the connection with EMSGSIZE.
+//
+// Over a stream socket, message boundaries are not preserved, and fds arrive with
+// the first byte of the data they were sent with.
+class UnixConnection : public event::EventHandler {
+public:
+  static constexpr int kMaxReadsPerEvent = 16;
+
+  struct Options {
+    size_t max_message_size{65536};
+    int max_fds{16};  // per message, up to kMaxPassedFds
+  };
+
+public:
+  // Takes the ownership of "fd".
+  UnixConnection(event::Poller* poller, int fd);
+  UnixConnection(event::Poller* poller, int fd, const Options& opt);
+  UnixConnection() = delete;
+  ~UnixConnection() override;
+
+  // Register the socket to the poller and start reading.
+  bool Start();
+
+  // Returns false if the connection is not writable anymore, or with errno set if
+  // only this message failed, e.g. EMSGSIZE if it is larger than the socket send
+  // buffer. "fds" may be closed once it returns.
+  bool Send(const void* data, size_t len, const int* fds = nullptr, int nfds = 0);
+  // Close immediately, queued messages are discarded. The close callback is invoked.
+  void Close();
+
+  inline void SetMessageCallback(MessageCb cb) { message_cb_ = std::move(cb); }
+  inline void SetCloseCallback(UnixCloseCb cb) { close_cb_ = std::move(cb); }
+
+  inline int Fd() const { return fd_; }
+  inline bool Connected() const { return !closed_; }
+  inline size_t QueuedMessages() const { return output_.size(); }
+  // Fatal write error.
+  inline int GetLastErrno() const { return errno_; }
+
+protected:
+  void OnReadable(int fd) override;
+  void OnWritable(int fd) override;
+  void OnError(int fd) override;
+
+  // Returns false on fatal error.
+  bool FlushOutput();
+  void HandleClose(int err);
+
+  struct Message {
+    std::string data;
+    std::vector<int> fds;  // duplicated, owned
+  };
+
+protected:
+  event::Poller* poller_{nullptr};
+  int fd_{BAD_FD};
+  const Options* options_{nullptr};
+  bool closed_{false};
+  bool writing_{false};  // kEventOut enabled
+  int errno_{0};
+
+  std::vector<char> input_;
+  std::vector<int> fds_;  // received with the current message
+  std::deque<Message> output_;
+
+  MessageCb message_cb_;
+  UnixCloseCb close_cb_;
+
+  static const Options kDefaultOptions;
+  NON_COPYABLE_NOR_MOVABLE(UnixConnection)
+};
+
+}  // namespace net
+}  // namespace LNETNS
@@ -0,0 +1,240 @@
+#include "unix_socket.h"
+#include "acceptor.h"
+#include "tcp_connection.h"
+#include "socket.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+int ConnectUnix(const address::SockAddr& addr, int type) {
+  int fd = CreateSocket(AF_UNIX, type);
+  if (connect(fd, &addr.sockaddr, address::GetSockLen(addr)) != 0) {
+    close(fd);
+    return BAD_FD;
+  }
+  return fd;
+}
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(UnixSocketTest, PassFdsTest) {
+  int sv[2];
+  ASSERT_TRUE(LNETNS::net::CreateUnixPair(SOCK_SEQPACKET, sv));
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+
+  ASSERT_EQ(LNETNS::net::SendWithFds(sv[0], "pipe", 4, &pipefd[1], 1), 4);
+  close(pipefd[1]);
+
+  char buf[16];
+  int fds[4];
+  int nfds = 0;
+  ASSERT_EQ(LNETNS::net::RecvWithFds(sv[1], buf, sizeof(buf), fds, &nfds, 4), 4);
+  EXPECT_EQ(std::string(buf, 4), "pipe");
+  ASSERT_EQ(nfds, 1);
+  EXPECT_TRUE(fcntl(fds[0], F_GETFD) & FD_CLOEXEC);
+  // The received fd is the write end of the same pipe.
+  ASSERT_EQ(write(fds[0], "x", 1), 1);
+  close(fds[0]);
+  ASSERT_EQ(read(pipefd[0], buf, sizeof(buf)), 1);
+  EXPECT_EQ(buf[0], 'x');
+
+  // More fds than accepted: they are closed and the message is reported.
+  int three[3] = {pipefd[0], pipefd[0], pipefd[0]};
+  ASSERT_EQ(LNETNS::net::SendWithFds(sv[0], "y", 1, three, 3), 1);
+  EXPECT_EQ(LNETNS::net::RecvWithFds(sv[1], buf, sizeof(buf), fds, &nfds, 2), -1);
+  EXPECT_EQ(errno, EMSGSIZE);
+  EXPECT_EQ(nfds, 0);
+
+  // With an odd "max_fds", the control buffer has room for one more fd: it is not
+  // stored past "max_fds".
+  int four[4] = {pipefd[0], pipefd[0], pipefd[0], pipefd[0]};
+  ASSERT_EQ(LNETNS::net::SendWithFds(sv[0], "z", 1, four, 4), 1);
+  int guarded[4] = {-1, -1, -1, -1};
+  EXPECT_EQ(LNETNS::net::RecvWithFds(sv[1], buf, sizeof(buf), guarded, &nfds, 3), -1);
+  EXPECT_EQ(errno, EMSGSIZE);
+  EXPECT_EQ(nfds, 0);
+  EXPECT_EQ(guarded[3], -1);
+  ASSERT_EQ(LNETNS::net::SendWithFds(sv[0], "z", 1, four, 3), 1);
+  EXPECT_EQ(LNETNS::net::RecvWithFds(sv[1], buf, sizeof(buf), guarded, &nfds, 3), 1);
+  EXPECT_EQ(nfds, 3);
+  EXPECT_EQ(guarded[3], -1);
+  for (int i = 0; i < nfds; ++i) {
+    close(guarded[i]);
+  }
+
+  close(pipefd[0]);
+  close(sv[0]);
+  close(sv[1]);
+}
+
+GTEST_TEST(UnixSocketTest, SeqpacketConnectionTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  std::unique_ptr<LNETNS::net::UnixConnection> server;
+  std::vector<std::string> messages;
+  std::vector<int> received;
+  LNETNS::address::SockAddr peer_addr;
+
+  LNETNS::net::Acceptor::Options opts;
+  opts.socket_type = SOCK_SEQPACKET;
+  LNETNS::net::Acceptor acceptor(
+    poller.get(), [&](int fd, const LNETNS::address::SockAddr& peer) {
+      peer_addr = peer;
+      server = std::make_unique<LNETNS::net::UnixConnection>(poller.get(), fd);
+      server->SetMessageCallback([&](LNETNS::net::UnixConnection* c, const char* data,
+                                     size_t len, std::vector<int>* fds) {
+        messages.emplace_back(data, len);
+        received.insert(received.end(), fds->begin(), fds->end());
+      });
+      server->Start();
+    }, opts);
+
+  std::string name = "@lightnet-test-" + std::to_string(getpid());
+  auto addr = LNETNS::address::ParseUnix("unix:" + name);
+  ASSERT_NE(addr, nullptr);
+  ASSERT_TRUE(acceptor.Listen(*addr));
+  LNETNS::address::SockAddr local;
+  ASSERT_TRUE(LNETNS::net::GetLocalAddr(acceptor.Fd(), &local));
+  EXPECT_EQ(LNETNS::address::ToString(local), "unix:" + name);
+
+  int fd = TESTNS::ConnectUnix(*addr, SOCK_SEQPACKET);
+  ASSERT_NE(fd, BAD_FD);
+  LNETNS::net::UnixConnection client(poller.get(), fd);
+  bool closed = false;
+  client.SetCloseCallback([&](LNETNS::net::UnixConnection* c, int err) {
+    closed = true;
+  });
+  ASSERT_TRUE(client.Start());
+  poller->DoPoll();
+  ASSERT_NE(server, nullptr);
+  EXPECT_EQ(LNETNS::address::ToString(peer_addr), "unix:");
+
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+  ASSERT_TRUE(client.Send("first", 5, &pipefd[1], 1));
+  ASSERT_TRUE(client.Send("second", 6));
+  close(pipefd[1]);
+  poller->DoPoll();
+
+  // Boundaries are kept, each message is delivered on its own.
+  ASSERT_EQ(messages.size(), 2);
+  EXPECT_EQ(messages[0], "first");
+  EXPECT_EQ(messages[1], "second");
+  ASSERT_EQ(received.size(), 1);
+  ASSERT_EQ(write(received[0], "z", 1), 1);
+  close(received[0]);
+  char c;
+  ASSERT_EQ(read(pipefd[0], &c, 1), 1);
+  EXPECT_EQ(c, 'z');
+  close(pipefd[0]);
+
+  server->Close();
+  poller->DoPoll();
+  EXPECT_TRUE(closed);
+  EXPECT_FALSE(client.Connected());
+}
+
+GTEST_TEST(UnixSocketTest, QueuedSendTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int sv[2];
+  ASSERT_TRUE(LNETNS::net::CreateUnixPair(SOCK_SEQPACKET, sv));
+  LNETNS::net::UnixConnection sender(poller.get(), sv[0]);
+  LNETNS::net::UnixConnection receiver(poller.get(), sv[1]);
+  ASSERT_TRUE(sender.Start());
+
+  // Fill the socket until messages are queued, fds queued along are duplicated.
+  std::string msg(4096, 'm');
+  int count = 0;
+  while (sender.QueuedMessages() == 0) {
+    ASSERT_TRUE(sender.Send(msg.data(), msg.size()));
+    ++count;
+  }
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+  ASSERT_TRUE(sender.Send("fd", 2, &pipefd[1], 1));
+  close(pipefd[1]);
+  ++count;
+
+  int got = 0;
+  bool has_fd = false;
+  receiver.SetMessageCallback([&](LNETNS::net::UnixConnection* c, const char* data,
+                                  size_t len, std::vector<int>* fds) {
+    ++got;
+    for (auto fd : *fds) {
+      has_fd = len == 2;
+      close(fd);
+    }
+  });
+  ASSERT_TRUE(receiver.Start());
+  while (got < count) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_EQ(sender.QueuedMessages(), 0);
+  EXPECT_TRUE(has_fd);
+
+  // All the write ends are closed now.
+  char c;
+  EXPECT_EQ(read(pipefd[0], &c, 1), 0);
+  close(pipefd[0]);
+}
+
+GTEST_TEST(UnixSocketTest, StreamTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  std::unique_ptr<LNETNS::net::TcpConnection> server;
+  std::string input;
+
+  LNETNS::net::Acceptor acceptor(
+    poller.get(), [&](int fd, const LNETNS::address::SockAddr& peer) {
+      server = std::make_unique<LNETNS::net::TcpConnection>(poller.get(), fd);
+      server->SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* buf) {
+        std::string s(buf->Size(), '\0');
+        buf->Peek(&s[0], s.size());
+        buf->Consume(s.size());
+        input += s;
+        c->Send(s.data(), s.size());
+      });
+      server->Start();
+    });
+
+  std::string path = "/tmp/lightnet-test-" + std::to_string(getpid()) + ".sock";
+  unlink(path.c_str());
+  auto addr = LNETNS::address::ParseUnix("unix:" + path);
+  ASSERT_NE(addr, nullptr);
+  ASSERT_TRUE(acceptor.Listen(*addr));
+
+  int fd = TESTNS::ConnectUnix(*addr, SOCK_STREAM);
+  ASSERT_NE(fd, BAD_FD);
+  LNETNS::net::TcpConnection client(poller.get(), fd);
+  std::string echoed;
+  client.SetDataCallback([&](LNETNS::net::TcpConnection* c, LNETNS::net::RingBuffer* buf) {
+    std::string s(buf->Size(), '\0');
+    buf->Peek(&s[0], s.size());
+    buf->Consume(s.size());
+    echoed += s;
+  });
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(client.Send("hello", 5));
+  while (echoed.size() < 5) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_EQ(input, "hello");
+  EXPECT_EQ(echoed, "hello");
+
+  acceptor.Close();
+  unlink(path.c_str());
+}
@@ -0,0 +1,327 @@
+#include "tcp_connection.h"
+#include "splice_relay.h"
+#include "socket.h"
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace LNETNS {
+namespace net {
+namespace test {
+
+// Collects everything received until EOF.
+struct Sink {
+  Sink(event::Poller* poller, int fd) : conn(poller, fd) {
+    conn.SetDataCallback([this](TcpConnection* c, RingBuffer* input) {
+      std::string s(input->Size(), '\0');
+      input->Peek(&s[0], s.size());
+      received += s;
+      input->Consume(input->Size());
+    });
+    conn.SetCloseCallback([this](TcpConnection* c, int err) {
+      closed = true;
+    });
+    conn.Start();
+  }
+
+  TcpConnection conn;
+  std::string received;
+  bool closed{false};
+};
+
+std::string Payload(size_t size) {
+  std::string s;
+  for (int i = 0; s.size() < size; ++i) {
+    s += std::to_string(i) + ",";
+  }
+  return s;
+}
+
+// Connected pair of loopback TCP sockets.
+bool TcpPair(int fds[2]) {
+  auto addr = *address::ParseIPPort("127.0.0.1:0");
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (bind(listen_fd, &addr.sockaddr, address::GetSockLen(addr)) != 0 ||
+      listen(listen_fd, 1) != 0 || !GetLocalAddr(listen_fd, &addr)) {
+    close(listen_fd);
+    return false;
+  }
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  connect(fds[0], &addr.sockaddr, address::GetSockLen(addr));
+  fds[1] = accept(listen_fd, nullptr, nullptr);
+  close(listen_fd);
+  return fds[1] >= 0 && SetNonBlock(fds[0]) && SetNonBlock(fds[1]);
+}
+
+}  // namespace test
+}  // namespace net
+}  // namespace LNETNS
+
+#define TESTNS LNETNS::net::test
+
+GTEST_TEST(ZeroCopyTest, SendFileTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  auto content = TESTNS::Payload(2 * 1024 * 1024);
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fwrite(content.data(), 1, content.size(), file), content.size());
+  fflush(file);
+
+  TESTNS::Sink sink(poller.get(), fds[0]);
+  LNETNS::net::TcpConnection conn(poller.get(), fds[1]);
+  ASSERT_TRUE(conn.Start());
+  // Ordered with the buffered output around it.
+  ASSERT_TRUE(conn.Send("header|", 7));
+  ASSERT_TRUE(conn.SendFile(fileno(file), 10, content.size() - 10));
+  fclose(file);
+  ASSERT_TRUE(conn.Send("|trailer", 8));
+  conn.Shutdown();
+
+  while (!sink.closed) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(sink.received, "header|" + content.substr(10) + "|trailer");
+  EXPECT_EQ(conn.OutputSize(), 0);
+  EXPECT_EQ(conn.BytesWritten(), content.size() + 5);
+}
+
+GTEST_TEST(ZeroCopyTest, SpliceRelayTest) {
+  signal(SIGPIPE, SIG_IGN);
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int in[2], out[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in), 0);
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out), 0);
+
+  // client -> in[1] ~relay~> out[0] -> sink
+  LNETNS::net::TcpConnection client(poller.get(), in[0]);
+  LNETNS::net::TcpConnection src(poller.get(), in[1]);
+  LNETNS::net::TcpConnection dst(poller.get(), out[0]);
+  TESTNS::Sink sink(poller.get(), out[1]);
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(src.Start());
+  ASSERT_TRUE(dst.Start());
+
+  LNETNS::net::SpliceRelay relay(&src, &dst);
+  ASSERT_TRUE(relay.Start());
+
+  auto payload = TESTNS::Payload(4 * 1024 * 1024);
+  ASSERT_TRUE(client.Send(payload.data(), payload.size()));
+  client.Shutdown();
+
+  // EOF is forwarded to the sink.
+  while (!sink.closed) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(sink.received, payload);
+  EXPECT_TRUE(relay.SourceEof());
+  EXPECT_EQ(relay.Pending(), 0);
+  EXPECT_EQ(relay.BytesRelayed(), payload.size());
+  EXPECT_EQ(src.BytesRead(), payload.size());
+  EXPECT_EQ(dst.BytesWritten(), payload.size());
+}
+
+GTEST_TEST(ZeroCopyTest, SpliceRelayBlockedEofTest) {
+  signal(SIGPIPE, SIG_IGN);
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int in[2], out[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in), 0);
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out), 0);
+
+  LNETNS::net::TcpConnection client(poller.get(), in[0]);
+  LNETNS::net::TcpConnection src(poller.get(), in[1]);
+  LNETNS::net::TcpConnection dst(poller.get(), out[0]);
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(src.Start());
+  ASSERT_TRUE(dst.Start());
+
+  // "dst" has queued output nobody reads yet.
+  auto blocker = TESTNS::Payload(4 * 1024 * 1024);
+  ASSERT_TRUE(dst.Send(blocker.data(), blocker.size()));
+  ASSERT_GT(dst.OutputSize(), 0);
+
+  // Data already read when the relay starts, then EOF with the pipe empty.
+  ASSERT_TRUE(client.Send("data", 4));
+  while (src.BytesRead() < 4) {
+    poller->DoPoll();
+  }
+  client.Shutdown();
+  LNETNS::net::SpliceRelay relay(&src, &dst);
+  ASSERT_TRUE(relay.Start());
+  while (!relay.SourceEof()) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(relay.Pending(), 0);
+
+  // EOF is forwarded once "dst" drained.
+  TESTNS::Sink sink(poller.get(), out[1]);
+  for (int i = 0; i < 1000 && !sink.closed; ++i) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_TRUE(sink.closed);
+  EXPECT_EQ(sink.received, blocker + "data");
+}
+
+GTEST_TEST(ZeroCopyTest, SpliceRelayCoalescedTest) {
+  signal(SIGPIPE, SIG_IGN);
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int in[2], out[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in), 0);
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out), 0);
+
+  LNETNS::net::TcpConnection::Options opts;
+  opts.coalesce_writes = true;
+  LNETNS::net::TcpConnection client(poller.get(), in[0]);
+  LNETNS::net::TcpConnection src(poller.get(), in[1]);
+  LNETNS::net::TcpConnection dst(poller.get(), out[0], opts);
+  TESTNS::Sink sink(poller.get(), out[1]);
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(src.Start());
+  ASSERT_TRUE(dst.Start());
+
+  ASSERT_TRUE(client.Send("head|", 5));
+  while (src.BytesRead() < 5) {
+    poller->DoPoll();
+  }
+  // The forwarded input is queued until the end of the iteration, bytes spliced
+  // meanwhile wait for it.
+  LNETNS::net::SpliceRelay relay(&src, &dst);
+  ASSERT_TRUE(relay.Start());
+  ASSERT_GT(dst.OutputSize(), 0);
+  auto payload = TESTNS::Payload(1024 * 1024);
+  ASSERT_TRUE(client.Send(payload.data(), payload.size()));
+  client.Shutdown();
+
+  for (int i = 0; i < 1000 && !sink.closed; ++i) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_TRUE(sink.closed);
+  EXPECT_EQ(sink.received, "head|" + payload);
+}
+
+GTEST_TEST(ZeroCopyTest, SpliceRelayPauseTest) {
+  signal(SIGPIPE, SIG_IGN);
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int in[2], out[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in), 0);
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out), 0);
+
+  LNETNS::net::TcpConnection client(poller.get(), in[0]);
+  LNETNS::net::TcpConnection src(poller.get(), in[1]);
+  LNETNS::net::TcpConnection dst(poller.get(), out[0]);
+  ASSERT_TRUE(client.Start());
+  ASSERT_TRUE(src.Start());
+  ASSERT_TRUE(dst.Start());
+
+  // "dst" is blocked: the relay pauses "src" with bytes in the pipe.
+  auto blocker = TESTNS::Payload(4 * 1024 * 1024);
+  ASSERT_TRUE(dst.Send(blocker.data(), blocker.size()));
+  LNETNS::net::SpliceRelay relay(&src, &dst);
+  ASSERT_TRUE(relay.Start());
+  ASSERT_TRUE(client.Send("first|", 6));
+  while (relay.Pending() == 0) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(src.PauseReasons(), LNETNS::net::TcpConnection::kPauseRelay);
+
+  // Paused by the application too: draining "dst" doesn't resume reading.
+  src.PauseReading();
+  TESTNS::Sink sink(poller.get(), out[1]);
+  for (int i = 0; i < 1000 && sink.received.size() < blocker.size() + 6; ++i) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_EQ(sink.received, blocker + "first|");
+  EXPECT_EQ(src.PauseReasons(), LNETNS::net::TcpConnection::kPauseApplication);
+  ASSERT_TRUE(client.Send("second", 6));
+  poller->AddTimer(10, nullptr);
+  poller->DoPoll();
+  EXPECT_EQ(src.BytesRead(), 6);
+
+  src.ResumeReading();
+  client.Shutdown();
+  for (int i = 0; i < 1000 && !sink.closed; ++i) {
+    poller->AddTimer(10, nullptr);
+    poller->DoPoll();
+  }
+  EXPECT_EQ(sink.received, blocker + "first|second");
+}
+
+GTEST_TEST(ZeroCopyTest, MsgZeroCopyTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_TRUE(TESTNS::TcpPair(fds));
+
+  TESTNS::Sink sink(poller.get(), fds[0]);
+  LNETNS::net::TcpConnection::Options opts;
+  opts.zerocopy = true;
+  LNETNS::net::TcpConnection conn(poller.get(), fds[1], opts);
+  ASSERT_TRUE(conn.Start());
+  if (!conn.ZeroCopyEnabled()) {
+    GTEST_SKIP() << "SO_ZEROCOPY is not supported";
+  }
+
+  int completions = 0;
+  conn.SetZeroCopyCallback([&](LNETNS::net::TcpConnection* c, uint32_t lo, uint32_t hi, bool copied) {
+    completions += hi - lo + 1;
+  });
+
+  auto payload = TESTNS::Payload(4 * 1024 * 1024);
+  LNETNS::net::IOBuf buf;
+  buf.Append(payload);
+  ASSERT_TRUE(conn.Send(std::move(buf)));
+  // Sent slices are held until completed.
+  EXPECT_GT(conn.ZeroCopyPending(), 0);
+
+  while (sink.received.size() < payload.size() || conn.ZeroCopyPending() > 0) {
+    poller->DoPoll();
+  }
+  EXPECT_EQ(sink.received, payload);
+  EXPECT_GT(completions, 0);
+  EXPECT_EQ(conn.GetState(), LNETNS::net::TcpConnection::kConnected);
+}
+
+GTEST_TEST(ZeroCopyTest, CloseWithPendingTest) {
+  auto poller = std::make_unique<LNETNS::event::Poller>();
+  int fds[2];
+  ASSERT_TRUE(TESTNS::TcpPair(fds));
+
+  TESTNS::Sink sink(poller.get(), fds[0]);
+  LNETNS::net::TcpConnection::Options opts;
+  opts.zerocopy = true;
+  LNETNS::net::TcpConnection conn(poller.get(), fds[1], opts);
+  ASSERT_TRUE(conn.Start());
+  if (!conn.ZeroCopyEnabled()) {
+    GTEST_SKIP() << "SO_ZEROCOPY is not supported";
+  }
+
+  auto payload = TESTNS::Payload(4 * 1024 * 1024);
+  LNETNS::net::IOBuf buf;
+  buf.Append(payload);
+  ASSERT_TRUE(conn.Send(std::move(buf)));
+  ASSERT_GT(conn.ZeroCopyPending(), 0);
+
+  // The socket stays open with the pending slices until they complete.
+  conn.Close();
+  EXPECT_EQ(conn.ZeroCopyPending(), 0);
+  EXPECT_EQ(poller->FdCount(), 2);
+
+  while (!sink.closed || poller->FdCount() > 0) {
+    poller->DoPoll();
+  }
+  EXPECT_GT(sink.received.size(), 0);
+  EXPECT_EQ(sink.received, payload.substr(0, sink.received.size()));
+}
+
+#undef TESTNS